@@ -139,6 +139,175 @@ public:
   //
   char *GetHDImageFilename(void);
 
+  // Function: GetHDDeltaFilename
+  //
+  // Description:
+  // Gets the delta file to keep hard disk writes in, leaving the HD image
+  // unchanged.
+  //
+  // Parameters:
+  //
+  //   None.
+  //
+  // Returns:
+  //
+  //   char * : The delta filename, or NULL to write to the HD image.
+  //
+  char *GetHDDeltaFilename(void);
+
+  // Function: GetDiskCacheMode
+  //
+  // Description:
+  // Gets how disk writes are cached.
+  //
+  // Parameters:
+  //
+  //   None.
+  //
+  // Returns:
+  //
+  //   int : DISK_CACHE_OFF, DISK_CACHE_WRITEBACK or DISK_CACHE_SYNC, as
+  //         defined in emulator/XTdisk.h.
+  //
+  int GetDiskCacheMode(void);
+
+  // Function: GetDiskTraceDirectory
+  //
+  // Description:
+  // Gets the directory of disk boot traces, used to prefetch disk images.
+  //
+  // Parameters:
+  //
+  //   None.
+  //
+  // Returns:
+  //
+  //   char * : The trace directory, or NULL to not prefetch disk images.
+  //
+  char *GetDiskTraceDirectory(void);
+
+  // Function: GetHostDriveDirectory
+  //
+  // Description:
+  // Gets the host directory shown to DOS as a network drive.
+  //
+  // Parameters:
+  //
+  //   None.
+  //
+  // Returns:
+  //
+  //   char * : The host directory, or NULL for no host drive.
+  //
+  char *GetHostDriveDirectory(void);
+
+  // Function: GetDiskStats
+  //
+  // Description:
+  // Gets whether the disk statistics are printed when the emulator exits.
+  //
+  // Parameters:
+  //
+  //   None.
+  //
+  // Returns:
+  //
+  //   bool : true to print the disk statistics at exit.
+  //
+  bool GetDiskStats(void);
+
+  // Function: GetLockstepBlockLength
+  //
+  // Description:
+  // Gets the lockstep checking block length.
+  //
+  // Parameters:
+  //
+  //   None.
+  //
+  // Returns:
+  //
+  //   int : The number of instructions per lockstep block, or 0 if
+  //         lockstep checking is disabled.
+  //
+  int GetLockstepBlockLength(void);
+
+  // Function: GetCPUModel
+  //
+  // Description:
+  // Gets the CPU model to emulate.
+  //
+  // Parameters:
+  //
+  //   None.
+  //
+  // Returns:
+  //
+  //   int : One of the CPU_MODEL_ values defined in emulator/XTcpu.h.
+  //
+  int GetCPUModel(void);
+
+  // Function: GetFPUMode
+  //
+  // Description:
+  // Gets the numeric coprocessor configuration.
+  //
+  // Parameters:
+  //
+  //   None.
+  //
+  // Returns:
+  //
+  //   int : One of the FPU_MODE_ values defined in emulator/XTfpu.h.
+  //
+  int GetFPUMode(void);
+
+  // Function: GetA20Enabled
+  //
+  // Description:
+  // Gets what the 64KB above 1MB addresses.
+  //
+  // Parameters:
+  //
+  //   None.
+  //
+  // Returns:
+  //
+  //   bool : true for separate memory (A20 enabled), false if addresses
+  //          wrap to the first 64KB as on the 8086.
+  //
+  bool GetA20Enabled(void);
+
+  // Function: GetEMSSize
+  //
+  // Description:
+  // Gets the size of the expanded memory board.
+  //
+  // Parameters:
+  //
+  //   None.
+  //
+  // Returns:
+  //
+  //   int : The expanded memory size in KB, 0 if no board is fitted.
+  //
+  int GetEMSSize(void);
+
+  // Function: GetEMSFrame
+  //
+  // Description:
+  // Gets the expanded memory page frame segment.
+  //
+  // Parameters:
+  //
+  //   None.
+  //
+  // Returns:
+  //
+  //   int : The page frame segment.
+  //
+  int GetEMSFrame(void);
+
   // Function: FDChanged
   //
   // Description:
@@ -154,14 +323,270 @@ public:
   //
   bool FDChanged(void);
 
+  // Function: SnapshotRequest
+  //
+  // Description:
+  // Tell when the user has asked to save or restore a machine snapshot or to
+  // rewind the machine, or when a rewind checkpoint is due or running ahead
+  // starts or ends. Call until it returns SNAP_REQUEST_NONE.
+  //
+  // Parameters:
+  //
+  //   None.
+  //
+  // Returns:
+  //
+  //   int : One of the SNAP_REQUEST_ values defined in
+  //         emulator/XTsnapshot.h. The snapshot file is given by
+  //         GetSnapshotFilename().
+  //
+  int SnapshotRequest(void);
+
+  // Function: DiskRequest
+  //
+  // Description:
+  // Tell when the user has asked to commit the hard disk delta file to the
+  // HD image or to discard it, or to print the disk statistics.
+  //
+  // Parameters:
+  //
+  //   None.
+  //
+  // Returns:
+  //
+  //   int : One of the DISK_REQUEST_ values defined in emulator/XTdisk.h.
+  //
+  int DiskRequest(void);
+
+  // Function: GetSnapshotFilename
+  //
+  // Description:
+  // Gets the snapshot file for the last snapshot request. Before any
+  // request this is the snapshot configured to be restored at start up.
+  //
+  // Parameters:
+  //
+  //   None.
+  //
+  // Returns:
+  //
+  //   char * : The snapshot file name, or NULL if there is none.
+  //
+  char *GetSnapshotFilename(void);
+
+  // Function: GetSnapshotCompress
+  //
+  // Description:
+  // Gets whether snapshots are saved compressed.
+  //
+  // Parameters:
+  //
+  //   None.
+  //
+  // Returns:
+  //
+  //   bool : true to save compressed snapshots, false to save snapshots
+  //          that clones can be started from.
+  //
+  bool GetSnapshotCompress(void);
+
+  // Function: SaveDeviceState
+  //
+  // Description:
+  // Save the state of the devices emulated by the interface for a machine
+  // snapshot.
+  //
+  // Parameters:
+  //
+  //   Buffer : The buffer to save to, or NULL to get the length needed.
+  //
+  // Returns:
+  //
+  //   int : The length of the saved state in bytes.
+  //
+  int SaveDeviceState(unsigned char *Buffer);
+
+  // Function: RestoreDeviceState
+  //
+  // Description:
+  // Restore device state saved by SaveDeviceState.
+  //
+  // Parameters:
+  //
+  //   Buffer   : The saved state.
+  //
+  //   Length   : The length of the saved state in bytes.
+  //
+  //   RunAhead : true when restoring the state saved before running ahead,
+  //              which happens every frame, so what is presented is left
+  //              as it is. Video memory changed by the restore is marked
+  //              through VMemInvalidate().
+  //
+  // Returns:
+  //
+  //   bool : true if the state was restored.
+  //
+  bool RestoreDeviceState(const unsigned char *Buffer, int Length, bool RunAhead);
+
+  // Function: GetRewindCheckpoints
+  //
+  // Description:
+  // Gets the number of rewind checkpoints to keep. SnapshotRequest() asks
+  // for checkpoints at the interval they should be taken.
+  //
+  // Parameters:
+  //
+  //   None.
+  //
+  // Returns:
+  //
+  //   int : The number of checkpoints, 0 to disable rewinding.
+  //
+  int GetRewindCheckpoints(void);
+
+  // Function: GetRunAheadFrames
+  //
+  // Description:
+  // Gets the number of frames to run ahead of the frame being presented.
+  // SnapshotRequest() asks to run ahead at the end of each frame, then to
+  // end running ahead once the frame to present has been drawn.
+  //
+  // Parameters:
+  //
+  //   None.
+  //
+  // Returns:
+  //
+  //   int : The number of frames, 0 to disable running ahead.
+  //
+  int GetRunAheadFrames(void);
+
+  // Function: RunAhead
+  //
+  // Description:
+  // Called for a request to run ahead, once the machine state is saved.
+  // While running ahead the interface must not take input, output sound or
+  // wait for real time, as everything the machine does is discarded.
+  //
+  // Parameters:
+  //
+  //   Ahead : true if the machine runs ahead, false if the state could not
+  //           be saved and the current frame should be presented as is.
+  //
+  // Returns:
+  //
+  //   None.
+  //
+  void RunAhead(bool Ahead);
+
+  // Function: GetReplayMode
+  //
+  // Description:
+  // Gets whether to record the machine inputs to the replay log given by
+  // GetReplayFilename(), or replay them from it. When replaying, the
+  // interface takes its inputs from the log instead of the host and does
+  // not wait for real time.
+  //
+  // Parameters:
+  //
+  //   None.
+  //
+  // Returns:
+  //
+  //   int : REPLAY_OFF, REPLAY_RECORD or REPLAY_PLAY.
+  //
+  int GetReplayMode(void);
+
+  // Function: GetReplayFilename
+  //
+  // Description:
+  // Gets the replay log filename.
+  //
+  // Parameters:
+  //
+  //   None.
+  //
+  // Returns:
+  //
+  //   char * : The log filename, or NULL if there is none.
+  //
+  char *GetReplayFilename(void);
+
+  // Function: GetCloneCount
+  //
+  // Description:
+  // Gets the number of clone machines to start from the snapshot given by
+  // GetSnapshotFilename() at start up, instead of restoring it.
+  //
+  // Parameters:
+  //
+  //   None.
+  //
+  // Returns:
+  //
+  //   int : The number of clones, 0 to restore the snapshot.
+  //
+  int GetCloneCount(void);
+
+  // Function: GetCloneParallel
+  //
+  // Description:
+  // Gets the most clone machines to run at once.
+  //
+  // Parameters:
+  //
+  //   None.
+  //
+  // Returns:
+  //
+  //   int : The number of clones to run at once, 0 for no limit.
+  //
+  int GetCloneParallel(void);
+
+  // Function: CloneStarted
+  //
+  // Description:
+  // Called in a clone machine once it has been restored from the snapshot,
+  // before it runs.
+  //
+  // Parameters:
+  //
+  //   Index : The clone number, from 0 to GetCloneCount() - 1.
+  //
+  // Returns:
+  //
+  //   None.
+  //
+  void CloneStarted(int Index);
+
+  // Function: DiskActivity
+  //
+  // Description:
+  // Called each time the guest reads or writes a disk through the BIOS, so
+  // the interface can stop waiting for real time while the guest is busy
+  // with the disks.
+  //
+  // Parameters:
+  //
+  //   None.
+  //
+  // Returns:
+  //
+  //   None.
+  //
+  void DiskActivity(void);
+
   // Function: TimerTick
   //
   // Description:
   // Call this every instruction to update the HW emulation.
+  // Several instructions may be accounted for in one call. The result is
+  // the same as one call per instruction as long as nTicks does not exceed
+  // TimerHorizon().
   //
   // Parameters:
   //
-  //   nTicks : The number of CPU ticks elapsed in the instruction
+  //   nTicks : The number of CPU ticks elapsed in the instruction(s)
   //
   // Returns:
   //
@@ -170,10 +595,29 @@ public:
   //            ExitEmulation()
   //            Reset()
   //            FDChanged()
+  //            SnapshotRequest()
+  //            DiskRequest()
   //          To find out what has changed.
   //
   bool TimerTick(int nTicks);
 
+  // Function: TimerHorizon
+  //
+  // Description:
+  // Gets the number of CPU ticks that can elapse before the next timer
+  // event. Up to this many ticks TimerTick will not cause a state change or
+  // make an interrupt pending, so the CPU may retire instructions in bulk.
+  //
+  // Parameters:
+  //
+  //   None.
+  //
+  // Returns:
+  //
+  //   int : The number of CPU ticks until the next timer event.
+  //
+  int TimerHorizon(void);
+
   // Function: WritePort
   //
   // Description:
@@ -210,6 +654,24 @@ public:
 
   unsigned int VMemWrite(int i_w, int addr, unsigned int val);
 
+  // Function: VMemInvalidate
+  //
+  // Description:
+  // Tells the video emulation that the emulator wrote video memory
+  // directly rather than through VMemWrite, as when a disk is read into it.
+  //
+  // Parameters:
+  //
+  //   addr : The first RAM address written
+  //
+  //   len  : The number of bytes written
+  //
+  // Returns:
+  //
+  //   None.
+  //
+  void VMemInvalidate(int addr, int len);
+
   // Function: IntPending
   //
   // Description:
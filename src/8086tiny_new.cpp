@@ -17,6 +17,7 @@
 
 #include <time.h>
 #include <memory.h>
+#include <string.h>
 #include <stdio.h>
 
 #include <windows.h>
@@ -32,59 +33,22 @@
 
 #include "8086tiny_interface.h"
 #include "emulator/XTmemory.h"
+#include "emulator/XTcpu.h"
+#include "emulator/XTfpu.h"
+#include "emulator/XTems.h"
+#include "emulator/XTdisk.h"
+#include "emulator/XTredir.h"
+#include "emulator/XTsnapshot.h"
+#include "emulator/XTrewind.h"
+#include "emulator/XTrunahead.h"
+#include "emulator/XTreplay.h"
+#include "emulator/XTlockstep.h"
 
 T8086TinyInterface_t Interface ;
 
 #define XFALSE                                   ( ( uint8_t ) 0x00 )
 #define XTRUE                                    ( ( uint8_t ) 0x01 )
 
-// Emulator system constants
-
-#define REGS_BASE                                0xF0000
-
-// 16-bit register decodes
-
-#define REG_AX                                   0
-#define REG_CX                                   1
-#define REG_DX                                   2
-#define REG_BX                                   3
-#define REG_SP                                   4
-#define REG_BP                                   5
-#define REG_SI                                   6
-#define REG_DI                                   7
-
-#define REG_ES                                   8
-#define REG_CS                                   9
-#define REG_SS                                   10
-#define REG_DS                                   11
-
-#define REG_ZERO                                 12
-#define REG_SCRATCH                              13
-
-#define REG_IP                                   14
-#define REG_TMP                                  15
-
-// 8-bit register decodes
-#define REG_AL                                   0
-#define REG_AH                                   1
-#define REG_CL                                   2
-#define REG_CH                                   3
-#define REG_DL                                   4
-#define REG_DH                                   5
-#define REG_BL                                   6
-#define REG_BH                                   7
-
-// FLAGS register decodes
-#define FLAG_CF                                  40
-#define FLAG_PF                                  41
-#define FLAG_AF                                  42
-#define FLAG_ZF                                  43
-#define FLAG_SF                                  44
-#define FLAG_TF                                  45
-#define FLAG_IF                                  46
-#define FLAG_DF                                  47
-#define FLAG_OF                                  48
-
 // Lookup tables in the BIOS binary
 #define TABLE_XLAT_OPCODE                        8
 #define TABLE_XLAT_SUBFUNCTION                   9
@@ -99,6 +63,9 @@ T8086TinyInterface_t Interface ;
 #define TABLE_COND_JUMP_DECODE_D                 18
 #define TABLE_FLAGS_BITFIELDS                    19
 
+// CPU ticks charged per instruction
+#define INSTRUCTION_TICKS                        4
+
 // Bitfields for TABLE_STD_FLAGS values
 #define FLAGS_UPDATE_SZP                         1
 #define FLAGS_UPDATE_AO_ARITH                    2
@@ -111,7 +78,7 @@ T8086TinyInterface_t Interface ;
                                   set_CF((regs8[REG_AL] > 0x9f) || regs8[FLAG_CF]) && (op_result = (regs8[REG_AL] op1 0x60))
 
 #define ADC_SBB_MACRO(a) (i_w ? op_dest = *(uint16_t*)&mem[ op_to_addr ], op_result = *(uint16_t*)&mem[ op_to_addr ] a##= regs8[FLAG_CF] + (op_source = *(uint16_t*)&mem[ op_from_addr ]) : (op_dest = mem[ op_to_addr ], op_result = mem[ op_to_addr ] a##= regs8[FLAG_CF] + (op_source = *(uint8_t*)&mem[ op_from_addr ]))), \
-                         set_CF((regs8[FLAG_CF] && (op_result == op_dest)) || (a op_result < a(int)op_dest)), \
+                         set_CF((regs8[FLAG_CF] && ((uint32_t)op_result == op_dest)) || (a op_result < a(int)op_dest)), \
                          set_AF_OF_arith()
 
 // Global variable definitions
@@ -127,6 +94,33 @@ typedef struct STOPCODE_T
 
 stOpcode_t stOpcode ;
 
+// The decode cache holds the result of decoding the instruction at an
+// address, with the bytes it was decoded from.
+#define DECODE_CACHE_ENTRIES                     4096
+
+typedef struct STDECODEENTRY_T
+{
+  uint64_t   bytes           ;
+  uint32_t   addr            ;
+  bool       valid           ;
+  uint8_t    prefixes        ;
+  uint8_t    seg_override_en ;
+  uint8_t    rep_override_en ;
+  uint16_t   seg_override    ;
+  uint8_t    rep_mode        ;
+  uint8_t    scratch_uchar   ;
+  stOpcode_t opcode          ;
+  uint16_t   i_data0         ;
+  uint16_t   i_data1         ;
+  uint16_t   i_data2         ;
+  uint8_t    i_reg4bit       ;
+  uint8_t    i_w             ;
+  uint8_t    i_d             ;
+  uint8_t    i_mod           ;
+  uint8_t    i_reg           ;
+  uint8_t    i_rm            ;
+} stDecodeEntry_t ;
+
 uint32_t op_source      ;
 uint32_t op_dest        ;
 uint32_t rm_addr        ;
@@ -135,7 +129,7 @@ uint32_t op_from_addr   ;
 uint32_t scratch_uint   ;
 uint32_t scratch2_uint  ;
 
-int op_result , disk[ 3 ] , scratch_int ;
+int op_result , scratch_int ;
 
 uint16_t * regs16       ;
 uint16_t   reg_ip       ;
@@ -158,6 +152,22 @@ uint8_t   rep_override_en ;
 uint8_t   trap_flag       ;
 uint8_t   scratch_uchar   ;
 
+// The r/m operand of the current instruction when it is in a device page.
+uint32_t  device_addr     ;
+uint16_t  device_saved    ;
+uint8_t   device_access   ;
+uint8_t   device_word     ;
+
+// Set when the emulation should stop.
+bool ExitEmulation = false ;
+
+// The engine used to execute instructions, and the engine it is checked
+// against in lockstep mode.
+template< int Model , bool DecodeCache > void CPU_ExecuteInstruction( void ) ;
+
+CPUEngine_t CPU_Reference = CPU_ExecuteInstruction< CPU_MODEL_80186 , false > ;
+CPUEngine_t CPU_Engine    = CPU_ExecuteInstruction< CPU_MODEL_80186 , false > ;
+
 // Helper functions
 
 // Set carry flag
@@ -202,7 +212,7 @@ int8_t set_AF_OF_arith( void )
   reg = op_source & 0x10 ;
   set_AF( reg ) ;
 
-  if( op_result == op_dest )
+  if( ( uint32_t ) op_result == op_dest )
   {
     reg = set_OF( 0 ) ;
   }
@@ -255,9 +265,381 @@ void set_opcode( uint8_t opcode )
   stOpcode.set_flags_type = bios_table_lookup[ TABLE_STD_FLAGS        ][ opcode ] ;
 }
 
+// Transfer sectors between a disk image and guest memory for the BIOS.
+// In lockstep mode the data read is host data, so is replayed rather than
+// read from the image again, as a later write in the block may have
+// changed it.
+// Returns the number of bytes transferred.
+static int DiskTransfer( bool Write , int Drive , uint32_t Offset , uint32_t Addr , int Length )
+{
+  int Count = 0 ;
+
+  Interface.DiskActivity() ;
+
+  if( LockstepPhase != LOCKSTEP_REPLAY )
+  {
+    if( Write )
+    {
+      Count = DISK_Write( Drive , Offset , ( mem + Addr ) , Length ) ;
+    }
+    else
+    {
+      Count = DISK_Read( Drive , Offset , ( mem + Addr ) , Length ) ;
+    }
+  }
+
+  if( LockstepPhase != LOCKSTEP_LIVE )
+  {
+    LOCKSTEP_HostData( &Count , sizeof( Count ) ) ;
+    if( !Write && ( Count > 0 ) )
+    {
+      LOCKSTEP_HostData( mem + Addr , Count ) ;
+    }
+  }
+
+  if( !Write && ( Count > 0 ) )
+  {
+    MEM_HostWrite( Addr , Count ) ;
+  }
+
+  return( Count ) ;
+}
+
+// INT 13h is serviced here rather than by the BIOS handler while the
+// vector points at the handler, giving the same results without running
+// it. The BIOS does not export the variables the handler uses, so their
+// offsets in the BIOS segment are taken from the instructions that use
+// them, and a BIOS whose disk code does not match is left to itself.
+enum
+{
+  BIOS_NUM_DISKS ,
+  BIOS_HD_SECS_HI ,
+  BIOS_HD_SECS_LO ,
+  BIOS_HD_MAX_SECTOR ,
+  BIOS_HD_MAX_TRACK ,
+  BIOS_HD_MAX_HEAD ,
+  BIOS_INT1E ,          // Diskette parameter table
+  BIOS_INT1E_SPT ,      // Floppy disk sectors per track
+  BIOS_LAST_STATUS ,
+  BIOS_DRIVE_NUM ,      // chs_to_abs scratch variables
+  BIOS_DRIVE_SECTORS ,
+  BIOS_DRIVE_HEADS ,
+  BIOS_VAR_COUNT
+} ;
+
+typedef struct STBIOSOPERAND_T
+{
+  uint8_t  Var        ;
+  bool     InChs      ; // In chs_to_abs rather than the INT 13h handler
+  uint16_t At         ;
+  uint8_t  Length     ;
+  uint8_t  Opcode[ 3 ] ;
+} stBiosOperand_t ;
+
+static const uint8_t BiosDiskEntry[] =
+{
+  0xFB ,                             // sti
+  0x55 ,                             // push bp
+  0x89 , 0xE5 ,                      // mov bp, sp
+  0x81 , 0x4E , 0x06 , 0x00 , 0x02 , // or word [bp+6], 0x0200
+  0x5D ,                             // pop bp
+  0x80 , 0xFC , 0x00                 // cmp ah, 0
+} ;
+
+// The call to chs_to_abs from the read code.
+#define BIOS_CHS_CALL                            0xA3
+
+static const stBiosOperand_t BiosOperands[] =
+{
+  { BIOS_NUM_DISKS     , false , 0x019 , 3 , { 0x2E , 0x83 , 0x3E } } , // cmp word [cs:num_disks], 2
+  { BIOS_LAST_STATUS   , false , 0x074 , 3 , { 0x2E , 0x8A , 0x26 } } , // mov ah, [cs:disk_laststatus]
+  { BIOS_INT1E_SPT     , false , 0x092 , 3 , { 0x2E , 0x3A , 0x0E } } , // cmp cl, [cs:int1e_spt]
+  { BIOS_HD_SECS_HI    , false , 0x116 , 3 , { 0x2E , 0x3B , 0x3E } } , // cmp di, [cs:hd_secs_hi]
+  { BIOS_HD_SECS_LO    , false , 0x11F , 3 , { 0x2E , 0x3B , 0x0E } } , // cmp cx, [cs:hd_secs_lo]
+  { BIOS_INT1E         , false , 0x166 , 1 , { 0xBF } } ,               // mov di, int1e
+  { BIOS_HD_MAX_HEAD   , false , 0x18A , 3 , { 0x2E , 0x8A , 0x36 } } , // mov dh, [cs:hd_max_head]
+  { BIOS_HD_MAX_TRACK  , false , 0x18F , 3 , { 0x2E , 0x8B , 0x0E } } , // mov cx, [cs:hd_max_track]
+  { BIOS_HD_MAX_SECTOR , false , 0x198 , 3 , { 0x2E , 0x02 , 0x2E } } , // add ch, [cs:hd_max_sector]
+  { BIOS_DRIVE_NUM     , true  , 0x004 , 3 , { 0x2E , 0x88 , 0x16 } } , // mov [cs:drive_num_temp], dl
+  { BIOS_DRIVE_SECTORS , true  , 0x028 , 2 , { 0x2E , 0xA3 } } ,        // mov [cs:drive_sectors_temp], ax
+  { BIOS_DRIVE_HEADS   , true  , 0x035 , 3 , { 0x2E , 0x89 , 0x2E } }   // mov [cs:drive_heads_temp], bp
+} ;
+
+static uint16_t BiosVars[ BIOS_VAR_COUNT ] ;
+
+static uint8_t * BiosByte( uint16_t Offset )
+{
+  return( &mem[ REGS_BASE + Offset ] ) ;
+}
+
+static uint16_t * BiosWord( uint16_t Offset )
+{
+  return( ( uint16_t * )&mem[ REGS_BASE + Offset ] ) ;
+}
+
+// Check the BIOS INT 13h handler at an offset in the BIOS segment, and find
+// the variables it uses. The BIOS segment is RAM, so this is checked on
+// every call, which costs little next to the disk transfer.
+static bool FindBiosDisk( uint16_t Handler )
+{
+  const stBiosOperand_t * Operand ;
+  uint16_t                Chs ;
+  uint16_t                Base ;
+
+  if( ( Handler > 0xFE00 ) || ( memcmp( BiosByte( Handler ) , BiosDiskEntry , sizeof( BiosDiskEntry ) ) != 0 ) ||
+      ( *BiosByte( Handler + BIOS_CHS_CALL ) != 0xE8 ) )
+  {
+    return( false ) ;
+  }
+
+  Chs = ( uint16_t ) ( Handler + BIOS_CHS_CALL + 3 + *BiosWord( Handler + BIOS_CHS_CALL + 1 ) ) ;
+  if( Chs > 0xFF00 )
+  {
+    return( false ) ;
+  }
+
+  for( size_t i = 0 ; i < sizeof( BiosOperands ) / sizeof( BiosOperands[ 0 ] ) ; i++ )
+  {
+    Operand = &BiosOperands[ i ] ;
+    Base    = ( Operand->InChs ) ? Chs : Handler ;
+    if( memcmp( BiosByte( Base + Operand->At ) , Operand->Opcode , Operand->Length ) != 0 )
+    {
+      return( false ) ;
+    }
+    BiosVars[ Operand->Var ] = *BiosWord( Base + Operand->At + Operand->Length ) ;
+  }
+
+  return( true ) ;
+}
+
+// Convert the cylinder, head and sector in CX and DH to a sector number as
+// chs_to_abs does, with its 16 bit arithmetic.
+static uint32_t BiosChsToSector( bool Floppy )
+{
+  uint16_t Cylinder = ( uint16_t ) ( ( ( regs8[ REG_CL ] >> 6 ) << 8 ) | regs8[ REG_CH ] ) ;
+  uint16_t Track ;
+  uint16_t Sectors ;
+  uint16_t Heads ;
+
+  *BiosByte( BiosVars[ BIOS_DRIVE_NUM ] ) = ( Floppy ) ? 1 : 0 ;
+
+  if( Floppy )
+  {
+    Track   = ( uint16_t ) ( Cylinder << 1 ) ;
+    Sectors = *BiosByte( BiosVars[ BIOS_INT1E_SPT ] ) ;
+  }
+  else
+  {
+    Heads   = ( uint16_t ) ( *BiosWord( BiosVars[ BIOS_HD_MAX_HEAD ] ) + 1 ) ;
+    Track   = ( uint16_t ) ( Cylinder * Heads ) ;
+    Sectors = *BiosWord( BiosVars[ BIOS_HD_MAX_SECTOR ] ) ;
+    *BiosWord( BiosVars[ BIOS_DRIVE_HEADS ] ) = Heads ;
+  }
+  *BiosWord( BiosVars[ BIOS_DRIVE_SECTORS ] ) = Sectors ;
+
+  Track = ( uint16_t ) ( Track + regs8[ REG_DH ] ) ;
+
+  return( ( uint32_t ) Sectors * Track + ( uint8_t ) ( ( regs8[ REG_CL ] & 0x3F ) - 1 ) ) ;
+}
+
+// Read or write sectors as the BIOS handler does.
+// Returns true to set CF.
+static bool BiosDiskTransfer( bool Write )
+{
+  bool     Floppy = ( regs8[ REG_DL ] == 0 ) ;
+  uint32_t Sector ;
+  uint32_t End ;
+  uint32_t Addr ;
+  uint16_t Length ;
+  int      Count ;
+
+  if( ( regs8[ REG_DL ] != 0 ) && ( regs8[ REG_DL ] != 0x80 ) )
+  {
+    regs8[ REG_AH ] = 1 ;
+    return( true ) ;
+  }
+
+  regs8[ REG_AH ] = 4 ;
+
+  if( !Write && Floppy && ( regs8[ REG_CL ] > *BiosByte( BiosVars[ BIOS_INT1E_SPT ] ) ) )
+  {
+    *BiosByte( BiosVars[ BIOS_LAST_STATUS ] ) = regs8[ REG_AH ] ;
+    return( true ) ;
+  }
+
+  Sector = BiosChsToSector( Floppy ) ;
+
+  // Writes past the end of the hard disk are refused.
+  End = Sector + regs8[ REG_AL ] ;
+  if( Write && !Floppy &&
+      ( End > ( ( uint32_t ) *BiosWord( BiosVars[ BIOS_HD_SECS_HI ] ) << 16 | *BiosWord( BiosVars[ BIOS_HD_SECS_LO ] ) ) ) )
+  {
+    *BiosByte( BiosVars[ BIOS_LAST_STATUS ] ) = regs8[ REG_AH ] ;
+    return( true ) ;
+  }
+
+  // The sector count is shifted to a byte count in AX, of which the disk
+  // hypercall sets the low byte to the count transferred, and shifted back.
+  Length  = ( uint16_t ) ( regs8[ REG_AL ] << 9 ) ;
+  Addr    = 16 * ( uint32_t ) regs16[ REG_ES ] + regs16[ REG_BX ] ;
+  Count   = DiskTransfer( Write , ( Floppy ) ? DISK_FD : DISK_HD , Sector << 9 , Addr , Length ) ;
+  regs16[ REG_AX ] = ( uint16_t ) ( ( ( Length & 0xFF00 ) | ( uint8_t ) Count ) >> 9 ) ;
+
+  if( regs8[ REG_AL ] == 0 )
+  {
+    regs8[ REG_AH ] = 4 ;
+  }
+  else
+  {
+    // Reading the floppy disk boot sector sets the sectors per track.
+    if( !Write && Floppy && ( regs8[ REG_DH ] == 0 ) && ( regs16[ REG_CX ] == 1 ) )
+    {
+      uint8_t Sectors = mem[ 16 * ( uint32_t ) regs16[ REG_ES ] + ( uint16_t ) ( regs16[ REG_BX ] + 24 ) ] ;
+
+      if( ( Sectors == 9 ) || ( Sectors == 18 ) )
+      {
+        *BiosByte( BiosVars[ BIOS_INT1E_SPT ] ) = Sectors ;
+      }
+    }
+    regs8[ REG_AH ] = 0 ;
+  }
+
+  *BiosByte( BiosVars[ BIOS_LAST_STATUS ] ) = regs8[ REG_AH ] ;
+
+  return( regs8[ REG_AH ] != 0 ) ;
+}
+
+// Service INT 13h functions 02h, 03h, 04h, 08h and 15h as the BIOS handler
+// does, leaving the others to it.
+// Returns true if the interrupt was serviced.
+static bool DiskInterrupt( void )
+{
+  uint16_t Handler = *( uint16_t * )&mem[ 4 * 0x13 ] ;
+  uint8_t  Drive   = regs8[ REG_DL ] ;
+  bool     Carry   = false ;
+
+  if( *( uint16_t * )&mem[ 4 * 0x13 + 2 ] != ( REGS_BASE >> 4 ) )
+  {
+    return( false ) ;
+  }
+
+  switch( regs8[ REG_AH ] )
+  {
+  case 0x02 :
+  case 0x03 :
+  case 0x04 :
+  case 0x08 :
+  case 0x15 :
+    break ;
+
+  default :
+    return( false ) ;
+  }
+
+  if( !FindBiosDisk( Handler ) )
+  {
+    return( false ) ;
+  }
+
+  if( ( Drive == 0x80 ) && ( ( int16_t ) *BiosWord( BiosVars[ BIOS_NUM_DISKS ] ) < 2 ) )
+  {
+    // No hard disk.
+    regs8[ REG_AH ] = 15 ;
+    Carry = true ;
+  }
+  else
+  {
+    switch( regs8[ REG_AH ] )
+    {
+    // Read sectors
+    case 0x02 :
+      Carry = BiosDiskTransfer( false ) ;
+      break ;
+
+    // Write sectors
+    case 0x03 :
+      Carry = BiosDiskTransfer( true ) ;
+      break ;
+
+    // Verify sectors
+    case 0x04 :
+      regs8[ REG_AH ] = 0 ;
+      break ;
+
+    // Get drive parameters
+    case 0x08 :
+      if( Drive == 0 )
+      {
+        regs16[ REG_ES ] = ( REGS_BASE >> 4 ) ;
+        regs16[ REG_DI ] = BiosVars[ BIOS_INT1E ] ;
+        regs16[ REG_AX ] = 0 ;
+        regs16[ REG_BX ] = 4 ;
+        regs8[ REG_CH ]  = 0x4F ;
+        regs8[ REG_CL ]  = *BiosByte( BiosVars[ BIOS_INT1E_SPT ] ) ;
+        regs16[ REG_DX ] = 0x0101 ;
+      }
+      else if( Drive == 0x80 )
+      {
+        uint16_t Track = *BiosWord( BiosVars[ BIOS_HD_MAX_TRACK ] ) ;
+        uint8_t  High  = ( uint8_t ) ( Track >> 8 ) ;
+
+        regs16[ REG_AX ] = 0 ;
+        regs16[ REG_BX ] = 0 ;
+        regs8[ REG_DL ]  = 1 ;
+        regs8[ REG_DH ]  = *BiosByte( BiosVars[ BIOS_HD_MAX_HEAD ] ) ;
+        regs8[ REG_CH ]  = ( uint8_t ) Track ;
+        regs8[ REG_CL ]  = ( uint8_t ) ( ( ( High >> 2 ) | ( High << 6 ) ) + *BiosByte( BiosVars[ BIOS_HD_MAX_SECTOR ] ) ) ;
+      }
+      else
+      {
+        regs8[ REG_AH ] = 1 ;
+        Carry = true ;
+      }
+      *BiosByte( BiosVars[ BIOS_LAST_STATUS ] ) = regs8[ REG_AH ] ;
+      break ;
+
+    // Get disk type
+    case 0x15 :
+      if( Drive == 0 )
+      {
+        regs8[ REG_AH ] = 1 ;
+      }
+      else if( Drive == 0x80 )
+      {
+        regs8[ REG_AH ]  = 3 ;
+        regs16[ REG_CX ] = *BiosWord( BiosVars[ BIOS_HD_SECS_HI ] ) ;
+        regs16[ REG_DX ] = *BiosWord( BiosVars[ BIOS_HD_SECS_LO ] ) ;
+      }
+      else
+      {
+        regs8[ REG_AH ] = 15 ;
+        *BiosByte( BiosVars[ BIOS_LAST_STATUS ] ) = regs8[ REG_AH ] ;
+        Carry = true ;
+      }
+      break ;
+    }
+  }
+
+  // The handler returns with interrupts enabled.
+  regs8[ FLAG_IF ] = XTRUE ;
+  set_CF( Carry ) ;
+
+  return( true ) ;
+}
+
 // Execute INT #interrupt_num on the emulated machine
 int8_t pc_interrupt( uint8_t interrupt_num )
 {
+  if( ( interrupt_num == 0x13 ) && DiskInterrupt() )
+  {
+    return( 0 ) ;
+  }
+
+  if( ( interrupt_num == 0x2F ) && REDIR_Interrupt() )
+  {
+    return( 0 ) ;
+  }
+
   // Decode like INT.
   set_opcode( 0xCD ) ;
 
@@ -280,6 +662,8 @@ int8_t pc_interrupt( uint8_t interrupt_num )
   op_source = *( uint16_t * )&reg_ip ;
   op_result = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] = op_source ;
 
+  MEM_HostWrite( 16 * regs16[ REG_SS ] + regs16[ REG_SP ] , 6 ) ;
+
   // Execute arithmetic/logic operations in emulator memory/registers
   if( i_w )
   {
@@ -328,52 +712,281 @@ int AAA_AAS(int8_t which_operation)
   return( regs16[ REG_AX ] += 262 * which_operation * set_AF( set_CF( ( ( regs8[ REG_AL ] & 0x0F) > 9) || regs8[FLAG_AF])), regs8[REG_AL] &= 0x0F);
 }
 
-void Reset( void )
+// Read an I/O port through the interface.
+// In lockstep mode reads are logged while recording and taken from the log
+// while replaying, so each port read reaches the hardware once.
+uint8_t port_read( int addr )
 {
-  uint32_t i ;
+  uint8_t val ;
 
-  // Fill RAM with 00h.
-  // BIOS area is 64K from F0000h.
-  memset( ( void * ) mem , 0x00 , ( size_t ) RAM_SIZE ) ;
+  // The expanded memory page registers are part of the emulated machine.
+  if( EMS_ReadPort( addr , val ) )
+  {
+    return( val ) ;
+  }
+
+  if( LockstepPhase == LOCKSTEP_REPLAY )
+  {
+    return( LOCKSTEP_PortRead( addr , 0 ) ) ;
+  }
+
+  val = Interface.ReadPort( addr ) ;
+
+  if( LockstepPhase == LOCKSTEP_RECORD )
+  {
+    LOCKSTEP_PortRead( addr , val ) ;
+  }
+
+  return( val ) ;
+}
+
+// Write an I/O port through the interface.
+// In lockstep mode writes are only passed to the hardware while recording.
+void port_write( int addr , uint8_t val )
+{
+  if( LockstepPhase != LOCKSTEP_LIVE )
+  {
+    LOCKSTEP_PortWrite( addr , val ) ;
+  }
+
+  if( EMS_WritePort( addr , val ) )
+  {
+    return ;
+  }
+
+  if( LockstepPhase != LOCKSTEP_REPLAY )
+  {
+    Interface.WritePort( addr , val ) ;
+  }
+}
+
+// r/m operand access types, see rm_access.
+#define RM_READ                                  0x01
+#define RM_WRITE                                 0x02
+#define RM_WORD                                  0x04 // Word operand whatever the W bit
+
+// Read and write handlers for the video memory pages.
+static unsigned int vmem_read( int Width , int addr )
+{
+  return( Interface.VMemRead( Width , addr ) ) ;
+}
+
+static unsigned int vmem_write( int Width , int addr , unsigned int val )
+{
+  return( Interface.VMemWrite( Width , addr , val ) ) ;
+}
+
+static void vmem_invalidate( int start , int length )
+{
+  Interface.VMemInvalidate( start , length ) ;
+}
+
+// Classify how an instruction accesses its r/m memory operand.
+// ESC instructions and LEA do not access the operand through the CPU.
+uint8_t rm_access( uint8_t opcode , uint8_t reg )
+{
+  if( opcode < 0x40 )
+  {
+    // ALU r/m,reg (d=0) updates r/m unless it is CMP.
+    if( ( opcode & 0x02 ) || ( ( opcode & 0x38 ) == 0x38 ) )
+    {
+      return( RM_READ ) ;
+    }
+    return( RM_READ | RM_WRITE ) ;
+  }
+
+  switch( opcode )
+  {
+  case 0x62 : // BOUND
+  case 0x8E : // MOV Sreg,r/m
+  case 0xC4 : // LES
+  case 0xC5 : // LDS
+    return( RM_READ | RM_WORD ) ;
+
+  case 0x8C : // MOV r/m,Sreg
+    return( RM_WRITE | RM_WORD ) ;
+
+  case 0x69 : // IMUL imm
+  case 0x6B :
+  case 0x84 : // TEST
+  case 0x85 :
+  case 0x8A : // MOV reg,r/m
+  case 0x8B :
+    return( RM_READ ) ;
+
+  case 0x80 : // ALU r/m,imm
+  case 0x81 :
+  case 0x82 :
+  case 0x83 :
+    return( ( reg == 7 ) ? RM_READ : ( RM_READ | RM_WRITE ) ) ;
+
+  case 0x86 : // XCHG
+  case 0x87 :
+  case 0xC0 : // Shifts and rotates
+  case 0xC1 :
+  case 0xD0 :
+  case 0xD1 :
+  case 0xD2 :
+  case 0xD3 :
+    return( RM_READ | RM_WRITE ) ;
+
+  case 0x88 : // MOV r/m,reg
+  case 0x89 :
+  case 0x8F : // POP r/m
+  case 0xC6 : // MOV r/m,imm
+  case 0xC7 :
+    return( RM_WRITE ) ;
+
+  case 0xF6 : // NOT and NEG update r/m, TEST/MUL/DIV only read it
+  case 0xF7 :
+    return( ( ( reg == 2 ) || ( reg == 3 ) ) ? ( RM_READ | RM_WRITE ) : RM_READ ) ;
+
+  case 0xFE : // INC and DEC update r/m, CALL/JMP/PUSH only read it
+  case 0xFF :
+    return( ( reg < 2 ) ? ( RM_READ | RM_WRITE ) : RM_READ ) ;
+
+  default :
+    return( 0 ) ;
+  }
+}
+
+// Start an instruction whose r/m operand is in a device page.
+// The engine accesses operands directly in mem[], so the device read handler
+// is called up front and its result placed in mem[] for the instruction to
+// use. The original contents are kept so the value the instruction writes
+// can be passed to the write handler by device_operand_end.
+void device_operand_begin( uint8_t access )
+{
+  if( access == 0 )
+  {
+    return ;
+  }
 
-  for( i = 0 ; i < 3 ; i++ )
+  device_access = access ;
+  device_addr   = rm_addr ;
+  device_word   = i_w || ( access & RM_WORD ) ;
+  device_saved  = *( uint16_t * )&mem[ device_addr ] ;
+
+  if( access & RM_READ )
   {
-    if( disk[ i ] != 0 )
+    scratch_int = MEM_DeviceRead( device_word , device_addr ) ;
+    mem[ device_addr ] = ( uint8_t ) scratch_int ;
+    if( device_word )
     {
-      close( disk[ i ] ) ;
-      disk[ i ] = 0 ;
+      mem[ device_addr + 1 ] = ( uint8_t ) ( scratch_int >> 8 ) ;
     }
   }
+}
+
+// Finish an instruction started with device_operand_begin.
+void device_operand_end( void )
+{
+  if( device_access & RM_WRITE )
+  {
+    scratch_int = *( uint16_t * )&mem[ device_addr ] ;
+    *( uint16_t * )&mem[ device_addr ] = device_saved ;
+    MEM_DeviceWrite( device_word , device_addr , scratch_int ) ;
+  }
+
+  device_access = 0 ;
+}
 
-  if( Interface.GetBIOSFilename() != NULL )
+// Read a string operand, routing device pages through their handlers.
+inline unsigned int read_operand( uint32_t addr )
+{
+  if( MEM_IS_DEVICE( addr ) )
   {
-    disk[ 2 ] = open( Interface.GetBIOSFilename() , O_BINARY | O_NOINHERIT | O_RDWR ) ;
+    return( MEM_DeviceRead( i_w , addr ) ) ;
   }
 
-  if( Interface.GetFDImageFilename() != NULL )
+  return( ( i_w ) ? *( uint16_t * )&mem[ addr ] : mem[ addr ] ) ;
+}
+
+// Write a string operand, routing device pages through their handlers.
+inline void write_operand( uint32_t addr , unsigned int val )
+{
+  if( MEM_IS_DEVICE( addr ) )
+  {
+    MEM_DeviceWrite( i_w , addr , val ) ;
+  }
+  else if( i_w )
+  {
+    *( uint16_t * )&mem[ addr ] = ( uint16_t ) val ;
+  }
+  else
   {
-    disk[ 1 ] = open( Interface.GetFDImageFilename() , O_BINARY | O_NOINHERIT | O_RDWR ) ;
+    mem[ addr ] = ( uint8_t ) val ;
   }
+}
+
+void CPU_GetState( stCPUState_t * State )
+{
+  State->reg_ip          = reg_ip          ;
+  State->seg_override    = seg_override    ;
+  State->seg_override_en = seg_override_en ;
+  State->rep_override_en = rep_override_en ;
+  State->rep_mode        = rep_mode        ;
+  State->trap_flag       = trap_flag       ;
+  FPU_GetState( &State->fpu ) ;
+}
+
+void CPU_SetState( const stCPUState_t * State )
+{
+  reg_ip          = State->reg_ip          ;
+  seg_override    = State->seg_override    ;
+  seg_override_en = State->seg_override_en ;
+  rep_override_en = State->rep_override_en ;
+  rep_mode        = State->rep_mode        ;
+  trap_flag       = State->trap_flag       ;
+  FPU_SetState( &State->fpu ) ;
+}
 
-  if( Interface.GetHDImageFilename() != NULL )
+// Make the cached disk writes, reporting any that failed.
+void FlushDisks( void )
+{
+  if( !DISK_Flush() )
   {
-    disk[ 0 ] = open( Interface.GetHDImageFilename() , O_BINARY | O_NOINHERIT | O_RDWR ) ;
+    printf( "Disk write failed, the disk image may be damaged\n" ) ;
   }
+}
+
+void Reset( void )
+{
+  uint32_t i ;
+
+  // The images are opened again, so finish writing them first.
+  FlushDisks() ;
+
+  // Fill RAM with 00h.
+  // BIOS area is 64K from F0000h.
+  memset( ( void * ) mem , 0x00 , ( size_t ) RAM_SIZE ) ;
+
+  DISK_Open( DISK_BIOS , Interface.GetBIOSFilename() ) ;
+  DISK_Open( DISK_FD , Interface.GetFDImageFilename() ) ;
+  DISK_Open( DISK_HD , Interface.GetHDImageFilename() ) ;
 
   // Set CX:AX equal to the hard disk image size, if present
-  *( uint32_t * )&regs16[ REG_AX ] = ( disk[ 0 ] ) ? ( lseek( disk[ 0 ] , 0 , 2 ) >> 9 ) : ( 0 ) ;
+  *( uint32_t * )&regs16[ REG_AX ] = ( uint32_t ) ( DISK_Size( DISK_HD ) >> 9 ) ;
 
   // CS is initialised to F000
   regs16[ REG_CS ] = ( REGS_BASE >> 4 ) ;
 
   // Load BIOS image into F000:0100, and set IP to 0100
   reg_ip = 0x100 ;
-  read( disk[ 2 ] , ( regs8 + 0x100 ) , 0xFF00 ) ;
+  DISK_Read( DISK_BIOS , 0 , ( regs8 + 0x100 ) , 0xFF00 ) ;
 
   // Initialise CPU state variables
   seg_override_en = 0 ;
   rep_override_en = 0 ;
 
+  FPU_Reset() ;
+
+  // The EMS driver code is installed in the cleared RAM.
+  EMS_Reset() ;
+
+  // DOS has gone, so the host drive must be mounted again.
+  REDIR_Reset() ;
+
   // Load instruction decoding helper table vectors
   for( i = 0 ; i < 20 ; i++ )
   {
@@ -382,85 +995,139 @@ void Reset( void )
       bios_table_lookup[ i ][ j ] = regs8[ regs16[ 0x81 + i ] + j ] ;
     }
   }
+
+  // The BIOS tables do not describe the ModR/M operand of the 80186 BOUND
+  // and IMUL imm instructions, so correct their decoding and length.
+  bios_table_lookup[ TABLE_I_MOD_SIZE     ][ 0x62 ] = 1 ;
+  bios_table_lookup[ TABLE_BASE_INST_SIZE ][ 0x62 ] = 2 ;
+  bios_table_lookup[ TABLE_I_MOD_SIZE     ][ 0x69 ] = 1 ;
+  bios_table_lookup[ TABLE_BASE_INST_SIZE ][ 0x69 ] = 2 ;
+  bios_table_lookup[ TABLE_I_W_SIZE       ][ 0x69 ] = 1 ;
+  bios_table_lookup[ TABLE_I_MOD_SIZE     ][ 0x6B ] = 1 ;
+  bios_table_lookup[ TABLE_BASE_INST_SIZE ][ 0x6B ] = 3 ;
+  bios_table_lookup[ TABLE_I_W_SIZE       ][ 0x6B ] = 0 ;
+
+  // Nor the ModR/M operand of the V20 FPO2 escape (66/67).
+  bios_table_lookup[ TABLE_I_MOD_SIZE     ][ 0x66 ] = 1 ;
+  bios_table_lookup[ TABLE_BASE_INST_SIZE ][ 0x66 ] = 2 ;
+  bios_table_lookup[ TABLE_I_MOD_SIZE     ][ 0x67 ] = 1 ;
+  bios_table_lookup[ TABLE_BASE_INST_SIZE ][ 0x67 ] = 2 ;
 }
 
-// Emulator entry point
+// The 8086tiny BIOS uses 80186 instructions, such as shifts by an
+// immediate count, so cannot run on an 8088. It is recognised by the
+// banner in the image loaded by Reset.
+static bool BIOSNeeds80186( void )
+{
+  static const char Banner[] = "8086tiny BIOS" ;
 
-#if defined(_WIN32)
-int CALLBACK WinMain(
-  HINSTANCE hInstance,
-  HINSTANCE /* hPrevInstance */,
-  LPSTR     /* lpCmdLine */,
-  int       /* nCmdShow */)
-#else
-int main(int argc, char **argv)
-#endif
-{
-  uint8_t * opcode_stream   ;
-
-#if defined(_WIN32)
-  Interface.SetInstance(hInstance);
-#endif
-  Interface.Initialise( mem ) ;
+  for( int i = 0x100 ; i + ( int ) sizeof( Banner ) - 1 <= 0x10000 ; i++ )
+  {
+    if( memcmp( regs8 + i , Banner , sizeof( Banner ) - 1 ) == 0 )
+    {
+      return( true ) ;
+    }
+  }
 
-  // regs16 and reg8 point to F000:0, the start of memory-mapped registers
-  regs8  = ( uint8_t  * ) ( mem + REGS_BASE ) ; // Base + 000F.0000
-  regs16 = ( uint16_t * ) ( mem + REGS_BASE ) ; // Base + 000F.0000
+  return( false ) ;
+}
 
-  // Clear BIOS and disk filed.
-  disk[ 0 ] = 0 ;
-  disk[ 1 ] = 0 ;
-  disk[ 2 ] = 0 ;
+// Decode the instruction at CS:IP: its prefixes, its opcode, its ModR/M
+// fields and its data. reg_ip is left at the opcode. Only the prefixes and
+// the 6 bytes from the opcode on are read.
+template< int Model > static inline void DecodeInstruction( void )
+{
+  uint8_t * opcode_stream   ;
 
-  // Reset, loads initial disk and bios images, clears RAM and sets CS & IP.
-  Reset() ;
+  opcode_stream = mem + 16 * regs16[ REG_CS ] + reg_ip ;
 
-  // Instruction execution loop.
-  bool ExitEmulation = false ;
-  while( !ExitEmulation )
+  // Segment override, REP and LOCK prefixes are decoded as part of the
+  // instruction they apply to.
+  for( ;; )
   {
-    opcode_stream = mem + 16 * regs16[ REG_CS ] + reg_ip ;
-
-    // Set up variables to prepare for decoding an opcode.
-    set_opcode( *opcode_stream ) ;
-
-    /**********
-     *
-     *      7     6     5     4     3     2     1     0
-     *   +-----+-----+-----+-----+-----+-----+-----+-----+
-     *   |     |     |     |     |     |       REG       |
-     *   +-----+-----+-----+-----+-----+-----+-----+-----+
-     *                                        \_ _/ \_ _/
-     *                                          |     |
-     *                                          |     +---> W
-     *                                          +---------> D
-     *
-     **********/
-    // Extract i_w and i_d fields from instruction.
-
-    i_reg4bit = stOpcode.raw_opcode_id & 0x07 ;
-    i_w       = ( i_reg4bit & 0x01 ) == 0x01 ;
-    i_d       = ( i_reg4bit & 0x02 ) == 0x02 ;
+    scratch_uchar = bios_table_lookup[ TABLE_XLAT_OPCODE ][ *opcode_stream ] ;
+    if( scratch_uchar == 0x1B )
+    {
+      // xS: segment override
+      seg_override_en = 1 ;
+      seg_override    = bios_table_lookup[ TABLE_XLAT_SUBFUNCTION ][ *opcode_stream ] ;
+    }
+    else if( scratch_uchar == 0x17 )
+    {
+      // REPxx
+      rep_override_en = 1 ;
+      rep_mode        = *opcode_stream & 0x01 ;
+    }
+    else if( ( Model == CPU_MODEL_V20 ) && ( ( *opcode_stream & 0xFE ) == 0x64 ) )
+    {
+      // V20 REPNC/REPC: repeat while CF is clear/set as well as CX != 0.
+      rep_override_en = 1 ;
+      rep_mode        = 0x02 | ( *opcode_stream & 0x01 ) ;
+    }
+    else if( scratch_uchar != 0x30 ) // LOCK is ignored
+    {
+      break ;
+    }
 
-    // Extract instruction data fields
-    i_data0 = *( int16_t * )&opcode_stream[ 1 ] ;
-    i_data1 = *( int16_t * )&opcode_stream[ 2 ] ;
-    i_data2 = *( int16_t * )&opcode_stream[ 3 ] ;
+    reg_ip++ ;
+    opcode_stream = mem + 16 * regs16[ REG_CS ] + reg_ip ;
+  }
 
-    // seg_override_en and rep_override_en contain number of instructions to hold segment override and REP prefix respectively
-    if( seg_override_en )
+  // Set up variables to prepare for decoding an opcode.
+  if( Model == CPU_MODEL_8088 )
+  {
+    // The 8088 only partially decodes some opcodes:
+    // 60-6F alias the conditional jumps 70-7F, C0/C1 alias RET imm (C2/C3)
+    // and C8/C9 alias RETF imm/RETF (CA/CB).
+    if( ( *opcode_stream & 0xF0 ) == 0x60 )
     {
-      seg_override_en-- ;
+      set_opcode( *opcode_stream | 0x10 ) ;
     }
-
-    if( rep_override_en )
+    else if( ( ( *opcode_stream & 0xFE ) == 0xC0 ) || ( ( *opcode_stream & 0xFE ) == 0xC8 ) )
     {
-      rep_override_en-- ;
+      set_opcode( *opcode_stream | 0x02 ) ;
     }
-
-    // i_mod_size > 0 indicates that opcode uses i_mod/i_rm/i_reg, so decode them
-    if( stOpcode.i_mod_size )
+    else
     {
+      set_opcode( *opcode_stream ) ;
+    }
+  }
+  else if( ( Model == CPU_MODEL_V20 ) && ( *opcode_stream == 0xD6 ) )
+  {
+    // There is no SALC on the V20, D6 is an alias of XLAT.
+    set_opcode( 0xD7 ) ;
+  }
+  else
+  {
+    set_opcode( *opcode_stream ) ;
+  }
+
+  /**********
+   *
+   *      7     6     5     4     3     2     1     0
+   *   +-----+-----+-----+-----+-----+-----+-----+-----+
+   *   |     |     |     |     |     |       REG       |
+   *   +-----+-----+-----+-----+-----+-----+-----+-----+
+   *                                        \_ _/ \_ _/
+   *                                          |     |
+   *                                          |     +---> W
+   *                                          +---------> D
+   *
+   **********/
+  // Extract i_w and i_d fields from instruction.
+
+  i_reg4bit = stOpcode.raw_opcode_id & 0x07 ;
+  i_w       = ( i_reg4bit & 0x01 ) == 0x01 ;
+  i_d       = ( i_reg4bit & 0x02 ) == 0x02 ;
+
+  // Extract instruction data fields
+  i_data0 = *( int16_t * )&opcode_stream[ 1 ] ;
+  i_data1 = *( int16_t * )&opcode_stream[ 2 ] ;
+  i_data2 = *( int16_t * )&opcode_stream[ 3 ] ;
+
+  // i_mod_size > 0 indicates that opcode uses i_mod/i_rm/i_reg, so decode them
+  if( stOpcode.i_mod_size )
+  {
 
     /**********
      *
@@ -491,7 +1158,108 @@ int main(int argc, char **argv)
     {
       i_data1 = ( int8_t ) i_data1 ;
     }
+  }
+}
+
+// Decode the instruction at CS:IP through a cache of decoded instructions.
+// An entry is used only if the bytes at its address are still the bytes it
+// was decoded from, so code that is changed or paged in is decoded again.
+// Instructions with more than two prefixes are not cached, as their decode
+// reads more than the bytes compared.
+template< int Model > static inline void DecodeCached( void )
+{
+  static stDecodeEntry_t Cache[ DECODE_CACHE_ENTRIES ] ;
+  stDecodeEntry_t      * Entry ;
+  uint32_t               Addr  ;
+  uint64_t               Bytes ;
+  uint16_t               Start ;
+
+  Addr = 16 * regs16[ REG_CS ] + reg_ip ;
+  if( ( Addr > RAM_SIZE - sizeof( Bytes ) ) || seg_override_en || rep_override_en )
+  {
+    DecodeInstruction< Model >() ;
+    return ;
+  }
+
+  memcpy( &Bytes , mem + Addr , sizeof( Bytes ) ) ;
+  Entry = &Cache[ ( Addr ^ ( Addr >> 12 ) ) & ( DECODE_CACHE_ENTRIES - 1 ) ] ;
+
+  if( Entry->valid && ( Entry->addr == Addr ) && ( Entry->bytes == Bytes ) )
+  {
+    reg_ip += Entry->prefixes ;
+    if( Entry->seg_override_en )
+    {
+      seg_override_en = 1 ;
+      seg_override    = Entry->seg_override ;
+    }
+    if( Entry->rep_override_en )
+    {
+      rep_override_en = 1 ;
+      rep_mode        = Entry->rep_mode ;
+    }
+
+    scratch_uchar = Entry->scratch_uchar ;
+    stOpcode      = Entry->opcode ;
+    i_reg4bit     = Entry->i_reg4bit ;
+    i_w           = Entry->i_w ;
+    i_d           = Entry->i_d ;
+    i_data0       = Entry->i_data0 ;
+    i_data1       = Entry->i_data1 ;
+    i_data2       = Entry->i_data2 ;
+    if( stOpcode.i_mod_size )
+    {
+      i_mod = Entry->i_mod ;
+      i_reg = Entry->i_reg ;
+      i_rm  = Entry->i_rm ;
+    }
+    return ;
+  }
+
+  Start = reg_ip ;
+  DecodeInstruction< Model >() ;
+
+  // Prefixes that wrap IP do not follow the bytes compared either.
+  Entry->valid = ( ( uint16_t ) ( reg_ip - Start ) <= 2 ) && ( reg_ip >= Start ) ;
+  if( Entry->valid )
+  {
+    Entry->addr            = Addr ;
+    Entry->bytes           = Bytes ;
+    Entry->prefixes        = ( uint8_t ) ( reg_ip - Start ) ;
+    Entry->seg_override_en = seg_override_en ;
+    Entry->seg_override    = seg_override ;
+    Entry->rep_override_en = rep_override_en ;
+    Entry->rep_mode        = rep_mode ;
+    Entry->scratch_uchar   = scratch_uchar ;
+    Entry->opcode          = stOpcode ;
+    Entry->i_reg4bit       = i_reg4bit ;
+    Entry->i_w             = i_w ;
+    Entry->i_d             = i_d ;
+    Entry->i_data0         = i_data0 ;
+    Entry->i_data1         = i_data1 ;
+    Entry->i_data2         = i_data2 ;
+    Entry->i_mod           = i_mod ;
+    Entry->i_reg           = i_reg ;
+    Entry->i_rm            = i_rm ;
+  }
+}
+
+// Execute the instruction at CS:IP.
+// Without the decode cache this is the reference execution engine. It is
+// instantiated for each CPU model; all model differences are resolved at
+// compile time.
+template< int Model , bool DecodeCache > void CPU_ExecuteInstruction( void )
+{
+  if( DecodeCache )
+  {
+    DecodeCached< Model >() ;
+  }
+  else
+  {
+    DecodeInstruction< Model >() ;
+  }
 
+  if( stOpcode.i_mod_size )
+  {
     scratch2_uint = 4 * !i_mod ;
     if( i_mod < 3 )
     {
@@ -525,6 +1293,12 @@ int main(int argc, char **argv)
       op_from_addr = rm_addr      ;
       op_to_addr   = scratch_uint ;
     }
+
+    // Plain RAM operands are used directly, device pages need their handlers.
+    if( ( i_mod < 3 ) && MEM_IS_DEVICE( rm_addr ) )
+    {
+      device_operand_begin( rm_access( stOpcode.raw_opcode_id , i_reg ) ) ;
+    }
   }
 
   // Instruction execution unit.
@@ -621,6 +1395,7 @@ int main(int argc, char **argv)
     }
 
     i_reg = stOpcode.extra ;
+    // Fall through
 
   // INC|DEC|JMP|CALL|PUSH
   case 0x05 :
@@ -788,7 +1563,7 @@ int main(int argc, char **argv)
 
       // Decode like SUB
       set_opcode( 0x28 ) ;
-      set_CF( op_result > op_dest ) ;
+      set_CF( ( uint32_t ) op_result > op_dest ) ;
       break ;
 
     // MUL
@@ -948,6 +1723,7 @@ int main(int argc, char **argv)
     i_mod   = 3         ;
     i_reg   = stOpcode.extra ;
     reg_ip-- ;
+    // Fall through
 
   // ADD|OR|ADC|SBB|AND|SUB|XOR|CMP reg, immed
   case 0x08 :
@@ -966,6 +1742,7 @@ int main(int argc, char **argv)
     reg_ip += ( !i_d + 1 ) ;
     stOpcode.extra = i_reg ;
     set_opcode( 0x08 * i_reg ) ;
+    // Fall through
 
   // ADD|OR|ADC|SBB|AND|SUB|XOR|CMP|MOV reg, r/m
   case 0x09 :
@@ -987,7 +1764,7 @@ int main(int argc, char **argv)
           op_result = mem[ op_to_addr ] += op_source ;
         }
 
-        set_CF( op_result < op_dest ) ;
+        set_CF( ( uint32_t ) op_result < op_dest ) ;
         break ;
 
       // OR
@@ -1050,7 +1827,7 @@ int main(int argc, char **argv)
           op_result = mem[ op_to_addr ] -= op_source ;
         }
 
-        set_CF( op_result > op_dest ) ;
+        set_CF( ( uint32_t ) op_result > op_dest ) ;
         break ;
 
       // XOR
@@ -1086,7 +1863,7 @@ int main(int argc, char **argv)
           op_result = mem[ op_to_addr ] - op_source ;
         }
 
-        set_CF( op_result > op_dest ) ;
+        set_CF( ( uint32_t ) op_result > op_dest ) ;
         break ;
 
       // MOV
@@ -1114,157 +1891,72 @@ int main(int argc, char **argv)
           mem[ op_to_addr ] = aux ;
         }
         break ;
-      }
-      break ;
+    }
+    break ;
 
-    // MOV sreg, r/m | POP r/m | LEA reg, r/m
-    case 0x0A :
-      // MOV
-      if( !i_w )
+  // MOV sreg, r/m | POP r/m | LEA reg, r/m
+  case 0x0A :
+    // MOV
+    if( !i_w )
+    {
+      i_w = 1,
+      i_reg += 8,
+
+      scratch2_uint = 4 * !i_mod ;
+      if( i_mod < 3 )
       {
-        i_w = 1,
-        i_reg += 8,
+        uint16_t localIndex ;
+        uint16_t localAddr  ;
 
-        scratch2_uint = 4 * !i_mod ;
-        if( i_mod < 3 )
+        if( seg_override_en )
         {
-          uint16_t localIndex ;
-          uint16_t localAddr  ;
-
-          if( seg_override_en )
-          {
-            localIndex = seg_override ;
-          }
-          else
-          {
-            localIndex = bios_table_lookup[ scratch2_uint + 3 ][ i_rm ] ;
-          }
-
-          localAddr  = ( uint16_t ) regs16[ bios_table_lookup[ scratch2_uint + 1 ][ i_rm ] ] ;
-          localAddr += ( uint16_t ) bios_table_lookup[ scratch2_uint + 2 ][ i_rm ] * i_data1 ;
-          localAddr += ( uint16_t ) regs16[ bios_table_lookup[ scratch2_uint ][ i_rm ] ] ;
-          rm_addr = ( 16 * regs16[ localIndex ] ) + localAddr ;
+          localIndex = seg_override ;
         }
         else
         {
-          rm_addr = ( REGS_BASE + ( ( i_w ) ? ( 2 * i_rm ) : ( 2 * i_rm + i_rm / 4 ) & 7 ) ) ;
-        }
-        op_to_addr = rm_addr ;
-        op_from_addr = (REGS_BASE + ( ( i_w ) ? ( 2 * i_reg ) : ( 2 * i_reg + i_reg / 4 ) & 7 ) ) ;
-        if( i_d )
-        {
-          scratch_uint = op_from_addr ;
-          op_from_addr = rm_addr      ;
-          op_to_addr   = scratch_uint ;
-        }
-
-        // Execute arithmetic/logic operations.
-        if( i_w )
-        {
-          op_dest   = *( uint16_t * )&mem[ op_to_addr ] ;
-
-          op_source = *( uint16_t * )&mem[ op_from_addr ]  ;
-          op_result = op_source ;
-          *( uint16_t * )&mem[ op_to_addr ] = op_source ;
+          localIndex = bios_table_lookup[ scratch2_uint + 3 ][ i_rm ] ;
         }
-        else
-        {
-          op_dest   = mem[ op_to_addr ] ;
 
-          op_source = *( uint8_t * )&mem[ op_from_addr ] ;
-          op_result = op_source ;
-          mem[ op_to_addr ] = op_source ;
-        }
+        localAddr  = ( uint16_t ) regs16[ bios_table_lookup[ scratch2_uint + 1 ][ i_rm ] ] ;
+        localAddr += ( uint16_t ) bios_table_lookup[ scratch2_uint + 2 ][ i_rm ] * i_data1 ;
+        localAddr += ( uint16_t ) regs16[ bios_table_lookup[ scratch2_uint ][ i_rm ] ] ;
+        rm_addr = ( 16 * regs16[ localIndex ] ) + localAddr ;
       }
-      else if( !i_d ) // LEA
+      else
       {
-        seg_override_en = 1 ;
-        seg_override = REG_ZERO ;
-
-        scratch2_uint = 4 * !i_mod ;
-        if( i_mod < 3 )
-        {
-          uint16_t localIndex ;
-          uint16_t localAddr  ;
-
-          if( seg_override_en )
-          {
-            localIndex = seg_override ;
-          }
-          else
-          {
-            localIndex = bios_table_lookup[ scratch2_uint + 3 ][ i_rm ] ;
-          }
-
-          localAddr  = ( uint16_t ) regs16[ bios_table_lookup[ scratch2_uint + 1 ][ i_rm ] ] ;
-          localAddr += ( uint16_t ) bios_table_lookup[ scratch2_uint + 2 ][ i_rm ] * i_data1 ;
-          localAddr += ( uint16_t ) regs16[ bios_table_lookup[ scratch2_uint ][ i_rm ] ] ;
-          rm_addr = ( 16 * regs16[ localIndex ] ) + localAddr ;
-        }
-        else
-        {
-          rm_addr = ( REGS_BASE + ( ( i_w ) ? ( 2 * i_rm ) : ( 2 * i_rm + i_rm / 4 ) & 7 ) ) ;
-        }
-        op_to_addr = rm_addr ;
-        op_from_addr = ( REGS_BASE + ( ( i_w ) ? ( 2 * i_reg ) : ( 2 * i_reg + i_reg / 4 ) & 7 ) ) ;
-        if( i_d )
-        {
-          scratch_uint = op_from_addr ;
-          op_from_addr = rm_addr      ;
-          op_to_addr   = scratch_uint ;
-        }
-
-        // MOV
-        if( i_w )
-        {
-          uint16_t aux ;
-
-          op_dest = *( uint16_t * )&mem[ op_from_addr ] ;
-
-          aux = *( uint16_t * )&rm_addr ;
-
-          op_source = aux ;
-          op_result = aux ;
-          *( uint16_t * )&mem[ op_from_addr ] = aux ;
-        }
-        else
-        {
-          uint8_t aux ;
-
-          op_dest = mem[ op_from_addr ] ;
-
-          aux = *( uint8_t * )&rm_addr ;
-
-          op_source = aux ;
-          op_result = aux ;
-          mem[ op_from_addr ] = aux ;
-        }
+        rm_addr = ( REGS_BASE + ( ( i_w ) ? ( 2 * i_rm ) : ( 2 * i_rm + i_rm / 4 ) & 7 ) ) ;
       }
-      else // POP
+      op_to_addr = rm_addr ;
+      op_from_addr = (REGS_BASE + ( ( i_w ) ? ( 2 * i_reg ) : ( 2 * i_reg + i_reg / 4 ) & 7 ) ) ;
+      if( i_d )
       {
-        uint32_t addr ;
-
-        i_w = 1 ;
-        regs16[ REG_SP ] += 2 ;
-
-        op_dest   = *( uint16_t * )&mem[ rm_addr ] ;
+        scratch_uint = op_from_addr ;
+        op_from_addr = rm_addr      ;
+        op_to_addr   = scratch_uint ;
+      }
 
-        addr  = 16 ;
-        addr *= regs16[ REG_SS ] ;
-        addr += ( uint16_t ) ( regs16[ REG_SP ] - 2 ) ;
+      // Execute arithmetic/logic operations.
+      if( i_w )
+      {
+        op_dest   = *( uint16_t * )&mem[ op_to_addr ] ;
 
-        op_source = *( uint16_t * )&mem[ addr ]  ;
+        op_source = *( uint16_t * )&mem[ op_from_addr ]  ;
         op_result = op_source ;
-        *( uint16_t * )&mem[ rm_addr ] = op_source ;
+        *( uint16_t * )&mem[ op_to_addr ] = op_source ;
       }
-      break ;
+      else
+      {
+        op_dest   = mem[ op_to_addr ] ;
 
-    // MOV AL/AX, [loc]
-    case 0x0B :
-      i_mod = 0 ;
-      i_reg = 0 ;
-      i_rm  = 6 ;
-      i_data1 = i_data0 ;
+        op_source = *( uint8_t * )&mem[ op_from_addr ] ;
+        op_result = op_source ;
+        mem[ op_to_addr ] = op_source ;
+      }
+    }
+    else if( !i_d ) // LEA
+    {
+      seg_override_en = 1 ;
+      seg_override = REG_ZERO ;
 
       scratch2_uint = 4 * !i_mod ;
       if( i_mod < 3 )
@@ -1306,7 +1998,8 @@ int main(int argc, char **argv)
 
         op_dest = *( uint16_t * )&mem[ op_from_addr ] ;
 
-        aux = *( uint16_t * )&mem[ op_to_addr ] ;
+        aux = *( uint16_t * )&rm_addr ;
+
         op_source = aux ;
         op_result = aux ;
         *( uint16_t * )&mem[ op_from_addr ] = aux ;
@@ -1317,1386 +2010,2016 @@ int main(int argc, char **argv)
 
         op_dest = mem[ op_from_addr ] ;
 
-        aux = *( uint8_t * )&mem[ op_to_addr ] ;
+        aux = *( uint8_t * )&rm_addr ;
+
         op_source = aux ;
         op_result = aux ;
         mem[ op_from_addr ] = aux ;
       }
-      break ;
+    }
+    else // POP
+    {
+      uint32_t addr ;
+
+      i_w = 1 ;
+      regs16[ REG_SP ] += 2 ;
 
-    // ROL|ROR|RCL|RCR|SHL|SHR|???|SAR reg/mem, 1/CL/imm (80186)
-    case 0x0C :
+      op_dest   = *( uint16_t * )&mem[ rm_addr ] ;
 
-      // Returns sign bit of an 8-bit or 16-bit operand.
-      if( i_w )
-      {
-        scratch2_uint = *( int16_t * )&( mem[ rm_addr ] ) ;
-        scratch2_uint >>= 15 ;
-      }
-      else
-      {
-        scratch2_uint = ( mem[ rm_addr ] ) ;
-        scratch2_uint >>= 7 ;
-      }
-      scratch2_uint &= 1 ;
+      addr  = 16 ;
+      addr *= regs16[ REG_SS ] ;
+      addr += ( uint16_t ) ( regs16[ REG_SP ] - 2 ) ;
 
-      if( stOpcode.extra )
-      {
-        // xxx reg/mem, imm
-        scratch_uint = ( int8_t ) i_data1 ;
-      }
-      else if( i_d )
+      op_source = *( uint16_t * )&mem[ addr ]  ;
+      op_result = op_source ;
+      *( uint16_t * )&mem[ rm_addr ] = op_source ;
+    }
+    break ;
+
+  // MOV AL/AX, [loc]
+  case 0x0B :
+    i_mod = 0 ;
+    i_reg = 0 ;
+    i_rm  = 6 ;
+    i_data1 = i_data0 ;
+
+    scratch2_uint = 4 * !i_mod ;
+    if( i_mod < 3 )
+    {
+      uint16_t localIndex ;
+      uint16_t localAddr  ;
+
+      if( seg_override_en )
       {
-        // xxx reg/mem, CL
-        scratch_uint = 0x1F & regs8[ REG_CL ] ;
+        localIndex = seg_override ;
       }
       else
       {
-        // xxx reg/mem, 1
-        scratch_uint = 0x01 ;
+        localIndex = bios_table_lookup[ scratch2_uint + 3 ][ i_rm ] ;
       }
 
-      if( scratch_uint )
-      {
-        if( i_reg < 4 ) // Rotate operations
-        {
-          scratch_uint %= i_reg / 2 + 8 * ( i_w + 1 ) ;
+      localAddr  = ( uint16_t ) regs16[ bios_table_lookup[ scratch2_uint + 1 ][ i_rm ] ] ;
+      localAddr += ( uint16_t ) bios_table_lookup[ scratch2_uint + 2 ][ i_rm ] * i_data1 ;
+      localAddr += ( uint16_t ) regs16[ bios_table_lookup[ scratch2_uint ][ i_rm ] ] ;
+      rm_addr = ( 16 * regs16[ localIndex ] ) + localAddr ;
+    }
+    else
+    {
+      rm_addr = ( REGS_BASE + ( ( i_w ) ? ( 2 * i_rm ) : ( 2 * i_rm + i_rm / 4 ) & 7 ) ) ;
+    }
+    op_to_addr = rm_addr ;
+    op_from_addr = ( REGS_BASE + ( ( i_w ) ? ( 2 * i_reg ) : ( 2 * i_reg + i_reg / 4 ) & 7 ) ) ;
+    if( i_d )
+    {
+      scratch_uint = op_from_addr ;
+      op_from_addr = rm_addr      ;
+      op_to_addr   = scratch_uint ;
+    }
 
-          // Execute arithmetic/logic operations.
-          if( i_w )
-          {
-            op_dest   = *( uint16_t * )&scratch2_uint ;
-            op_source = *( uint16_t * )&mem[ rm_addr ]  ;
-            op_result = *( uint16_t * )&scratch2_uint = op_source ;
-          }
-          else
-          {
-            op_dest   = scratch2_uint ;
-            op_source = *( uint8_t * )&mem[ rm_addr ] ;
-            op_result = scratch2_uint = op_source ;
-          }
-        }
+    if( MEM_IS_DEVICE( rm_addr ) )
+    {
+      device_operand_begin( ( i_d ) ? RM_WRITE : RM_READ ) ;
+    }
 
-        if( i_reg & 1 ) // Rotate/shift right operations
-        {
-          // Execute arithmetic/logic operations.
-          if( i_w )
-          {
-            op_dest   = *( uint16_t * )&mem[ rm_addr ] ;
-            op_source = *( uint16_t * )&scratch_uint  ;
-            op_result = *( uint16_t * )&mem[ rm_addr ] >>= op_source ;
-          }
-          else
-          {
-            op_dest   = mem[ rm_addr ] ;
-            op_source = *( uint8_t * )&scratch_uint ;
-            op_result = mem[ rm_addr ] >>= op_source ;
-          }
-        }
-        else // Rotate/shift left operations
-        {
-          // Execute arithmetic/logic operations.
-          if( i_w )
-          {
-            op_dest   = *( uint16_t * )&mem[ rm_addr ] ;
-            op_source = *( uint16_t * )&scratch_uint  ;
-            op_result = *( uint16_t * )&mem[ rm_addr ] <<= op_source ;
-          }
-          else
-          {
-            op_dest   = mem[ rm_addr ] ;
-            op_source = *( uint8_t * )&scratch_uint ;
-            op_result = mem[ rm_addr ] <<= op_source ;
-          }
-        }
+    // MOV
+    if( i_w )
+    {
+      uint16_t aux ;
 
-        // Shift operations
-        if( i_reg > 3 )
-        {
-          // Shift instructions affect SZP
-          stOpcode.set_flags_type = FLAGS_UPDATE_SZP ;
-        }
+      op_dest = *( uint16_t * )&mem[ op_from_addr ] ;
 
-        // SHR or SAR
-        if( i_reg > 4 )
-        {
-          set_CF( op_dest >> ( scratch_uint - 1 ) & 1 ) ;
-        }
-      }
+      aux = *( uint16_t * )&mem[ op_to_addr ] ;
+      op_source = aux ;
+      op_result = aux ;
+      *( uint16_t * )&mem[ op_from_addr ] = aux ;
+    }
+    else
+    {
+      uint8_t aux ;
 
-      switch( i_reg )
-      {
-      // ROL
-      case 0x00 :
-        // Execute arithmetic/logic operations.
-        if( i_w )
-        {
-          op_dest   = *( uint16_t * )&mem[ rm_addr ] ;
-          op_source = *( uint16_t * )&scratch2_uint >> ( 16 - scratch_uint )  ;
-          op_result = *( uint16_t * )&mem[ rm_addr ] += op_source ;
+      op_dest = mem[ op_from_addr ] ;
 
-          // Returns sign bit of an 8-bit or 16-bit operand
-          set_OF( ( 1 & ( *( int16_t * )&( op_result ) ) >> 15 ) ^ set_CF( op_result & 1 ) ) ;
-        }
-        else
-        {
-          op_dest   = mem[ rm_addr ] ;
-          op_source = *( uint8_t * )&scratch2_uint >> ( 8 - scratch_uint ) ;
-          op_result = mem[ rm_addr ] += op_source ;
+      aux = *( uint8_t * )&mem[ op_to_addr ] ;
+      op_source = aux ;
+      op_result = aux ;
+      mem[ op_from_addr ] = aux ;
+    }
+    break ;
 
-          // Returns sign bit of an 8-bit or 16-bit operand
-          set_OF( ( 1 & op_result >> 7 ) ^ set_CF( op_result & 1 ) ) ;
-        }
-        break ;
+  // ROL|ROR|RCL|RCR|SHL|SHR|???|SAR reg/mem, 1/CL/imm (80186)
+  case 0x0C :
 
-      // ROR
-      case 0x01 :
-        scratch2_uint &= ( 1 << scratch_uint ) - 1 ;
+    // Returns sign bit of an 8-bit or 16-bit operand.
+    if( i_w )
+    {
+      scratch2_uint = *( int16_t * )&( mem[ rm_addr ] ) ;
+      scratch2_uint >>= 15 ;
+    }
+    else
+    {
+      scratch2_uint = ( mem[ rm_addr ] ) ;
+      scratch2_uint >>= 7 ;
+    }
+    scratch2_uint &= 1 ;
 
-        if( i_w )
-        {
-          // Execute arithmetic/logic operations.
-          op_dest   = *( uint16_t * )&mem[ rm_addr ] ;
-          op_source = *( uint16_t * )&scratch2_uint << ( 16 - scratch_uint )  ;
-          op_result = *( uint16_t * )&mem[ rm_addr ] += op_source ;
+    if( stOpcode.extra )
+    {
+      // xxx reg/mem, imm
+      // The immediate follows any displacement.
+      scratch_uint = ( uint8_t ) i_data2 ;
+    }
+    else if( i_d )
+    {
+      // xxx reg/mem, CL
+      scratch_uint = regs8[ REG_CL ] ;
+    }
+    else
+    {
+      // xxx reg/mem, 1
+      scratch_uint = 0x01 ;
+    }
 
-          set_OF( ( 1 & ( *( int16_t * )&op_result * 2 ) >> 15 ) ^ set_CF( 1 & ( *( int16_t * )&( op_result ) ) >> 15 ) ) ;
-        }
-        else
-        {
-          // Execute arithmetic/logic operations.
-          op_dest   = mem[ rm_addr ] ;
-          op_source = *( uint8_t * )&scratch2_uint << ( 8 - scratch_uint ) ;
-          op_result = mem[ rm_addr ] += op_source ;
+    if( Model == CPU_MODEL_80186 )
+    {
+      // The 80186 masks the shift count to 5 bits.
+      scratch_uint &= 0x1F ;
+    }
+    else if( ( i_reg > 3 ) && ( scratch_uint > 8U * ( i_w + 1 ) ) )
+    {
+      // The 8088 and V20 shift by the full count. Any count beyond the
+      // operand width gives the same result as width + 1.
+      scratch_uint = 8 * ( i_w + 1 ) + 1 ;
+    }
 
-          set_OF( ( 1 & ( op_result * 2 ) >> 7 ) ^ set_CF( 1 & ( op_result ) >> 7 ) ) ;
-        }
-        break ;
+    if( scratch_uint )
+    {
+      if( i_reg < 4 ) // Rotate operations
+      {
+        scratch_uint %= i_reg / 2 + 8 * ( i_w + 1 ) ;
 
-      // RCL
-      case 0x02 :
         // Execute arithmetic/logic operations.
         if( i_w )
         {
-          op_dest   = *( uint16_t * )&mem[ rm_addr ] ;
-          op_source = *( uint16_t * )&scratch2_uint >> ( 17 - scratch_uint )  ;
-          op_result = *( uint16_t * )&mem[ rm_addr ] += ( regs8[ FLAG_CF ] << ( scratch_uint - 1 ) ) + op_source ;
-
-          set_OF( ( 1 & *( int16_t * )&( op_result ) >> 15 ) ^ set_CF( scratch2_uint & 1 << ( 16 - scratch_uint ) ) ) ;
+          op_dest   = *( uint16_t * )&scratch2_uint ;
+          op_source = *( uint16_t * )&mem[ rm_addr ]  ;
+          op_result = *( uint16_t * )&scratch2_uint = op_source ;
         }
         else
         {
-          op_dest   = mem[ rm_addr ] ;
-          op_source = *( uint8_t * )&scratch2_uint >> ( 9 - scratch_uint ) ;
-          op_result = mem[ rm_addr ] += ( regs8[ FLAG_CF ] << ( scratch_uint - 1 ) ) + op_source ;
-
-          set_OF( ( ( 1 & op_result ) >> 7 ) ^ set_CF( scratch2_uint & 1 << ( 8 - scratch_uint ) ) ) ;
+          op_dest   = scratch2_uint ;
+          op_source = *( uint8_t * )&mem[ rm_addr ] ;
+          op_result = scratch2_uint = op_source ;
         }
-        break ;
+      }
 
-      // RCR
-      case 0x03 :
+      if( i_reg & 1 ) // Rotate/shift right operations
+      {
+        // Execute arithmetic/logic operations.
         if( i_w )
         {
-          // Execute arithmetic/logic operations.
           op_dest   = *( uint16_t * )&mem[ rm_addr ] ;
-          op_source = *( uint16_t * )&scratch2_uint << ( 17 - scratch_uint )  ;
-          op_result = *( uint16_t * )&mem[ rm_addr ] += ( regs8[ FLAG_CF ] << ( 16 - scratch_uint ) ) + op_source ;
-
-          set_CF( scratch2_uint & 1 << ( scratch_uint - 1 ) ) ;
-          set_OF( ( 1 & *( int16_t * )&( op_result ) >> 15 ) ^ ( 1 & *( int16_t * )&op_result * 2 >> 15 ) ) ;
+          op_source = *( uint16_t * )&scratch_uint  ;
+          op_result = *( uint16_t * )&mem[ rm_addr ] >>= op_source ;
         }
         else
         {
-          // Execute arithmetic/logic operations.
           op_dest   = mem[ rm_addr ] ;
-          op_source = *( uint8_t * )&scratch2_uint << ( 9 - scratch_uint ) ;
-          op_result = mem[ rm_addr ] += ( regs8[ FLAG_CF ] << ( 8 - scratch_uint ) ) + op_source ;
-
-          set_CF( scratch2_uint & 1 << ( scratch_uint - 1 ) ) ;
-          set_OF( ( 1 & op_result >> 7 ) ^ ( 1 & ( op_result * 2 ) >> 7 ) ) ;
-        }
-        break ;
-
-      // SHL
-      case 0x04 :
-        if( i_w )
-        {
-          set_OF( ( 1 & *( int16_t * )&( op_result ) >> 15 ) ^ set_CF( ( 1 & *( int16_t * )&op_dest << ( scratch_uint - 1 ) ) >> 15 ) ) ;
-        }
-        else
-        {
-          set_OF( ( 1 & op_result >> 7 ) ^ set_CF( ( 1 & ( op_dest << ( scratch_uint - 1 ) ) >> 7 ) ) ) ;
-        }
-        break ;
-
-      // SHR
-      case 0x05 :
-        if( i_w )
-        {
-          set_OF( 1 & *( int16_t * )&( op_dest ) >> 15 ) ;
+          op_source = *( uint8_t * )&scratch_uint ;
+          op_result = mem[ rm_addr ] >>= op_source ;
         }
-        else
-        {
-          set_OF( ( 1 & ( op_dest ) >> 7 ) ) ;
-        }
-        break ;
-
-      // SAR
-      case 0x07 :
-        if( !( scratch_uint < 8 * ( i_w + 1 ) ) )
-        {
-          set_CF( scratch2_uint ) ;
-        }
-        set_OF( 0 ) ;
-
+      }
+      else // Rotate/shift left operations
+      {
         // Execute arithmetic/logic operations.
         if( i_w )
         {
           op_dest   = *( uint16_t * )&mem[ rm_addr ] ;
-          op_source = *( uint16_t * )&scratch2_uint *= ~( ( ( 1 << 16 ) - 1 ) >> scratch_uint )  ;
-          op_result = *( uint16_t * )&mem[ rm_addr ] += op_source ;
+          op_source = *( uint16_t * )&scratch_uint  ;
+          op_result = *( uint16_t * )&mem[ rm_addr ] <<= op_source ;
         }
         else
         {
           op_dest   = mem[ rm_addr ] ;
-          op_source = *( uint8_t * )&scratch2_uint *= ~( ( ( 1 << 8 ) - 1 ) >> scratch_uint ) ;
-          op_result = mem[ rm_addr ] += op_source ;
+          op_source = *( uint8_t * )&scratch_uint ;
+          op_result = mem[ rm_addr ] <<= op_source ;
         }
-        break ;
       }
-      break ;
 
-    // LOOPxx|JCZX
-    case 0x0D :
-      regs16[ REG_CX ]-- ;
-      scratch_uint = ( regs16[ REG_CX ] ) ? ( XTRUE ) : ( XFALSE ) ;
+      // Shift operations
+      if( i_reg > 3 )
+      {
+        // Shift instructions affect SZP
+        stOpcode.set_flags_type = FLAGS_UPDATE_SZP ;
+      }
 
-      switch( i_reg4bit )
+      // SHR or SAR
+      if( i_reg > 4 )
       {
-      // LOOPNZ
-      case 0x00 :
-        scratch_uint &= !regs8[ FLAG_ZF ] ;
-        break ;
+        set_CF( op_dest >> ( scratch_uint - 1 ) & 1 ) ;
+      }
+    }
 
-      // LOOPZ
-      case 0x01 :
-        scratch_uint &= regs8[ FLAG_ZF ] ;
-        break ;
+    switch( i_reg )
+    {
+    // ROL
+    case 0x00 :
+      // Execute arithmetic/logic operations.
+      if( i_w )
+      {
+        op_dest   = *( uint16_t * )&mem[ rm_addr ] ;
+        op_source = *( uint16_t * )&scratch2_uint >> ( 16 - scratch_uint )  ;
+        op_result = *( uint16_t * )&mem[ rm_addr ] += op_source ;
 
-      // JCXXZ
-      case 0x03 :
-        scratch_uint = !++regs16[ REG_CX ] ;
-        break ;
+        // Returns sign bit of an 8-bit or 16-bit operand
+        set_OF( ( 1 & ( *( int16_t * )&( op_result ) ) >> 15 ) ^ set_CF( op_result & 1 ) ) ;
       }
+      else
+      {
+        op_dest   = mem[ rm_addr ] ;
+        op_source = *( uint8_t * )&scratch2_uint >> ( 8 - scratch_uint ) ;
+        op_result = mem[ rm_addr ] += op_source ;
 
-      reg_ip += scratch_uint * ( ( int8_t ) i_data0 ) ;
+        // Returns sign bit of an 8-bit or 16-bit operand
+        set_OF( ( 1 & op_result >> 7 ) ^ set_CF( op_result & 1 ) ) ;
+      }
       break ;
 
-    // JMP | CALL short/near
-    case 0x0E :
-      reg_ip += 3 - i_d ;
-      if( !i_w )
+    // ROR
+    case 0x01 :
+      scratch2_uint &= ( 1 << scratch_uint ) - 1 ;
+
+      if( i_w )
       {
-        if( i_d ) // JMP far
-        {
-          reg_ip = 0 ;
-          regs16[ REG_CS ] = i_data2 ;
-        }
-        else // CALL
-        {
-          // PUSH reg_ip.
-          i_w = 1 ;
-          op_dest   = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] ;
-          op_source = *( uint16_t * )&reg_ip ;
-          op_result = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] = op_source ;
-        }
+        // Execute arithmetic/logic operations.
+        op_dest   = *( uint16_t * )&mem[ rm_addr ] ;
+        op_source = *( uint16_t * )&scratch2_uint << ( 16 - scratch_uint )  ;
+        op_result = *( uint16_t * )&mem[ rm_addr ] += op_source ;
+
+        set_OF( ( 1 & ( *( int16_t * )&op_result * 2 ) >> 15 ) ^ set_CF( 1 & ( *( int16_t * )&( op_result ) ) >> 15 ) ) ;
       }
+      else
+      {
+        // Execute arithmetic/logic operations.
+        op_dest   = mem[ rm_addr ] ;
+        op_source = *( uint8_t * )&scratch2_uint << ( 8 - scratch_uint ) ;
+        op_result = mem[ rm_addr ] += op_source ;
 
-      reg_ip += ( i_d && i_w ) ? ( ( int8_t ) i_data0 ) : ( i_data0 ) ;
+        set_OF( ( 1 & ( op_result * 2 ) >> 7 ) ^ set_CF( 1 & ( op_result ) >> 7 ) ) ;
+      }
       break ;
 
-    // TEST reg, r/m
-    case 0x0F :
+    // RCL
+    case 0x02 :
       // Execute arithmetic/logic operations.
       if( i_w )
       {
-        op_dest   = *( uint16_t * )&mem[ op_from_addr ] ;
-        op_source = *( uint16_t * )&mem[ op_to_addr ]  ;
-        op_result = *( uint16_t * )&mem[ op_from_addr ] & op_source ;
+        op_dest   = *( uint16_t * )&mem[ rm_addr ] ;
+        op_source = *( uint16_t * )&scratch2_uint >> ( 17 - scratch_uint )  ;
+        op_result = *( uint16_t * )&mem[ rm_addr ] += ( regs8[ FLAG_CF ] << ( scratch_uint - 1 ) ) + op_source ;
+
+        set_OF( ( 1 & *( int16_t * )&( op_result ) >> 15 ) ^ set_CF( scratch2_uint & 1 << ( 16 - scratch_uint ) ) ) ;
       }
       else
       {
-        op_dest   = mem[ op_from_addr ] ;
-        op_source = *( uint8_t * )&mem[ op_to_addr ] ;
-        op_result = mem[ op_from_addr ] & op_source ;
+        op_dest   = mem[ rm_addr ] ;
+        op_source = *( uint8_t * )&scratch2_uint >> ( 9 - scratch_uint ) ;
+        op_result = mem[ rm_addr ] += ( regs8[ FLAG_CF ] << ( scratch_uint - 1 ) ) + op_source ;
+
+        set_OF( ( ( 1 & op_result ) >> 7 ) ^ set_CF( scratch2_uint & 1 << ( 8 - scratch_uint ) ) ) ;
       }
       break ;
 
-    // XCHG AX, regs16
-    case 0x10 :
-      i_w = 1 ;
-      op_to_addr = REGS_BASE ;
-      op_from_addr = ( REGS_BASE + ( 2 * i_reg4bit ) ) ;
-
-    // NOP|XCHG reg, r/m
-    case 0x18 :
-      if( op_to_addr != op_from_addr )
+    // RCR
+    case 0x03 :
+      if( i_w )
       {
         // Execute arithmetic/logic operations.
-        if( i_w )
-        {
-          op_source = *( uint16_t * )&mem[ op_from_addr ]  ;
-          op_result = *( uint16_t * )&mem[ op_to_addr ] ^= op_source ;
-
-          op_source = *( uint16_t * )&mem[ op_to_addr   ]  ;
-          op_result = *( uint16_t * )&mem[ op_from_addr ] ^= op_source ;
-
-          op_dest   = *( uint16_t * )&mem[ op_to_addr ] ;
-          op_source = *( uint16_t * )&mem[ op_from_addr ]  ;
-          op_result = *( uint16_t * )&mem[ op_to_addr ] ^= op_source ;
-        }
-        else
-        {
-          op_source = *( uint8_t * )&mem[ op_from_addr ] ;
-          op_result = mem[ op_to_addr ] ^= op_source ;
+        op_dest   = *( uint16_t * )&mem[ rm_addr ] ;
+        op_source = *( uint16_t * )&scratch2_uint << ( 17 - scratch_uint )  ;
+        op_result = *( uint16_t * )&mem[ rm_addr ] += ( regs8[ FLAG_CF ] << ( 16 - scratch_uint ) ) + op_source ;
 
-          op_dest   = mem[ op_from_addr ] ;
-          op_source = *( uint8_t * )&mem[ op_to_addr   ] ;
-          op_result = mem[ op_from_addr ] ^= op_source ;
+        set_CF( scratch2_uint & 1 << ( scratch_uint - 1 ) ) ;
+        set_OF( ( 1 & *( int16_t * )&( op_result ) >> 15 ) ^ ( 1 & *( int16_t * )&op_result * 2 >> 15 ) ) ;
+      }
+      else
+      {
+        // Execute arithmetic/logic operations.
+        op_dest   = mem[ rm_addr ] ;
+        op_source = *( uint8_t * )&scratch2_uint << ( 9 - scratch_uint ) ;
+        op_result = mem[ rm_addr ] += ( regs8[ FLAG_CF ] << ( 8 - scratch_uint ) ) + op_source ;
 
-          op_source = *( uint8_t * )&mem[ op_from_addr ] ;
-          op_result = mem[ op_to_addr ] ^= op_source ;
-        }
+        set_CF( scratch2_uint & 1 << ( scratch_uint - 1 ) ) ;
+        set_OF( ( 1 & op_result >> 7 ) ^ ( 1 & ( op_result * 2 ) >> 7 ) ) ;
       }
       break ;
 
-    // MOVSx (extra=0)|STOSx (extra=1)|LODSx (extra=2)
-    case 0x11 :
-      scratch2_uint = ( seg_override_en ) ? ( seg_override     ) : ( REG_DS ) ;
-      scratch_uint  = ( rep_override_en ) ? ( regs16[ REG_CX ] ) : ( 1      ) ;
-
-      while( scratch_uint )
+    // SHL
+    case 0x04 :
+      if( i_w )
       {
-        uint32_t addrDst ;
-        uint32_t addrSrc ;
-
-        // Convert segment:offset to linear address.
-        addrSrc  = 16 ;
-        addrSrc *= regs16[ scratch2_uint ] ;
-        addrSrc += ( uint16_t ) regs16[ REG_SI ] ;
+        set_OF( ( 1 & *( int16_t * )&( op_result ) >> 15 ) ^ set_CF( ( 1 & *( int16_t * )&op_dest << ( scratch_uint - 1 ) ) >> 15 ) ) ;
+      }
+      else
+      {
+        set_OF( ( 1 & op_result >> 7 ) ^ set_CF( ( 1 & ( op_dest << ( scratch_uint - 1 ) ) >> 7 ) ) ) ;
+      }
+      break ;
 
-        addrDst  = 16 ;
-        addrDst *= regs16[ REG_ES ] ;
-        addrDst += ( uint16_t ) regs16[ REG_DI ] ;
+    // SHR
+    case 0x05 :
+      if( i_w )
+      {
+        set_OF( 1 & *( int16_t * )&( op_dest ) >> 15 ) ;
+      }
+      else
+      {
+        set_OF( ( 1 & ( op_dest ) >> 7 ) ) ;
+      }
+      break ;
 
-        // MOV
-        if( i_w )
-        {
-          uint16_t aux ;
+    // SAR
+    case 0x07 :
+      if( !( scratch_uint < ( uint32_t ) ( 8 * ( i_w + 1 ) ) ) )
+      {
+        set_CF( scratch2_uint ) ;
+      }
+      set_OF( 0 ) ;
 
-          op_dest = *( uint16_t * )&( mem[ ( stOpcode.extra < 2 ) ? addrDst : REGS_BASE ] ) ;
+      // Execute arithmetic/logic operations.
+      if( i_w )
+      {
+        op_dest   = *( uint16_t * )&mem[ rm_addr ] ;
+        op_source = *( uint16_t * )&scratch2_uint *= ~( ( ( 1 << 16 ) - 1 ) >> scratch_uint )  ;
+        op_result = *( uint16_t * )&mem[ rm_addr ] += op_source ;
+      }
+      else
+      {
+        op_dest   = mem[ rm_addr ] ;
+        op_source = *( uint8_t * )&scratch2_uint *= ~( ( ( 1 << 8 ) - 1 ) >> scratch_uint ) ;
+        op_result = mem[ rm_addr ] += op_source ;
+      }
+      break ;
+    }
+    break ;
 
-          aux = *( uint16_t * )&( mem[ ( stOpcode.extra & 1 ) ? REGS_BASE : addrSrc ] ) ;
-          op_source = aux ;
-          op_result = aux ;
-          *( uint16_t * )&( mem[ ( stOpcode.extra < 2 ) ? addrDst : REGS_BASE ] ) = aux ;
-        }
-        else
-        {
-          uint8_t aux ;
+  // LOOPxx|JCZX
+  case 0x0D :
+    regs16[ REG_CX ]-- ;
+    scratch_uint = ( regs16[ REG_CX ] ) ? ( XTRUE ) : ( XFALSE ) ;
 
-          op_dest = ( mem[ ( stOpcode.extra < 2 ) ? addrDst : REGS_BASE ] ) ;
+    switch( i_reg4bit )
+    {
+    // LOOPNZ
+    case 0x00 :
+      scratch_uint &= !regs8[ FLAG_ZF ] ;
+      break ;
 
-          aux = *( uint8_t * )&( mem[ ( stOpcode.extra & 1 ) ? REGS_BASE : addrSrc ] ) ;
-          op_source = aux ;
-          op_result = aux ;
-          mem[ ( stOpcode.extra < 2 ) ? addrDst : REGS_BASE ] = aux ;
-        }
+    // LOOPZ
+    case 0x01 :
+      scratch_uint &= regs8[ FLAG_ZF ] ;
+      break ;
 
-        if( ( stOpcode.extra & 0x01 ) == 0x00 )
-        {
-          regs16[ REG_SI ] -= ( 2 * regs8[ FLAG_DF ] - 1 ) * ( i_w + 1 ) ;
-        }
+    // JCXXZ
+    case 0x03 :
+      scratch_uint = !++regs16[ REG_CX ] ;
+      break ;
+    }
 
-        if( ( stOpcode.extra & 0x02 ) == 0x00 )
-        {
-          regs16[ REG_DI ] -= ( 2 * regs8[ FLAG_DF ] - 1 ) * ( i_w + 1 ) ;
-        }
+    reg_ip += scratch_uint * ( ( int8_t ) i_data0 ) ;
+    break ;
 
-        scratch_uint-- ;
+  // JMP | CALL short/near
+  case 0x0E :
+    reg_ip += 3 - i_d ;
+    if( !i_w )
+    {
+      if( i_d ) // JMP far
+      {
+        reg_ip = 0 ;
+        regs16[ REG_CS ] = i_data2 ;
       }
-
-      if( rep_override_en )
+      else // CALL
       {
-        regs16[ REG_CX ] = 0 ;
+        // PUSH reg_ip.
+        i_w = 1 ;
+        op_dest   = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] ;
+        op_source = *( uint16_t * )&reg_ip ;
+        op_result = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] = op_source ;
       }
-      break ;
+    }
 
-    // CMPSx (extra=0)|SCASx (extra=1)
-    case 0x12 :
-      scratch2_uint = ( seg_override_en ) ? ( seg_override     ) : ( REG_DS ) ;
-      scratch_uint  = ( rep_override_en ) ? ( regs16[ REG_CX ] ) : ( 1      ) ;
-      if( scratch_uint )
-      {
-        while( scratch_uint )
-        {
-          uint32_t addrSrc ;
-          uint32_t addrDst ;
+    reg_ip += ( i_d && i_w ) ? ( ( int8_t ) i_data0 ) : ( i_data0 ) ;
+    break ;
 
-          // Convert segment:offset to linear address.
-          addrSrc  = 16 ;
-          addrSrc *= regs16[ REG_ES ] ;
-          addrSrc += ( uint16_t ) regs16[ REG_DI ] ;
+  // TEST reg, r/m
+  case 0x0F :
+    // Execute arithmetic/logic operations.
+    if( i_w )
+    {
+      op_dest   = *( uint16_t * )&mem[ op_from_addr ] ;
+      op_source = *( uint16_t * )&mem[ op_to_addr ]  ;
+      op_result = *( uint16_t * )&mem[ op_from_addr ] & op_source ;
+    }
+    else
+    {
+      op_dest   = mem[ op_from_addr ] ;
+      op_source = *( uint8_t * )&mem[ op_to_addr ] ;
+      op_result = mem[ op_from_addr ] & op_source ;
+    }
+    break ;
 
-          addrDst  = 16 ;
-          addrDst *= regs16[ scratch2_uint ] ;
-          addrDst += ( uint16_t ) regs16[ REG_SI ] ;
+  // XCHG AX, regs16
+  case 0x10 :
+    i_w = 1 ;
+    op_to_addr = REGS_BASE ;
+    op_from_addr = ( REGS_BASE + ( 2 * i_reg4bit ) ) ;
+    // Fall through
 
-          // Execute arithmetic/logic operations.
-          if( i_w )
-          {
-            op_dest   = *( uint16_t * )&mem[ stOpcode.extra ? REGS_BASE : addrDst ] ;
-            op_source = *( uint16_t * )&mem[ addrSrc ]  ;
-            op_result = *( uint16_t * )&mem[ stOpcode.extra ? REGS_BASE : addrDst ] - op_source ;
-          }
-          else
-          {
-            op_dest   = mem[ stOpcode.extra ? REGS_BASE : addrDst ] ;
-            op_source = *( uint8_t * )&mem[ addrSrc ] ;
-            op_result = mem[ stOpcode.extra ? REGS_BASE : addrDst ] - op_source ;
-          }
-
-          if( !stOpcode.extra )
-          {
-            regs16[ REG_SI ] -= ( 2 * regs8[ FLAG_DF ] - 1 ) * ( i_w + 1 ) ;
-          }
+  // NOP|XCHG reg, r/m
+  case 0x18 :
+    if( op_to_addr != op_from_addr )
+    {
+      // Execute arithmetic/logic operations.
+      if( i_w )
+      {
+        op_source = *( uint16_t * )&mem[ op_from_addr ]  ;
+        op_result = *( uint16_t * )&mem[ op_to_addr ] ^= op_source ;
 
-          regs16[ REG_DI ] -= ( 2 * regs8[ FLAG_DF ] - 1 ) * ( i_w + 1 ) ;
+        op_source = *( uint16_t * )&mem[ op_to_addr   ]  ;
+        op_result = *( uint16_t * )&mem[ op_from_addr ] ^= op_source ;
 
-          if( rep_override_en )
-          {
-            regs16[ REG_CX ]-- ;
-            if( !( regs16[ REG_CX ] && ( !op_result == rep_mode ) ) )
-            {
-              scratch_uint = 0 ;
-            }
-          }
+        op_dest   = *( uint16_t * )&mem[ op_to_addr ] ;
+        op_source = *( uint16_t * )&mem[ op_from_addr ]  ;
+        op_result = *( uint16_t * )&mem[ op_to_addr ] ^= op_source ;
+      }
+      else
+      {
+        op_source = *( uint8_t * )&mem[ op_from_addr ] ;
+        op_result = mem[ op_to_addr ] ^= op_source ;
 
-          if( !rep_override_en )
-          {
-            scratch_uint-- ;
-          }
-        }
+        op_dest   = mem[ op_from_addr ] ;
+        op_source = *( uint8_t * )&mem[ op_to_addr   ] ;
+        op_result = mem[ op_from_addr ] ^= op_source ;
 
-        // Funge to set SZP/AO flags.
-        stOpcode.set_flags_type = ( FLAGS_UPDATE_SZP | FLAGS_UPDATE_AO_ARITH ) ;
-        set_CF( op_result > op_dest ) ;
+        op_source = *( uint8_t * )&mem[ op_from_addr ] ;
+        op_result = mem[ op_to_addr ] ^= op_source ;
       }
-      break ;
+    }
+    break ;
 
-    // RET|RETF|IRET
-    case 0x13 :
-      {
-        uint32_t addr ;
+  // MOVSx (extra=0)|STOSx (extra=1)|LODSx (extra=2)
+  case 0x11 :
+    scratch2_uint = ( seg_override_en ) ? ( seg_override     ) : ( REG_DS ) ;
+    scratch_uint  = ( rep_override_en ) ? ( regs16[ REG_CX ] ) : ( 1      ) ;
 
-        i_d = i_w ;
-        i_w = 1 ;
-        regs16[ REG_SP ] += 2 ;
+    while( scratch_uint )
+    {
+      uint32_t addrDst ;
+      uint32_t addrSrc ;
 
-        addr  = 16 ;
-        addr *= regs16[ REG_SS ] ;
-        addr += ( uint16_t ) ( regs16[ REG_SP ] - 2 ) ;
+      // Convert segment:offset to linear address.
+      addrSrc  = 16 ;
+      addrSrc *= regs16[ scratch2_uint ] ;
+      addrSrc += ( uint16_t ) regs16[ REG_SI ] ;
 
-        // Execute arithmetic/logic operations.
-        if( i_w )
-        {
-          op_dest   = *( uint16_t * )&reg_ip ;
-          op_source = *( uint16_t * )&mem[ addr ]  ;
-          op_result = op_source ;
-          *( uint16_t * )&reg_ip = op_source ;
-        }
-        else
-        {
-          op_dest   = reg_ip ;
-          op_source = *( uint8_t * )&mem[ addr ] ;
-          op_result = op_source ;
-          reg_ip = op_source ;
-        }
-      }
+      addrDst  = 16 ;
+      addrDst *= regs16[ REG_ES ] ;
+      addrDst += ( uint16_t ) regs16[ REG_DI ] ;
 
-      // IRET|RETF|RETF imm16
-      if( stOpcode.extra )
+      if( stOpcode.extra & 1 )
       {
-        i_w = 1 ;
-        regs16[ REG_SP ] += 2 ;
-
-        // Execute arithmetic/logic operations.
-        op_dest   = *( uint16_t * )&regs16[ REG_CS ] ;
-
-        op_source = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( regs16[ REG_SP ] - 2 ) ]  ;
-        op_result = op_source ;
-        *( uint16_t * )&regs16[ REG_CS ] = op_source ;
+        addrSrc = REGS_BASE ;
       }
 
-      if( stOpcode.extra & 0x02 )// IRET
+      if( stOpcode.extra >= 2 )
       {
-        uint32_t addr ;
-
-        i_w = 1 ;
-        regs16[ REG_SP ] += 2 ;
+        addrDst = REGS_BASE ;
+      }
 
-        op_dest = *( uint16_t * )&scratch_uint ;
+      // MOV
+      op_dest   = ( i_w ) ? *( uint16_t * )&mem[ addrDst ] : mem[ addrDst ] ;
+      op_source = read_operand( addrSrc ) ;
+      op_result = op_source ;
+      write_operand( addrDst , op_source ) ;
 
-        addr  = 16 ;
-        addr *= regs16[ REG_SS ] ;
-        addr += ( uint16_t ) ( regs16[ REG_SP ] - 2 ) ;
+      if( ( stOpcode.extra & 0x01 ) == 0x00 )
+      {
+        regs16[ REG_SI ] -= ( 2 * regs8[ FLAG_DF ] - 1 ) * ( i_w + 1 ) ;
+      }
 
-        op_source = *( uint16_t * )&mem[ addr ] ;
-        op_result = *( uint16_t * )&scratch_uint = op_source ;
-        set_flags( op_result ) ;
+      if( ( stOpcode.extra & 0x02 ) == 0x00 )
+      {
+        regs16[ REG_DI ] -= ( 2 * regs8[ FLAG_DF ] - 1 ) * ( i_w + 1 ) ;
       }
-      else if( !i_d ) // RET|RETF imm16
+
+      scratch_uint-- ;
+      if( ( rep_mode & 0x02 ) && ( regs8[ FLAG_CF ] != ( rep_mode & 0x01 ) ) )
       {
-        regs16[ REG_SP ] += i_data0 ;
+        break ;
       }
-      break ;
+    }
 
-    // MOV r/m, immed
-    case 0x14 :
-      regs16[ REG_TMP ] = i_data2 ;
+    if( rep_override_en )
+    {
+      regs16[ REG_CX ] = scratch_uint ;
+    }
+    break ;
 
-      // MOV
-      if( i_w )
+  // CMPSx (extra=0)|SCASx (extra=1)
+  case 0x12 :
+    scratch2_uint = ( seg_override_en ) ? ( seg_override     ) : ( REG_DS ) ;
+    scratch_uint  = ( rep_override_en ) ? ( regs16[ REG_CX ] ) : ( 1      ) ;
+    if( scratch_uint )
+    {
+      while( scratch_uint )
       {
-        uint16_t aux ;
-        op_dest = *( uint16_t * )&mem[ op_from_addr ] ;
+        uint32_t addrSrc ;
+        uint32_t addrDst ;
 
-        aux = *( uint16_t * )&mem[ REGS_BASE + REG_TMP * 2 ] ;
+        // Convert segment:offset to linear address.
+        addrSrc  = 16 ;
+        addrSrc *= regs16[ REG_ES ] ;
+        addrSrc += ( uint16_t ) regs16[ REG_DI ] ;
 
-        op_source = aux ;
-        op_result = aux ;
-        *( uint16_t * )&mem[ op_from_addr ] = aux ;
-      }
-      else
-      {
-        uint8_t aux ;
+        addrDst  = 16 ;
+        addrDst *= regs16[ scratch2_uint ] ;
+        addrDst += ( uint16_t ) regs16[ REG_SI ] ;
 
-        op_dest = mem[ op_from_addr ] ;
+        // Execute arithmetic/logic operations.
+        op_dest   = read_operand( stOpcode.extra ? REGS_BASE : addrDst ) ;
+        op_source = read_operand( addrSrc ) ;
+        op_result = op_dest - op_source ;
 
-        aux = *( uint8_t * )&mem[ REGS_BASE + REG_TMP * 2 ] ;
+        if( !stOpcode.extra )
+        {
+          regs16[ REG_SI ] -= ( 2 * regs8[ FLAG_DF ] - 1 ) * ( i_w + 1 ) ;
+        }
 
-        op_source = aux ;
-        op_result = aux ;
-        mem[ op_from_addr ] = aux ;
+        regs16[ REG_DI ] -= ( 2 * regs8[ FLAG_DF ] - 1 ) * ( i_w + 1 ) ;
+
+        if( rep_override_en )
+        {
+          regs16[ REG_CX ]-- ;
+          if( rep_mode & 0x02 )
+          {
+            // REPNC/REPC test the borrow of this comparison.
+            if( !( regs16[ REG_CX ] && ( ( ( uint32_t ) op_result > op_dest ) == ( rep_mode & 0x01 ) ) ) )
+            {
+              scratch_uint = 0 ;
+            }
+          }
+          else if( !( regs16[ REG_CX ] && ( ( !op_result ) == rep_mode ) ) )
+          {
+            scratch_uint = 0 ;
+          }
+        }
+
+        if( !rep_override_en )
+        {
+          scratch_uint-- ;
+        }
       }
-      break ;
 
-    // IN AL/AX, DX/imm8
-    case 0x15 :
-      scratch_uint = ( stOpcode.extra ) ? ( regs16[ REG_DX ] ) : ( ( uint8_t ) i_data0 ) ;
-      io_ports[ scratch_uint ] = Interface.ReadPort( scratch_uint ) ;
+      // Funge to set SZP/AO flags.
+      stOpcode.set_flags_type = ( FLAGS_UPDATE_SZP | FLAGS_UPDATE_AO_ARITH ) ;
+      set_CF( ( uint32_t ) op_result > op_dest ) ;
+    }
+    break ;
+
+  // RET|RETF|IRET
+  case 0x13 :
+    {
+      uint32_t addr ;
 
+      i_d = i_w ;
+      i_w = 1 ;
+      regs16[ REG_SP ] += 2 ;
+
+      addr  = 16 ;
+      addr *= regs16[ REG_SS ] ;
+      addr += ( uint16_t ) ( regs16[ REG_SP ] - 2 ) ;
+
+      // Execute arithmetic/logic operations.
       if( i_w )
       {
-        io_ports[ scratch_uint + 1 ] = Interface.ReadPort( scratch_uint + 1 ) ;
-
-        // Execute arithmetic/logic operations.
-        op_dest   = *( uint16_t * )&regs8[ REG_AL ] ;
-        op_source = *( uint16_t * )&io_ports[ scratch_uint ]  ;
+        op_dest   = *( uint16_t * )&reg_ip ;
+        op_source = *( uint16_t * )&mem[ addr ]  ;
         op_result = op_source ;
-        *( uint16_t * )&regs8[ REG_AL ] = op_source ;
+        *( uint16_t * )&reg_ip = op_source ;
       }
       else
       {
-        // Execute arithmetic/logic operations.
-        op_dest   = regs8[ REG_AL ] ;
-        op_source = *( uint8_t * )&io_ports[ scratch_uint ] ;
+        op_dest   = reg_ip ;
+        op_source = *( uint8_t * )&mem[ addr ] ;
         op_result = op_source ;
-        regs8[ REG_AL ] = op_source ;
+        reg_ip = op_source ;
       }
-      break ;
+    }
 
-    // OUT DX/imm8, AL/AX
-    case 0x16 :
-      scratch_uint = ( stOpcode.extra ) ? ( regs16[ REG_DX ] ) : ( ( uint8_t ) i_data0 ) ;
+    // IRET|RETF|RETF imm16
+    if( stOpcode.extra )
+    {
+      i_w = 1 ;
+      regs16[ REG_SP ] += 2 ;
 
       // Execute arithmetic/logic operations.
-      if( i_w )
-      {
-        op_dest   = *( uint16_t * )&io_ports[ scratch_uint ] ;
+      op_dest   = *( uint16_t * )&regs16[ REG_CS ] ;
 
-        op_source = *( uint16_t * )&regs8[ REG_AL ]  ;
-        op_result = op_source ;
-        *( uint16_t * )&io_ports[ scratch_uint ] = op_source ;
+      op_source = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( regs16[ REG_SP ] - 2 ) ]  ;
+      op_result = op_source ;
+      *( uint16_t * )&regs16[ REG_CS ] = op_source ;
+    }
+
+    if( stOpcode.extra & 0x02 )// IRET
+    {
+      uint32_t addr ;
+
+      i_w = 1 ;
+      regs16[ REG_SP ] += 2 ;
+
+      op_dest = *( uint16_t * )&scratch_uint ;
+
+      addr  = 16 ;
+      addr *= regs16[ REG_SS ] ;
+      addr += ( uint16_t ) ( regs16[ REG_SP ] - 2 ) ;
+
+      op_source = *( uint16_t * )&mem[ addr ] ;
+      op_result = *( uint16_t * )&scratch_uint = op_source ;
+      set_flags( op_result ) ;
+    }
+    else if( !i_d ) // RET|RETF imm16
+    {
+      regs16[ REG_SP ] += i_data0 ;
+    }
+    break ;
+
+  // MOV r/m, immed
+  case 0x14 :
+    regs16[ REG_TMP ] = i_data2 ;
+
+    // MOV
+    if( i_w )
+    {
+      uint16_t aux ;
+      op_dest = *( uint16_t * )&mem[ op_from_addr ] ;
 
-        Interface.WritePort( scratch_uint , io_ports[ scratch_uint ] ) ;
-        Interface.WritePort( scratch_uint + 1 , io_ports[ scratch_uint + 1 ] ) ;
+      aux = *( uint16_t * )&mem[ REGS_BASE + REG_TMP * 2 ] ;
+
+      op_source = aux ;
+      op_result = aux ;
+      *( uint16_t * )&mem[ op_from_addr ] = aux ;
+    }
+    else
+    {
+      uint8_t aux ;
+
+      op_dest = mem[ op_from_addr ] ;
+
+      aux = *( uint8_t * )&mem[ REGS_BASE + REG_TMP * 2 ] ;
+
+      op_source = aux ;
+      op_result = aux ;
+      mem[ op_from_addr ] = aux ;
+    }
+    break ;
+
+  // IN AL/AX, DX/imm8
+  case 0x15 :
+    scratch_uint = ( stOpcode.extra ) ? ( regs16[ REG_DX ] ) : ( ( uint8_t ) i_data0 ) ;
+    io_ports[ scratch_uint ] = port_read( scratch_uint ) ;
+
+    if( i_w )
+    {
+      io_ports[ scratch_uint + 1 ] = port_read( scratch_uint + 1 ) ;
+
+      // Execute arithmetic/logic operations.
+      op_dest   = *( uint16_t * )&regs8[ REG_AL ] ;
+      op_source = *( uint16_t * )&io_ports[ scratch_uint ]  ;
+      op_result = op_source ;
+      *( uint16_t * )&regs8[ REG_AL ] = op_source ;
+    }
+    else
+    {
+      // Execute arithmetic/logic operations.
+      op_dest   = regs8[ REG_AL ] ;
+      op_source = *( uint8_t * )&io_ports[ scratch_uint ] ;
+      op_result = op_source ;
+      regs8[ REG_AL ] = op_source ;
+    }
+    break ;
+
+  // OUT DX/imm8, AL/AX
+  case 0x16 :
+    scratch_uint = ( stOpcode.extra ) ? ( regs16[ REG_DX ] ) : ( ( uint8_t ) i_data0 ) ;
+
+    // Execute arithmetic/logic operations.
+    if( i_w )
+    {
+      op_dest   = *( uint16_t * )&io_ports[ scratch_uint ] ;
+
+      op_source = *( uint16_t * )&regs8[ REG_AL ]  ;
+      op_result = op_source ;
+      *( uint16_t * )&io_ports[ scratch_uint ] = op_source ;
+
+      port_write( scratch_uint , io_ports[ scratch_uint ] ) ;
+      port_write( scratch_uint + 1 , io_ports[ scratch_uint + 1 ] ) ;
+    }
+    else
+    {
+      op_dest   = io_ports[ scratch_uint ] ;
+
+      op_source = *( uint8_t * )&regs8[ REG_AL ] ;
+      op_result = op_source ;
+      io_ports[ scratch_uint ] = op_source ;
+
+      port_write( scratch_uint , io_ports[ scratch_uint ] ) ;
+    }
+    break ;
+
+  // PUSH reg
+  case 0x19 :
+    // PUSH regs16[ stOpcode.extra ].
+    i_w = 1 ;
+    op_dest   = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] ;
+    op_source = *( uint16_t * )&regs16[ stOpcode.extra ] ;
+    op_result = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] = op_source ;
+    break ;
+
+  // POP reg
+  case 0x1A :
+    i_w = 1 ;
+    regs16[ REG_SP ] += 2 ;
+
+    // Execute arithmetic/logic operations.
+    op_dest   = *( uint16_t * )&regs16[ stOpcode.extra ] ;
+
+    op_source = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( regs16[ REG_SP ] - 2 ) ]  ;
+    op_result = op_source ;
+    *( uint16_t * )&regs16[ stOpcode.extra ] = op_source ;
+    break ;
+
+  // DAA/DAS
+  case 0x1C :
+    i_w = 0 ;
+    if( stOpcode.extra )
+    {
+      // extra = 1 for DAS.
+      DAA_DAS( -= , > ) ;
+    }
+    else
+    {
+      // extra = 0 for DAA.
+      DAA_DAS( += , < ) ;
+    }
+    break ;
+
+  // AAA/AAS
+  case 0x1D :
+    op_result = AAA_AAS( stOpcode.extra - 1 ) ;
+    break ;
+
+  // CBW
+  case 0x1E :
+    if( i_w )
+    {
+      regs8[ REG_AH ] = -( 1 & *( int16_t * )&( regs8[ REG_AL ] ) >> 15 ) ;
+    }
+    else
+    {
+      regs8[ REG_AH ] = -( 1 & regs8[ REG_AL ] >> 7 ) ;
+    }
+    break ;
+
+  // CWD
+  case 0x1F :
+    if( i_w )
+    {
+      regs16[ REG_DX ] = -( 1 & *( int16_t * )&( regs16[ REG_AX ] ) >> 15 ) ;
+    }
+    else
+    {
+      regs16[ REG_DX ] = -( 1 & regs16[ REG_AX ] >> 7 ) ;
+    }
+    break ;
+
+  // CALL FAR imm16:imm16
+  case 0x20 :
+    i_w = 1 ;
+
+    // PUSH regs16[ REG_CS ].
+    op_dest   = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] ;
+    op_source = *( uint16_t * )&regs16[ REG_CS ] ;
+    op_result = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] = op_source ;
+
+    // PUSH reg_ip + 5.
+    op_dest   = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] ;
+    op_source = *( uint16_t * )&reg_ip + 5 ;
+    op_result = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] = op_source ;
+
+    regs16[ REG_CS ] = i_data2 ;
+    reg_ip = i_data0 ;
+    break ;
+
+  // PUSHF
+  case 0x21 :
+    make_flags() ;
+
+    // PUSH scratch_uint.
+    i_w = 1 ;
+    op_dest   = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] ;
+    op_source = *( uint16_t * )&scratch_uint ;
+    op_result = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] = op_source ;
+    break ;
+
+  // POPF
+  case 0x22 :
+    i_w = 1 ;
+    regs16[ REG_SP ] += 2 ;
+    op_dest = *( uint16_t * )&scratch_uint ;
+
+    {
+      uint16_t aux ;
+      aux = regs16[ REG_SS ] ;
+      aux *= 16 ;
+      aux += ( uint16_t ) regs16[ REG_SP ] ;
+      aux -= 2 ;
+
+      op_source = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( regs16[ REG_SP ] - 2 ) ] ;
+    }
+
+    op_result = op_source ;
+    *( uint16_t * )&scratch_uint = op_source ;
+    set_flags( op_source ) ;
+    break ;
+
+  // SAHF
+  case 0x23 :
+    make_flags() ;
+    set_flags( (scratch_uint & 0xFF00 ) + regs8[ REG_AH ] ) ;
+    break ;
+
+  // LAHF
+  case 0x24 :
+    make_flags() ;
+    regs8[ REG_AH ] = scratch_uint ;
+    break ;
+
+  // LES|LDS reg, r/m
+  case 0x25 :
+    i_w = 1 ;
+    i_d = 1 ;
+
+    scratch2_uint = 4 * !i_mod ;
+    if( i_mod < 3 )
+    {
+      uint16_t localIndex ;
+      uint16_t localAddr  ;
+
+      if( seg_override_en )
+      {
+        localIndex = seg_override ;
       }
       else
       {
-        op_dest   = io_ports[ scratch_uint ] ;
+        localIndex = bios_table_lookup[ scratch2_uint + 3 ][ i_rm ] ;
+      }
 
-        op_source = *( uint8_t * )&regs8[ REG_AL ] ;
-        op_result = op_source ;
-        io_ports[ scratch_uint ] = op_source ;
+      localAddr  = ( uint16_t ) regs16[ bios_table_lookup[ scratch2_uint + 1 ][ i_rm ] ] ;
+      localAddr += ( uint16_t ) bios_table_lookup[ scratch2_uint + 2 ][ i_rm ] * i_data1 ;
+      localAddr += ( uint16_t ) regs16[ bios_table_lookup[ scratch2_uint ][ i_rm ] ] ;
 
-        Interface.WritePort( scratch_uint , io_ports[ scratch_uint ] ) ;
-      }
-      break ;
+      rm_addr  = 16 ;
+      rm_addr *= regs16[ localIndex ] ;
+      rm_addr += localAddr ;
+    }
+    else
+    {
+      rm_addr = ( REGS_BASE + ( 2 * i_rm ) ) ;
+    }
+    op_to_addr = rm_addr ;
+    op_from_addr = ( REGS_BASE + ( 2 * i_reg ) ) ;
+    if( i_d )
+    {
+      scratch_uint = op_from_addr ;
+      op_from_addr = rm_addr      ;
+      op_to_addr   = scratch_uint ;
+    }
 
-    // REPxx
-    case 0x17 :
-      rep_override_en = 2   ;
-      rep_mode        = i_w ;
+    // Execute arithmetic/logic operations.
+    op_source = *( uint16_t * )&mem[ op_from_addr ]  ;
+    op_result = op_source ;
+    *( uint16_t * )&mem[ op_to_addr ] = op_source ;
 
-      if( seg_override_en )
+    op_dest   = *( uint16_t * )&mem[ REGS_BASE + stOpcode.extra ] ;
+
+    op_source = *( uint16_t * )&mem[ rm_addr + 2 ]  ;
+    op_result = op_source ;
+    *( uint16_t * )&mem[ REGS_BASE + stOpcode.extra ] = op_source ;
+    break ;
+
+  // INT 3
+  case 0x26 :
+    reg_ip++ ;
+    pc_interrupt( 3 ) ;
+    break ;
+
+  // INT imm8
+  case 0x27 :
+    reg_ip += 2 ;
+    pc_interrupt( ( uint8_t ) i_data0 ) ;
+    break ;
+
+  // INTO
+  case 0x28 :
+    reg_ip++ ;
+    if( regs8[ FLAG_OF ] )
+    {
+      pc_interrupt( 4 ) ;
+    }
+    break ;
+
+  // AAM
+  case 0x29 :
+    if( Model == CPU_MODEL_V20 )
+    {
+      // The V20 ignores the immediate and always uses base 10.
+      i_data0 = 10 ;
+    }
+    i_data0 &= 0xFF ;
+    if( i_data0 )
+    {
+      regs8[ REG_AH ]  = regs8[ REG_AL ] / i_data0 ;
+      regs8[ REG_AL ] %= i_data0 ;
+      op_result = regs8[ REG_AL ] ;
+    }
+    else // Divide by zero
+    {
+      pc_interrupt( 0 ) ;
+    }
+    break ;
+
+  // AAD
+  case 0x2A :
+    if( Model == CPU_MODEL_V20 )
+    {
+      // The V20 ignores the immediate and always uses base 10.
+      i_data0 = 10 ;
+    }
+    i_w = 0 ;
+    op_result = 0xFF & ( regs8[ REG_AL ] + i_data0 * regs8[ REG_AH ] ) ;
+    regs16[ REG_AX ] = op_result ;
+    break ;
+
+  // SALC
+  case 0x2B :
+    regs8[ REG_AL ] = -regs8[ FLAG_CF ] ;
+    break ;
+
+  // XLAT
+  case 0x2C :
+    regs8[ REG_AL ] = mem[ 16 * regs16[seg_override_en ? seg_override : REG_DS] + (uint16_t)(regs8[ REG_AL ] + regs16[REG_BX]) ] ;
+    break ;
+
+  // CMC
+  case 0x2D :
+    regs8[ FLAG_CF ] ^= 1 ;
+    break ;
+
+  // CLC|STC|CLI|STI|CLD|STD
+  case 0x2E :
+    regs8[ stOpcode.extra / 2 ] = stOpcode.extra & 0x01 ;
+    break ;
+
+  // TEST AL/AX, immed
+  case 0x2F :
+    // Execute arithmetic/logic operations.
+    if( i_w )
+    {
+      op_dest   = *( uint16_t * )&regs8[ REG_AL ] ;
+      op_source = *( uint16_t * )&i_data0  ;
+      op_result = *( uint16_t * )&regs8[ REG_AL ] & op_source ;
+    }
+    else
+    {
+      op_dest   = regs8[ REG_AL ] ;
+      op_source = *( uint8_t * )&i_data0 ;
+      op_result = regs8[ REG_AL ] & op_source ;
+    }
+    break ;
+
+  // HLT
+  case 0x31 :
+    break ;
+
+  // Emulator-specific 0F xx opcodes
+  case 0x32 :
+    switch( ( int8_t ) i_data0 )
+    {
+    // PUTCHAR_AL.
+    case 0x00 :
+      if( LockstepPhase != LOCKSTEP_REPLAY )
       {
-        seg_override_en++ ;
+        putchar( regs8[ 0 ] ) ;
       }
       break ;
 
-    // PUSH reg
-    case 0x19 :
-      // PUSH regs16[ stOpcode.extra ].
-      i_w = 1 ;
-      op_dest   = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] ;
-      op_source = *( uint16_t * )&regs16[ stOpcode.extra ] ;
-      op_result = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] = op_source ;
-      break ;
+    // GET_RTC
+    case 0x01 :
+      {
+        time_t clock_buf ;
+        struct timeb ms_clock ;
+        struct tm rtc ;
+        int16_t millitm ;
+        uint32_t addr ;
 
-    // POP reg
-    case 0x1A :
-      i_w = 1 ;
-      regs16[ REG_SP ] += 2 ;
+        if( LockstepPhase != LOCKSTEP_REPLAY )
+        {
+          time( &clock_buf ) ;
+          ftime( &ms_clock ) ;
 
-      // Execute arithmetic/logic operations.
-      op_dest   = *( uint16_t * )&regs16[ stOpcode.extra ] ;
+          rtc     = *localtime( &clock_buf ) ;
+          millitm = ms_clock.millitm ;
+        }
+
+        // The clock is an input to record or replay, once per instruction
+        // rather than again when a lockstep block is replayed.
+        if( LockstepPhase != LOCKSTEP_REPLAY )
+        {
+          REPLAY_HostData( REPLAY_EVENT_RTC , &rtc , sizeof( struct tm ) ) ;
+          REPLAY_HostData( REPLAY_EVENT_RTC , &millitm , sizeof( millitm ) ) ;
+        }
+
+        if( LockstepPhase != LOCKSTEP_LIVE )
+        {
+          LOCKSTEP_HostData( &rtc , sizeof( struct tm ) ) ;
+          LOCKSTEP_HostData( &millitm , sizeof( millitm ) ) ;
+        }
+
+        // Convert segment:offset to linear address.
+        addr  = 16 ;
+        addr *= regs16[ REG_ES ] ;
+        addr += ( uint16_t ) regs16[ REG_BX ] ;
+
+        memcpy( &mem[ addr ] , &rtc , sizeof( struct tm ) ) ;
 
-      op_source = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( regs16[ REG_SP ] - 2 ) ]  ;
-      op_result = op_source ;
-      *( uint16_t * )&regs16[ stOpcode.extra ] = op_source ;
-      break ;
+        // Convert segment:offset to linear address.
+        addr  = 16 ;
+        addr *= regs16[ REG_ES ] ;
+        addr += ( uint16_t ) ( regs16[ REG_BX ] + 36 ) ;
 
-    // xS: segment overrides
-    case 0x1B :
-      seg_override_en = 2 ;
-      seg_override = stOpcode.extra ;
-      if( rep_override_en )
-      {
-        rep_override_en++ ;
+        *( int16_t * )&mem[ addr ] = millitm ;
       }
       break ;
 
-    // DAA/DAS
-    case 0x1C :
-      i_w = 0 ;
-      if( stOpcode.extra )
-      {
-        // extra = 1 for DAS.
-        DAA_DAS( -= , > ) ;
-      }
-      else
+    // DISK_READ
+    case 0x02 :
+    // DISK_WRITE
+    case 0x03 :
       {
-        // extra = 0 for DAA.
-        DAA_DAS( += , < ) ;
-      }
-      break ;
+        // Convert segment:offset to linear address.
+        uint32_t addr ;
 
-    // AAA/AAS
-    case 0x1D :
-      op_result = AAA_AAS( stOpcode.extra - 1 ) ;
-      break ;
+        addr  = 16 ;
+        addr *= regs16[ REG_ES ] ;
+        addr += ( uint16_t ) regs16[ REG_BX ] ;
 
-    // CBW
-    case 0x1E :
-      if( i_w )
-      {
-        regs8[ REG_AH ] = -( 1 & *( int16_t * )&( regs8[ REG_AL ] ) >> 15 ) ;
-      }
-      else
-      {
-        regs8[ REG_AH ] = -( 1 & regs8[ REG_AL ] >> 7 ) ;
+        regs8[ REG_AL ] = DiskTransfer( ( ( int8_t ) i_data0 ) == 3 , regs8[ REG_DL ] ,
+                                        *( uint32_t * )&regs16[ REG_BP ] << 9 , addr , regs16[ REG_AX ] ) ;
       }
       break ;
 
-    // CWD
-    case 0x1F :
-      if( i_w )
-      {
-        regs16[ REG_DX ] = -( 1 & *( int16_t * )&( regs16[ REG_AX ] ) >> 15 ) ;
-      }
-      else
-      {
-        regs16[ REG_DX ] = -( 1 & regs16[ REG_AX ] >> 7 ) ;
-      }
+    // EMS_INT67
+    case 0x04 :
+      EMS_Interrupt() ;
       break ;
 
-    // CALL FAR imm16:imm16
-    case 0x20 :
-      i_w = 1 ;
+    // REDIR_MOUNT
+    case 0x05 :
+      REDIR_Mount() ;
+      break ;
+    }
+    break ;
 
-      // PUSH regs16[ REG_CS ].
-      op_dest   = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] ;
-      op_source = *( uint16_t * )&regs16[ REG_CS ] ;
-      op_result = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] = op_source ;
+  // 80186, NEC V20: ENTER
+  case 0x33 :
+    // PUSH regs16[ REG_BP ].
+    i_w = 1 ;
+    op_dest   = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] ;
+    op_source = *( uint16_t * )&regs16[ REG_BP ] ;
+    op_result = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] = op_source ;
 
-      // PUSH reg_ip + 5.
-      op_dest   = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] ;
-      op_source = *( uint16_t * )&reg_ip + 5 ;
-      op_result = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] = op_source ;
+    // The new frame pointer.
+    scratch_uint = regs16[ REG_SP ] ;
 
-      regs16[ REG_CS ] = i_data2 ;
-      reg_ip = i_data0 ;
-      break ;
+    // The nesting level is taken modulo 32.
+    scratch2_uint = i_data2 & 0x1F ;
+
+    if( scratch2_uint > 0 )
+    {
+      // Copy the frame pointers of the enclosing levels from the old frame.
+      while( --scratch2_uint )
+      {
+        regs16[ REG_BP ] -= 2 ;
 
-    // PUSHF
-    case 0x21 :
-      make_flags() ;
+        // PUSH word [ SS:BP ].
+        op_dest   = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] ;
+        op_source = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + regs16[ REG_BP ] ] ;
+        op_result = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] = op_source ;
+      }
 
       // PUSH scratch_uint.
-      i_w = 1 ;
       op_dest   = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] ;
       op_source = *( uint16_t * )&scratch_uint ;
       op_result = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] = op_source ;
-      break ;
+    }
 
-    // POPF
-    case 0x22 :
-      i_w = 1 ;
-      regs16[ REG_SP ] += 2 ;
-      op_dest = *( uint16_t * )&scratch_uint ;
+    regs16[ REG_BP ]  = scratch_uint ;
+    regs16[ REG_SP ] -= i_data0      ;
+    break ;
 
-      {
-        uint16_t aux ;
-        aux = regs16[ REG_SS ] ;
-        aux *= 16 ;
-        aux += ( uint16_t ) regs16[ REG_SP ] ;
-        aux -= 2 ;
+  // 80186, NEC V20: LEAVE
+  case 0x34 :
+    regs16[ REG_SP ] = regs16[ REG_BP ] ;
 
-        op_source = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( regs16[ REG_SP ] - 2 ) ] ;
-      }
+    i_w = 1 ;
+    regs16[ REG_SP ] += 2 ;
+
+    // Execute arithmetic/logic operations.
+    {
+      uint32_t addr ;
+
+      op_dest   = *( uint16_t * )&regs16[ REG_BP ] ;
+
+      addr  = 16 ;
+      addr *= regs16[ REG_SS ] ;
+      addr += ( uint16_t ) ( regs16[ REG_SP ] - 2 ) ;
 
+      op_source = *( uint16_t * )&mem[ addr ]  ;
       op_result = op_source ;
-      *( uint16_t * )&scratch_uint = op_source ;
-      set_flags( op_source ) ;
-      break ;
+      *( uint16_t * )&regs16[ REG_BP ] = op_source ;
+    }
+    break ;
 
-    // SAHF
-    case 0x23 :
-      make_flags() ;
-      set_flags( (scratch_uint & 0xFF00 ) + regs8[ REG_AH ] ) ;
-      break ;
+  // 80186, NEC V20: PUSHA
+  case 0x35 :
+    // PUSH AX, PUSH CX, PUSH DX, PUSH BX, PUSH SP, PUSH BP, PUSH SI, PUSH DI
+    i_w = 1 ;
 
-    // LAHF
-    case 0x24 :
-      make_flags() ;
-      regs8[ REG_AH ] = scratch_uint ;
-      break ;
+    // PUSH regs16[ REG_AX ].
+    op_dest   = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] ;
+    op_source = *( uint16_t * )&regs16[ REG_AX ] ;
+    op_result = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] = op_source ;
+
+    // PUSH regs16[ REG_CX ].
+    op_dest   = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] ;
+    op_source = *( uint16_t * )&regs16[ REG_CX ] ;
+    op_result = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] = op_source ;
+
+    // PUSH regs16[ REG_DX ].
+    op_dest   = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] ;
+    op_source = *( uint16_t * )&regs16[ REG_DX ] ;
+    op_result = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] = op_source ;
+
+    // PUSH regs16[ REG_BX ].
+    op_dest   = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] ;
+    op_source = *( uint16_t * )&regs16[ REG_BX ] ;
+    op_result = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] = op_source ;
+
+    scratch_uint = regs16[ REG_SP ] ;
+    // PUSH scratch_uint.
+    op_dest   = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] ;
+    op_source = *( uint16_t * )&scratch_uint ;
+    op_result = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] = op_source ;
+
+    // PUSH regs16[ REG_BP ].
+    op_dest   = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] ;
+    op_source = *( uint16_t * )&regs16[ REG_BP ] ;
+    op_result = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] = op_source ;
+
+    // PUSH regs16[ REG_SI ].
+    op_dest   = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] ;
+    op_source = *( uint16_t * )&regs16[ REG_SI ] ;
+    op_result = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] = op_source ;
+
+    // PUSH regs16[ REG_DI ].
+    op_dest   = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] ;
+    op_source = *( uint16_t * )&regs16[ REG_DI ] ;
+    op_result = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] = op_source ;
+    break ;
 
-    // LES|LDS reg, r/m
-    case 0x25 :
-      i_w = 1 ;
-      i_d = 1 ;
+  // 80186, NEC V20: POPA
+  case 0x36 :
+    // POP DI, POP SI, POP BP, ADD SP,2, POP BX, POP DX, POP CX, POP AX
+    i_w = 1 ;
 
-      scratch2_uint = 4 * !i_mod ;
-      if( i_mod < 3 )
-      {
-        uint16_t localIndex ;
-        uint16_t localAddr  ;
+    // POP regs16[ REG_DI ].
+    regs16[ REG_SP ] += 2 ;
+    op_dest   = *( uint16_t * )&regs16[ REG_DI ] ;
+    op_source = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( -2+ regs16[ REG_SP ] ) ] ;
+    op_result = *( uint16_t * )&regs16[ REG_DI ] = op_source ;
 
-        if( seg_override_en )
-        {
-          localIndex = seg_override ;
-        }
-        else
-        {
-          localIndex = bios_table_lookup[ scratch2_uint + 3 ][ i_rm ] ;
-        }
+    // POP regs16[ REG_SI ].
+    regs16[ REG_SP ] += 2 ;
+    op_dest   = *( uint16_t * )&regs16[ REG_SI ] ;
+    op_source = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( -2+ regs16[ REG_SP ] ) ] ;
+    op_result = *( uint16_t * )&regs16[ REG_SI ] = op_source ;
 
-        localAddr  = ( uint16_t ) regs16[ bios_table_lookup[ scratch2_uint + 1 ][ i_rm ] ] ;
-        localAddr += ( uint16_t ) bios_table_lookup[ scratch2_uint + 2 ][ i_rm ] * i_data1 ;
-        localAddr += ( uint16_t ) regs16[ bios_table_lookup[ scratch2_uint ][ i_rm ] ] ;
+    // POP regs16[ REG_BP ].
+    regs16[ REG_SP ] += 2 ;
+    op_dest   = *( uint16_t * )&regs16[ REG_BP ] ;
+    op_source = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( -2+ regs16[ REG_SP ] ) ] ;
+    op_result = *( uint16_t * )&regs16[ REG_BP ] = op_source ;
 
-        rm_addr  = 16 ;
-        rm_addr *= regs16[ localIndex ] ;
-        rm_addr += localAddr ;
-      }
-      else
-      {
-        rm_addr = ( REGS_BASE + ( 2 * i_rm ) ) ;
-      }
-      op_to_addr = rm_addr ;
-      op_from_addr = ( REGS_BASE + ( 2 * i_reg ) ) ;
-      if( i_d )
+    regs16[ REG_SP ] += 2 ;
+
+    // POP regs16[ REG_BX ].
+    regs16[ REG_SP ] += 2 ;
+    op_dest   = *( uint16_t * )&regs16[ REG_BX ] ;
+    op_source = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( -2+ regs16[ REG_SP ] ) ] ;
+    op_result = *( uint16_t * )&regs16[ REG_BX ] = op_source ;
+
+    // POP regs16[ REG_DX ].
+    regs16[ REG_SP ] += 2 ;
+    op_dest   = *( uint16_t * )&regs16[ REG_DX ] ;
+    op_source = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( -2+ regs16[ REG_SP ] ) ] ;
+    op_result = *( uint16_t * )&regs16[ REG_DX ] = op_source ;
+
+    // POP regs16[ REG_CX ].
+    regs16[ REG_SP ] += 2 ;
+    op_dest   = *( uint16_t * )&regs16[ REG_CX ] ;
+    op_source = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( -2+ regs16[ REG_SP ] ) ] ;
+    op_result = *( uint16_t * )&regs16[ REG_CX ] = op_source ;
+
+    // POP regs16[ REG_AX ].
+    regs16[ REG_SP ] += 2 ;
+    op_dest   = *( uint16_t * )&regs16[ REG_AX ] ;
+    op_source = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( -2+ regs16[ REG_SP ] ) ] ;
+    op_result = *( uint16_t * )&regs16[ REG_AX ] = op_source ;
+    break ;
+
+  // 80186, NEC V20: BOUND
+  case 0x37 :
+    if( i_mod == 3 )
+    {
+      // The bounds must be in memory.
+      if( Model == CPU_MODEL_80186 )
       {
-        scratch_uint = op_from_addr ;
-        op_from_addr = rm_addr      ;
-        op_to_addr   = scratch_uint ;
+        pc_interrupt( 6 ) ;
       }
+    }
+    else if( ( *( int16_t * )&regs16[ i_reg ] < *( int16_t * )&mem[ rm_addr ] ) ||
+             ( *( int16_t * )&regs16[ i_reg ] > *( int16_t * )&mem[ rm_addr + 2 ] ) )
+    {
+      // Out of range: INT 5 returns to the BOUND instruction.
+      pc_interrupt( 5 ) ;
+    }
+    break ;
 
-      // Execute arithmetic/logic operations.
-      op_source = *( uint16_t * )&mem[ op_from_addr ]  ;
-      op_result = op_source ;
-      *( uint16_t * )&mem[ op_to_addr ] = op_source ;
+  // 80186, NEC V20: PUSH imm16
+  case 0x38 :
+    // PUSH i_data0.
+    i_w = 1 ;
+    op_dest   = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] ;
+    op_source = *( uint16_t * )&i_data0 ;
+    op_result = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] = op_source ;
+    break ;
 
-      op_dest   = *( uint16_t * )&mem[ REGS_BASE + stOpcode.extra ] ;
+  // 80186, NEC V20: PUSH imm8
+  case 0x39 :
+    // PUSH ( i_data0 & 0x00FF )
+    i_w = 1 ;
+    op_dest   = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] ;
+    op_source = *( uint16_t * )&i_data0 & 0x00FF ;
+    op_result = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] = op_source ;
+    break ;
 
-      op_source = *( uint16_t * )&mem[ rm_addr + 2 ]  ;
-      op_result = op_source ;
-      *( uint16_t * )&mem[ REGS_BASE + stOpcode.extra ] = op_source ;
-      break ;
+  // 80186, NEC V20: IMUL reg, reg/mem, imm
+  case 0x3A :
+    // 69 has a 16-bit immediate, 6B a sign extended 8-bit immediate.
+    // The immediate follows any displacement.
+    scratch_int = ( i_d ) ? ( ( int8_t ) i_data2 ) : ( ( int16_t ) i_data2 ) ;
+    scratch_int *= *( int16_t * )&mem[ rm_addr ] ;
 
-    // INT 3
-    case 0x26 :
-      reg_ip++ ;
-      pc_interrupt( 3 ) ;
-      break ;
+    op_result = regs16[ i_reg ] = scratch_int ;
 
-    // INT imm8
-    case 0x27 :
-      reg_ip += 2 ;
-      pc_interrupt( ( uint8_t ) i_data0 ) ;
-      break ;
+    // CF and OF are set if the result does not fit in 16 bits.
+    set_OF( set_CF( scratch_int != ( int16_t ) scratch_int ) ) ;
+    break ;
+
+  // 80186: INSB INSW
+  case 0x3B :
+    // Loads data from port to the destination ES:DI.
+    // DI is adjusted by the size of the operand and increased if the
+    // Direction Flag is cleared and decreased if the Direction Flag is set.
+    scratch2_uint = regs16[ REG_DX ] ;
+
+    scratch_uint = ( rep_override_en ) ? ( regs16[REG_CX] ) : ( 1 ) ;
+    while( scratch_uint )
+    {
+      uint32_t addr ;
 
-    // INTO
-    case 0x28 :
-      reg_ip++ ;
-      if( regs8[ FLAG_OF ] )
+      io_ports[ scratch2_uint ] = port_read( scratch2_uint ) ;
+      if( i_w )
       {
-        pc_interrupt( 4 ) ;
+        io_ports[ scratch2_uint + 1 ] = port_read( scratch2_uint + 1 ) ;
       }
-      break ;
 
-    // AAM
-    case 0x29 :
-      i_data0 &= 0xFF ;
-      if( i_data0 )
+      // Convert segment:offset to linear address.
+      addr  = 16 ;
+      addr *= regs16[ REG_ES ] ;
+      addr += ( uint16_t ) regs16[ REG_DI ] ;
+
+      // Execute arithmetic/logic operations.
+      if( i_w )
       {
-        regs8[ REG_AH ]  = regs8[ REG_AL ] / i_data0 ;
-        regs8[ REG_AL ] %= i_data0 ;
-        op_result = regs8[ REG_AL ] ;
+        op_dest   = *( uint16_t * )&mem[ addr ] ;
+        op_source = *( uint16_t * )&io_ports[ scratch2_uint ]  ;
       }
-      else // Divide by zero
+      else
       {
-        pc_interrupt( 0 ) ;
+        op_dest   = mem[ addr ] ;
+        op_source = *( uint8_t * )&io_ports[ scratch2_uint ] ;
       }
-      break ;
-
-    // AAD
-    case 0x2A :
-      i_w = 0 ;
-      op_result = 0xFF & ( regs8[ REG_AL ] + i_data0 * regs8[ REG_AH ] ) ;
-      regs16[ REG_AX ] = op_result ;
-      break ;
+      op_result = op_source ;
+      write_operand( addr , op_source ) ;
 
-    // SALC
-    case 0x2B :
-      regs8[ REG_AL ] = -regs8[ FLAG_CF ] ;
-      break ;
+      regs16[ REG_DI ] -= ( 2 * regs8[ FLAG_DF ] - 1 ) * ( i_w + 1 ) ;
+      scratch_uint-- ;
+      if( ( rep_mode & 0x02 ) && ( regs8[ FLAG_CF ] != ( rep_mode & 0x01 ) ) )
+      {
+        break ;
+      }
+    }
 
-    // XLAT
-    case 0x2C :
-      regs8[ REG_AL ] = mem[ 16 * regs16[seg_override_en ? seg_override : REG_DS] + (uint16_t)(regs8[ REG_AL ] + regs16[REG_BX]) ] ;
-      break ;
+    if( rep_override_en )
+    {
+      regs16[ REG_CX ] = scratch_uint ;
+    }
+    break ;
 
-    // CMC
-    case 0x2D :
-      regs8[ FLAG_CF ] ^= 1 ;
-      break ;
+  // 80186: OUTSB OUTSW
+  case 0x3C :
+    // Transfers a byte or word "src" to the hardware port specified in DX.
+    // The "src" is located at DS:SI (or the segment override) and SI is
+    // incremented or decremented by the size dictated by the instruction
+    // format.
+    // When the Direction Flag is set SI is decremented, when clear, SI is
+    // incremented.
+    scratch2_uint = regs16[ REG_DX ] ;
+
+    scratch_uint = ( rep_override_en ) ? ( regs16[ REG_CX ] ) : ( 1 ) ;
+    while( scratch_uint )
+    {
+      uint32_t addr ;
 
-    // CLC|STC|CLI|STI|CLD|STD
-    case 0x2E :
-      regs8[ stOpcode.extra / 2 ] = stOpcode.extra & 0x01 ;
-      break ;
+      // Convert segment:offset to linear address.
+      addr  = 16 ;
+      addr *= regs16[ ( seg_override_en ) ? ( seg_override ) : ( REG_DS ) ] ;
+      addr += ( uint16_t ) regs16[ REG_SI ] ;
 
-    // TEST AL/AX, immed
-    case 0x2F :
       // Execute arithmetic/logic operations.
+      op_source = read_operand( addr ) ;
       if( i_w )
       {
-        op_dest   = *( uint16_t * )&regs8[ REG_AL ] ;
-        op_source = *( uint16_t * )&i_data0  ;
-        op_result = *( uint16_t * )&regs8[ REG_AL ] & op_source ;
+        op_dest   = *( uint16_t * )&io_ports[ scratch2_uint ] ;
+        op_result = *( uint16_t * )&io_ports[ scratch2_uint ] = op_source ;
       }
       else
       {
-        op_dest   = regs8[ REG_AL ] ;
-        op_source = *( uint8_t * )&i_data0 ;
-        op_result = regs8[ REG_AL ] & op_source ;
+        op_dest   = io_ports[ scratch2_uint ] ;
+        op_result = io_ports[ scratch2_uint ] = op_source ;
       }
-      break ;
-
-    // LOCK
-    case 0x30 :
-      break ;
 
-    // HLT
-    case 0x31 :
-      break ;
+      port_write( scratch2_uint , io_ports[ scratch2_uint ] ) ;
+      if( i_w )
+      {
+        port_write( scratch2_uint + 1 , io_ports[ scratch2_uint + 1 ] ) ;
+      }
+      regs16[ REG_SI ] -= ( 2 * regs8[ FLAG_DF ] - 1 ) * ( i_w + 1 ) ;
 
-    // Emulator-specific 0F xx opcodes
-    case 0x32 :
-      switch( ( int8_t ) i_data0 )
+      scratch_uint-- ;
+      if( ( rep_mode & 0x02 ) && ( regs8[ FLAG_CF ] != ( rep_mode & 0x01 ) ) )
       {
-      // PUTCHAR_AL.
-      case 0x00 :
-        putchar( regs8[ 0 ] ) ;
         break ;
+      }
+    }
 
-      // GET_RTC
-      case 0x01 :
-        {
-          time_t clock_buf ;
-          struct timeb ms_clock ;
-          uint32_t addr ;
-
-          time( &clock_buf ) ;
-          ftime( &ms_clock ) ;
-
-          // Convert segment:offset to linear address.
-          addr  = 16 ;
-          addr *= regs16[ REG_ES ] ;
-          addr += ( uint16_t ) regs16[ REG_BX ] ;
-
-          memcpy( &mem[ addr ] , localtime( &clock_buf ) , sizeof( struct tm ) ) ;
+    if( rep_override_en )
+    {
+      regs16[ REG_CX ] = scratch_uint ;
+    }
+    break ;
 
-          // Convert segment:offset to linear address.
-          addr  = 16 ;
-          addr *= regs16[ REG_ES ] ;
-          addr += ( uint16_t ) ( regs16[ REG_BX ] + 36 ) ;
+  // 8087 MATH Coprocessor: WAIT, ESC
+  case 0x45 :
+    // The coprocessor completes each instruction immediately, so WAIT
+    // never waits. Without a coprocessor ESC instructions are ignored.
+    if( ( stOpcode.raw_opcode_id != 0x9B ) && FPU_Present() )
+    {
+      FPU_Execute( stOpcode.raw_opcode_id , ( uint8_t ) i_data0 , rm_addr , 16 * regs16[ REG_CS ] + reg_ip ) ;
 
-          *( int16_t * )&mem[ addr ] = ms_clock.millitm ;
-        }
-        break ;
+      // The coprocessor stores to memory directly, at most the 94 bytes
+      // of FSAVE.
+      if( i_mod != 3 )
+      {
+        MEM_HostWrite( rm_addr , 94 ) ;
+      }
+    }
+    break ;
 
-      // DISK_READ
-      case 0x02 :
-      // DISK_WRITE
-      case 0x03 :
-        {
-          long seekRet ;
+  // 80286+ (63), 80386+ (64/65) and undefined (66/67) op codes.
+  // The 80186 raises the invalid opcode exception, INT 6, which returns to
+  // the faulting instruction. On the V20 64/65 are the REPNC/REPC prefixes,
+  // decoded above, 66/67 are the FPO2 coprocessor escape, ignored as no
+  // coprocessor answers it, and 63 does nothing. The 8088 decodes all of
+  // 60-6F as conditional jumps.
+  case 0x46 :
+  case 0x47 :
+  case 0x48 :
+    if( Model == CPU_MODEL_80186 )
+    {
+      pc_interrupt( 6 ) ;
+    }
+    break ;
 
-          seekRet = ~lseek( disk[ regs8[ REG_DL ] ] , *( uint32_t * )&regs16[ REG_BP ] << 9 , 0 ) ;
-          if( seekRet )
-          {
-            // Convert segment:offset to linear address.
-            uint32_t addr ;
+  default :
+    printf( "Unknown opcode %02Xh\n" , stOpcode.raw_opcode_id ) ;
+    break ;
+  }
 
-            addr  = 16 ;
-            addr *= regs16[ REG_ES ] ;
-            addr += ( uint16_t ) regs16[ REG_BX ] ;
+  // Increment instruction pointer by computed instruction length. Tables in the BIOS binary
+  // help us here.
+  reg_ip += ( i_mod * ( i_mod != 3 ) + 2 * ( !i_mod && i_rm == 6 ) ) * stOpcode.i_mod_size ;
+  reg_ip += bios_table_lookup[ TABLE_BASE_INST_SIZE ][ stOpcode.raw_opcode_id ] ;
+  reg_ip += bios_table_lookup[ TABLE_I_W_SIZE       ][ stOpcode.raw_opcode_id ] * ( i_w + 1 ) ;
 
-            if( ( ( int8_t ) i_data0 ) == 3 )
-            {
-              regs8[ REG_AL ] = write( disk[ regs8[ REG_DL ] ] , ( mem + addr ) , regs16[ REG_AX ] ) ;
-            }
-            else
-            {
-              regs8[ REG_AL ] = read( disk[ regs8[ REG_DL ] ] , ( mem + addr ) , regs16[ REG_AX ] ) ;
-            }
-          }
-          else
-          {
-            regs8[ REG_AL ] = 0 ;
-          }
-        }
-        break ;
-      }
-      break ;
+  // If instruction needs to update SF, ZF and PF, set them as appropriate
+  if( stOpcode.set_flags_type & FLAGS_UPDATE_SZP )
+  {
+    // Returns sign bit of an 8-bit or 16-bit operand
+    regs8[ FLAG_SF ] = ( 1 & ( ( i_w ) ? *( int16_t * )&( op_result ) : ( op_result ) ) >> ( 8 * ( i_w + 1 ) - 1 ) ) ;
+    regs8[ FLAG_ZF ] = !op_result ;
+    regs8[ FLAG_PF ] = bios_table_lookup[ TABLE_PARITY_FLAG ][ ( uint8_t ) op_result ] ;
 
-    // 80186, NEC V20: ENTER
-    case 0x33 :
-      // PUSH regs16[ REG_BP ].
-      i_w = 1 ;
-      op_dest   = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] ;
-      op_source = *( uint16_t * )&regs16[ REG_BP ] ;
-      op_result = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] = op_source ;
+    // If instruction is an arithmetic or logic operation, also set AF/OF/CF as appropriate.
+    if( stOpcode.set_flags_type & FLAGS_UPDATE_AO_ARITH )
+    {
+      set_AF_OF_arith() ;
+    }
+    if( stOpcode.set_flags_type & FLAGS_UPDATE_OC_LOGIC )
+    {
+      set_CF( 0 ) ;
+      set_OF( 0 ) ;
+    }
+  }
 
-      scratch_uint = regs16[ REG_SP ] ;
+  if( device_access )
+  {
+    device_operand_end() ;
+  }
 
-      i_data2 &= 0x00ff ;
-      scratch2_uint = i_data2 ;
+  // Prefixes only apply to the instruction they were decoded with.
+  seg_override_en = 0 ;
+  rep_override_en = 0 ;
 
-      if( scratch2_uint > 0 )
-      {
-        while( scratch2_uint != 1 )
-        {
-          scratch2_uint-- ;
-          regs16[ REG_BP ] -= 2 ;
-
-          // PUSH regs16[ REG_BP ].
-          i_w = 1 ;
-          op_dest   = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] ;
-          op_source = *( uint16_t * )&regs16[ REG_BP ] ;
-          op_result = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] = op_source ;
-        }
+  regs16[ REG_IP ] = reg_ip ;
+}
 
-        // PUSH scratch_uint.
-        i_w = 1 ;
-        op_dest   = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] ;
-        op_source = *( uint16_t * )&scratch_uint ;
-        op_result = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] = op_source ;
-      }
+CPUEngine_t CPU_GetEngine( int Model , int Engine )
+{
+  bool Cached = ( Engine == CPU_ENGINE_DECODE_CACHE ) ;
 
-      regs16[ REG_BP ]  = scratch_uint ;
-      regs16[ REG_SP ] -= i_data0      ;
-      break ;
+  switch( Model )
+  {
+  case CPU_MODEL_8088 :
+    return( ( Cached ) ? CPU_ExecuteInstruction< CPU_MODEL_8088 , true > : CPU_ExecuteInstruction< CPU_MODEL_8088 , false > ) ;
 
-    // 80186, NEC V20: LEAVE
-    case 0x34 :
-      regs16[ REG_SP ] = regs16[ REG_BP ] ;
+  case CPU_MODEL_V20 :
+    return( ( Cached ) ? CPU_ExecuteInstruction< CPU_MODEL_V20 , true > : CPU_ExecuteInstruction< CPU_MODEL_V20 , false > ) ;
 
-      i_w = 1 ;
-      regs16[ REG_SP ] += 2 ;
+  default :
+    return( ( Cached ) ? CPU_ExecuteInstruction< CPU_MODEL_80186 , true > : CPU_ExecuteInstruction< CPU_MODEL_80186 , false > ) ;
+  }
+}
 
-      // Execute arithmetic/logic operations.
-      {
-        uint32_t addr ;
+// The decode cache engine is no faster than the reference engine yet, so
+// is only run as the candidate lockstep mode checks.
+static void SelectEngines( int Model )
+{
+  CPU_Reference = CPU_GetEngine( Model , CPU_ENGINE_REFERENCE ) ;
+  CPU_Engine    = CPU_GetEngine( Model , ( Interface.GetLockstepBlockLength() > 0 ) ? CPU_ENGINE_DECODE_CACHE : CPU_ENGINE_REFERENCE ) ;
+}
 
-        op_dest   = *( uint16_t * )&regs16[ REG_BP ] ;
+// Retire a delay loop at CS:IP in bulk.
+// A delay loop is a short loop whose body only changes a counter register
+// and the flags. Until the next timer event nothing outside the CPU can
+// observe the loop, so all but the last of the iterations that fit before
+// the event are retired by adjusting the counter directly. The last one is
+// executed normally to leave the exact register and flag state.
+// Returns the number of instructions retired, or 0 if there is no delay
+// loop at CS:IP.
+int CPU_SkipDelayLoop( void )
+{
+  uint8_t  * code       ;
+  uint8_t  * counter8   ;
+  uint16_t * counter16  ;
+  uint32_t   iterations ;
+  uint32_t   skip       ;
+  int        length     ;
+  int        i          ;
+
+  if( trap_flag || regs8[ FLAG_TF ] || ( reg_ip > 0xFFF0 ) )
+  {
+    return( 0 ) ;
+  }
 
-        addr  = 16 ;
-        addr *= regs16[ REG_SS ] ;
-        addr += ( uint16_t ) ( regs16[ REG_SP ] - 2 ) ;
+  code       = mem + 16 * regs16[ REG_CS ] + reg_ip ;
+  counter8   = NULL ;
+  counter16  = NULL ;
+  iterations = 0xFFFFFFFF ;
 
-        op_source = *( uint16_t * )&mem[ addr ]  ;
-        op_result = op_source ;
-        *( uint16_t * )&regs16[ REG_BP ] = op_source ;
-      }
-      break ;
+  if( ( code[ 0 ] == 0xE2 ) && ( code[ 1 ] == 0xFE ) )
+  {
+    // LOOP $
+    counter16 = &regs16[ REG_CX ] ;
+    length    = 1 ;
+  }
+  else if( ( code[ 0 ] == 0x90 ) && ( code[ 1 ] == 0xE2 ) && ( code[ 2 ] == 0xFD ) )
+  {
+    // NOP / LOOP $-1
+    counter16 = &regs16[ REG_CX ] ;
+    length    = 2 ;
+  }
+  else if( ( ( code[ 0 ] & 0xF8 ) == 0x48 ) && ( code[ 0 ] != 0x4C ) && ( code[ 1 ] == 0x75 ) && ( code[ 2 ] == 0xFD ) )
+  {
+    // DEC r16 / JNZ $-1
+    counter16 = &regs16[ code[ 0 ] & 0x07 ] ;
+    length    = 2 ;
+  }
+  else if( ( code[ 0 ] == 0xFE ) && ( ( code[ 1 ] & 0xF8 ) == 0xC8 ) && ( code[ 2 ] == 0x75 ) && ( code[ 3 ] == 0xFC ) )
+  {
+    // DEC r8 / JNZ $-2
+    i         = code[ 1 ] & 0x07 ;
+    counter8  = &regs8[ ( 2 * i + i / 4 ) & 7 ] ;
+    length    = 2 ;
+  }
+  else if( ( code[ 0 ] == 0xEB ) && ( code[ 1 ] == 0xFE ) )
+  {
+    // JMP $
+    length    = 1 ;
+  }
+  else
+  {
+    return( 0 ) ;
+  }
 
-    // 80186, NEC V20: PUSHA
-    case 0x35 :
-      // PUSH AX, PUSH CX, PUSH DX, PUSH BX, PUSH SP, PUSH BP, PUSH SI, PUSH DI
-      i_w = 1 ;
+  // A zero counter runs the full count before reaching zero again.
+  if( counter16 != NULL )
+  {
+    iterations = ( *counter16 ) ? ( *counter16 ) : ( 0x10000 ) ;
+  }
+  else if( counter8 != NULL )
+  {
+    iterations = ( *counter8 ) ? ( *counter8 ) : ( 0x100 ) ;
+  }
 
-      // PUSH regs16[ REG_AX ].
-      op_dest   = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] ;
-      op_source = *( uint16_t * )&regs16[ REG_AX ] ;
-      op_result = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] = op_source ;
+  // Number of whole iterations that fit before the next timer event.
+  skip = Interface.TimerHorizon() / ( INSTRUCTION_TICKS * length ) ;
+  if( skip > iterations )
+  {
+    skip = iterations ;
+  }
 
-      // PUSH regs16[ REG_CX ].
-      op_dest   = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] ;
-      op_source = *( uint16_t * )&regs16[ REG_CX ] ;
-      op_result = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] = op_source ;
+  if( skip < 2 )
+  {
+    return( 0 ) ;
+  }
 
-      // PUSH regs16[ REG_DX ].
-      op_dest   = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] ;
-      op_source = *( uint16_t * )&regs16[ REG_DX ] ;
-      op_result = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] = op_source ;
+  if( counter16 != NULL )
+  {
+    *counter16 -= ( uint16_t ) ( skip - 1 ) ;
+  }
+  else if( counter8 != NULL )
+  {
+    *counter8 -= ( uint8_t ) ( skip - 1 ) ;
+  }
 
-      // PUSH regs16[ REG_BX ].
-      op_dest   = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] ;
-      op_source = *( uint16_t * )&regs16[ REG_BX ] ;
-      op_result = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] = op_source ;
+  for( i = 0 ; i < length ; i++ )
+  {
+    CPU_Engine() ;
+  }
 
-      scratch_uint = regs16[ REG_SP ] ;
-      // PUSH scratch_uint.
-      op_dest   = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] ;
-      op_source = *( uint16_t * )&scratch_uint ;
-      op_result = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] = op_source ;
+  return( skip * length ) ;
+}
 
-      // PUSH regs16[ REG_BP ].
-      op_dest   = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] ;
-      op_source = *( uint16_t * )&regs16[ REG_BP ] ;
-      op_result = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] = op_source ;
+// Update the interface module after an instruction.
+// Returns true if the interface state changed.
+bool UpdateInterface( void )
+{
+  ReplayTime += INSTRUCTION_TICKS ;
 
-      // PUSH regs16[ REG_SI ].
-      op_dest   = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] ;
-      op_source = *( uint16_t * )&regs16[ REG_SI ] ;
-      op_result = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] = op_source ;
+  return( Interface.TimerTick( INSTRUCTION_TICKS ) ) ;
+}
 
-      // PUSH regs16[ REG_DI ].
-      op_dest   = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] ;
-      op_source = *( uint16_t * )&regs16[ REG_DI ] ;
-      op_result = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] = op_source ;
-      break ;
+// Report the result of saving or restoring a snapshot.
+void SnapshotResult( const char * Operation , int Result )
+{
+  if( Result != SNAP_OK )
+  {
+    printf( "Snapshot %s failed: %s\n" , Operation , SNAP_ErrorText( Result ) ) ;
+  }
+}
 
-    // 80186, NEC V20: POPA
-    case 0x63 :
-      // POP DI, POP SI, POP BP, ADD SP,2, POP BX, POP DX, POP CX, POP AX
-      i_w = 1 ;
+// Restore the configured snapshot. A damaged snapshot leaves the machine
+// partly restored, so it is reset.
+int RestoreSnapshot( void )
+{
+  int Result = SNAP_Restore( Interface.GetSnapshotFilename() ) ;
 
-      // POP regs16[ REG_DI ].
-      regs16[ REG_SP ] += 2 ;
-      op_dest   = *( uint16_t * )&regs16[ REG_DI ] ;
-      op_source = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( -2+ regs16[ REG_SP ] ) ] ;
-      op_result = *( uint16_t * )&regs16[ REG_DI ] = op_source ;
+  SnapshotResult( "restore" , Result ) ;
+  if( Result == SNAP_ERR_DAMAGED )
+  {
+    Reset() ;
+  }
 
-      // POP regs16[ REG_SI ].
-      regs16[ REG_SP ] += 2 ;
-      op_dest   = *( uint16_t * )&regs16[ REG_SI ] ;
-      op_source = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( -2+ regs16[ REG_SP ] ) ] ;
-      op_result = *( uint16_t * )&regs16[ REG_SI ] = op_source ;
+  return( Result ) ;
+}
 
-      // POP regs16[ REG_BP ].
-      regs16[ REG_SP ] += 2 ;
-      op_dest   = *( uint16_t * )&regs16[ REG_BP ] ;
-      op_source = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( -2+ regs16[ REG_SP ] ) ] ;
-      op_result = *( uint16_t * )&regs16[ REG_BP ] = op_source ;
+// Start the configured clones of the snapshot.
+// Returns true in each clone, false in the process that started them once
+// they have all exited.
+bool StartClones( void )
+{
+  int Index ;
+  int Result ;
 
-      regs16[ REG_SP ] += 2 ;
+  Result = SNAP_Clone( Interface.GetSnapshotFilename() , Interface.GetCloneCount() , Interface.GetCloneParallel() , Index ) ;
+  SnapshotResult( "clone" , Result ) ;
 
-      // POP regs16[ REG_BX ].
-      regs16[ REG_SP ] += 2 ;
-      op_dest   = *( uint16_t * )&regs16[ REG_BX ] ;
-      op_source = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( -2+ regs16[ REG_SP ] ) ] ;
-      op_result = *( uint16_t * )&regs16[ REG_BX ] = op_source ;
+  if( ( Index < 0 ) || ( Result != SNAP_OK ) )
+  {
+    return( false ) ;
+  }
 
-      // POP regs16[ REG_DX ].
-      regs16[ REG_SP ] += 2 ;
-      op_dest   = *( uint16_t * )&regs16[ REG_DX ] ;
-      op_source = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( -2+ regs16[ REG_SP ] ) ] ;
-      op_result = *( uint16_t * )&regs16[ REG_DX ] = op_source ;
+  Interface.CloneStarted( Index ) ;
 
-      // POP regs16[ REG_CX ].
-      regs16[ REG_SP ] += 2 ;
-      op_dest   = *( uint16_t * )&regs16[ REG_CX ] ;
-      op_source = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( -2+ regs16[ REG_SP ] ) ] ;
-      op_result = *( uint16_t * )&regs16[ REG_CX ] = op_source ;
+  return( true ) ;
+}
 
-      // POP regs16[ REG_AX ].
-      regs16[ REG_SP ] += 2 ;
-      op_dest   = *( uint16_t * )&regs16[ REG_AX ] ;
-      op_source = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( -2+ regs16[ REG_SP ] ) ] ;
-      op_result = *( uint16_t * )&regs16[ REG_AX ] = op_source ;
-      break ;
+// Change the floppy disk image. The change is ignored when replaying, as
+// the disk is changed as it was when recording instead.
+void ChangeFD( const char * Filename )
+{
+  if( REPLAY_Playing() )
+  {
+    return ;
+  }
 
-    // 80186: BOUND
-    case 0x37 :
-      // Not implemented. Incompatible with PC/XT hardware.
-      printf( "BOUND\n" ) ;
-      break ;
+  REPLAY_Input( REPLAY_EVENT_FD_CHANGE , ( Filename != NULL ) ? Filename : "" , ( Filename != NULL ) ? ( int ) strlen( Filename ) : 0 ) ;
 
-    // 80186, NEC V20: PUSH imm16
-    case 0x38 :
-      // PUSH i_data0.
-      i_w = 1 ;
-      op_dest   = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] ;
-      op_source = *( uint16_t * )&i_data0 ;
-      op_result = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] = op_source ;
-      break ;
+  FlushDisks() ;
+  DISK_Open( DISK_FD , Filename ) ;
+}
 
-    // 80186, NEC V20: PUSH imm8
-    case 0x39 :
-      // PUSH ( i_data0 & 0x00FF )
-      i_w = 1 ;
-      op_dest   = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] ;
-      op_source = *( uint16_t * )&i_data0 & 0x00FF ;
-      op_result = *( uint16_t * )&mem[ 16 * regs16[ REG_SS ] + ( uint16_t ) ( --regs16[ REG_SP ] ) ] = op_source ;
-      break ;
+// Handle an interface state change reported by UpdateInterface.
+void HandleInterfaceChange( void )
+{
+  char Filename[ REPLAY_MAX_DATA + 1 ] ;
+  int  Length = REPLAY_MAX_DATA ;
 
-    // 80186 IMUL
-    case 0x3A :
-      // Not implemented.
-      printf( "IMUL at %04X:%04X\n" , regs16[ REG_CS ] , reg_ip ) ;
-      break ;
+  if( Interface.ExitEmulation() )
+  {
+    ExitEmulation = true ;
+  }
+  else
+  {
+    if( Interface.FDChanged() )
+    {
+      ChangeFD( Interface.GetFDImageFilename() ) ;
+    }
 
-    // 80186: INSB INSW
-    case 0x3B :
-      // Loads data from port to the destination ES:DI.
-      // DI is adjusted by the size of the operand and increased if the
-      // Direction Flag is cleared and decreased if the Direction Flag is set.
-      scratch2_uint = regs16[ REG_DX ] ;
+    // When replaying the floppy disk is changed as it was when recording.
+    while( REPLAY_NextInput( REPLAY_EVENT_FD_CHANGE , Filename , Length ) )
+    {
+      Filename[ Length ] = 0 ;
+      FlushDisks() ;
+      DISK_Open( DISK_FD , ( Length > 0 ) ? Filename : NULL ) ;
+      Length = REPLAY_MAX_DATA ;
+    }
 
-      scratch_uint = ( rep_override_en ) ? ( regs16[REG_CX] ) : ( 1 ) ;
-      while( scratch_uint )
+    // Several requests may be due at once.
+    for( int Request = Interface.SnapshotRequest() ; Request != SNAP_REQUEST_NONE ; Request = Interface.SnapshotRequest() )
+    {
+      switch( Request )
       {
-        uint32_t addr ;
+      case SNAP_REQUEST_SAVE :
+        SnapshotResult( "save" , SNAP_Save( Interface.GetSnapshotFilename() , Interface.GetSnapshotCompress() ) ) ;
+        break ;
 
-        io_ports[ scratch2_uint ] = Interface.ReadPort( scratch2_uint ) ;
-        if( i_w )
+      case SNAP_REQUEST_RESTORE :
+        if( REPLAY_Active() )
         {
-          io_ports[ scratch2_uint + 1 ] = Interface.ReadPort( scratch2_uint + 1 ) ;
+          printf( "Snapshot restore is not available while recording or replaying\n" ) ;
         }
-
-        // Convert segment:offset to linear address.
-        addr  = 16 ;
-        addr *= regs16[ REG_ES ] ;
-        addr += ( uint16_t ) regs16[ REG_DI ] ;
-
-        // Execute arithmetic/logic operations.
-        if( i_w )
+        else if( RestoreSnapshot() == SNAP_OK )
         {
-          op_dest   = *( uint16_t * )&mem[ addr ] ;
-          op_source = *( uint16_t * )&io_ports[ scratch_uint ]  ;
-          op_result = *( uint16_t * )&mem[ addr ] = op_source ;
+          // The host files the restored DOS had open are not known.
+          REDIR_Reset() ;
         }
-        else
+        break ;
+
+      case SNAP_REQUEST_CHECKPOINT :
+        REWIND_Checkpoint() ;
+        break ;
+
+      case SNAP_REQUEST_REWIND :
+        if( REWIND_Rewind( Interface.GetRewindCheckpoints() ) )
         {
-          op_dest   = mem[ addr ] ;
-          op_source = *( uint8_t * )&io_ports[ scratch_uint ] ;
-          op_result = mem[ addr ] = op_source ;
+          REDIR_Reset() ;
         }
+        break ;
 
-        regs16[ REG_DI ] -= ( 2 * regs8[ FLAG_DF ] - 1 ) * ( i_w + 1 ) ;
-        scratch_uint-- ;
+      case SNAP_REQUEST_RUNAHEAD :
+        Interface.RunAhead( RUNAHEAD_Save() ) ;
+        break ;
+
+      case SNAP_REQUEST_RUNAHEAD_END :
+        RUNAHEAD_Load() ;
+        break ;
+
+      default :
+        break ;
       }
+    }
 
-      if( rep_override_en )
+    switch( Interface.DiskRequest() )
+    {
+    case DISK_REQUEST_COMMIT :
+      if( !DISK_CommitDelta( DISK_HD ) )
       {
-        regs16[ REG_CX ] = 0 ;
+        printf( "Commit disk changes failed\n" ) ;
       }
       break ;
 
-    // 80186: OUTSB OUTSW
-    case 0x3C :
-      // Transfers a byte or word "src" to the hardware port specified in DX.
-      // The "src" is located at DS:SI and SI is incremented or decremented
-      // by the size dictated by the instruction format.
-      // When the Direction Flag is set SI is decremented, when clear, SI is
-      // incremented.
-      scratch2_uint = regs16[ REG_DX ] ;
-
-      scratch_uint = ( rep_override_en ) ? ( regs16[ REG_CX ] ) : ( 1 ) ;
-      while( scratch_uint )
+    case DISK_REQUEST_DISCARD :
+      // The guest may have cached what was discarded, so it starts again.
+      if( REPLAY_Active() )
       {
-        uint32_t addr ;
-
-        // Convert segment:offset to linear address.
-        addr  = 16 ;
-        addr *= regs16[ REG_DS ] ;
-        addr += ( uint16_t ) regs16[ REG_SI ] ;
-
-        // Execute arithmetic/logic operations.
-        if( i_w )
-        {
-          op_dest   = *( uint16_t * )&io_ports[ scratch2_uint ] ;
-          op_source = *( uint16_t * )&mem[ addr ]  ;
-          op_result = *( uint16_t * )&io_ports[ scratch2_uint ] = op_source ;
-        }
-        else
-        {
-          op_dest   = io_ports[ scratch2_uint ] ;
-          op_source = *( uint8_t * )&mem[ addr ] ;
-          op_result = io_ports[ scratch2_uint ] = op_source ;
-        }
-
-        Interface.WritePort( scratch2_uint , io_ports[ scratch2_uint ] ) ;
-        if( i_w )
-        {
-          Interface.WritePort( scratch2_uint + 1 , io_ports[ scratch2_uint + 1 ] ) ;
-        }
-        regs16[ REG_SI ] -= ( 2 * regs8[ FLAG_DF ] - 1 ) * ( i_w + 1 ) ;
-
-        scratch_uint-- ;
+        printf( "Discarding disk changes is not available while recording or replaying\n" ) ;
       }
-
-      if( rep_override_en )
+      else if( DISK_DiscardDelta( DISK_HD ) )
+      {
+        Reset() ;
+      }
+      else
       {
-        regs16[ REG_CX ] = 0 ;
+        printf( "Discard disk changes failed\n" ) ;
       }
       break ;
 
-    // 8087 MATH Coprocessor
-    case 0x45 :
-      printf( "8087 coprocessor instruction: 0x%02X\n" , stOpcode.raw_opcode_id ) ;
-      ExitEmulation = true ;
+    case DISK_REQUEST_STATS :
+      DISK_PrintStats() ;
       break ;
 
-    // 80286+
-    case 0x46 :
-      printf( "80286+ only op code: 0x%02X at %04X:%04X\n" , stOpcode.raw_opcode_id , regs16[ REG_CS ] , reg_ip ) ;
+    default :
       break ;
+    }
 
-    // 80386+
-    case 0x47 :
-      printf( "80386+ only op code: 0x%02X at %04X:%04X\n" , stOpcode.raw_opcode_id , regs16[ REG_CS ] , reg_ip ) ;
-      break ;
+    if( Interface.Reset() )
+    {
+      Reset() ;
+    }
 
-    // BAD OP CODE
-    case 0x48 :
-      printf( "Bad op code: %02x  at %04X:%04X\n" , stOpcode.raw_opcode_id , regs16[ REG_CS ] , reg_ip ) ;
-      break ;
+    REPLAY_CheckState() ;
+  }
+}
 
-    default :
-      printf( "Unknown opcode %02Xh\n" , stOpcode.raw_opcode_id ) ;
-      break ;
-    }
+// Instructions retired since the last INT 8 was delivered
+int InstrSinceInt8 = 0 ;
+
+// Deliver trap and hardware interrupts between instructions.
+void ServiceInterrupts( void )
+{
+  // Application has set trap flag, so fire INT 1
+  if( trap_flag )
+  {
+    pc_interrupt( 1 ) ;
+  }
+
+  trap_flag = regs8[ FLAG_TF ] ;
 
-    // Increment instruction pointer by computed instruction length. Tables in the BIOS binary
-    // help us here.
-    reg_ip += ( i_mod * ( i_mod != 3 ) + 2 * ( !i_mod && i_rm == 6 ) ) * stOpcode.i_mod_size ;
-    reg_ip += bios_table_lookup[ TABLE_BASE_INST_SIZE ][ stOpcode.raw_opcode_id ] ;
-    reg_ip += bios_table_lookup[ TABLE_I_W_SIZE       ][ stOpcode.raw_opcode_id ] * ( i_w + 1 ) ;
+  // Check for interrupts triggered by system interfaces
+  int IntNo ;
 
-    // If instruction needs to update SF, ZF and PF, set them as appropriate
-    if( stOpcode.set_flags_type & FLAGS_UPDATE_SZP )
+  // When replaying a lockstep block, deliver the interrupts that were
+  // delivered to the reference engine.
+  if( LockstepPhase == LOCKSTEP_REPLAY )
+  {
+    if( LOCKSTEP_ReplayInterrupt( IntNo ) )
     {
-      // Returns sign bit of an 8-bit or 16-bit operand
-      regs8[ FLAG_SF ] = ( 1 & ( ( i_w ) ? *( int16_t * )&( op_result ) : ( op_result ) ) >> ( 8 * ( i_w + 1 ) - 1 ) ) ;
-      regs8[ FLAG_ZF ] = !op_result ;
-      regs8[ FLAG_PF ] = bios_table_lookup[ TABLE_PARITY_FLAG ][ ( uint8_t ) op_result ] ;
+      EMS_Bootstrap() ;
+      pc_interrupt( IntNo ) ;
 
-      // If instruction is an arithmetic or logic operation, also set AF/OF/CF as appropriate.
-      if( stOpcode.set_flags_type & FLAGS_UPDATE_AO_ARITH )
-      {
-        set_AF_OF_arith() ;
-      }
-      if( stOpcode.set_flags_type & FLAGS_UPDATE_OC_LOGIC )
-      {
-        set_CF( 0 ) ;
-        set_OF( 0 ) ;
-      }
+      regs16[ REG_IP ] = reg_ip ;
     }
+    return ;
+  }
 
-    regs16[ REG_IP ] = reg_ip ;
-
-    // Update the interface module
-    if( Interface.TimerTick( 4 ) )
+  InstrSinceInt8++ ;
+  if( regs8[ FLAG_IF ] && !regs8[ FLAG_TF ] && Interface.IntPending( IntNo ) )
+  {
+    if( ( IntNo == 8 ) && ( InstrSinceInt8 < 300 ) )
     {
-      if( Interface.ExitEmulation() )
+      //printf("*** Int8 after %d instructions\n", InstrSinceInt8);
+    }
+    else
+    {
+      if( IntNo == 8 )
       {
-        ExitEmulation = true ;
+        InstrSinceInt8 = 0 ;
       }
-      else
-      {
-        if( Interface.FDChanged() )
-        {
-          close( disk[ 1 ] ) ;
-          disk[ 1 ] = open( Interface.GetFDImageFilename() , O_BINARY | O_NOINHERIT | O_RDWR ) ;
-        }
 
-        if( Interface.Reset() )
-        {
-          Reset() ;
-        }
+      // POST is over once the BIOS takes hardware interrupts.
+      EMS_Bootstrap() ;
+
+      pc_interrupt( IntNo ) ;
+
+      regs16[ REG_IP ] = reg_ip ;
+
+      if( LockstepPhase == LOCKSTEP_RECORD )
+      {
+        LOCKSTEP_LogInterrupt( IntNo ) ;
       }
     }
+  }
+}
+
+// Emulator entry point
+
+#if defined(_WIN32)
+int CALLBACK WinMain(
+  HINSTANCE hInstance,
+  HINSTANCE /* hPrevInstance */,
+  LPSTR     /* lpCmdLine */,
+  int       /* nCmdShow */)
+#else
+int main(int /* argc */, char ** /* argv */)
+#endif
+{
+  bool RunAhead ;
+
+#if defined(_WIN32)
+  Interface.SetInstance(hInstance);
+#endif
+  // Guest memory is mapped before anything is given a pointer to it.
+  MEM_Initialise() ;
+  Interface.Initialise( mem ) ;
+  if( !MEM_SetA20( Interface.GetA20Enabled() ) )
+  {
+    // Only a mapped region can mirror the first 64KB above 1MB.
+    printf( "Cannot %s A20, memory above 1MB is %s\n" ,
+            Interface.GetA20Enabled() ? "enable" : "disable" ,
+            Interface.GetA20Enabled() ? "a mirror of the first 64KB" : "separate" ) ;
+  }
+
+  // Fit the configured expanded memory board.
+  EMS_Initialise( Interface.GetEMSSize() , Interface.GetEMSFrame() ) ;
+
+  // regs16 and reg8 point to F000:0, the start of memory-mapped registers
+  regs8  = ( uint8_t  * ) ( mem + REGS_BASE ) ; // Base + 000F.0000
+  regs16 = ( uint16_t * ) ( mem + REGS_BASE ) ; // Base + 000F.0000
+
+  // Fit the configured numeric coprocessor.
+  FPU_Initialise( Interface.GetFPUMode() ) ;
+
+  // Select the execution engines for the configured CPU model.
+  SelectEngines( Interface.GetCPUModel() ) ;
+
+  // Video memory is accessed through the interface.
+  MEM_MapDevice( 0xA0000 , 0x20000 , vmem_read , vmem_write , vmem_invalidate ) ;
+
+  // Write to the disks in the background if configured.
+  DISK_SetCache( Interface.GetDiskCacheMode() ) ;
+
+  // Prefetch disk images from their boot traces if configured.
+  DISK_SetPrefetch( Interface.GetDiskTraceDirectory() ) ;
 
-    // Application has set trap flag, so fire INT 1
-    if( trap_flag )
+  // Keep hard disk writes in the delta file, if there is one.
+  if( ( Interface.GetHDDeltaFilename() != NULL ) && !DISK_SetDelta( DISK_HD , Interface.GetHDDeltaFilename() ) )
+  {
+    printf( "Cannot use HD delta file %s\n" , Interface.GetHDDeltaFilename() ) ;
+  }
+
+  // Reset, loads initial disk and bios images, clears RAM and sets CS & IP.
+  Reset() ;
+
+  if( ( Interface.GetCPUModel() == CPU_MODEL_8088 ) && BIOSNeeds80186() )
+  {
+    printf( "The 8086tiny BIOS needs an 80186 or V20, running as an 80186 instead of an 8088\n" ) ;
+    SelectEngines( CPU_MODEL_80186 ) ;
+  }
+
+  // Resume from the configured snapshot instead of booting, or run clones
+  // of it.
+  if( Interface.GetSnapshotFilename() != NULL )
+  {
+    if( Interface.GetCloneCount() > 0 )
+    {
+      ExitEmulation = !StartClones() ;
+    }
+    else
     {
-      pc_interrupt( 1 ) ;
+      RestoreSnapshot() ;
     }
+  }
+
+  // Record or replay inputs from the machine state at start up. Disk
+  // writes go to overlays both when recording and when replaying, so the
+  // images stay as they were when recording started.
+  if( REPLAY_Initialise( Interface.GetReplayMode() , Interface.GetReplayFilename() ) )
+  {
+    DISK_SetOverlay( DISK_FD ) ;
+    DISK_SetOverlay( DISK_HD ) ;
+  }
+
+  // Keep checkpoints to rewind to. Rewinding and running ahead change the
+  // machine state other than by running it, so not while recording or
+  // replaying.
+  REWIND_Initialise( ( REPLAY_Active() ) ? 0 : Interface.GetRewindCheckpoints() ) ;
+
+  // Keep the state to load after running ahead.
+  RunAhead = RUNAHEAD_Initialise( ( REPLAY_Active() ) ? 0 : Interface.GetRunAheadFrames() ) ;
+
+  // Lockstep mode checks the execution engine against the reference engine.
+  LOCKSTEP_Initialise( Interface.GetLockstepBlockLength() , CPU_Reference , CPU_Engine , ServiceInterrupts ) ;
 
-    trap_flag = regs8[ FLAG_TF ] ;
+  // Show the host directory as a network drive. Host files change outside
+  // the machine state, so not while replaying, running ahead or checking
+  // in lockstep.
+  if( !REPLAY_Active() && !RunAhead && !LOCKSTEP_Enabled() && ( Interface.GetHostDriveDirectory() != NULL ) &&
+      !REDIR_Initialise( Interface.GetHostDriveDirectory() ) )
+  {
+    printf( "Cannot use host drive directory %s\n" , Interface.GetHostDriveDirectory() ) ;
+  }
 
-    // Check for interrupts triggered by system interfaces
-    int IntNo ;
-    static int InstrSinceInt8 = 0 ;
-    InstrSinceInt8++ ;
-    if( !seg_override_en && !rep_override_en && regs8[ FLAG_IF ] && !regs8[ FLAG_TF ] && Interface.IntPending( IntNo ) )
+  // Instruction execution loop.
+  while( !ExitEmulation )
+  {
+    if( LOCKSTEP_Enabled() )
     {
-      if( ( IntNo == 8 ) && ( InstrSinceInt8 < 300 ) )
+      if( LOCKSTEP_RunBlock( UpdateInterface ) )
       {
-        //printf("*** Int8 after %d instructions\n", InstrSinceInt8);
+        HandleInterfaceChange() ;
       }
-      else
+    }
+    else
+    {
+      int retired ;
+
+      retired = CPU_SkipDelayLoop() ;
+      if( retired == 0 )
       {
-        if( IntNo == 8 )
-        {
-          InstrSinceInt8 = 0 ;
-        }
-        pc_interrupt( IntNo ) ;
+        CPU_Engine() ;
+        retired = 1 ;
+      }
+
+      // ServiceInterrupts counts the last instruction
+      InstrSinceInt8 += retired - 1 ;
 
-        regs16[ REG_IP ] = reg_ip ;
+      ReplayTime += INSTRUCTION_TICKS * retired ;
+      if( Interface.TimerTick( INSTRUCTION_TICKS * retired ) )
+      {
+        HandleInterfaceChange() ;
       }
     }
+
+    ServiceInterrupts() ;
   } // for each instruction
 
+  LOCKSTEP_Cleanup() ;
+
+  REWIND_Cleanup() ;
+
+  RUNAHEAD_Cleanup() ;
+
+  REPLAY_Cleanup() ;
+
   Interface.Cleanup() ;
 
+  EMS_Cleanup() ;
+
+  REDIR_Cleanup() ;
+
+  FlushDisks() ;
+
+  if( Interface.GetDiskStats() )
+  {
+    DISK_PrintStats() ;
+  }
+
+  DISK_Cleanup() ;
+
+  MEM_Cleanup() ;
+
   return( 0 ) ;
 }
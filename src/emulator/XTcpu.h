@@ -0,0 +1,145 @@
+// =============================================================================
+// File: XTcpu.h
+//
+// Description:
+// CPU register layout and execution engine interface shared between the
+// 8086tiny core and the emulator support modules (lockstep checker,
+// disassembler).
+//
+// This work is licensed under the MIT License. See included LICENSE.TXT.
+//
+
+#ifndef _XTCPU_
+#define _XTCPU_
+
+#include <stdint.h>
+
+#include "XTfpu.h"
+
+// Emulator system constants
+
+#define REGS_BASE                                0xF0000
+
+// 16-bit register decodes
+
+#define REG_AX                                   0
+#define REG_CX                                   1
+#define REG_DX                                   2
+#define REG_BX                                   3
+#define REG_SP                                   4
+#define REG_BP                                   5
+#define REG_SI                                   6
+#define REG_DI                                   7
+
+#define REG_ES                                   8
+#define REG_CS                                   9
+#define REG_SS                                   10
+#define REG_DS                                   11
+
+#define REG_ZERO                                 12
+#define REG_SCRATCH                              13
+
+#define REG_IP                                   14
+#define REG_TMP                                  15
+
+// 8-bit register decodes
+#define REG_AL                                   0
+#define REG_AH                                   1
+#define REG_CL                                   2
+#define REG_CH                                   3
+#define REG_DL                                   4
+#define REG_DH                                   5
+#define REG_BL                                   6
+#define REG_BH                                   7
+
+// FLAGS register decodes
+#define FLAG_CF                                  40
+#define FLAG_PF                                  41
+#define FLAG_AF                                  42
+#define FLAG_ZF                                  43
+#define FLAG_SF                                  44
+#define FLAG_TF                                  45
+#define FLAG_IF                                  46
+#define FLAG_DF                                  47
+#define FLAG_OF                                  48
+
+// CPU models.
+// The execution engine is instantiated once per model.
+#define CPU_MODEL_8088                           0 // Intel 8088: no 80186 instructions
+#define CPU_MODEL_80186                          1 // Intel 80186/80188
+#define CPU_MODEL_V20                            2 // NEC V20: 80186 instruction set, 8088 quirks
+
+// Execution engines
+#define CPU_ENGINE_REFERENCE                     0 // Decodes every instruction it runs
+#define CPU_ENGINE_DECODE_CACHE                  1 // Reuses decoded instructions
+
+// CPU state that is not held in the memory mapped register file at REGS_BASE,
+// including the numeric coprocessor.
+typedef struct STCPUSTATE_T
+{
+  uint16_t     reg_ip          ;
+  uint16_t     seg_override    ;
+  uint8_t      seg_override_en ;
+  uint8_t      rep_override_en ;
+  uint8_t      rep_mode        ;
+  uint8_t      trap_flag       ;
+  stFPUState_t fpu             ;
+} stCPUState_t ;
+
+// An execution engine decodes and executes exactly one instruction at
+// CS:IP, leaving reg_ip pointing at the next instruction.
+// Interface timing and interrupt delivery are handled by the caller.
+typedef void ( * CPUEngine_t )( void ) ;
+
+// =============================================================================
+// Function: CPU_GetEngine
+//
+// Description:
+// Get an execution engine for a CPU model.
+//
+// Parameters:
+//
+//   Model  : One of the CPU_MODEL_ values.
+//
+//   Engine : One of the CPU_ENGINE_ values.
+//
+// Returns:
+//
+//   CPUEngine_t : The engine for the model, or the 80186 engine if the
+//                 model is not known.
+//
+CPUEngine_t CPU_GetEngine( int Model , int Engine ) ;
+
+// =============================================================================
+// Function: CPU_GetState
+//
+// Description:
+// Copy the CPU state that lives outside emulated memory.
+//
+// Parameters:
+//
+//   State : Set to the current CPU state.
+//
+// Returns:
+//
+//   None.
+//
+void CPU_GetState( stCPUState_t * State ) ;
+
+// =============================================================================
+// Function: CPU_SetState
+//
+// Description:
+// Restore CPU state previously read with CPU_GetState.
+//
+// Parameters:
+//
+//   State : The CPU state to restore.
+//
+// Returns:
+//
+//   None.
+//
+void CPU_SetState( const stCPUState_t * State ) ;
+
+#endif // _XTCPU_
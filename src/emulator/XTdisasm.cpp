@@ -0,0 +1,643 @@
+// =============================================================================
+// File: XTdisasm.cpp
+//
+// Description:
+// 8086/80186 instruction disassembler used for emulator diagnostics.
+// Output is Intel syntax with hexadecimal immediates.
+//
+// This work is licensed under the MIT License. See included LICENSE.TXT.
+//
+
+#include <stdio.h>
+#include <string.h>
+#include <stdarg.h>
+
+#include "XTdisasm.h"
+
+// =============================================================================
+// Local data
+//
+
+static const char * Reg8Names[ 8 ]  = { "AL" , "CL" , "DL" , "BL" , "AH" , "CH" , "DH" , "BH" } ;
+static const char * Reg16Names[ 8 ] = { "AX" , "CX" , "DX" , "BX" , "SP" , "BP" , "SI" , "DI" } ;
+static const char * SegNames[ 4 ]   = { "ES" , "CS" , "SS" , "DS" } ;
+static const char * EANames[ 8 ]    = { "BX+SI" , "BX+DI" , "BP+SI" , "BP+DI" , "SI" , "DI" , "BP" , "BX" } ;
+
+static const char * AluNames[ 8 ]   = { "ADD" , "OR" , "ADC" , "SBB" , "AND" , "SUB" , "XOR" , "CMP" } ;
+static const char * ShiftNames[ 8 ] = { "ROL" , "ROR" , "RCL" , "RCR" , "SHL" , "SHR" , "SETMO" , "SAR" } ;
+static const char * Grp3Names[ 8 ]  = { "TEST" , "TEST" , "NOT" , "NEG" , "MUL" , "IMUL" , "DIV" , "IDIV" } ;
+static const char * Grp5Names[ 8 ]  = { "INC" , "DEC" , "CALL" , "CALL FAR" , "JMP" , "JMP FAR" , "PUSH" , "???" } ;
+
+static const char * JccNames[ 16 ]  =
+{
+  "JO" , "JNO" , "JB" , "JNB" , "JZ" , "JNZ" , "JBE" , "JA" ,
+  "JS" , "JNS" , "JPE" , "JPO" , "JL" , "JGE" , "JLE" , "JG"
+} ;
+
+// Opcodes with no operands, indexed by opcode. NULL if the opcode has operands.
+static const char * SimpleNames[ 256 ] ;
+static bool SimpleNamesInitialised = false ;
+
+// Decoder state for the instruction being disassembled
+typedef struct STDISASM_T
+{
+  const uint8_t * Code       ;
+  int             Pos        ;
+  uint16_t        IP         ;
+  const char    * SegPrefix  ;
+  char          * Text       ;
+  int             TextLen    ;
+  int             TextPos    ;
+} stDisasm_t ;
+
+// =============================================================================
+// Local functions
+//
+
+static void InitSimpleNames( void )
+{
+  SimpleNames[ 0x27 ] = "DAA"    ; SimpleNames[ 0x2F ] = "DAS"   ;
+  SimpleNames[ 0x37 ] = "AAA"    ; SimpleNames[ 0x3F ] = "AAS"   ;
+  SimpleNames[ 0x60 ] = "PUSHA"  ; SimpleNames[ 0x61 ] = "POPA"  ;
+  SimpleNames[ 0x6C ] = "INSB"   ; SimpleNames[ 0x6D ] = "INSW"  ;
+  SimpleNames[ 0x6E ] = "OUTSB"  ; SimpleNames[ 0x6F ] = "OUTSW" ;
+  SimpleNames[ 0x90 ] = "NOP"    ;
+  SimpleNames[ 0x98 ] = "CBW"    ; SimpleNames[ 0x99 ] = "CWD"   ;
+  SimpleNames[ 0x9B ] = "WAIT"   ;
+  SimpleNames[ 0x9C ] = "PUSHF"  ; SimpleNames[ 0x9D ] = "POPF"  ;
+  SimpleNames[ 0x9E ] = "SAHF"   ; SimpleNames[ 0x9F ] = "LAHF"  ;
+  SimpleNames[ 0xA4 ] = "MOVSB"  ; SimpleNames[ 0xA5 ] = "MOVSW" ;
+  SimpleNames[ 0xA6 ] = "CMPSB"  ; SimpleNames[ 0xA7 ] = "CMPSW" ;
+  SimpleNames[ 0xAA ] = "STOSB"  ; SimpleNames[ 0xAB ] = "STOSW" ;
+  SimpleNames[ 0xAC ] = "LODSB"  ; SimpleNames[ 0xAD ] = "LODSW" ;
+  SimpleNames[ 0xAE ] = "SCASB"  ; SimpleNames[ 0xAF ] = "SCASW" ;
+  SimpleNames[ 0xC3 ] = "RET"    ; SimpleNames[ 0xC9 ] = "LEAVE" ;
+  SimpleNames[ 0xCB ] = "RETF"   ; SimpleNames[ 0xCC ] = "INT 3" ;
+  SimpleNames[ 0xCE ] = "INTO"   ; SimpleNames[ 0xCF ] = "IRET"  ;
+  SimpleNames[ 0xD6 ] = "SALC"   ; SimpleNames[ 0xD7 ] = "XLAT"  ;
+  SimpleNames[ 0xEC ] = "IN AL,DX"  ; SimpleNames[ 0xED ] = "IN AX,DX"  ;
+  SimpleNames[ 0xEE ] = "OUT DX,AL" ; SimpleNames[ 0xEF ] = "OUT DX,AX" ;
+  SimpleNames[ 0xF4 ] = "HLT"    ; SimpleNames[ 0xF5 ] = "CMC"   ;
+  SimpleNames[ 0xF8 ] = "CLC"    ; SimpleNames[ 0xF9 ] = "STC"   ;
+  SimpleNames[ 0xFA ] = "CLI"    ; SimpleNames[ 0xFB ] = "STI"   ;
+  SimpleNames[ 0xFC ] = "CLD"    ; SimpleNames[ 0xFD ] = "STD"   ;
+
+  SimpleNamesInitialised = true ;
+}
+
+// Append formatted text to the output buffer
+static void Emit( stDisasm_t * D , const char * Format , ... )
+{
+  va_list Args ;
+  int     n    ;
+
+  if( D->TextPos >= D->TextLen - 1 )
+  {
+    return ;
+  }
+
+  va_start( Args , Format ) ;
+  n = vsnprintf( D->Text + D->TextPos , D->TextLen - D->TextPos , Format , Args ) ;
+  va_end( Args ) ;
+
+  if( n > 0 )
+  {
+    D->TextPos += n ;
+    if( D->TextPos > D->TextLen - 1 )
+    {
+      D->TextPos = D->TextLen - 1 ;
+    }
+  }
+}
+
+static uint8_t Fetch8( stDisasm_t * D )
+{
+  return( D->Code[ D->Pos++ ] ) ;
+}
+
+static uint16_t Fetch16( stDisasm_t * D )
+{
+  uint16_t Value ;
+
+  Value  = D->Code[ D->Pos ] ;
+  Value |= ( uint16_t ) ( D->Code[ D->Pos + 1 ] << 8 ) ;
+  D->Pos += 2 ;
+
+  return( Value ) ;
+}
+
+static void EmitImm8( stDisasm_t * D )
+{
+  Emit( D , "%02Xh" , Fetch8( D ) ) ;
+}
+
+static void EmitImm16( stDisasm_t * D )
+{
+  Emit( D , "%04Xh" , Fetch16( D ) ) ;
+}
+
+// Sign extended 8-bit immediate shown as a 16-bit value
+static void EmitSImm8( stDisasm_t * D )
+{
+  Emit( D , "%04Xh" , ( uint16_t ) ( int8_t ) Fetch8( D ) ) ;
+}
+
+static void EmitRel8( stDisasm_t * D )
+{
+  int8_t Rel ;
+
+  Rel = ( int8_t ) Fetch8( D ) ;
+  Emit( D , "%04Xh" , ( uint16_t ) ( D->IP + D->Pos + Rel ) ) ;
+}
+
+static void EmitRel16( stDisasm_t * D )
+{
+  uint16_t Rel ;
+
+  Rel = Fetch16( D ) ;
+  Emit( D , "%04Xh" , ( uint16_t ) ( D->IP + D->Pos + Rel ) ) ;
+}
+
+// Decode the ModRM byte. Returns the ModRM byte; the r/m operand text is
+// written to RMText.
+// Size is 0 for byte operands, 1 for word operands and -1 when no size
+// qualifier should be shown.
+static uint8_t DecodeModRM( stDisasm_t * D , int Size , bool ShowSize , char * RMText , int RMLen )
+{
+  uint8_t  ModRM ;
+  uint8_t  Mod   ;
+  uint8_t  RM    ;
+  uint16_t Disp  ;
+  int      n     ;
+
+  ModRM = Fetch8( D ) ;
+  Mod   = ( ModRM >> 6 ) & 0x03 ;
+  RM    =   ModRM        & 0x07 ;
+
+  if( Mod == 3 )
+  {
+    snprintf( RMText , RMLen , "%s" , ( Size == 0 ) ? Reg8Names[ RM ] : Reg16Names[ RM ] ) ;
+    return( ModRM ) ;
+  }
+
+  n = 0 ;
+  if( ShowSize && ( Size >= 0 ) )
+  {
+    n += snprintf( RMText + n , RMLen - n , "%s" , ( Size == 0 ) ? "BYTE PTR " : "WORD PTR " ) ;
+  }
+
+  if( D->SegPrefix != NULL )
+  {
+    n += snprintf( RMText + n , RMLen - n , "%s:" , D->SegPrefix ) ;
+  }
+
+  if( ( Mod == 0 ) && ( RM == 6 ) )
+  {
+    snprintf( RMText + n , RMLen - n , "[%04Xh]" , Fetch16( D ) ) ;
+  }
+  else if( Mod == 0 )
+  {
+    snprintf( RMText + n , RMLen - n , "[%s]" , EANames[ RM ] ) ;
+  }
+  else
+  {
+    if( Mod == 1 )
+    {
+      Disp = ( uint16_t ) ( int8_t ) Fetch8( D ) ;
+    }
+    else
+    {
+      Disp = Fetch16( D ) ;
+    }
+
+    if( Disp & 0x8000 )
+    {
+      snprintf( RMText + n , RMLen - n , "[%s-%04Xh]" , EANames[ RM ] , ( uint16_t ) -Disp ) ;
+    }
+    else
+    {
+      snprintf( RMText + n , RMLen - n , "[%s+%04Xh]" , EANames[ RM ] , Disp ) ;
+    }
+  }
+
+  return( ModRM ) ;
+}
+
+// =============================================================================
+// Exported functions
+//
+
+int DISASM_Instruction( const uint8_t * Code , uint16_t IP , char * Text , int TextLen )
+{
+  stDisasm_t D      ;
+  uint8_t    Opcode ;
+  uint8_t    ModRM  ;
+  int        Size   ;
+  char       RM[ 48 ] ;
+
+  if( !SimpleNamesInitialised )
+  {
+    InitSimpleNames() ;
+  }
+
+  D.Code      = Code    ;
+  D.Pos       = 0       ;
+  D.IP        = IP      ;
+  D.SegPrefix = NULL    ;
+  D.Text      = Text    ;
+  D.TextLen   = TextLen ;
+  D.TextPos   = 0       ;
+  Text[ 0 ]   = 0       ;
+
+  // Prefixes
+  for( ;; )
+  {
+    Opcode = D.Code[ D.Pos ] ;
+
+    if( ( Opcode & 0xE7 ) == 0x26 )
+    {
+      D.SegPrefix = SegNames[ ( Opcode >> 3 ) & 0x03 ] ;
+    }
+    else if( Opcode == 0xF0 )
+    {
+      Emit( &D , "LOCK " ) ;
+    }
+    else if( Opcode == 0xF2 )
+    {
+      Emit( &D , "REPNZ " ) ;
+    }
+    else if( Opcode == 0xF3 )
+    {
+      Emit( &D , "REP " ) ;
+    }
+    else
+    {
+      break ;
+    }
+
+    D.Pos++ ;
+
+    // A run of prefixes longer than any real instruction
+    if( D.Pos >= 15 )
+    {
+      Emit( &D , "(prefixes)" ) ;
+      return( D.Pos ) ;
+    }
+  }
+
+  Opcode = Fetch8( &D ) ;
+  Size   = Opcode & 0x01 ;
+
+  if( SimpleNames[ Opcode ] != NULL )
+  {
+    Emit( &D , "%s" , SimpleNames[ Opcode ] ) ;
+    return( D.Pos ) ;
+  }
+
+  // ALU operations 00-3F
+  if( ( Opcode < 0x40 ) && ( ( Opcode & 0x07 ) < 6 ) )
+  {
+    const char * Name = AluNames[ Opcode >> 3 ] ;
+
+    switch( Opcode & 0x07 )
+    {
+    case 0 :
+    case 1 :
+      ModRM = DecodeModRM( &D , Size , false , RM , sizeof( RM ) ) ;
+      Emit( &D , "%s %s,%s" , Name , RM , Size ? Reg16Names[ ( ModRM >> 3 ) & 7 ] : Reg8Names[ ( ModRM >> 3 ) & 7 ] ) ;
+      break ;
+
+    case 2 :
+    case 3 :
+      ModRM = DecodeModRM( &D , Size , false , RM , sizeof( RM ) ) ;
+      Emit( &D , "%s %s,%s" , Name , Size ? Reg16Names[ ( ModRM >> 3 ) & 7 ] : Reg8Names[ ( ModRM >> 3 ) & 7 ] , RM ) ;
+      break ;
+
+    case 4 :
+      Emit( &D , "%s AL," , Name ) ;
+      EmitImm8( &D ) ;
+      break ;
+
+    default :
+      Emit( &D , "%s AX," , Name ) ;
+      EmitImm16( &D ) ;
+      break ;
+    }
+
+    return( D.Pos ) ;
+  }
+
+  // PUSH/POP segment register
+  if( ( Opcode < 0x20 ) && ( ( Opcode & 0x06 ) == 0x06 ) )
+  {
+    if( Opcode == 0x0F )
+    {
+      Emit( &D , "HYPERCALL " ) ;
+      EmitImm8( &D ) ;
+    }
+    else
+    {
+      Emit( &D , "%s %s" , ( Opcode & 0x01 ) ? "POP" : "PUSH" , SegNames[ ( Opcode >> 3 ) & 0x03 ] ) ;
+    }
+    return( D.Pos ) ;
+  }
+
+  if( ( Opcode >= 0x40 ) && ( Opcode < 0x60 ) )
+  {
+    static const char * RegOpNames[ 4 ] = { "INC" , "DEC" , "PUSH" , "POP" } ;
+
+    Emit( &D , "%s %s" , RegOpNames[ ( Opcode - 0x40 ) >> 3 ] , Reg16Names[ Opcode & 0x07 ] ) ;
+    return( D.Pos ) ;
+  }
+
+  if( ( Opcode >= 0x70 ) && ( Opcode < 0x80 ) )
+  {
+    Emit( &D , "%s " , JccNames[ Opcode & 0x0F ] ) ;
+    EmitRel8( &D ) ;
+    return( D.Pos ) ;
+  }
+
+  if( ( Opcode >= 0x91 ) && ( Opcode < 0x98 ) )
+  {
+    Emit( &D , "XCHG AX,%s" , Reg16Names[ Opcode & 0x07 ] ) ;
+    return( D.Pos ) ;
+  }
+
+  if( ( Opcode >= 0xB0 ) && ( Opcode < 0xC0 ) )
+  {
+    if( Opcode & 0x08 )
+    {
+      Emit( &D , "MOV %s," , Reg16Names[ Opcode & 0x07 ] ) ;
+      EmitImm16( &D ) ;
+    }
+    else
+    {
+      Emit( &D , "MOV %s," , Reg8Names[ Opcode & 0x07 ] ) ;
+      EmitImm8( &D ) ;
+    }
+    return( D.Pos ) ;
+  }
+
+  if( ( Opcode >= 0xD8 ) && ( Opcode < 0xE0 ) )
+  {
+    ModRM = DecodeModRM( &D , -1 , false , RM , sizeof( RM ) ) ;
+    Emit( &D , "ESC %02Xh,%s" , ( ( Opcode & 0x07 ) << 3 ) | ( ( ModRM >> 3 ) & 0x07 ) , RM ) ;
+    return( D.Pos ) ;
+  }
+
+  switch( Opcode )
+  {
+  case 0x62 :
+    ModRM = DecodeModRM( &D , 1 , false , RM , sizeof( RM ) ) ;
+    Emit( &D , "BOUND %s,%s" , Reg16Names[ ( ModRM >> 3 ) & 7 ] , RM ) ;
+    break ;
+
+  case 0x68 :
+    Emit( &D , "PUSH " ) ;
+    EmitImm16( &D ) ;
+    break ;
+
+  case 0x69 :
+  case 0x6B :
+    ModRM = DecodeModRM( &D , 1 , false , RM , sizeof( RM ) ) ;
+    Emit( &D , "IMUL %s,%s," , Reg16Names[ ( ModRM >> 3 ) & 7 ] , RM ) ;
+    if( Opcode == 0x69 )
+    {
+      EmitImm16( &D ) ;
+    }
+    else
+    {
+      EmitSImm8( &D ) ;
+    }
+    break ;
+
+  case 0x6A :
+    Emit( &D , "PUSH " ) ;
+    EmitSImm8( &D ) ;
+    break ;
+
+  case 0x80 :
+  case 0x81 :
+  case 0x82 :
+  case 0x83 :
+    ModRM = DecodeModRM( &D , Size , true , RM , sizeof( RM ) ) ;
+    Emit( &D , "%s %s," , AluNames[ ( ModRM >> 3 ) & 7 ] , RM ) ;
+    if( Opcode == 0x81 )
+    {
+      EmitImm16( &D ) ;
+    }
+    else if( Opcode == 0x83 )
+    {
+      EmitSImm8( &D ) ;
+    }
+    else
+    {
+      EmitImm8( &D ) ;
+    }
+    break ;
+
+  case 0x84 :
+  case 0x85 :
+  case 0x86 :
+  case 0x87 :
+  case 0x88 :
+  case 0x89 :
+    ModRM = DecodeModRM( &D , Size , false , RM , sizeof( RM ) ) ;
+    Emit( &D , "%s %s,%s" , ( Opcode < 0x86 ) ? "TEST" : ( Opcode < 0x88 ) ? "XCHG" : "MOV" ,
+          RM , Size ? Reg16Names[ ( ModRM >> 3 ) & 7 ] : Reg8Names[ ( ModRM >> 3 ) & 7 ] ) ;
+    break ;
+
+  case 0x8A :
+  case 0x8B :
+    ModRM = DecodeModRM( &D , Size , false , RM , sizeof( RM ) ) ;
+    Emit( &D , "MOV %s,%s" , Size ? Reg16Names[ ( ModRM >> 3 ) & 7 ] : Reg8Names[ ( ModRM >> 3 ) & 7 ] , RM ) ;
+    break ;
+
+  case 0x8C :
+    ModRM = DecodeModRM( &D , 1 , false , RM , sizeof( RM ) ) ;
+    Emit( &D , "MOV %s,%s" , RM , SegNames[ ( ModRM >> 3 ) & 3 ] ) ;
+    break ;
+
+  case 0x8D :
+  case 0xC4 :
+  case 0xC5 :
+    ModRM = DecodeModRM( &D , -1 , false , RM , sizeof( RM ) ) ;
+    Emit( &D , "%s %s,%s" , ( Opcode == 0x8D ) ? "LEA" : ( Opcode == 0xC4 ) ? "LES" : "LDS" ,
+          Reg16Names[ ( ModRM >> 3 ) & 7 ] , RM ) ;
+    break ;
+
+  case 0x8E :
+    ModRM = DecodeModRM( &D , 1 , false , RM , sizeof( RM ) ) ;
+    Emit( &D , "MOV %s,%s" , SegNames[ ( ModRM >> 3 ) & 3 ] , RM ) ;
+    break ;
+
+  case 0x8F :
+    DecodeModRM( &D , 1 , true , RM , sizeof( RM ) ) ;
+    Emit( &D , "POP %s" , RM ) ;
+    break ;
+
+  case 0x9A :
+  case 0xEA :
+    {
+      uint16_t Off ;
+      uint16_t Seg ;
+
+      Off = Fetch16( &D ) ;
+      Seg = Fetch16( &D ) ;
+      Emit( &D , "%s %04X:%04X" , ( Opcode == 0x9A ) ? "CALL" : "JMP" , Seg , Off ) ;
+    }
+    break ;
+
+  case 0xA0 :
+  case 0xA1 :
+    Emit( &D , "MOV %s,%s%s[%04Xh]" , Size ? "AX" : "AL" ,
+          D.SegPrefix ? D.SegPrefix : "" , D.SegPrefix ? ":" : "" , Fetch16( &D ) ) ;
+    break ;
+
+  case 0xA2 :
+  case 0xA3 :
+    {
+      uint16_t Off = Fetch16( &D ) ;
+
+      Emit( &D , "MOV %s%s[%04Xh],%s" , D.SegPrefix ? D.SegPrefix : "" , D.SegPrefix ? ":" : "" ,
+            Off , Size ? "AX" : "AL" ) ;
+    }
+    break ;
+
+  case 0xA8 :
+    Emit( &D , "TEST AL," ) ;
+    EmitImm8( &D ) ;
+    break ;
+
+  case 0xA9 :
+    Emit( &D , "TEST AX," ) ;
+    EmitImm16( &D ) ;
+    break ;
+
+  case 0xC0 :
+  case 0xC1 :
+  case 0xD0 :
+  case 0xD1 :
+  case 0xD2 :
+  case 0xD3 :
+    ModRM = DecodeModRM( &D , Size , true , RM , sizeof( RM ) ) ;
+    Emit( &D , "%s %s," , ShiftNames[ ( ModRM >> 3 ) & 7 ] , RM ) ;
+    if( Opcode < 0xD0 )
+    {
+      EmitImm8( &D ) ;
+    }
+    else
+    {
+      Emit( &D , "%s" , ( Opcode < 0xD2 ) ? "1" : "CL" ) ;
+    }
+    break ;
+
+  case 0xC2 :
+  case 0xCA :
+    Emit( &D , "%s " , ( Opcode == 0xC2 ) ? "RET" : "RETF" ) ;
+    EmitImm16( &D ) ;
+    break ;
+
+  case 0xC6 :
+  case 0xC7 :
+    DecodeModRM( &D , Size , true , RM , sizeof( RM ) ) ;
+    Emit( &D , "MOV %s," , RM ) ;
+    if( Size )
+    {
+      EmitImm16( &D ) ;
+    }
+    else
+    {
+      EmitImm8( &D ) ;
+    }
+    break ;
+
+  case 0xC8 :
+    Emit( &D , "ENTER " ) ;
+    EmitImm16( &D ) ;
+    Emit( &D , "," ) ;
+    EmitImm8( &D ) ;
+    break ;
+
+  case 0xCD :
+    Emit( &D , "INT " ) ;
+    EmitImm8( &D ) ;
+    break ;
+
+  case 0xD4 :
+  case 0xD5 :
+    Emit( &D , "%s " , ( Opcode == 0xD4 ) ? "AAM" : "AAD" ) ;
+    EmitImm8( &D ) ;
+    break ;
+
+  case 0xE0 :
+  case 0xE1 :
+  case 0xE2 :
+  case 0xE3 :
+    {
+      static const char * LoopNames[ 4 ] = { "LOOPNZ" , "LOOPZ" , "LOOP" , "JCXZ" } ;
+
+      Emit( &D , "%s " , LoopNames[ Opcode & 0x03 ] ) ;
+      EmitRel8( &D ) ;
+    }
+    break ;
+
+  case 0xE4 :
+  case 0xE5 :
+    Emit( &D , "IN %s," , Size ? "AX" : "AL" ) ;
+    EmitImm8( &D ) ;
+    break ;
+
+  case 0xE6 :
+  case 0xE7 :
+    Emit( &D , "OUT " ) ;
+    EmitImm8( &D ) ;
+    Emit( &D , ",%s" , Size ? "AX" : "AL" ) ;
+    break ;
+
+  case 0xE8 :
+  case 0xE9 :
+    Emit( &D , "%s " , ( Opcode == 0xE8 ) ? "CALL" : "JMP" ) ;
+    EmitRel16( &D ) ;
+    break ;
+
+  case 0xEB :
+    Emit( &D , "JMP SHORT " ) ;
+    EmitRel8( &D ) ;
+    break ;
+
+  case 0xF6 :
+  case 0xF7 :
+    ModRM = DecodeModRM( &D , Size , true , RM , sizeof( RM ) ) ;
+    Emit( &D , "%s %s" , Grp3Names[ ( ModRM >> 3 ) & 7 ] , RM ) ;
+    if( ( ( ModRM >> 3 ) & 7 ) < 2 )
+    {
+      Emit( &D , "," ) ;
+      if( Size )
+      {
+        EmitImm16( &D ) ;
+      }
+      else
+      {
+        EmitImm8( &D ) ;
+      }
+    }
+    break ;
+
+  case 0xFE :
+    ModRM = DecodeModRM( &D , 0 , true , RM , sizeof( RM ) ) ;
+    Emit( &D , "%s %s" , ( ( ModRM >> 3 ) & 7 ) ? "DEC" : "INC" , RM ) ;
+    break ;
+
+  case 0xFF :
+    ModRM = DecodeModRM( &D , 1 , true , RM , sizeof( RM ) ) ;
+    Emit( &D , "%s %s" , Grp5Names[ ( ModRM >> 3 ) & 7 ] , RM ) ;
+    break ;
+
+  default :
+    Emit( &D , "DB %02Xh" , Opcode ) ;
+    break ;
+  }
+
+  return( D.Pos ) ;
+}
@@ -0,0 +1,40 @@
+// =============================================================================
+// File: XTdisasm.h
+//
+// Description:
+// 8086/80186 instruction disassembler used for emulator diagnostics.
+//
+// This work is licensed under the MIT License. See included LICENSE.TXT.
+//
+
+#ifndef _XTDISASM_
+#define _XTDISASM_
+
+#include <stdint.h>
+
+// =============================================================================
+// Function: DISASM_Instruction
+//
+// Description:
+// Disassemble a single instruction, including any prefixes.
+// 0F xx is decoded as the emulator hypercall it is in this machine.
+//
+// Parameters:
+//
+//   Code    : Pointer to the instruction bytes. At least 16 bytes must be
+//             readable.
+//
+//   IP      : The offset of the instruction in its code segment, used to
+//             show the target of relative jumps and calls.
+//
+//   Text    : Set to the disassembled instruction text.
+//
+//   TextLen : The size of the Text buffer.
+//
+// Returns:
+//
+//   int : The length of the instruction in bytes.
+//
+int DISASM_Instruction( const uint8_t * Code , uint16_t IP , char * Text , int TextLen ) ;
+
+#endif // _XTDISASM_
@@ -0,0 +1,1875 @@
+// =============================================================================
+// File: XTdisk.cpp
+//
+// Description:
+// Disk image access.
+// See XTdisk.h for details.
+//
+// This work is licensed under the MIT License. See included LICENSE.TXT.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#if defined( _WIN32 )
+  #include <windows.h>
+  #include <io.h>
+#else
+  #include <sys/mman.h>
+  #include <pthread.h>
+  #include <time.h>
+#endif
+
+#include "XTdisk.h"
+#include "XTimage.h"
+#include "XTprefetch.h"
+#include "XTvfat.h"
+
+#ifndef O_BINARY
+  #define O_BINARY                               0
+#endif
+
+#ifndef O_NOINHERIT
+  #define O_NOINHERIT                            0
+#endif
+
+#define DISK_MAX_PATH                            1024
+
+#define DISK_DELTA_MAGIC                         "XTDD"
+#define DISK_DELTA_VERSION                       1
+#define DISK_DELTA_ALIGN                         0x1000
+
+// Write back cache limits
+#define DISK_CACHE_ENTRIES                       256
+#define DISK_CACHE_BYTES                         0x100000 // 1MB
+#define DISK_CACHE_RUN                           0x10000  // Longest write made
+
+// Write back cache events
+#define DISK_EVENT_WORK                          0 // A write was queued
+#define DISK_EVENT_DONE                          1 // A write was made
+#define DISK_EVENT_COUNT                         2
+
+// Statistics
+#define DISK_STATS_BUCKETS                       32       // Power of 2 histogram buckets
+#define DISK_STATS_REGION                        0x10000  // Smallest region counted for heat
+#define DISK_STATS_REGIONS                       4096     // Most regions counted for heat
+#define DISK_STATS_HOT                           8        // Hottest regions printed
+
+// A delta file is this header, the sector bitmap and then the sectors, each
+// at the same offset from the start of the data as in the base image. The
+// sectors never written are left as holes in the file.
+typedef struct STDISKDELTAHEADER_T
+{
+  char     magic[ 4 ]   ;
+  uint32_t version      ;
+  uint32_t sector_size  ;
+  uint32_t reserved     ;
+  uint64_t sector_count ; // Sectors in the base image
+  uint64_t data_offset  ; // Offset of the first sector
+} stDiskDeltaHeader_t ;
+
+typedef struct STDISK_T
+{
+  int        File       ; // -1 if no image is open
+  int64_t    Size       ;
+  char       Filename[ DISK_MAX_PATH ] ;
+  stImage_t * Image     ; // NULL for a raw image
+  stVFat_t * VFat       ; // A host directory, NULL for an image file
+  uint8_t  * Map        ; // The image mapped into memory, NULL for file I/O
+  stPrefetch_t * Prefetch ; // Boot trace prefetch, NULL if not traced
+#if defined( _WIN32 )
+  HANDLE     Mapping    ;
+#endif
+  bool       Overlay    ;
+  uint8_t ** Blocks     ; // Overlay blocks, NULL until written
+  int        BlockCount ;
+  char       DeltaName[ DISK_MAX_PATH ] ; // Empty for no delta file
+  int        Delta      ;
+  uint8_t  * Bitmap     ; // Sectors held in the delta, NULL if no delta is open
+  int64_t    SectorCount ;
+  int64_t    DeltaData  ; // Offset of the sectors in the delta file
+  uint8_t ** Scratch    ; // Scratch blocks, NULL until written
+  int        ScratchCount ;
+} stDisk_t ;
+
+typedef struct STDISKWRITE_T
+{
+  int       Drive  ;
+  int64_t   Offset ;
+  int       Length ;
+  uint8_t * Data   ;
+} stDiskWrite_t ;
+
+// Bucket n of a histogram counts values from 2^(n-1) to 2^n - 1, bucket 0
+// counts zero.
+typedef struct STDISKOPSTATS_T
+{
+  uint64_t Calls       ;
+  uint64_t Bytes       ;
+  uint64_t Sequential  ; // Calls starting where the last call ended
+  uint64_t Nanoseconds ; // Host time taken
+  uint64_t Sizes[ DISK_STATS_BUCKETS ]   ; // Bytes per call
+  uint64_t Latency[ DISK_STATS_BUCKETS ] ; // Microseconds per call
+} stDiskOpStats_t ;
+
+typedef struct STDISKSTATS_T
+{
+  stDiskOpStats_t Read  ;
+  stDiskOpStats_t Write ;
+  uint64_t   Seeks[ DISK_STATS_BUCKETS ] ; // Sectors from the last call
+  int64_t    LastEnd     ;
+  uint64_t * Heat        ; // Sectors accessed in each region
+  int        Regions     ;
+  int        RegionShift ;
+} stDiskStats_t ;
+
+// =============================================================================
+// Local variables
+//
+
+static stDisk_t Disks[ DISK_COUNT ] ;
+static bool     DisksReady = false ;
+
+// Statistics are kept for each drive as long as the emulator runs, whatever
+// images are opened on it.
+static stDiskStats_t Stats[ DISK_COUNT ] ;
+
+// Every write to any drive is counted, so callers can tell whether disk
+// contents changed between two points in time.
+static uint32_t      WriteCount = 0 ;
+
+// Writes made while scratch is set go to scratch blocks above everything
+// else, and are thrown away when it is cleared.
+static bool          ScratchMode = false ;
+
+// Writes are queued and made by a writer thread, so the CPU does not wait
+// for the host storage. The writer runs from the first write queued until
+// the queue is flushed. Other than by the writer, images are only read
+// holding the storage lock, once queued writes to the sectors read are made.
+static int           CacheMode   = DISK_CACHE_OFF ;
+static stDiskWrite_t Queue[ DISK_CACHE_ENTRIES ] ;
+static int           QueueHead   = 0 ; // The oldest write
+static int           QueueCount  = 0 ;
+static int           QueueBytes  = 0 ;
+static int           QueueBusy   = 0 ; // Writes from the head being made
+static bool          Running     = false ;
+static bool          StopWriter  = false ;
+static bool          WriteFailed = false ;
+
+#if defined( _WIN32 )
+static CRITICAL_SECTION QueueLock ;
+static CRITICAL_SECTION StorageLock ;
+static HANDLE           QueueEvents[ DISK_EVENT_COUNT ] ;
+static HANDLE           Writer ;
+static bool             LocksReady = false ;
+#else
+static pthread_mutex_t  QueueLock   = PTHREAD_MUTEX_INITIALIZER ;
+static pthread_mutex_t  StorageLock = PTHREAD_MUTEX_INITIALIZER ;
+static pthread_cond_t   QueueEvents[ DISK_EVENT_COUNT ] = { PTHREAD_COND_INITIALIZER , PTHREAD_COND_INITIALIZER } ;
+static pthread_t        Writer ;
+#endif
+
+// =============================================================================
+// Local functions
+//
+
+// Mark all drives empty before the first one is used.
+static void InitDisks( void )
+{
+  if( !DisksReady )
+  {
+    for( int i = 0 ; i < DISK_COUNT ; i++ )
+    {
+      Disks[ i ].File = -1 ;
+    }
+    DisksReady = true ;
+  }
+}
+
+static stDisk_t * GetDisk( int Drive )
+{
+  InitDisks() ;
+
+  if( ( Drive < 0 ) || ( Drive >= DISK_COUNT ) || ( ( Disks[ Drive ].File < 0 ) && ( Disks[ Drive ].VFat == NULL ) ) )
+  {
+    return( NULL ) ;
+  }
+
+  return( &Disks[ Drive ] ) ;
+}
+
+// Host directories are read only, so writes to them are kept in an overlay.
+static bool HasOverlay( const stDisk_t * Disk )
+{
+  return( Disk->Overlay || ( Disk->VFat != NULL ) ) ;
+}
+
+// The image file is only read if written data is kept elsewhere.
+static bool ReadOnly( const stDisk_t * Disk )
+{
+  return( Disk->Overlay || ( Disk->DeltaName[ 0 ] != 0 ) ) ;
+}
+
+static int ReadAt( int File , int64_t Offset , void * Buffer , int Length )
+{
+  if( lseek( File , ( off_t ) Offset , SEEK_SET ) == ( off_t ) -1 )
+  {
+    return( 0 ) ;
+  }
+
+  return( read( File , Buffer , Length ) ) ;
+}
+
+static int WriteAt( int File , int64_t Offset , const void * Buffer , int Length )
+{
+  if( lseek( File , ( off_t ) Offset , SEEK_SET ) == ( off_t ) -1 )
+  {
+    return( 0 ) ;
+  }
+
+  return( write( File , Buffer , Length ) ) ;
+}
+
+// Map the image into memory, read only if written data is kept elsewhere. Images
+// that cannot be mapped, such as empty ones, are read and written through
+// file I/O instead.
+static void MapImage( stDisk_t * Disk )
+{
+  Disk->Map = NULL ;
+
+  if( ( Disk->Size <= 0 ) || ( ( uint64_t ) Disk->Size > ( uint64_t ) ( ( size_t ) -1 ) ) )
+  {
+    return ;
+  }
+
+#if defined( _WIN32 )
+  Disk->Mapping = CreateFileMapping( ( HANDLE ) _get_osfhandle( Disk->File ) , NULL ,
+                                     ( ReadOnly( Disk ) ) ? PAGE_READONLY : PAGE_READWRITE , 0 , 0 , NULL ) ;
+  if( Disk->Mapping != NULL )
+  {
+    Disk->Map = ( uint8_t * ) MapViewOfFile( Disk->Mapping , ( ReadOnly( Disk ) ) ? FILE_MAP_READ : FILE_MAP_WRITE , 0 , 0 , 0 ) ;
+    if( Disk->Map == NULL )
+    {
+      CloseHandle( Disk->Mapping ) ;
+    }
+  }
+#else
+  void * Data = mmap( NULL , ( size_t ) Disk->Size , ( ReadOnly( Disk ) ) ? PROT_READ : ( PROT_READ | PROT_WRITE ) ,
+                      MAP_SHARED , Disk->File , 0 ) ;
+
+  Disk->Map = ( Data != MAP_FAILED ) ? ( uint8_t * ) Data : NULL ;
+#endif
+}
+
+// Write back and unmap the image.
+static void UnmapImage( stDisk_t * Disk )
+{
+  if( Disk->Map == NULL )
+  {
+    return ;
+  }
+
+#if defined( _WIN32 )
+  FlushViewOfFile( Disk->Map , 0 ) ;
+  UnmapViewOfFile( Disk->Map ) ;
+  CloseHandle( Disk->Mapping ) ;
+#else
+  msync( Disk->Map , ( size_t ) Disk->Size , MS_SYNC ) ;
+  munmap( Disk->Map , ( size_t ) Disk->Size ) ;
+#endif
+
+  Disk->Map = NULL ;
+}
+
+static int ReadBase( stDisk_t * Disk , int64_t Offset , uint8_t * Buffer , int Length )
+{
+  if( Disk->VFat != NULL )
+  {
+    return( VFAT_Read( Disk->VFat , Offset , Buffer , Length ) ) ;
+  }
+
+  if( Disk->Image != NULL )
+  {
+    return( IMAGE_Read( Disk->Image , Disk->File , Offset , Buffer , Length ) ) ;
+  }
+
+  if( Disk->Map != NULL )
+  {
+    if( ( Offset < 0 ) || ( Offset >= Disk->Size ) )
+    {
+      return( 0 ) ;
+    }
+
+    if( Length > Disk->Size - Offset )
+    {
+      Length = ( int ) ( Disk->Size - Offset ) ;
+    }
+
+    memcpy( Buffer , Disk->Map + Offset , Length ) ;
+
+    return( Length ) ;
+  }
+
+  return( ReadAt( Disk->File , Offset , Buffer , Length ) ) ;
+}
+
+static bool InDelta( const stDisk_t * Disk , int64_t Sector )
+{
+  return( ( Disk->Bitmap[ Sector >> 3 ] & ( 1 << ( Sector & 7 ) ) ) != 0 ) ;
+}
+
+static void CloseDelta( stDisk_t * Disk )
+{
+  if( Disk->Bitmap != NULL )
+  {
+    close( Disk->Delta ) ;
+    free( Disk->Bitmap ) ;
+    Disk->Bitmap = NULL ;
+  }
+}
+
+// Open the delta file for the image, creating it if it does not exist.
+static bool OpenDelta( stDisk_t * Disk )
+{
+  stDiskDeltaHeader_t Header ;
+  int                 BitmapLength ;
+
+  Disk->SectorCount = ( Disk->Size + DISK_SECTOR_SIZE - 1 ) / DISK_SECTOR_SIZE ;
+  BitmapLength      = ( int ) ( ( Disk->SectorCount + 7 ) / 8 ) ;
+
+  Disk->Delta = open( Disk->DeltaName , O_BINARY | O_NOINHERIT | ( ( Disk->Overlay ) ? O_RDONLY : ( O_RDWR | O_CREAT ) ) , 0644 ) ;
+  if( Disk->Delta < 0 )
+  {
+    return( false ) ;
+  }
+
+  Disk->Bitmap = ( uint8_t * ) calloc( BitmapLength + 1 , 1 ) ;
+  if( Disk->Bitmap == NULL )
+  {
+    close( Disk->Delta ) ;
+    return( false ) ;
+  }
+
+  if( ReadAt( Disk->Delta , 0 , &Header , sizeof( Header ) ) == 0 )
+  {
+    // A new delta holds no sectors.
+    memcpy( Header.magic , DISK_DELTA_MAGIC , sizeof( Header.magic ) ) ;
+    Header.version      = DISK_DELTA_VERSION ;
+    Header.sector_size  = DISK_SECTOR_SIZE ;
+    Header.reserved     = 0 ;
+    Header.sector_count = Disk->SectorCount ;
+    Header.data_offset  = ( sizeof( Header ) + BitmapLength + DISK_DELTA_ALIGN - 1 ) & ~( uint64_t ) ( DISK_DELTA_ALIGN - 1 ) ;
+
+#if defined( _WIN32 )
+    // NTFS only leaves holes in files marked sparse.
+    DWORD Returned ;
+    DeviceIoControl( ( HANDLE ) _get_osfhandle( Disk->Delta ) , FSCTL_SET_SPARSE , NULL , 0 , NULL , 0 , &Returned , NULL ) ;
+#endif
+
+    if( ( WriteAt( Disk->Delta , 0 , &Header , sizeof( Header ) ) != sizeof( Header ) ) ||
+        ( WriteAt( Disk->Delta , sizeof( Header ) , Disk->Bitmap , BitmapLength ) != BitmapLength ) )
+    {
+      CloseDelta( Disk ) ;
+      return( false ) ;
+    }
+  }
+  else if( ( memcmp( Header.magic , DISK_DELTA_MAGIC , sizeof( Header.magic ) ) != 0 ) ||
+           ( Header.version != DISK_DELTA_VERSION ) || ( Header.sector_size != DISK_SECTOR_SIZE ) ||
+           ( Header.sector_count != ( uint64_t ) Disk->SectorCount ) ||
+           ( ReadAt( Disk->Delta , sizeof( Header ) , Disk->Bitmap , BitmapLength ) != BitmapLength ) )
+  {
+    // Not a delta, or the delta of a different image.
+    CloseDelta( Disk ) ;
+    return( false ) ;
+  }
+
+  Disk->DeltaData = ( int64_t ) Header.data_offset ;
+
+  return( true ) ;
+}
+
+// Read the image, taking sectors from the delta file where it has them.
+static int ReadImage( stDisk_t * Disk , int64_t Offset , uint8_t * Buffer , int Length )
+{
+  int64_t Sector ;
+  bool    Delta ;
+  int     Done ;
+  int     Count ;
+
+  if( Disk->Bitmap == NULL )
+  {
+    return( ReadBase( Disk , Offset , Buffer , Length ) ) ;
+  }
+
+  if( ( Offset < 0 ) || ( Offset >= Disk->Size ) )
+  {
+    return( 0 ) ;
+  }
+
+  if( Length > Disk->Size - Offset )
+  {
+    Length = ( int ) ( Disk->Size - Offset ) ;
+  }
+
+  // Read runs of sectors from the same file.
+  for( Done = 0 ; Done < Length ; Done += Count )
+  {
+    Sector = ( Offset + Done ) / DISK_SECTOR_SIZE ;
+    Delta  = InDelta( Disk , Sector ) ;
+    Count  = DISK_SECTOR_SIZE - ( int ) ( ( Offset + Done ) % DISK_SECTOR_SIZE ) ;
+    while( ( Count < Length - Done ) && ( InDelta( Disk , ++Sector ) == Delta ) )
+    {
+      Count += DISK_SECTOR_SIZE ;
+    }
+    Count = ( Count < Length - Done ) ? Count : ( Length - Done ) ;
+
+    if( ( ( Delta ) ? ReadAt( Disk->Delta , Disk->DeltaData + Offset + Done , Buffer + Done , Count )
+                    : ReadBase( Disk , Offset + Done , Buffer + Done , Count ) ) != Count )
+    {
+      return( -1 ) ;
+    }
+  }
+
+  return( Done ) ;
+}
+
+// Write to the delta file. Sectors are written whole, so a sector written
+// in part is first copied from the image.
+static int WriteDelta( stDisk_t * Disk , int64_t Offset , const uint8_t * Buffer , int Length )
+{
+  uint8_t         Sector[ DISK_SECTOR_SIZE ] ;
+  const uint8_t * Data ;
+  int64_t         Index ;
+  int64_t         First ;
+  int64_t         Last ;
+  int             Start ;
+  int             Done ;
+  int             Count ;
+
+  if( ( Offset < 0 ) || ( Offset >= Disk->Size ) )
+  {
+    return( 0 ) ;
+  }
+
+  if( Length > Disk->Size - Offset )
+  {
+    Length = ( int ) ( Disk->Size - Offset ) ;
+  }
+
+  for( Done = 0 ; Done < Length ; Done += Count )
+  {
+    Index = ( Offset + Done ) / DISK_SECTOR_SIZE ;
+    Start = ( int ) ( ( Offset + Done ) % DISK_SECTOR_SIZE ) ;
+    Count = DISK_SECTOR_SIZE - Start ;
+    Data  = Buffer + Done ;
+
+    if( ( Start == 0 ) && ( Count <= Length - Done ) )
+    {
+      // Runs of whole sectors are written at once.
+      Count = ( ( Length - Done ) / DISK_SECTOR_SIZE ) * DISK_SECTOR_SIZE ;
+    }
+    else
+    {
+      Count = ( Count < Length - Done ) ? Count : ( Length - Done ) ;
+      if( ReadImage( Disk , Index * DISK_SECTOR_SIZE , Sector , DISK_SECTOR_SIZE ) < 0 )
+      {
+        return( -1 ) ;
+      }
+      memcpy( Sector + Start , Data , Count ) ;
+      Data = Sector ;
+    }
+
+    if( WriteAt( Disk->Delta , Disk->DeltaData + Index * DISK_SECTOR_SIZE , Data ,
+                 ( Data == Sector ) ? DISK_SECTOR_SIZE : Count ) != ( ( Data == Sector ) ? DISK_SECTOR_SIZE : Count ) )
+    {
+      return( -1 ) ;
+    }
+  }
+
+  // Mark the sectors written once their data is in the delta.
+  First = Offset / DISK_SECTOR_SIZE ;
+  Last  = ( Offset + Length - 1 ) / DISK_SECTOR_SIZE ;
+  for( Index = First ; Index <= Last ; Index++ )
+  {
+    Disk->Bitmap[ Index >> 3 ] |= ( uint8_t ) ( 1 << ( Index & 7 ) ) ;
+  }
+
+  if( WriteAt( Disk->Delta , sizeof( stDiskDeltaHeader_t ) + ( First >> 3 ) , Disk->Bitmap + ( First >> 3 ) ,
+               ( int ) ( ( Last >> 3 ) - ( First >> 3 ) + 1 ) ) <= 0 )
+  {
+    return( -1 ) ;
+  }
+
+  return( Done ) ;
+}
+
+// Empty the delta file.
+static bool ClearDelta( stDisk_t * Disk )
+{
+  int BitmapLength = ( int ) ( ( Disk->SectorCount + 7 ) / 8 ) ;
+
+  memset( Disk->Bitmap , 0 , BitmapLength ) ;
+
+  return( ( WriteAt( Disk->Delta , sizeof( stDiskDeltaHeader_t ) , Disk->Bitmap , BitmapLength ) == BitmapLength ) &&
+          ( ftruncate( Disk->Delta , ( off_t ) Disk->DeltaData ) == 0 ) ) ;
+}
+
+// Get an overlay block for writing, copying it from the image if needed.
+static uint8_t * WriteBlock( stDisk_t * Disk , int Block )
+{
+  uint8_t * Data = Disk->Blocks[ Block ] ;
+  int64_t   Start ;
+  int       Length ;
+
+  if( Data == NULL )
+  {
+    Data = ( uint8_t * ) calloc( DISK_OVERLAY_BLOCK , 1 ) ;
+    if( Data == NULL )
+    {
+      return( NULL ) ;
+    }
+
+    Start  = ( int64_t ) Block * DISK_OVERLAY_BLOCK ;
+    Length = ( int ) ( ( Disk->Size - Start < DISK_OVERLAY_BLOCK ) ? ( Disk->Size - Start ) : DISK_OVERLAY_BLOCK ) ;
+    if( ReadImage( Disk , Start , Data , Length ) != Length )
+    {
+      free( Data ) ;
+      return( NULL ) ;
+    }
+
+    Disk->Blocks[ Block ] = Data ;
+  }
+
+  return( Data ) ;
+}
+
+// Read a drive, through its overlay if it has one.
+static int ReadDisk( stDisk_t * Disk , int64_t Offset , uint8_t * Buffer , int Length )
+{
+  int        Done ;
+  int        Count ;
+  int        Block ;
+  int        Start ;
+
+  if( !HasOverlay( Disk ) )
+  {
+    return( ReadImage( Disk , Offset , Buffer , Length ) ) ;
+  }
+
+  if( ( Offset < 0 ) || ( Offset >= Disk->Size ) )
+  {
+    return( 0 ) ;
+  }
+
+  if( Length > Disk->Size - Offset )
+  {
+    Length = ( int ) ( Disk->Size - Offset ) ;
+  }
+
+  // Copy written blocks from the overlay and read runs of unwritten blocks
+  // from the image.
+  for( Done = 0 ; Done < Length ; Done += Count )
+  {
+    Block = ( int ) ( ( Offset + Done ) / DISK_OVERLAY_BLOCK ) ;
+    Start = ( int ) ( ( Offset + Done ) % DISK_OVERLAY_BLOCK ) ;
+    Count = DISK_OVERLAY_BLOCK - Start ;
+
+    if( Disk->Blocks[ Block ] != NULL )
+    {
+      Count = ( Count < Length - Done ) ? Count : ( Length - Done ) ;
+      memcpy( Buffer + Done , Disk->Blocks[ Block ] + Start , Count ) ;
+    }
+    else
+    {
+      while( ( Count < Length - Done ) && ( Disk->Blocks[ ++Block ] == NULL ) )
+      {
+        Count += DISK_OVERLAY_BLOCK ;
+      }
+      Count = ( Count < Length - Done ) ? Count : ( Length - Done ) ;
+
+      if( ReadImage( Disk , Offset + Done , Buffer + Done , Count ) != Count )
+      {
+        return( -1 ) ;
+      }
+    }
+  }
+
+  return( Done ) ;
+}
+
+// Write a drive, to its overlay if it has one.
+static int WriteDisk( stDisk_t * Disk , int64_t Offset , const uint8_t * Buffer , int Length )
+{
+  uint8_t  * Data ;
+  int        Done ;
+  int        Count ;
+  int        Start ;
+
+  if( !HasOverlay( Disk ) && ( Disk->Bitmap != NULL ) )
+  {
+    return( WriteDelta( Disk , Offset , Buffer , Length ) ) ;
+  }
+
+  if( !HasOverlay( Disk ) && ( Disk->Image != NULL ) )
+  {
+    return( IMAGE_Write( Disk->Image , Disk->File , Offset , Buffer , Length ) ) ;
+  }
+
+  if( !HasOverlay( Disk ) )
+  {
+    if( ( Disk->Map != NULL ) && ( Offset >= 0 ) && ( Offset + Length <= Disk->Size ) )
+    {
+      memcpy( Disk->Map + Offset , Buffer , Length ) ;
+      return( Length ) ;
+    }
+
+    // A write past the end grows the image, which is then mapped again.
+    UnmapImage( Disk ) ;
+
+    Count = 0 ;
+    if( lseek( Disk->File , ( off_t ) Offset , SEEK_SET ) != ( off_t ) -1 )
+    {
+      Count = write( Disk->File , Buffer , Length ) ;
+      if( ( Count > 0 ) && ( Offset + Count > Disk->Size ) )
+      {
+        Disk->Size = Offset + Count ;
+      }
+    }
+
+    MapImage( Disk ) ;
+
+    return( Count ) ;
+  }
+
+  if( ( Offset < 0 ) || ( Offset >= Disk->Size ) )
+  {
+    return( 0 ) ;
+  }
+
+  if( Length > Disk->Size - Offset )
+  {
+    Length = ( int ) ( Disk->Size - Offset ) ;
+  }
+
+  for( Done = 0 ; Done < Length ; Done += Count )
+  {
+    Data = WriteBlock( Disk , ( int ) ( ( Offset + Done ) / DISK_OVERLAY_BLOCK ) ) ;
+    if( Data == NULL )
+    {
+      return( -1 ) ;
+    }
+
+    Start = ( int ) ( ( Offset + Done ) % DISK_OVERLAY_BLOCK ) ;
+    Count = ( DISK_OVERLAY_BLOCK - Start < Length - Done ) ? ( DISK_OVERLAY_BLOCK - Start ) : ( Length - Done ) ;
+    memcpy( Data + Start , Buffer + Done , Count ) ;
+  }
+
+  return( Done ) ;
+}
+
+// Only the main thread starts and stops the writer, so while it is not
+// running there is nothing to lock.
+static void LockQueue( void )
+{
+  if( Running )
+  {
+#if defined( _WIN32 )
+    EnterCriticalSection( &QueueLock ) ;
+#else
+    pthread_mutex_lock( &QueueLock ) ;
+#endif
+  }
+}
+
+static void UnlockQueue( void )
+{
+  if( Running )
+  {
+#if defined( _WIN32 )
+    LeaveCriticalSection( &QueueLock ) ;
+#else
+    pthread_mutex_unlock( &QueueLock ) ;
+#endif
+  }
+}
+
+static void LockStorage( void )
+{
+  if( Running )
+  {
+#if defined( _WIN32 )
+    EnterCriticalSection( &StorageLock ) ;
+#else
+    pthread_mutex_lock( &StorageLock ) ;
+#endif
+  }
+}
+
+static void UnlockStorage( void )
+{
+  if( Running )
+  {
+#if defined( _WIN32 )
+    LeaveCriticalSection( &StorageLock ) ;
+#else
+    pthread_mutex_unlock( &StorageLock ) ;
+#endif
+  }
+}
+
+// Wait for an event with the queue locked. The queue must be checked
+// again after waiting.
+static void WaitQueue( int Event )
+{
+#if defined( _WIN32 )
+  LeaveCriticalSection( &QueueLock ) ;
+  WaitForSingleObject( QueueEvents[ Event ] , INFINITE ) ;
+  EnterCriticalSection( &QueueLock ) ;
+#else
+  pthread_cond_wait( &QueueEvents[ Event ] , &QueueLock ) ;
+#endif
+}
+
+static void SignalQueue( int Event )
+{
+#if defined( _WIN32 )
+  SetEvent( QueueEvents[ Event ] ) ;
+#else
+  pthread_cond_signal( &QueueEvents[ Event ] ) ;
+#endif
+}
+
+// Make sure what was written is on the host storage.
+static bool SyncDisk( stDisk_t * Disk , int64_t Offset , int Length )
+{
+  bool Ok = true ;
+
+#if defined( _WIN32 )
+  if( Disk->Map != NULL )
+  {
+    Ok = ( FlushViewOfFile( Disk->Map + Offset , Length ) != 0 ) ;
+  }
+
+  Ok = Ok && ( _commit( Disk->File ) == 0 ) ;
+  if( Disk->Bitmap != NULL )
+  {
+    Ok = Ok && ( _commit( Disk->Delta ) == 0 ) ;
+  }
+#else
+  int64_t Page = sysconf( _SC_PAGESIZE ) ;
+  int64_t Start = Offset - Offset % Page ;
+
+  if( Disk->Map != NULL )
+  {
+    Ok = ( msync( Disk->Map + Start , ( size_t ) ( Offset + Length - Start ) , MS_SYNC ) == 0 ) ;
+  }
+
+  Ok = Ok && ( fsync( Disk->File ) == 0 ) ;
+  if( Disk->Bitmap != NULL )
+  {
+    Ok = Ok && ( fsync( Disk->Delta ) == 0 ) ;
+  }
+#endif
+
+  return( Ok ) ;
+}
+
+// Make the queued writes until the queue is empty and the writer is asked
+// to stop. Runs of writes to consecutive parts of a drive are made at once.
+static void WriteBack( void )
+{
+  static uint8_t  Run[ DISK_CACHE_RUN ] ;
+  stDiskWrite_t * First ;
+  stDiskWrite_t * Next ;
+  const uint8_t * Data ;
+  int             Length ;
+  int             Count ;
+  bool            Ok ;
+
+  LockQueue() ;
+
+  for( ;; )
+  {
+    while( ( QueueCount == 0 ) && !StopWriter )
+    {
+      WaitQueue( DISK_EVENT_WORK ) ;
+    }
+
+    if( QueueCount == 0 )
+    {
+      break ;
+    }
+
+    First  = &Queue[ QueueHead ] ;
+    Length = First->Length ;
+    for( Count = 1 ; Count < QueueCount ; Count++ )
+    {
+      Next = &Queue[ ( QueueHead + Count ) % DISK_CACHE_ENTRIES ] ;
+      if( ( Next->Drive != First->Drive ) || ( Next->Offset != First->Offset + Length ) ||
+          ( Length + Next->Length > DISK_CACHE_RUN ) )
+      {
+        break ;
+      }
+      Length += Next->Length ;
+    }
+
+    // The writes taken are left alone until they are made.
+    QueueBusy = Count ;
+    UnlockQueue() ;
+
+    Data = First->Data ;
+    if( Count > 1 )
+    {
+      Length = 0 ;
+      for( int i = 0 ; i < Count ; i++ )
+      {
+        Next = &Queue[ ( QueueHead + i ) % DISK_CACHE_ENTRIES ] ;
+        memcpy( Run + Length , Next->Data , Next->Length ) ;
+        Length += Next->Length ;
+      }
+      Data = Run ;
+    }
+
+    LockStorage() ;
+    Ok = ( WriteDisk( &Disks[ First->Drive ] , First->Offset , Data , Length ) == Length ) ;
+    if( Ok && ( CacheMode == DISK_CACHE_SYNC ) )
+    {
+      Ok = SyncDisk( &Disks[ First->Drive ] , First->Offset , Length ) ;
+    }
+    UnlockStorage() ;
+
+    LockQueue() ;
+
+    WriteFailed = WriteFailed || !Ok ;
+    for( int i = 0 ; i < Count ; i++ )
+    {
+      Next = &Queue[ QueueHead ] ;
+      free( Next->Data ) ;
+      QueueBytes -= Next->Length ;
+      QueueHead   = ( QueueHead + 1 ) % DISK_CACHE_ENTRIES ;
+    }
+    QueueCount -= Count ;
+    QueueBusy   = 0 ;
+
+    SignalQueue( DISK_EVENT_DONE ) ;
+  }
+
+  UnlockQueue() ;
+}
+
+#if defined( _WIN32 )
+static DWORD WINAPI WriterThread( LPVOID Parameter )
+#else
+static void * WriterThread( void * Parameter )
+#endif
+{
+  ( void ) Parameter ;
+
+  WriteBack() ;
+
+  return( 0 ) ;
+}
+
+static bool StartWriter( void )
+{
+  // Running before the writer starts, as the writer locks the queue.
+  StopWriter = false ;
+  Running    = true ;
+
+#if defined( _WIN32 )
+  if( !LocksReady )
+  {
+    InitializeCriticalSection( &QueueLock ) ;
+    InitializeCriticalSection( &StorageLock ) ;
+    for( int i = 0 ; i < DISK_EVENT_COUNT ; i++ )
+    {
+      QueueEvents[ i ] = CreateEvent( NULL , FALSE , FALSE , NULL ) ;
+    }
+    LocksReady = true ;
+  }
+
+  Writer = CreateThread( NULL , 0 , WriterThread , NULL , 0 , NULL ) ;
+  if( Writer == NULL )
+  {
+    Running = false ;
+  }
+#else
+  if( pthread_create( &Writer , NULL , WriterThread , NULL ) != 0 )
+  {
+    Running = false ;
+  }
+#endif
+
+  return( Running ) ;
+}
+
+// Make all queued writes and stop the writer.
+static void FlushQueue( void )
+{
+  if( !Running )
+  {
+    return ;
+  }
+
+  LockQueue() ;
+  StopWriter = true ;
+  SignalQueue( DISK_EVENT_WORK ) ;
+  UnlockQueue() ;
+
+#if defined( _WIN32 )
+  WaitForSingleObject( Writer , INFINITE ) ;
+  CloseHandle( Writer ) ;
+#else
+  pthread_join( Writer , NULL ) ;
+#endif
+
+  Running = false ;
+}
+
+static bool Overlaps( const stDiskWrite_t * Write , int Drive , int64_t Offset , int Length )
+{
+  return( ( Write->Drive == Drive ) && ( Write->Offset < Offset + Length ) && ( Offset < Write->Offset + Write->Length ) ) ;
+}
+
+// Wait until no queued write is to the part of the drive given.
+static void WaitForWrites( int Drive , int64_t Offset , int Length )
+{
+  bool Wait = true ;
+
+  if( !Running )
+  {
+    return ;
+  }
+
+  LockQueue() ;
+
+  while( Wait )
+  {
+    Wait = false ;
+    for( int i = 0 ; !Wait && ( i < QueueCount ) ; i++ )
+    {
+      Wait = Overlaps( &Queue[ ( QueueHead + i ) % DISK_CACHE_ENTRIES ] , Drive , Offset , Length ) ;
+    }
+
+    if( Wait )
+    {
+      WaitQueue( DISK_EVENT_DONE ) ;
+    }
+  }
+
+  UnlockQueue() ;
+}
+
+// Copy the parts of a read held in queued writes, newest first, so a read
+// does not wait for the writer. Covered is set to a flag for each byte of
+// the read, set for those copied, or to NULL if no queued write overlaps
+// the read.
+// Returns false if the flags could not be allocated.
+static bool ReadQueued( int Drive , int64_t Offset , uint8_t * Buffer , int Length , uint8_t ** Covered )
+{
+  const stDiskWrite_t * Write ;
+  int64_t               Start ;
+  int64_t               End ;
+  int64_t               Next ;
+
+  *Covered = NULL ;
+
+  if( !Running || ( Length <= 0 ) )
+  {
+    return( true ) ;
+  }
+
+  LockQueue() ;
+
+  for( int i = QueueCount - 1 ; i >= 0 ; i-- )
+  {
+    Write = &Queue[ ( QueueHead + i ) % DISK_CACHE_ENTRIES ] ;
+    if( !Overlaps( Write , Drive , Offset , Length ) )
+    {
+      continue ;
+    }
+
+    if( *Covered == NULL )
+    {
+      *Covered = ( uint8_t * ) calloc( Length , 1 ) ;
+      if( *Covered == NULL )
+      {
+        UnlockQueue() ;
+        return( false ) ;
+      }
+    }
+
+    // Newer writes have already been copied over their part.
+    Start = ( Write->Offset > Offset ) ? Write->Offset : Offset ;
+    End   = ( Write->Offset + Write->Length < Offset + Length ) ? Write->Offset + Write->Length : Offset + Length ;
+    for( ; Start < End ; Start = Next )
+    {
+      for( Next = Start + 1 ; ( Next < End ) && ( ( *Covered )[ Next - Offset ] == ( *Covered )[ Start - Offset ] ) ; Next++ )
+      {
+      }
+
+      if( !( *Covered )[ Start - Offset ] )
+      {
+        memcpy( Buffer + ( Start - Offset ) , Write->Data + ( Start - Write->Offset ) , ( size_t ) ( Next - Start ) ) ;
+        memset( *Covered + ( Start - Offset ) , 1 , ( size_t ) ( Next - Start ) ) ;
+      }
+    }
+  }
+
+  UnlockQueue() ;
+
+  return( true ) ;
+}
+
+// Read the parts of a drive not copied from queued writes. Only this thread
+// queues writes, so those parts cannot be queued before the read is made.
+static int ReadUncovered( stDisk_t * Disk , int64_t Offset , uint8_t * Buffer , int Length , const uint8_t * Covered )
+{
+  int Start ;
+  int Next ;
+  int Count ;
+
+  for( Start = 0 ; Start < Length ; Start = Next )
+  {
+    for( Next = Start + 1 ; ( Next < Length ) && ( Covered[ Next ] == Covered[ Start ] ) ; Next++ )
+    {
+    }
+
+    if( !Covered[ Start ] )
+    {
+      Count = ReadDisk( Disk , Offset + Start , Buffer + Start , Next - Start ) ;
+      if( Count != Next - Start )
+      {
+        return( ( Count < 0 ) ? -1 : Start + Count ) ;
+      }
+    }
+  }
+
+  return( Length ) ;
+}
+
+// Read a drive below its scratch blocks, from the queued writes, the
+// overlay and the image.
+static int ReadDrive( int Drive , stDisk_t * Disk , int64_t Offset , uint8_t * Buffer , int Length )
+{
+  uint8_t * Covered ;
+  int       Count ;
+
+  // Writes still in the cache are read from the cache. Without memory to
+  // track which parts they cover, wait for them to reach the image.
+  if( !ReadQueued( Drive , Offset , Buffer , Length , &Covered ) )
+  {
+    WaitForWrites( Drive , Offset , Length ) ;
+  }
+
+  LockStorage() ;
+  Count = ( Covered != NULL ) ? ReadUncovered( Disk , Offset , Buffer , Length , Covered ) : ReadDisk( Disk , Offset , Buffer , Length ) ;
+  UnlockStorage() ;
+  free( Covered ) ;
+
+  return( Count ) ;
+}
+
+static void FreeScratch( stDisk_t * Disk )
+{
+  if( Disk->Scratch != NULL )
+  {
+    for( int i = 0 ; i < Disk->ScratchCount ; i++ )
+    {
+      free( Disk->Scratch[ i ] ) ;
+    }
+    free( Disk->Scratch ) ;
+    Disk->Scratch      = NULL ;
+    Disk->ScratchCount = 0 ;
+  }
+}
+
+// Read a drive through its scratch blocks.
+static int ReadScratch( int Drive , stDisk_t * Disk , int64_t Offset , uint8_t * Buffer , int Length )
+{
+  int Done ;
+  int Count ;
+  int Block ;
+  int Start ;
+
+  if( Disk->Scratch == NULL )
+  {
+    return( ReadDrive( Drive , Disk , Offset , Buffer , Length ) ) ;
+  }
+
+  if( ( Offset < 0 ) || ( Offset >= Disk->Size ) )
+  {
+    return( 0 ) ;
+  }
+
+  if( Length > Disk->Size - Offset )
+  {
+    Length = ( int ) ( Disk->Size - Offset ) ;
+  }
+
+  for( Done = 0 ; Done < Length ; Done += Count )
+  {
+    Block = ( int ) ( ( Offset + Done ) / DISK_OVERLAY_BLOCK ) ;
+    Start = ( int ) ( ( Offset + Done ) % DISK_OVERLAY_BLOCK ) ;
+    Count = DISK_OVERLAY_BLOCK - Start ;
+
+    if( Disk->Scratch[ Block ] != NULL )
+    {
+      Count = ( Count < Length - Done ) ? Count : ( Length - Done ) ;
+      memcpy( Buffer + Done , Disk->Scratch[ Block ] + Start , Count ) ;
+    }
+    else
+    {
+      while( ( Count < Length - Done ) && ( Disk->Scratch[ ++Block ] == NULL ) )
+      {
+        Count += DISK_OVERLAY_BLOCK ;
+      }
+      Count = ( Count < Length - Done ) ? Count : ( Length - Done ) ;
+
+      if( ReadDrive( Drive , Disk , Offset + Done , Buffer + Done , Count ) != Count )
+      {
+        return( -1 ) ;
+      }
+    }
+  }
+
+  return( Done ) ;
+}
+
+// Write a drive's scratch blocks, copying them from below when first
+// written. Like an overlay, the scratch blocks do not grow the image.
+static int WriteScratch( int Drive , stDisk_t * Disk , int64_t Offset , const uint8_t * Buffer , int Length )
+{
+  uint8_t * Data ;
+  int64_t   BlockStart ;
+  int       BlockLength ;
+  int       Done ;
+  int       Count ;
+  int       Block ;
+  int       Start ;
+
+  if( ( Offset < 0 ) || ( Offset >= Disk->Size ) )
+  {
+    return( 0 ) ;
+  }
+
+  if( Length > Disk->Size - Offset )
+  {
+    Length = ( int ) ( Disk->Size - Offset ) ;
+  }
+
+  if( Disk->Scratch == NULL )
+  {
+    Disk->ScratchCount = ( int ) ( ( Disk->Size + DISK_OVERLAY_BLOCK - 1 ) / DISK_OVERLAY_BLOCK ) ;
+    Disk->Scratch      = ( uint8_t ** ) calloc( Disk->ScratchCount + 1 , sizeof( uint8_t * ) ) ;
+    if( Disk->Scratch == NULL )
+    {
+      Disk->ScratchCount = 0 ;
+      return( -1 ) ;
+    }
+  }
+
+  for( Done = 0 ; Done < Length ; Done += Count )
+  {
+    Block = ( int ) ( ( Offset + Done ) / DISK_OVERLAY_BLOCK ) ;
+    Start = ( int ) ( ( Offset + Done ) % DISK_OVERLAY_BLOCK ) ;
+    Count = DISK_OVERLAY_BLOCK - Start ;
+    Count = ( Count < Length - Done ) ? Count : ( Length - Done ) ;
+
+    Data = Disk->Scratch[ Block ] ;
+    if( Data == NULL )
+    {
+      Data = ( uint8_t * ) calloc( DISK_OVERLAY_BLOCK , 1 ) ;
+      if( Data == NULL )
+      {
+        return( -1 ) ;
+      }
+
+      BlockStart  = ( int64_t ) Block * DISK_OVERLAY_BLOCK ;
+      BlockLength = ( int ) ( ( Disk->Size - BlockStart < DISK_OVERLAY_BLOCK ) ? ( Disk->Size - BlockStart ) : DISK_OVERLAY_BLOCK ) ;
+      if( ReadDrive( Drive , Disk , BlockStart , Data , BlockLength ) != BlockLength )
+      {
+        free( Data ) ;
+        return( -1 ) ;
+      }
+
+      Disk->Scratch[ Block ] = Data ;
+    }
+
+    memcpy( Data + Start , Buffer + Done , Count ) ;
+  }
+
+  return( Done ) ;
+}
+
+// Queue a write. A write to the same part of the drive as the last queued
+// write to it replaces that write, if it has not been started.
+// Returns false if the write could not be queued.
+static bool QueueWrite( int Drive , int64_t Offset , const uint8_t * Buffer , int Length )
+{
+  stDiskWrite_t * Write ;
+  uint8_t       * Data ;
+
+  if( !Running && !StartWriter() )
+  {
+    return( false ) ;
+  }
+
+  LockQueue() ;
+
+  for( int i = QueueCount - 1 ; i >= 0 ; i-- )
+  {
+    Write = &Queue[ ( QueueHead + i ) % DISK_CACHE_ENTRIES ] ;
+    if( Overlaps( Write , Drive , Offset , Length ) )
+    {
+      if( ( i >= QueueBusy ) && ( Write->Offset == Offset ) && ( Write->Length == Length ) )
+      {
+        memcpy( Write->Data , Buffer , Length ) ;
+        UnlockQueue() ;
+        return( true ) ;
+      }
+      break ;
+    }
+  }
+
+  while( ( QueueCount == DISK_CACHE_ENTRIES ) || ( ( QueueCount > 0 ) && ( QueueBytes + Length > DISK_CACHE_BYTES ) ) )
+  {
+    WaitQueue( DISK_EVENT_DONE ) ;
+  }
+
+  Data = ( uint8_t * ) malloc( Length ) ;
+  if( Data == NULL )
+  {
+    UnlockQueue() ;
+    return( false ) ;
+  }
+  memcpy( Data , Buffer , Length ) ;
+
+  Write         = &Queue[ ( QueueHead + QueueCount ) % DISK_CACHE_ENTRIES ] ;
+  Write->Drive  = Drive ;
+  Write->Offset = Offset ;
+  Write->Length = Length ;
+  Write->Data   = Data ;
+  QueueCount++ ;
+  QueueBytes   += Length ;
+
+  SignalQueue( DISK_EVENT_WORK ) ;
+  UnlockQueue() ;
+
+  return( true ) ;
+}
+
+static uint64_t HostTime( void )
+{
+#if defined( _WIN32 )
+  static LARGE_INTEGER Frequency = { 0 } ;
+  LARGE_INTEGER        Count ;
+
+  if( Frequency.QuadPart == 0 )
+  {
+    QueryPerformanceFrequency( &Frequency ) ;
+  }
+
+  QueryPerformanceCounter( &Count ) ;
+
+  return( ( uint64_t )( ( Count.QuadPart / Frequency.QuadPart ) * 1000000000 +
+                        ( Count.QuadPart % Frequency.QuadPart ) * 1000000000 / Frequency.QuadPart ) ) ;
+#else
+  struct timespec Now ;
+
+  clock_gettime( CLOCK_MONOTONIC , &Now ) ;
+
+  return( ( uint64_t )Now.tv_sec * 1000000000 + ( uint64_t )Now.tv_nsec ) ;
+#endif
+}
+
+static int Bucket( uint64_t Value )
+{
+  int Index = 0 ;
+
+  while( ( Value != 0 ) && ( Index < DISK_STATS_BUCKETS - 1 ) )
+  {
+    Value >>= 1 ;
+    Index++ ;
+  }
+
+  return( Index ) ;
+}
+
+static void CountHeat( stDiskStats_t * Stat , int64_t Size , int64_t Offset , int Length )
+{
+  int64_t End = Offset + Length ;
+  int64_t Next ;
+  int     Region ;
+
+  // The regions are sized for the first image accessed. Accesses past the
+  // last region are counted in it.
+  if( Stat->Heat == NULL )
+  {
+    Stat->RegionShift = Bucket( DISK_STATS_REGION - 1 ) ;
+
+    while( ( Size >> Stat->RegionShift ) >= DISK_STATS_REGIONS )
+    {
+      Stat->RegionShift++ ;
+    }
+
+    Stat->Regions = ( int )( ( Size + ( 1 << Stat->RegionShift ) - 1 ) >> Stat->RegionShift ) ;
+    Stat->Regions = ( Stat->Regions > 0 ) ? Stat->Regions : 1 ;
+    Stat->Heat    = ( uint64_t * )calloc( Stat->Regions , sizeof( uint64_t ) ) ;
+
+    if( Stat->Heat == NULL )
+    {
+      return ;
+    }
+  }
+
+  while( Offset < End )
+  {
+    Region = ( int )( Offset >> Stat->RegionShift ) ;
+    Next   = ( ( int64_t )Region + 1 ) << Stat->RegionShift ;
+    Next   = ( Next < End ) ? Next : End ;
+
+    Stat->Heat[ ( Region < Stat->Regions ) ? Region : Stat->Regions - 1 ] +=
+      ( uint64_t )( Next - Offset + DISK_SECTOR_SIZE - 1 ) / DISK_SECTOR_SIZE ;
+
+    Offset = Next ;
+  }
+}
+
+// Length is the number of bytes asked for and Count the number moved.
+static void CountAccess( int Drive , bool Write , int64_t Offset , int Length , int Count , uint64_t Start )
+{
+  stDiskStats_t   * Stat = &Stats[ Drive ] ;
+  stDiskOpStats_t * Op   = ( Write ) ? &Stat->Write : &Stat->Read ;
+  uint64_t          Nanoseconds = HostTime() - Start ;
+
+  Op->Calls++ ;
+  Op->Bytes       += ( Count > 0 ) ? Count : 0 ;
+  Op->Nanoseconds += Nanoseconds ;
+  Op->Sizes[ Bucket( ( Length > 0 ) ? Length : 0 ) ]++ ;
+  Op->Latency[ Bucket( Nanoseconds / 1000 ) ]++ ;
+
+  if( ( Offset < 0 ) || ( Count <= 0 ) )
+  {
+    return ;
+  }
+
+  if( Offset == Stat->LastEnd )
+  {
+    Op->Sequential++ ;
+  }
+  else
+  {
+    Stat->Seeks[ Bucket( ( uint64_t )llabs( Offset - Stat->LastEnd ) / DISK_SECTOR_SIZE ) ]++ ;
+  }
+
+  Stat->LastEnd = Offset + Count ;
+
+  CountHeat( Stat , DISK_Size( Drive ) , Offset , Count ) ;
+}
+
+// Sizes are shown in K, M, G or T where they are whole multiples.
+static const char * ScaledValue( uint64_t Value , bool Scale , char * Text )
+{
+  static const char Units[] = " KMGT" ;
+  int               Unit    = 0 ;
+
+  while( Scale && ( Value >= 1024 ) && ( ( Value % 1024 ) == 0 ) && ( Unit < 4 ) )
+  {
+    Value /= 1024 ;
+    Unit++ ;
+  }
+
+  sprintf( Text , ( Unit ) ? "%llu%c" : "%llu" , ( unsigned long long )Value , Units[ Unit ] ) ;
+
+  return( Text ) ;
+}
+
+static void PrintHistogram( const char * Name , const uint64_t * Buckets , const char * Unit , bool Scale )
+{
+  char Text[ 32 ] ;
+  bool Empty = true ;
+
+  printf( "  %-16s:" , Name ) ;
+
+  for( int i = 0 ; i < DISK_STATS_BUCKETS ; i++ )
+  {
+    if( Buckets[ i ] != 0 )
+    {
+      Empty = false ;
+      printf( " %s%s+ %llu" , ScaledValue( ( i ) ? ( uint64_t )1 << ( i - 1 ) : 0 , Scale , Text ) , Unit ,
+              ( unsigned long long )Buckets[ i ] ) ;
+    }
+  }
+
+  printf( ( Empty ) ? " none\n" : "\n" ) ;
+}
+
+static void PrintOpStats( const char * Name , const stDiskOpStats_t * Op )
+{
+  if( Op->Calls == 0 )
+  {
+    printf( "  %-16s: none\n" , Name ) ;
+    return ;
+  }
+
+  printf( "  %-16s: %llu calls, %llu sectors, %llu bytes per call, %llu%% sequential, %llu us per call, %.1f MB/s\n" ,
+          Name , ( unsigned long long )Op->Calls , ( unsigned long long )( Op->Bytes / DISK_SECTOR_SIZE ) ,
+          ( unsigned long long )( Op->Bytes / Op->Calls ) , ( unsigned long long )( Op->Sequential * 100 / Op->Calls ) ,
+          ( unsigned long long )( Op->Nanoseconds / Op->Calls / 1000 ) ,
+          ( Op->Nanoseconds ) ? ( double )Op->Bytes * 1000.0 / ( double )Op->Nanoseconds : 0.0 ) ;
+}
+
+static void PrintHeat( const stDiskStats_t * Stat )
+{
+  int64_t RegionSectors = ( ( int64_t )1 << Stat->RegionShift ) / DISK_SECTOR_SIZE ;
+  bool    Printed[ DISK_STATS_REGIONS ] = { false } ;
+  int     Hottest ;
+
+  printf( "  %-16s:" , "Hottest sectors" ) ;
+
+  for( int i = 0 ; i < DISK_STATS_HOT ; i++ )
+  {
+    Hottest = -1 ;
+
+    for( int Region = 0 ; Region < Stat->Regions ; Region++ )
+    {
+      if( !Printed[ Region ] && ( Stat->Heat[ Region ] != 0 ) &&
+          ( ( Hottest < 0 ) || ( Stat->Heat[ Region ] > Stat->Heat[ Hottest ] ) ) )
+      {
+        Hottest = Region ;
+      }
+    }
+
+    if( Hottest < 0 )
+    {
+      break ;
+    }
+
+    Printed[ Hottest ] = true ;
+
+    printf( " %lld-%lld: %llu" , ( long long )( Hottest * RegionSectors ) ,
+            ( long long )( ( Hottest + 1 ) * RegionSectors - 1 ) , ( unsigned long long )Stat->Heat[ Hottest ] ) ;
+  }
+
+  printf( "\n" ) ;
+}
+
+// =============================================================================
+// Exported functions
+//
+
+bool DISK_Open( int Drive , const char * Filename )
+{
+  stDisk_t * Disk ;
+
+  if( ( Drive < 0 ) || ( Drive >= DISK_COUNT ) )
+  {
+    return( false ) ;
+  }
+
+  InitDisks() ;
+
+  // Reopening the image a drive has an overlay on keeps the overlay, so a
+  // reset does not lose the writes made to it.
+  if( ( Filename != NULL ) && HasOverlay( &Disks[ Drive ] ) && ( GetDisk( Drive ) != NULL ) &&
+      ( strcmp( Disks[ Drive ].Filename , Filename ) == 0 ) )
+  {
+    return( true ) ;
+  }
+
+  DISK_Close( Drive ) ;
+
+  if( Filename == NULL )
+  {
+    return( false ) ;
+  }
+
+  Disk = &Disks[ Drive ] ;
+  strncpy( Disk->Filename , Filename , DISK_MAX_PATH - 1 ) ;
+  Disk->Filename[ DISK_MAX_PATH - 1 ] = 0 ;
+
+  // A host directory on a disk drive is a virtual FAT disk, which has no
+  // file, delta or mapping.
+  if( ( Drive != DISK_BIOS ) && VFAT_IsDirectory( Filename ) )
+  {
+    Disk->VFat = VFAT_Open( Filename , ( Drive == DISK_FD ) ) ;
+    if( Disk->VFat == NULL )
+    {
+      return( false ) ;
+    }
+    Disk->Size = VFAT_Size( Disk->VFat ) ;
+  }
+  else
+  {
+    Disk->File = open( Filename , O_BINARY | O_NOINHERIT | ( ( ReadOnly( Disk ) ) ? O_RDONLY : O_RDWR ) ) ;
+    if( Disk->File < 0 )
+    {
+      return( false ) ;
+    }
+
+    // Block indexed images are read through their index rather than mapped.
+    Disk->Image = IMAGE_Open( Disk->File ) ;
+    Disk->Size  = ( Disk->Image != NULL ) ? IMAGE_Size( Disk->Image ) : lseek( Disk->File , 0 , SEEK_END ) ;
+
+    if( ( Disk->DeltaName[ 0 ] != 0 ) && !OpenDelta( Disk ) )
+    {
+      DISK_Close( Drive ) ;
+      return( false ) ;
+    }
+
+    if( Disk->Image == NULL )
+    {
+      MapImage( Disk ) ;
+
+      if( Drive != DISK_BIOS )
+      {
+        Disk->Prefetch = PREFETCH_Open( Filename ) ;
+      }
+    }
+  }
+
+  if( HasOverlay( Disk ) )
+  {
+    Disk->BlockCount = ( int ) ( ( Disk->Size + DISK_OVERLAY_BLOCK - 1 ) / DISK_OVERLAY_BLOCK ) ;
+    Disk->Blocks     = ( uint8_t ** ) calloc( Disk->BlockCount + 1 , sizeof( uint8_t * ) ) ;
+    if( Disk->Blocks == NULL )
+    {
+      DISK_Close( Drive ) ;
+      return( false ) ;
+    }
+  }
+
+  return( true ) ;
+}
+
+void DISK_Close( int Drive )
+{
+  stDisk_t * Disk = GetDisk( Drive ) ;
+
+  if( Disk == NULL )
+  {
+    return ;
+  }
+
+  FlushQueue() ;
+
+  PREFETCH_Close( Disk->Prefetch ) ;
+  Disk->Prefetch = NULL ;
+  UnmapImage( Disk ) ;
+  CloseDelta( Disk ) ;
+  IMAGE_Close( Disk->Image ) ;
+  Disk->Image = NULL ;
+  VFAT_Close( Disk->VFat ) ;
+  Disk->VFat = NULL ;
+
+  if( Disk->File >= 0 )
+  {
+    close( Disk->File ) ;
+    Disk->File = -1 ;
+  }
+  Disk->Size = 0 ;
+
+  if( Disk->Blocks != NULL )
+  {
+    for( int i = 0 ; i < Disk->BlockCount ; i++ )
+    {
+      free( Disk->Blocks[ i ] ) ;
+    }
+    free( Disk->Blocks ) ;
+    Disk->Blocks     = NULL ;
+    Disk->BlockCount = 0 ;
+  }
+
+  FreeScratch( Disk ) ;
+}
+
+int64_t DISK_Size( int Drive )
+{
+  stDisk_t * Disk = GetDisk( Drive ) ;
+
+  return( ( Disk ) ? Disk->Size : 0 ) ;
+}
+
+int DISK_Read( int Drive , int64_t Offset , uint8_t * Buffer , int Length )
+{
+  stDisk_t * Disk  = GetDisk( Drive ) ;
+  uint64_t   Start = HostTime() ;
+  int        Count ;
+
+  if( Disk == NULL )
+  {
+    return( 0 ) ;
+  }
+
+  // Scratch reads are not what the guest reads for real, so are neither
+  // traced nor counted.
+  if( ScratchMode )
+  {
+    return( ReadScratch( Drive , Disk , Offset , Buffer , Length ) ) ;
+  }
+
+  Count = ReadDrive( Drive , Disk , Offset , Buffer , Length ) ;
+
+  PREFETCH_Read( Disk->Prefetch , Offset , Count ) ;
+  CountAccess( Drive , false , Offset , Length , Count , Start ) ;
+
+  return( Count ) ;
+}
+
+int DISK_Write( int Drive , int64_t Offset , const uint8_t * Buffer , int Length )
+{
+  stDisk_t * Disk  = GetDisk( Drive ) ;
+  uint64_t   Start = HostTime() ;
+  int        Count ;
+
+  if( Disk == NULL )
+  {
+    return( 0 ) ;
+  }
+
+  if( ScratchMode )
+  {
+    return( WriteScratch( Drive , Disk , Offset , Buffer , Length ) ) ;
+  }
+
+  WriteCount++ ;
+
+  // Writes to an overlay only copy memory. Writes past the end of the
+  // image change its size, so are made at once after those in the cache.
+  if( HasOverlay( Disk ) || ( CacheMode == DISK_CACHE_OFF ) || ( Offset < 0 ) || ( Length <= 0 ) ||
+      ( Length > DISK_CACHE_RUN ) || ( Offset + Length > Disk->Size ) || !QueueWrite( Drive , Offset , Buffer , Length ) )
+  {
+    if( !HasOverlay( Disk ) )
+    {
+      FlushQueue() ;
+    }
+
+    LockStorage() ;
+    Count = WriteDisk( Disk , Offset , Buffer , Length ) ;
+    UnlockStorage() ;
+
+    CountAccess( Drive , true , Offset , Length , Count , Start ) ;
+
+    return( Count ) ;
+  }
+
+  CountAccess( Drive , true , Offset , Length , Length , Start ) ;
+
+  return( Length ) ;
+}
+
+bool DISK_Flush( void )
+{
+  bool Ok ;
+
+  FlushQueue() ;
+
+  Ok          = !WriteFailed ;
+  WriteFailed = false ;
+
+  return( Ok ) ;
+}
+
+void DISK_SetCache( int Mode )
+{
+  FlushQueue() ;
+
+  CacheMode = Mode ;
+}
+
+void DISK_SetPrefetch( const char * Directory )
+{
+  PREFETCH_SetDirectory( Directory ) ;
+}
+
+void DISK_SetScratch( bool Scratch )
+{
+  InitDisks() ;
+
+  ScratchMode = Scratch ;
+  if( !Scratch )
+  {
+    for( int i = 0 ; i < DISK_COUNT ; i++ )
+    {
+      FreeScratch( &Disks[ i ] ) ;
+    }
+  }
+}
+
+void DISK_Cleanup( void )
+{
+  for( int i = 0 ; i < DISK_COUNT ; i++ )
+  {
+    DISK_Close( i ) ;
+
+    free( Stats[ i ].Heat ) ;
+    Stats[ i ].Heat = NULL ;
+  }
+}
+
+uint32_t DISK_GetWriteCount( void )
+{
+  return( WriteCount ) ;
+}
+
+void DISK_PrintStats( void )
+{
+  static const char * Names[ DISK_COUNT ] = { "Hard disk" , "Floppy disk" , "BIOS" } ;
+
+  printf( "Disk statistics\n" ) ;
+
+  for( int i = 0 ; i < DISK_COUNT ; i++ )
+  {
+    const stDiskStats_t * Stat = &Stats[ i ] ;
+
+    if( ( Stat->Read.Calls == 0 ) && ( Stat->Write.Calls == 0 ) )
+    {
+      continue ;
+    }
+
+    printf( "%s\n" , Names[ i ] ) ;
+
+    PrintOpStats( "Reads" , &Stat->Read ) ;
+    PrintOpStats( "Writes" , &Stat->Write ) ;
+    PrintHistogram( "Read size" , Stat->Read.Sizes , "B" , true ) ;
+    PrintHistogram( "Write size" , Stat->Write.Sizes , "B" , true ) ;
+    PrintHistogram( "Read latency" , Stat->Read.Latency , "us" , false ) ;
+    PrintHistogram( "Write latency" , Stat->Write.Latency , "us" , false ) ;
+    PrintHistogram( "Seek sectors" , Stat->Seeks , "" , true ) ;
+
+    if( Stat->Heat != NULL )
+    {
+      PrintHeat( Stat ) ;
+    }
+  }
+
+  fflush( stdout ) ;
+}
+
+bool DISK_SetOverlay( int Drive )
+{
+  char Filename[ DISK_MAX_PATH ] ;
+
+  if( ( Drive < 0 ) || ( Drive >= DISK_COUNT ) )
+  {
+    return( false ) ;
+  }
+
+  if( Disks[ Drive ].Overlay )
+  {
+    return( true ) ;
+  }
+
+  Disks[ Drive ].Overlay = true ;
+
+  if( GetDisk( Drive ) == NULL )
+  {
+    return( true ) ;
+  }
+
+  strcpy( Filename , Disks[ Drive ].Filename ) ;
+  DISK_Close( Drive ) ;
+
+  return( DISK_Open( Drive , Filename ) ) ;
+}
+
+bool DISK_SetDelta( int Drive , const char * Filename )
+{
+  char Image[ DISK_MAX_PATH ] ;
+
+  if( ( Drive < 0 ) || ( Drive >= DISK_COUNT ) )
+  {
+    return( false ) ;
+  }
+
+  // The image is opened again with the delta if one is open.
+  Image[ 0 ] = 0 ;
+  if( GetDisk( Drive ) != NULL )
+  {
+    strcpy( Image , Disks[ Drive ].Filename ) ;
+    DISK_Close( Drive ) ;
+  }
+
+  Disks[ Drive ].DeltaName[ 0 ] = 0 ;
+  if( Filename != NULL )
+  {
+    strncpy( Disks[ Drive ].DeltaName , Filename , DISK_MAX_PATH - 1 ) ;
+    Disks[ Drive ].DeltaName[ DISK_MAX_PATH - 1 ] = 0 ;
+  }
+
+  return( ( Image[ 0 ] == 0 ) || DISK_Open( Drive , Image ) ) ;
+}
+
+bool DISK_CommitDelta( int Drive )
+{
+  stDisk_t * Disk = GetDisk( Drive ) ;
+  uint8_t    Buffer[ DISK_OVERLAY_BLOCK ] ;
+  int        Base ;
+  int64_t    Sector ;
+  int64_t    Offset ;
+  int        Count ;
+  bool       Ok = true ;
+
+  // A machine with an overlay does not write to the delta either.
+  if( ( Disk == NULL ) || ( Disk->Bitmap == NULL ) || Disk->Overlay )
+  {
+    return( false ) ;
+  }
+
+  FlushQueue() ;
+
+  Base = open( Disk->Filename , O_BINARY | O_NOINHERIT | O_RDWR ) ;
+  if( Base < 0 )
+  {
+    return( false ) ;
+  }
+
+  // Copy runs of sectors in the delta to the image.
+  for( Sector = 0 ; Ok && ( Sector < Disk->SectorCount ) ; Sector++ )
+  {
+    if( !InDelta( Disk , Sector ) )
+    {
+      continue ;
+    }
+
+    Count = 1 ;
+    while( ( Count < DISK_OVERLAY_BLOCK / DISK_SECTOR_SIZE ) && ( Sector + Count < Disk->SectorCount ) &&
+           InDelta( Disk , Sector + Count ) )
+    {
+      Count++ ;
+    }
+
+    Offset = Sector * DISK_SECTOR_SIZE ;
+    Count  = ( int ) ( ( Disk->Size - Offset < Count * DISK_SECTOR_SIZE ) ? ( Disk->Size - Offset ) : ( Count * DISK_SECTOR_SIZE ) ) ;
+    Ok     = ( ReadAt( Disk->Delta , Disk->DeltaData + Offset , Buffer , Count ) == Count ) &&
+             ( ( ( Disk->Image != NULL ) ? IMAGE_Write( Disk->Image , Base , Offset , Buffer , Count )
+                                         : WriteAt( Base , Offset , Buffer , Count ) ) == Count ) ;
+
+    Sector += ( Count - 1 ) / DISK_SECTOR_SIZE ;
+  }
+
+  close( Base ) ;
+
+  // The image now has the data, so reading it from either file is the same
+  // until the delta is cleared.
+  return( Ok && ClearDelta( Disk ) ) ;
+}
+
+bool DISK_DiscardDelta( int Drive )
+{
+  stDisk_t * Disk = GetDisk( Drive ) ;
+
+  if( ( Disk == NULL ) || ( Disk->Bitmap == NULL ) || Disk->Overlay )
+  {
+    return( false ) ;
+  }
+
+  FlushQueue() ;
+  WriteCount++ ;
+
+  return( ClearDelta( Disk ) ) ;
+}
@@ -0,0 +1,380 @@
+// =============================================================================
+// File: XTdisk.h
+//
+// Description:
+// Disk image access.
+//
+// The BIOS reads and writes the hard disk, floppy disk and BIOS images
+// through the disk hypercalls. An image can be given a private overlay, in
+// which case the image file is only read and written blocks are kept in
+// memory, so several machines can run from the same image without seeing
+// each other's writes.
+//
+// A drive can also be given a delta file, in which case the image is a
+// read only base that can be shared by several machines, and written
+// sectors are kept in the delta file with a bitmap of the sectors it
+// holds. Unlike an overlay, the delta persists between runs. It can be
+// committed, copying its sectors to the base image, or discarded.
+//
+// Writes to drives without an overlay can be cached, in which case they
+// are queued and made by a writer thread, so the emulated CPU does not
+// wait for the host storage. Reads of queued data are served from the
+// queue. The cache is flushed when an image is closed.
+//
+// Images are either raw or block indexed, as described in XTimage.h. Raw
+// images are mapped into memory where possible, so a transfer is a copy
+// between the image and guest memory rather than system calls. Writes
+// reach the image file through the mapping and are flushed to disk when
+// the image is closed.
+//
+// The hard disk and floppy disk can also be given a host directory in place
+// of an image, which the guest sees as a FAT disk, as described in
+// XTvfat.h. Writes to it are always kept in an overlay.
+//
+// Raw images can be prefetched from a trace of the sectors read the first
+// time they were booted, as described in XTprefetch.h.
+//
+// Every read and write is counted, with the host time it took, so the disk
+// access pattern of a guest can be seen with DISK_PrintStats.
+//
+// This work is licensed under the MIT License. See included LICENSE.TXT.
+//
+
+#ifndef _XTDISK_
+#define _XTDISK_
+
+#include <stdint.h>
+
+// Drives, as numbered in DL by the BIOS disk hypercalls.
+#define DISK_HD                                  0
+#define DISK_FD                                  1
+#define DISK_BIOS                                2
+#define DISK_COUNT                               3
+
+#define DISK_SECTOR_SIZE                         512
+
+// Overlay block size. A block is copied from the image the first time it
+// is written.
+#define DISK_OVERLAY_BLOCK                       0x1000 // 4KB
+
+// Write cache modes.
+#define DISK_CACHE_OFF                           0 // Write at once
+#define DISK_CACHE_WRITEBACK                     1 // Write in the background
+#define DISK_CACHE_SYNC                          2 // As write back, then sync
+                                                   // the image to storage
+
+// Requests for the delta file on the hard disk.
+#define DISK_REQUEST_NONE                        0
+#define DISK_REQUEST_COMMIT                      1 // Copy the delta to the image
+#define DISK_REQUEST_DISCARD                     2 // Empty the delta and reset
+#define DISK_REQUEST_STATS                       3 // Print the disk statistics
+
+// =============================================================================
+// Function: DISK_Open
+//
+// Description:
+// Open an image, closing any image already open on the drive. If the drive
+// has an overlay the new image gets an empty overlay, unless it is the image
+// already open, which keeps its overlay.
+//
+// Parameters:
+//
+//   Drive    : The drive, DISK_HD, DISK_FD or DISK_BIOS.
+//
+//   Filename : The image file, or NULL for no image. For DISK_HD and
+//              DISK_FD this can be a host directory.
+//
+// Returns:
+//
+//   bool : true if the image was opened.
+//
+bool DISK_Open( int Drive , const char * Filename ) ;
+
+// =============================================================================
+// Function: DISK_Close
+//
+// Description:
+// Close the image on a drive, flushing writes to the image file and
+// discarding its overlay contents.
+//
+// Parameters:
+//
+//   Drive : The drive.
+//
+// Returns:
+//
+//   None.
+//
+void DISK_Close( int Drive ) ;
+
+// =============================================================================
+// Function: DISK_Size
+//
+// Description:
+// Get the size of the image on a drive.
+//
+// Parameters:
+//
+//   Drive : The drive.
+//
+// Returns:
+//
+//   int64_t : The image size in bytes, 0 if no image is open.
+//
+int64_t DISK_Size( int Drive ) ;
+
+// =============================================================================
+// Function: DISK_Read
+//
+// Description:
+// Read from the image on a drive.
+//
+// Parameters:
+//
+//   Drive  : The drive.
+//
+//   Offset : Byte offset in the image.
+//
+//   Buffer : The buffer to read into.
+//
+//   Length : The number of bytes to read.
+//
+// Returns:
+//
+//   int : The number of bytes read, 0 if no image is open or the offset is
+//         past the end of the image, -1 on a read error.
+//
+int DISK_Read( int Drive , int64_t Offset , uint8_t * Buffer , int Length ) ;
+
+// =============================================================================
+// Function: DISK_Write
+//
+// Description:
+// Write to the image on a drive, or to its overlay.
+//
+// Parameters:
+//
+//   Drive  : The drive.
+//
+//   Offset : Byte offset in the image.
+//
+//   Buffer : The data to write.
+//
+//   Length : The number of bytes to write.
+//
+// Returns:
+//
+//   int : The number of bytes written, 0 if no image is open, -1 on a write
+//         error. An overlay does not grow the image, so writes past its end
+//         are cut short.
+//         A cached write returns Length, and any error is reported by
+//         DISK_Flush.
+//
+int DISK_Write( int Drive , int64_t Offset , const uint8_t * Buffer , int Length ) ;
+
+// =============================================================================
+// Function: DISK_Flush
+//
+// Description:
+// Make all cached writes. A write made in the background may fail after
+// the guest was told it succeeded, so this reports any write that failed
+// since the last flush.
+//
+// Parameters:
+//
+//   None.
+//
+// Returns:
+//
+//   bool : true if every cached write succeeded.
+//
+bool DISK_Flush( void ) ;
+
+// =============================================================================
+// Function: DISK_SetCache
+//
+// Description:
+// Set how writes to drives without an overlay are cached. Any cached
+// writes are made first.
+//
+// Parameters:
+//
+//   Mode : DISK_CACHE_OFF, DISK_CACHE_WRITEBACK or DISK_CACHE_SYNC.
+//
+// Returns:
+//
+//   None.
+//
+void DISK_SetCache( int Mode ) ;
+
+// =============================================================================
+// Function: DISK_SetPrefetch
+//
+// Description:
+// Set the directory of boot traces, used to prefetch the raw images opened
+// on the hard disk and floppy disk drives afterwards, as described in
+// XTprefetch.h.
+//
+// Parameters:
+//
+//   Directory : The trace directory, or NULL to neither trace nor prefetch.
+//
+// Returns:
+//
+//   None.
+//
+void DISK_SetPrefetch( const char * Directory ) ;
+
+// =============================================================================
+// Function: DISK_SetScratch
+//
+// Description:
+// Set or clear scratch mode. While set, writes to every drive go to scratch
+// blocks in memory and are read back from them, and reads and writes are
+// not counted in the statistics, added to boot traces or counted by
+// DISK_GetWriteCount. Clearing it throws the scratch blocks away, so the
+// drives read as they did when it was set.
+//
+// Parameters:
+//
+//   Scratch : true to set scratch mode, false to clear it.
+//
+// Returns:
+//
+//   None.
+//
+void DISK_SetScratch( bool Scratch ) ;
+
+// =============================================================================
+// Function: DISK_Cleanup
+//
+// Description:
+// Close the images on all drives.
+//
+// Parameters:
+//
+//   None.
+//
+// Returns:
+//
+//   None.
+//
+void DISK_Cleanup( void ) ;
+
+// =============================================================================
+// Function: DISK_PrintStats
+//
+// Description:
+// Print the statistics kept for each drive since the emulator started:
+// calls, sectors, bytes per call, sequential calls and host time for reads
+// and writes, histograms of call sizes, host latency and seek distances,
+// and the most accessed sectors.
+//
+// Parameters:
+//
+//   None.
+//
+// Returns:
+//
+//   None.
+//
+void DISK_PrintStats( void ) ;
+
+// =============================================================================
+// Function: DISK_GetWriteCount
+//
+// Description:
+// Get the number of writes made to any drive since the emulator started,
+// counting a discarded delta file as a write.
+// Machine state saved in memory, such as rewind checkpoints, does not
+// include disk contents, so it can only be restored while this is the
+// same as when it was saved.
+//
+// Parameters:
+//
+//   None.
+//
+// Returns:
+//
+//   uint32_t : The number of writes.
+//
+uint32_t DISK_GetWriteCount( void ) ;
+
+// =============================================================================
+// Function: DISK_SetOverlay
+//
+// Description:
+// Give a drive a private overlay. The image is reopened read only, so the
+// file position is no longer shared with a process this one was forked
+// from, and from then on writes only change the overlay. The overlay stays
+// in place when a new image is opened on the drive.
+//
+// Parameters:
+//
+//   Drive : The drive.
+//
+// Returns:
+//
+//   bool : true if the overlay is in place.
+//
+bool DISK_SetOverlay( int Drive ) ;
+
+// =============================================================================
+// Function: DISK_SetDelta
+//
+// Description:
+// Set the delta file of a drive. The delta file is created if it does not
+// exist, and must have been created for an image of the same size. The
+// image is reopened read only, with the delta file read only as well if
+// the drive has an overlay. The delta file stays in place when a new image
+// is opened on the drive.
+//
+// Parameters:
+//
+//   Drive    : The drive.
+//
+//   Filename : The delta file, NULL to write to the image itself.
+//
+// Returns:
+//
+//   bool : true if the image is open with the delta file, or there is no
+//          image open on the drive.
+//
+bool DISK_SetDelta( int Drive , const char * Filename ) ;
+
+// =============================================================================
+// Function: DISK_CommitDelta
+//
+// Description:
+// Copy the sectors in the delta file of a drive to its image, then empty
+// the delta file. Not done if the drive has an overlay.
+//
+// Parameters:
+//
+//   Drive : The drive.
+//
+// Returns:
+//
+//   bool : true if the delta file was committed.
+//
+bool DISK_CommitDelta( int Drive ) ;
+
+// =============================================================================
+// Function: DISK_DiscardDelta
+//
+// Description:
+// Empty the delta file of a drive, so the drive reads as the image again.
+// The machine should be reset afterwards, as the guest may have the
+// discarded sectors cached. Not done if the drive has an overlay.
+//
+// Parameters:
+//
+//   Drive : The drive.
+//
+// Returns:
+//
+//   bool : true if the delta file was discarded.
+//
+bool DISK_DiscardDelta( int Drive ) ;
+
+#endif // _XTDISK_
@@ -0,0 +1,1211 @@
+// =============================================================================
+// File: XTems.cpp
+//
+// Description:
+// LIM EMS 4.0 expanded memory board.
+// See XTems.h for a description of the implementation.
+//
+// This work is licensed under the MIT License. See included LICENSE.TXT.
+//
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "XTems.h"
+#include "XTcpu.h"
+#include "XTmemory.h"
+
+// INT 67h status codes
+#define EMS_OK                                   0x00
+#define EMS_ERR_SOFTWARE                         0x80 // Internal error
+#define EMS_ERR_HANDLE                           0x83 // Invalid handle
+#define EMS_ERR_FUNCTION                         0x84 // Function not supported
+#define EMS_ERR_NO_HANDLES                       0x85 // No free handles
+#define EMS_ERR_SAVE_RESTORE                     0x86 // Handle has a saved page map
+#define EMS_ERR_TOTAL_PAGES                      0x87 // More pages than fitted
+#define EMS_ERR_FREE_PAGES                       0x88 // More pages than free
+#define EMS_ERR_ZERO_PAGES                       0x89 // Zero pages requested
+#define EMS_ERR_LOGICAL_PAGE                     0x8A // Logical page out of range
+#define EMS_ERR_PHYSICAL_PAGE                    0x8B // Physical page out of range
+#define EMS_ERR_MAP_SAVED                        0x8D // Page map already saved
+#define EMS_ERR_NO_MAP_SAVED                     0x8E // No page map saved
+#define EMS_ERR_SUBFUNCTION                      0x8F // Subfunction not supported
+#define EMS_ERR_ATTRIBUTE                        0x91 // Non-volatile handles not supported
+#define EMS_ERR_REGION_PAGES                     0x93 // Region exceeds the handle's pages
+#define EMS_ERR_OFFSET                           0x95 // Offset outside a page
+#define EMS_ERR_LENGTH                           0x96 // Region longer than 1MB
+#define EMS_ERR_MEMORY_TYPE                      0x98 // Region type not defined
+#define EMS_ERR_NAME_NOT_FOUND                   0xA0
+#define EMS_ERR_NAME_EXISTS                      0xA1
+#define EMS_ERR_WRAP                             0xA2 // Conventional region passes 1MB
+
+#define EMS_VERSION                              0x40
+#define EMS_NO_PAGE                              0xFFFF
+#define EMS_FREE                                 0xFF
+
+// The INT 67h entry point. Programs detect the driver by the device name
+// at offset 10 of the interrupt vector's segment, so the entry point has a
+// segment of its own just below the page frame.
+#define EMS_DRIVER_PARAS                         2
+#define EMS_DRIVER_ENTRY                         0x12
+
+static const uint8_t DriverStub[ EMS_DRIVER_ENTRY + 3 ] =
+{
+  0xFF , 0xFF , 0xFF , 0xFF ,                     // Next device: none
+  0x00 , 0xC0 ,                                   // Character device, IOCTL
+  0x00 , 0x00 , 0x00 , 0x00 ,                     // Strategy and interrupt: unused
+  'E' , 'M' , 'M' , 'X' , 'X' , 'X' , 'X' , '0' , // Device name
+  0x0F , 0x04 ,                                   // Emulator EMS call
+  0xCF                                            // IRET
+} ;
+
+// =============================================================================
+// Local variables
+//
+
+static bool         Fitted       = false ;
+static int          TotalPages   = 0     ;
+static uint32_t     FrameAddr    = 0     ;
+static uint16_t     FrameSegment = 0     ;
+static bool         ZeroCopy     = false ;
+static uint8_t    * Store        = NULL  ;
+static stEMSState_t Ems ;
+
+// Guest RAM hidden by frame pages while they are mapped, used when pages
+// are copied rather than remapped.
+static uint8_t      Shadow[ EMS_FRAME_PAGES * EMS_PAGE_SIZE ] ;
+
+// Journal of the pages changed since EMS_StartJournal, with the contents
+// each had before its first change.
+static bool         JournalOn     = false ;
+static bool         JournalFailed = false ;
+static int          JournalCount  = 0     ;
+static int          JournalSize   = 0     ;
+static uint16_t     JournalPages[ EMS_MAX_PAGES ] ;
+static uint8_t      Journalled[ EMS_MAX_PAGES ] ;
+static uint8_t    * JournalData   = NULL  ;
+
+// =============================================================================
+// Local functions
+//
+
+static uint16_t * Regs16( void )
+{
+  return( ( uint16_t * ) ( mem + REGS_BASE ) ) ;
+}
+
+static uint8_t * Regs8( void )
+{
+  return( mem + REGS_BASE ) ;
+}
+
+static uint8_t * Linear( uint16_t Segment , uint16_t Offset )
+{
+  return( mem + 16 * ( uint32_t ) Segment + Offset ) ;
+}
+
+// Grow a page buffer to hold Count pages.
+static bool GrowPages( uint8_t * & Data , int & Size , int Count )
+{
+  uint8_t * New ;
+  int       NewSize ;
+
+  if( Count <= Size )
+  {
+    return( true ) ;
+  }
+
+  NewSize = ( Size > 0 ) ? ( 2 * Size ) : EMS_FRAME_PAGES ;
+  if( NewSize < Count )
+  {
+    NewSize = Count ;
+  }
+
+  New = ( uint8_t * ) realloc( Data , ( size_t ) NewSize * EMS_PAGE_SIZE ) ;
+  if( New == NULL )
+  {
+    return( false ) ;
+  }
+
+  Data = New ;
+  Size = NewSize ;
+
+  return( true ) ;
+}
+
+// Record Page in the journal before the page in the store is changed, or
+// before it is mapped into the frame where the guest can change it.
+static void JournalPage( uint16_t Page )
+{
+  if( !JournalOn || Journalled[ Page ] || JournalFailed )
+  {
+    return ;
+  }
+
+  if( !GrowPages( JournalData , JournalSize , JournalCount + 1 ) )
+  {
+    JournalFailed = true ;
+    return ;
+  }
+
+  memcpy( JournalData + JournalCount * EMS_PAGE_SIZE , Store + Page * EMS_PAGE_SIZE , EMS_PAGE_SIZE ) ;
+  JournalPages[ JournalCount++ ] = Page ;
+  Journalled[ Page ] = 1 ;
+}
+
+// Show Page (or guest RAM if Page is EMS_NO_PAGE) in a frame page.
+// When copying, a page mapped in two frame pages at once only keeps the
+// data written through the last one to be switched away.
+static void MapFrame( int Slot , uint16_t Page )
+{
+  uint16_t Old  = Ems.frame[ Slot ] ;
+  uint32_t Addr = FrameAddr + Slot * EMS_PAGE_SIZE ;
+
+  if( Old == Page )
+  {
+    return ;
+  }
+
+  if( ZeroCopy )
+  {
+    if( Page == EMS_NO_PAGE )
+    {
+      MEM_UnmapExpanded( Addr , EMS_PAGE_SIZE ) ;
+    }
+    else
+    {
+      JournalPage( Page ) ;
+      MEM_MapExpanded( Addr , Page * EMS_PAGE_SIZE , EMS_PAGE_SIZE ) ;
+    }
+  }
+  else
+  {
+    if( Old == EMS_NO_PAGE )
+    {
+      memcpy( Shadow + Slot * EMS_PAGE_SIZE , mem + Addr , EMS_PAGE_SIZE ) ;
+    }
+    else
+    {
+      JournalPage( Old ) ;
+      memcpy( Store + Old * EMS_PAGE_SIZE , mem + Addr , EMS_PAGE_SIZE ) ;
+    }
+
+    if( Page == EMS_NO_PAGE )
+    {
+      memcpy( mem + Addr , Shadow + Slot * EMS_PAGE_SIZE , EMS_PAGE_SIZE ) ;
+    }
+    else
+    {
+      memcpy( mem + Addr , Store + Page * EMS_PAGE_SIZE , EMS_PAGE_SIZE ) ;
+    }
+  }
+
+  Ems.frame[ Slot ] = Page ;
+}
+
+// Get the current data of a page.
+static uint8_t * PageData( uint16_t Page )
+{
+  if( !ZeroCopy )
+  {
+    for( int Slot = 0 ; Slot < EMS_FRAME_PAGES ; Slot++ )
+    {
+      if( Ems.frame[ Slot ] == Page )
+      {
+        return( mem + FrameAddr + Slot * EMS_PAGE_SIZE ) ;
+      }
+    }
+  }
+
+  return( Store + Page * EMS_PAGE_SIZE ) ;
+}
+
+static int FreePages( void )
+{
+  int Count = 0 ;
+
+  for( int Page = 0 ; Page < TotalPages ; Page++ )
+  {
+    if( Ems.owner[ Page ] == EMS_FREE )
+    {
+      Count++ ;
+    }
+  }
+
+  return( Count ) ;
+}
+
+static bool ValidHandle( uint16_t Handle )
+{
+  return( ( Handle < EMS_MAX_HANDLES ) && Ems.used[ Handle ] ) ;
+}
+
+// Find the page holding a handle's logical page, or -1.
+static int FindPage( uint16_t Handle , uint16_t Logical )
+{
+  if( Logical >= Ems.pages[ Handle ] )
+  {
+    return( -1 ) ;
+  }
+
+  for( int Page = 0 ; Page < TotalPages ; Page++ )
+  {
+    if( ( Ems.owner[ Page ] == Handle ) && ( Ems.logical[ Page ] == Logical ) )
+    {
+      return( Page ) ;
+    }
+  }
+
+  return( -1 ) ;
+}
+
+// Give a handle Count pages in total.
+// The caller has checked enough pages are free.
+static void ResizeHandle( uint16_t Handle , uint16_t Count )
+{
+  uint16_t Logical = Ems.pages[ Handle ] ;
+
+  for( int Page = 0 ; Page < TotalPages ; Page++ )
+  {
+    if( ( Ems.owner[ Page ] == Handle ) && ( Ems.logical[ Page ] >= Count ) )
+    {
+      Ems.owner[ Page ] = EMS_FREE ;
+    }
+    else if( ( Ems.owner[ Page ] == EMS_FREE ) && ( Logical < Count ) )
+    {
+      Ems.owner[ Page ]   = ( uint8_t ) Handle ;
+      Ems.logical[ Page ] = Logical++ ;
+    }
+  }
+
+  Ems.pages[ Handle ] = Count ;
+}
+
+static uint8_t Allocate( uint16_t Count , bool AllowZero , uint16_t & Handle )
+{
+  if( ( Count == 0 ) && !AllowZero )
+  {
+    return( EMS_ERR_ZERO_PAGES ) ;
+  }
+
+  if( Count > TotalPages )
+  {
+    return( EMS_ERR_TOTAL_PAGES ) ;
+  }
+
+  if( Count > FreePages() )
+  {
+    return( EMS_ERR_FREE_PAGES ) ;
+  }
+
+  // Handle 0 belongs to the operating system.
+  for( Handle = 1 ; Handle < EMS_MAX_HANDLES ; Handle++ )
+  {
+    if( !Ems.used[ Handle ] )
+    {
+      Ems.used[ Handle ]  = 1 ;
+      Ems.saved[ Handle ] = 0 ;
+      Ems.pages[ Handle ] = 0 ;
+      memset( Ems.name[ Handle ] , 0 , 8 ) ;
+      ResizeHandle( Handle , Count ) ;
+      return( EMS_OK ) ;
+    }
+  }
+
+  return( EMS_ERR_NO_HANDLES ) ;
+}
+
+// Map a handle's logical page, or unmap if Logical is EMS_NO_PAGE.
+static uint8_t MapHandlePage( uint16_t Handle , uint16_t Logical , int Slot )
+{
+  int Page ;
+
+  if( !ValidHandle( Handle ) )
+  {
+    return( EMS_ERR_HANDLE ) ;
+  }
+
+  if( ( Slot < 0 ) || ( Slot >= EMS_FRAME_PAGES ) )
+  {
+    return( EMS_ERR_PHYSICAL_PAGE ) ;
+  }
+
+  if( Logical == EMS_NO_PAGE )
+  {
+    MapFrame( Slot , EMS_NO_PAGE ) ;
+    return( EMS_OK ) ;
+  }
+
+  Page = FindPage( Handle , Logical ) ;
+  if( Page < 0 )
+  {
+    return( EMS_ERR_LOGICAL_PAGE ) ;
+  }
+
+  MapFrame( Slot , ( uint16_t ) Page ) ;
+
+  return( EMS_OK ) ;
+}
+
+// Frame page number for a segment address, or -1.
+static int SegmentSlot( uint16_t Segment )
+{
+  if( ( Segment < FrameSegment ) || ( ( Segment - FrameSegment ) % ( EMS_PAGE_SIZE >> 4 ) ) != 0 )
+  {
+    return( -1 ) ;
+  }
+
+  return( ( Segment - FrameSegment ) / ( EMS_PAGE_SIZE >> 4 ) ) ;
+}
+
+// Copy a move/exchange region (function 57h) to or from Buffer, or only
+// check the region if Buffer is NULL.
+static uint8_t Region( const uint8_t * Desc , uint32_t Length , uint8_t * Buffer , bool Write )
+{
+  uint8_t  Type    = Desc[ 0 ] ;
+  uint16_t Handle  = *( uint16_t * ) &Desc[ 1 ] ;
+  uint16_t Offset  = *( uint16_t * ) &Desc[ 3 ] ;
+  uint16_t SegPage = *( uint16_t * ) &Desc[ 5 ] ;
+
+  if( Type == 0 )
+  {
+    uint32_t Addr = 16 * ( uint32_t ) SegPage + Offset ;
+
+    if( Addr + Length > MEM_LOW_SIZE )
+    {
+      return( EMS_ERR_WRAP ) ;
+    }
+
+    if( ( Buffer != NULL ) && Write )
+    {
+      memcpy( mem + Addr , Buffer , Length ) ;
+    }
+    else if( Buffer != NULL )
+    {
+      memcpy( Buffer , mem + Addr , Length ) ;
+    }
+
+    return( EMS_OK ) ;
+  }
+
+  if( Type != 1 )
+  {
+    return( EMS_ERR_MEMORY_TYPE ) ;
+  }
+
+  if( !ValidHandle( Handle ) )
+  {
+    return( EMS_ERR_HANDLE ) ;
+  }
+
+  if( Offset >= EMS_PAGE_SIZE )
+  {
+    return( EMS_ERR_OFFSET ) ;
+  }
+
+  if( FindPage( Handle , SegPage ) < 0 )
+  {
+    return( EMS_ERR_LOGICAL_PAGE ) ;
+  }
+
+  while( Length > 0 )
+  {
+    uint32_t Chunk = EMS_PAGE_SIZE - Offset ;
+    int      Page  = FindPage( Handle , SegPage ) ;
+
+    if( Page < 0 )
+    {
+      return( EMS_ERR_REGION_PAGES ) ;
+    }
+
+    if( Chunk > Length )
+    {
+      Chunk = Length ;
+    }
+
+    if( ( Buffer != NULL ) && Write )
+    {
+      JournalPage( ( uint16_t ) Page ) ;
+      memcpy( PageData( ( uint16_t ) Page ) + Offset , Buffer , Chunk ) ;
+      Buffer += Chunk ;
+    }
+    else if( Buffer != NULL )
+    {
+      memcpy( Buffer , PageData( ( uint16_t ) Page ) + Offset , Chunk ) ;
+      Buffer += Chunk ;
+    }
+
+    Length -= Chunk ;
+    Offset  = 0 ;
+    SegPage++ ;
+  }
+
+  return( EMS_OK ) ;
+}
+
+// Function 57h: move (Exchange false) or exchange a memory region.
+static uint8_t MoveRegion( const uint8_t * Desc , bool Exchange )
+{
+  uint32_t  Length = *( uint32_t * ) &Desc[ 0 ] ;
+  uint8_t * Source ;
+  uint8_t * Dest   = NULL ;
+  uint8_t   Status ;
+
+  if( Length > MEM_LOW_SIZE )
+  {
+    return( EMS_ERR_LENGTH ) ;
+  }
+
+  // Both regions are read before either is written, so a bad descriptor
+  // leaves memory unchanged and overlapping regions behave as if copied in
+  // one step.
+  Source = ( uint8_t * ) malloc( Length + 1 ) ;
+  if( Exchange )
+  {
+    Dest = ( uint8_t * ) malloc( Length + 1 ) ;
+  }
+
+  if( ( Source == NULL ) || ( Exchange && ( Dest == NULL ) ) )
+  {
+    Status = EMS_ERR_SOFTWARE ;
+  }
+  else
+  {
+    Status = Region( &Desc[ 4 ] , Length , Source , false ) ;
+    if( Status == EMS_OK )
+    {
+      Status = Region( &Desc[ 11 ] , Length , Dest , false ) ;
+    }
+    if( Status == EMS_OK )
+    {
+      Region( &Desc[ 11 ] , Length , Source , true ) ;
+      if( Exchange )
+      {
+        Region( &Desc[ 4 ] , Length , Dest , true ) ;
+      }
+    }
+  }
+
+  free( Source ) ;
+  free( Dest ) ;
+
+  return( Status ) ;
+}
+
+// =============================================================================
+// Exported functions
+//
+
+bool EMS_Initialise( int SizeKB , int FrameSegmentIn )
+{
+  EMS_Cleanup() ;
+
+  if( SizeKB <= 0 )
+  {
+    return( false ) ;
+  }
+
+  TotalPages = SizeKB / ( EMS_PAGE_SIZE / 1024 ) ;
+  if( TotalPages > EMS_MAX_PAGES )
+  {
+    TotalPages = EMS_MAX_PAGES ;
+  }
+
+  if( ( FrameSegmentIn < 0xC000 ) || ( FrameSegmentIn > 0xEC00 ) || ( FrameSegmentIn & 0x03FF ) )
+  {
+    FrameSegmentIn = EMS_DEFAULT_FRAME ;
+  }
+
+  FrameSegment = ( uint16_t ) FrameSegmentIn ;
+  FrameAddr    = 16 * ( uint32_t ) FrameSegment ;
+
+  Store = MEM_ExpandedAlloc( TotalPages * EMS_PAGE_SIZE ) ;
+  if( Store == NULL )
+  {
+    TotalPages = 0 ;
+    return( false ) ;
+  }
+
+  for( int Slot = 0 ; Slot < EMS_FRAME_PAGES ; Slot++ )
+  {
+    Ems.frame[ Slot ] = EMS_NO_PAGE ;
+  }
+
+  // Find out if the host can remap pages into the frame.
+  ZeroCopy = ( MEM_MapExpanded( FrameAddr , 0 , EMS_PAGE_SIZE ) != 0 ) ;
+  if( ZeroCopy )
+  {
+    MEM_UnmapExpanded( FrameAddr , EMS_PAGE_SIZE ) ;
+  }
+
+  Fitted = true ;
+
+  return( true ) ;
+}
+
+void EMS_Cleanup( void )
+{
+  if( Fitted )
+  {
+    EMS_UnmapFrame() ;
+
+    MEM_ExpandedFree() ;
+    Store      = NULL ;
+    TotalPages = 0 ;
+    Fitted     = false ;
+  }
+
+  EMS_StopJournal() ;
+  free( JournalData ) ;
+  JournalData = NULL ;
+  JournalSize = 0 ;
+}
+
+void EMS_Reset( void )
+{
+  if( !Fitted )
+  {
+    return ;
+  }
+
+  for( int Slot = 0 ; Slot < EMS_FRAME_PAGES ; Slot++ )
+  {
+    MapFrame( Slot , EMS_NO_PAGE ) ;
+    Ems.high[ Slot ] = 0 ;
+  }
+
+  memset( Ems.owner , EMS_FREE , sizeof( Ems.owner ) ) ;
+  memset( Ems.pages , 0 , sizeof( Ems.pages ) ) ;
+  memset( Ems.used , 0 , sizeof( Ems.used ) ) ;
+  memset( Ems.name , 0 , sizeof( Ems.name ) ) ;
+  memset( Ems.saved , 0 , sizeof( Ems.saved ) ) ;
+  Ems.used[ 0 ] = 1 ;
+
+  // Guest RAM was cleared while expanded memory may have been mapped over
+  // the frame, so clear what was behind it.
+  memset( mem + FrameAddr , 0 , EMS_FRAME_PAGES * EMS_PAGE_SIZE ) ;
+
+  memcpy( mem + FrameAddr - 16 * EMS_DRIVER_PARAS , DriverStub , sizeof( DriverStub ) ) ;
+  Ems.hooked = 0 ;
+}
+
+void EMS_Bootstrap( void )
+{
+  if( Fitted && ( *( uint32_t * ) &mem[ 4 * 0x67 ] == 0 ) )
+  {
+    *( uint16_t * ) &mem[ 4 * 0x67 ]     = EMS_DRIVER_ENTRY ;
+    *( uint16_t * ) &mem[ 4 * 0x67 + 2 ] = ( uint16_t ) ( FrameSegment - EMS_DRIVER_PARAS ) ;
+    Ems.hooked = 1 ;
+  }
+}
+
+bool EMS_WritePort( int Address , uint8_t Value )
+{
+  int      Slot ;
+  uint16_t Page ;
+
+  if( !Fitted || ( Address < EMS_PORT_BASE ) || ( Address >= EMS_PORT_BASE + 2 * EMS_FRAME_PAGES ) )
+  {
+    return( false ) ;
+  }
+
+  Slot = ( Address - EMS_PORT_BASE ) % EMS_FRAME_PAGES ;
+  if( Address >= EMS_PORT_BASE + EMS_FRAME_PAGES )
+  {
+    Ems.high[ Slot ] = Value ;
+  }
+  else
+  {
+    Page = ( uint16_t ) ( ( Ems.high[ Slot ] << 8 ) | Value ) ;
+    MapFrame( Slot , ( Page < TotalPages ) ? Page : EMS_NO_PAGE ) ;
+  }
+
+  return( true ) ;
+}
+
+bool EMS_ReadPort( int Address , uint8_t & Value )
+{
+  int Slot ;
+
+  if( !Fitted || ( Address < EMS_PORT_BASE ) || ( Address >= EMS_PORT_BASE + 2 * EMS_FRAME_PAGES ) )
+  {
+    return( false ) ;
+  }
+
+  Slot = ( Address - EMS_PORT_BASE ) % EMS_FRAME_PAGES ;
+  if( Address >= EMS_PORT_BASE + EMS_FRAME_PAGES )
+  {
+    Value = ( uint8_t ) ( Ems.frame[ Slot ] >> 8 ) ;
+  }
+  else
+  {
+    Value = ( uint8_t ) Ems.frame[ Slot ] ;
+  }
+
+  return( true ) ;
+}
+
+void EMS_Interrupt( void )
+{
+  uint16_t * Regs   = Regs16() ;
+  uint8_t  * Regs8b = Regs8() ;
+  uint8_t    Status = EMS_OK ;
+  uint16_t   Handle = Regs[ REG_DX ] ;
+  uint8_t    Sub    = Regs8b[ REG_AL ] ;
+  uint8_t  * Src    = Linear( Regs[ REG_DS ] , Regs[ REG_SI ] ) ;
+  uint8_t  * Dst    = Linear( Regs[ REG_ES ] , Regs[ REG_DI ] ) ;
+
+  if( !Fitted )
+  {
+    Regs8b[ REG_AH ] = EMS_ERR_SOFTWARE ;
+    return ;
+  }
+
+  switch( Regs8b[ REG_AH ] )
+  {
+  // Get status
+  case 0x40 :
+    break ;
+
+  // Get page frame address
+  case 0x41 :
+    Regs[ REG_BX ] = FrameSegment ;
+    break ;
+
+  // Get unallocated page count
+  case 0x42 :
+    Regs[ REG_BX ] = ( uint16_t ) FreePages() ;
+    Regs[ REG_DX ] = ( uint16_t ) TotalPages ;
+    break ;
+
+  // Allocate pages
+  case 0x43 :
+    Status = Allocate( Regs[ REG_BX ] , false , Handle ) ;
+    if( Status == EMS_OK )
+    {
+      Regs[ REG_DX ] = Handle ;
+    }
+    break ;
+
+  // Map/unmap handle page
+  case 0x44 :
+    Status = MapHandlePage( Handle , Regs[ REG_BX ] , Sub ) ;
+    break ;
+
+  // Deallocate pages
+  case 0x45 :
+    if( !ValidHandle( Handle ) )
+    {
+      Status = EMS_ERR_HANDLE ;
+    }
+    else if( Ems.saved[ Handle ] )
+    {
+      Status = EMS_ERR_SAVE_RESTORE ;
+    }
+    else
+    {
+      ResizeHandle( Handle , 0 ) ;
+      memset( Ems.name[ Handle ] , 0 , 8 ) ;
+
+      // The operating system handle stays open.
+      Ems.used[ Handle ] = ( Handle == 0 ) ;
+    }
+    break ;
+
+  // Get version
+  case 0x46 :
+    Regs8b[ REG_AL ] = EMS_VERSION ;
+    break ;
+
+  // Save page map
+  case 0x47 :
+    if( !ValidHandle( Handle ) )
+    {
+      Status = EMS_ERR_HANDLE ;
+    }
+    else if( Ems.saved[ Handle ] )
+    {
+      Status = EMS_ERR_MAP_SAVED ;
+    }
+    else
+    {
+      memcpy( Ems.savedmap[ Handle ] , Ems.frame , sizeof( Ems.frame ) ) ;
+      Ems.saved[ Handle ] = 1 ;
+    }
+    break ;
+
+  // Restore page map
+  case 0x48 :
+    if( !ValidHandle( Handle ) )
+    {
+      Status = EMS_ERR_HANDLE ;
+    }
+    else if( !Ems.saved[ Handle ] )
+    {
+      Status = EMS_ERR_NO_MAP_SAVED ;
+    }
+    else
+    {
+      for( int Slot = 0 ; Slot < EMS_FRAME_PAGES ; Slot++ )
+      {
+        MapFrame( Slot , Ems.savedmap[ Handle ][ Slot ] ) ;
+      }
+      Ems.saved[ Handle ] = 0 ;
+    }
+    break ;
+
+  // Get handle count
+  case 0x4B :
+    Regs[ REG_BX ] = 0 ;
+    for( int i = 0 ; i < EMS_MAX_HANDLES ; i++ )
+    {
+      Regs[ REG_BX ] += Ems.used[ i ] ;
+    }
+    break ;
+
+  // Get handle pages
+  case 0x4C :
+    if( !ValidHandle( Handle ) )
+    {
+      Status = EMS_ERR_HANDLE ;
+    }
+    else
+    {
+      Regs[ REG_BX ] = Ems.pages[ Handle ] ;
+    }
+    break ;
+
+  // Get all handle pages
+  case 0x4D :
+    Regs[ REG_BX ] = 0 ;
+    for( int i = 0 ; i < EMS_MAX_HANDLES ; i++ )
+    {
+      if( Ems.used[ i ] )
+      {
+        *( uint16_t * ) &Dst[ 0 ] = ( uint16_t ) i ;
+        *( uint16_t * ) &Dst[ 2 ] = Ems.pages[ i ] ;
+        Dst += 4 ;
+        Regs[ REG_BX ]++ ;
+      }
+    }
+    break ;
+
+  // Get/set page map. The map is the page number of each frame page.
+  case 0x4E :
+    if( Sub > 3 )
+    {
+      Status = EMS_ERR_SUBFUNCTION ;
+      break ;
+    }
+    if( ( Sub == 0 ) || ( Sub == 2 ) )
+    {
+      memcpy( Dst , Ems.frame , sizeof( Ems.frame ) ) ;
+    }
+    if( ( Sub == 1 ) || ( Sub == 2 ) )
+    {
+      for( int Slot = 0 ; Slot < EMS_FRAME_PAGES ; Slot++ )
+      {
+        uint16_t Page = *( uint16_t * ) &Src[ 2 * Slot ] ;
+        MapFrame( Slot , ( Page < TotalPages ) ? Page : EMS_NO_PAGE ) ;
+      }
+    }
+    if( Sub == 3 )
+    {
+      Regs8b[ REG_AL ] = sizeof( Ems.frame ) ;
+    }
+    break ;
+
+  // Get/set partial page map. The map is a count followed by a segment
+  // and page number for each frame page saved.
+  case 0x4F :
+    if( Sub == 0 )
+    {
+      uint16_t Count = *( uint16_t * ) &Src[ 0 ] ;
+
+      if( Count > EMS_FRAME_PAGES )
+      {
+        Status = EMS_ERR_PHYSICAL_PAGE ;
+        break ;
+      }
+      for( int i = 0 ; ( i < Count ) && ( Status == EMS_OK ) ; i++ )
+      {
+        if( SegmentSlot( *( uint16_t * ) &Src[ 2 + 2 * i ] ) < 0 )
+        {
+          Status = EMS_ERR_PHYSICAL_PAGE ;
+        }
+      }
+      if( Status != EMS_OK )
+      {
+        break ;
+      }
+      *( uint16_t * ) &Dst[ 0 ] = Count ;
+      for( int i = 0 ; i < Count ; i++ )
+      {
+        uint16_t Segment = *( uint16_t * ) &Src[ 2 + 2 * i ] ;
+        *( uint16_t * ) &Dst[ 2 + 4 * i ] = Segment ;
+        *( uint16_t * ) &Dst[ 4 + 4 * i ] = Ems.frame[ SegmentSlot( Segment ) ] ;
+      }
+    }
+    else if( Sub == 1 )
+    {
+      uint16_t Count = *( uint16_t * ) &Src[ 0 ] ;
+
+      for( int i = 0 ; ( i < Count ) && ( i < EMS_FRAME_PAGES ) ; i++ )
+      {
+        int      Slot = SegmentSlot( *( uint16_t * ) &Src[ 2 + 4 * i ] ) ;
+        uint16_t Page = *( uint16_t * ) &Src[ 4 + 4 * i ] ;
+
+        if( ( Slot >= 0 ) && ( Slot < EMS_FRAME_PAGES ) )
+        {
+          MapFrame( Slot , ( Page < TotalPages ) ? Page : EMS_NO_PAGE ) ;
+        }
+      }
+    }
+    else if( Sub == 2 )
+    {
+      Regs8b[ REG_AL ] = ( uint8_t ) ( 2 + 4 * Regs[ REG_BX ] ) ;
+    }
+    else
+    {
+      Status = EMS_ERR_SUBFUNCTION ;
+    }
+    break ;
+
+  // Map/unmap multiple handle pages, by frame page number (AL=0) or by
+  // segment (AL=1).
+  case 0x50 :
+    if( Sub > 1 )
+    {
+      Status = EMS_ERR_SUBFUNCTION ;
+      break ;
+    }
+    for( int i = 0 ; ( i < Regs[ REG_CX ] ) && ( Status == EMS_OK ) ; i++ )
+    {
+      uint16_t Logical = *( uint16_t * ) &Src[ 4 * i ] ;
+      uint16_t Where   = *( uint16_t * ) &Src[ 4 * i + 2 ] ;
+
+      Status = MapHandlePage( Handle , Logical , ( Sub == 0 ) ? Where : SegmentSlot( Where ) ) ;
+    }
+    break ;
+
+  // Reallocate pages
+  case 0x51 :
+    if( !ValidHandle( Handle ) )
+    {
+      Status = EMS_ERR_HANDLE ;
+    }
+    else if( Regs[ REG_BX ] > TotalPages )
+    {
+      Status = EMS_ERR_TOTAL_PAGES ;
+    }
+    else if( Regs[ REG_BX ] > Ems.pages[ Handle ] + FreePages() )
+    {
+      Status = EMS_ERR_FREE_PAGES ;
+    }
+    else
+    {
+      ResizeHandle( Handle , Regs[ REG_BX ] ) ;
+    }
+    if( ValidHandle( Handle ) )
+    {
+      Regs[ REG_BX ] = Ems.pages[ Handle ] ;
+    }
+    break ;
+
+  // Get/set handle attribute. Only volatile handles are supported.
+  case 0x52 :
+    if( ( Sub < 2 ) && !ValidHandle( Handle ) )
+    {
+      Status = EMS_ERR_HANDLE ;
+    }
+    else if( ( Sub == 0 ) || ( Sub == 2 ) )
+    {
+      Regs8b[ REG_AL ] = 0 ;
+    }
+    else if( Sub == 1 )
+    {
+      Status = ( Regs8b[ REG_BL ] == 0 ) ? EMS_OK : EMS_ERR_ATTRIBUTE ;
+    }
+    else
+    {
+      Status = EMS_ERR_SUBFUNCTION ;
+    }
+    break ;
+
+  // Get/set handle name
+  case 0x53 :
+    if( !ValidHandle( Handle ) )
+    {
+      Status = EMS_ERR_HANDLE ;
+    }
+    else if( Sub == 0 )
+    {
+      memcpy( Dst , Ems.name[ Handle ] , 8 ) ;
+    }
+    else if( Sub == 1 )
+    {
+      static const char NoName[ 8 ] = { 0 } ;
+
+      for( int i = 0 ; i < EMS_MAX_HANDLES ; i++ )
+      {
+        if( Ems.used[ i ] && ( i != Handle ) && ( memcmp( Src , NoName , 8 ) != 0 ) &&
+            ( memcmp( Ems.name[ i ] , Src , 8 ) == 0 ) )
+        {
+          Status = EMS_ERR_NAME_EXISTS ;
+        }
+      }
+      if( Status == EMS_OK )
+      {
+        memcpy( Ems.name[ Handle ] , Src , 8 ) ;
+      }
+    }
+    else
+    {
+      Status = EMS_ERR_SUBFUNCTION ;
+    }
+    break ;
+
+  // Get handle directory
+  case 0x54 :
+    if( Sub == 0 )
+    {
+      Regs8b[ REG_AL ] = 0 ;
+      for( int i = 0 ; i < EMS_MAX_HANDLES ; i++ )
+      {
+        if( Ems.used[ i ] )
+        {
+          *( uint16_t * ) &Dst[ 0 ] = ( uint16_t ) i ;
+          memcpy( &Dst[ 2 ] , Ems.name[ i ] , 8 ) ;
+          Dst += 10 ;
+          Regs8b[ REG_AL ]++ ;
+        }
+      }
+    }
+    else if( Sub == 1 )
+    {
+      Status = EMS_ERR_NAME_NOT_FOUND ;
+      for( int i = 0 ; i < EMS_MAX_HANDLES ; i++ )
+      {
+        if( Ems.used[ i ] && ( memcmp( Ems.name[ i ] , Src , 8 ) == 0 ) )
+        {
+          Regs[ REG_DX ] = ( uint16_t ) i ;
+          Status = EMS_OK ;
+          break ;
+        }
+      }
+    }
+    else if( Sub == 2 )
+    {
+      Regs[ REG_BX ] = EMS_MAX_HANDLES ;
+    }
+    else
+    {
+      Status = EMS_ERR_SUBFUNCTION ;
+    }
+    break ;
+
+  // Move/exchange memory region
+  case 0x57 :
+    if( Sub > 1 )
+    {
+      Status = EMS_ERR_SUBFUNCTION ;
+    }
+    else
+    {
+      Status = MoveRegion( Src , ( Sub == 1 ) ) ;
+    }
+    break ;
+
+  // Get mappable physical address array
+  case 0x58 :
+    if( Sub == 0 )
+    {
+      for( int Slot = 0 ; Slot < EMS_FRAME_PAGES ; Slot++ )
+      {
+        *( uint16_t * ) &Dst[ 4 * Slot ]     = ( uint16_t ) ( FrameSegment + Slot * ( EMS_PAGE_SIZE >> 4 ) ) ;
+        *( uint16_t * ) &Dst[ 4 * Slot + 2 ] = ( uint16_t ) Slot ;
+      }
+    }
+    if( Sub < 2 )
+    {
+      Regs[ REG_CX ] = EMS_FRAME_PAGES ;
+    }
+    else
+    {
+      Status = EMS_ERR_SUBFUNCTION ;
+    }
+    break ;
+
+  // Get hardware configuration / raw page count
+  case 0x59 :
+    if( Sub == 0 )
+    {
+      *( uint16_t * ) &Dst[ 0 ] = EMS_PAGE_SIZE >> 4 ;     // Raw page size in paragraphs
+      *( uint16_t * ) &Dst[ 2 ] = 0 ;                      // Alternate register sets
+      *( uint16_t * ) &Dst[ 4 ] = sizeof( Ems.frame ) ;    // Page map size
+      *( uint16_t * ) &Dst[ 6 ] = 0 ;                      // DMA register sets
+      *( uint16_t * ) &Dst[ 8 ] = 0 ;                      // DMA channel operation
+    }
+    else if( Sub == 1 )
+    {
+      Regs[ REG_BX ] = ( uint16_t ) FreePages() ;
+      Regs[ REG_DX ] = ( uint16_t ) TotalPages ;
+    }
+    else
+    {
+      Status = EMS_ERR_SUBFUNCTION ;
+    }
+    break ;
+
+  // Allocate standard/raw pages, allowing zero pages
+  case 0x5A :
+    if( Sub > 1 )
+    {
+      Status = EMS_ERR_SUBFUNCTION ;
+      break ;
+    }
+    Status = Allocate( Regs[ REG_BX ] , true , Handle ) ;
+    if( Status == EMS_OK )
+    {
+      Regs[ REG_DX ] = Handle ;
+    }
+    break ;
+
+  // Alter page map and jump/call, alternate map registers, prepare for warm
+  // boot and the operating system functions are not provided.
+  default :
+    Status = EMS_ERR_FUNCTION ;
+    break ;
+  }
+
+  Regs8b[ REG_AH ] = Status ;
+}
+
+void EMS_UnmapFrame( void )
+{
+  if( Fitted )
+  {
+    for( int Slot = 0 ; Slot < EMS_FRAME_PAGES ; Slot++ )
+    {
+      MapFrame( Slot , EMS_NO_PAGE ) ;
+    }
+  }
+}
+
+uint8_t * EMS_GetPages( int & Count )
+{
+  Count = TotalPages ;
+
+  return( Store ) ;
+}
+
+void EMS_GetState( stEMSState_t * State )
+{
+  *State = Ems ;
+}
+
+void EMS_SetState( const stEMSState_t * State )
+{
+  // Switch the frame first so any copying uses the current ownership.
+  if( Fitted )
+  {
+    for( int Slot = 0 ; Slot < EMS_FRAME_PAGES ; Slot++ )
+    {
+      MapFrame( Slot , State->frame[ Slot ] ) ;
+    }
+  }
+
+  Ems = *State ;
+}
+
+void EMS_StartJournal( void )
+{
+  for( int i = 0 ; i < JournalCount ; i++ )
+  {
+    Journalled[ JournalPages[ i ] ] = 0 ;
+  }
+
+  JournalCount  = 0 ;
+  JournalFailed = false ;
+  JournalOn     = Fitted ;
+
+  // The guest can change the pages already in the frame.
+  if( JournalOn && ZeroCopy )
+  {
+    for( int Slot = 0 ; Slot < EMS_FRAME_PAGES ; Slot++ )
+    {
+      if( Ems.frame[ Slot ] != EMS_NO_PAGE )
+      {
+        JournalPage( Ems.frame[ Slot ] ) ;
+      }
+    }
+  }
+}
+
+void EMS_StopJournal( void )
+{
+  JournalOn = false ;
+}
+
+bool EMS_SaveCheckpoint( stEMSCheckpoint_t * Checkpoint )
+{
+  Checkpoint->state = Ems ;
+  Checkpoint->count = 0 ;
+
+  if( !JournalOn )
+  {
+    return( true ) ;
+  }
+
+  if( JournalFailed || !GrowPages( Checkpoint->pages , Checkpoint->size , JournalCount ) )
+  {
+    return( false ) ;
+  }
+
+  for( int i = 0 ; i < JournalCount ; i++ )
+  {
+    memcpy( Checkpoint->pages + i * EMS_PAGE_SIZE , Store + JournalPages[ i ] * EMS_PAGE_SIZE , EMS_PAGE_SIZE ) ;
+  }
+  Checkpoint->count = JournalCount ;
+
+  if( !ZeroCopy )
+  {
+    memcpy( Checkpoint->shadow , Shadow , sizeof( Shadow ) ) ;
+  }
+
+  return( true ) ;
+}
+
+void EMS_RestoreCheckpoint( const stEMSCheckpoint_t * Checkpoint )
+{
+  // Switch the frame first, as copying pages out of the frame changes the
+  // store.
+  EMS_SetState( &Checkpoint->state ) ;
+
+  if( !JournalOn )
+  {
+    return ;
+  }
+
+  // Pages first changed after the checkpoint get their journal contents.
+  for( int i = 0 ; i < JournalCount ; i++ )
+  {
+    const uint8_t * Data ;
+
+    Data = ( i < Checkpoint->count ) ? ( Checkpoint->pages + i * EMS_PAGE_SIZE ) : ( JournalData + i * EMS_PAGE_SIZE ) ;
+    memcpy( Store + JournalPages[ i ] * EMS_PAGE_SIZE , Data , EMS_PAGE_SIZE ) ;
+  }
+
+  if( !ZeroCopy )
+  {
+    memcpy( Shadow , Checkpoint->shadow , sizeof( Shadow ) ) ;
+  }
+}
+
+void EMS_FreeCheckpoint( stEMSCheckpoint_t * Checkpoint )
+{
+  free( Checkpoint->pages ) ;
+  Checkpoint->pages = NULL ;
+  Checkpoint->size  = 0 ;
+  Checkpoint->count = 0 ;
+}
@@ -0,0 +1,342 @@
+// =============================================================================
+// File: XTems.h
+//
+// Description:
+// LIM EMS 4.0 expanded memory board.
+//
+// The board holds up to 32MB of expanded memory in 16KB pages. Four pages at
+// a time are visible through a 64KB page frame in upper memory. Each frame
+// page has an I/O page register selecting the expanded memory page shown
+// there, and an INT 67h driver provides the LIM EMS 4.0 interface on top of
+// the registers.
+// Where the host allows it, switching a frame page remaps host memory into
+// the guest address space instead of copying the page.
+//
+// This work is licensed under the MIT License. See included LICENSE.TXT.
+//
+
+#ifndef _XTEMS_
+#define _XTEMS_
+
+#include <stdint.h>
+
+#define EMS_PAGE_SIZE                            0x4000 // 16KB
+#define EMS_FRAME_PAGES                          4
+#define EMS_MAX_PAGES                            2048   // 32MB
+#define EMS_MAX_HANDLES                          64
+
+// Page registers. Writing the low byte of a page number maps the page, so
+// the high byte is written first. Page numbers past the end of expanded
+// memory unmap the frame page.
+#define EMS_PORT_BASE                            0x260  // 260-263: low bytes of frame pages 0-3
+                                                        // 264-267: high bytes of frame pages 0-3
+
+// The page frame segment used if none is configured.
+#define EMS_DEFAULT_FRAME                        0xE000
+
+// Board state.
+typedef struct STEMSSTATE_T
+{
+  uint16_t frame[ EMS_FRAME_PAGES ]       ; // Page mapped in each frame page, 0xFFFF = none
+  uint8_t  high[ EMS_FRAME_PAGES ]        ; // Page register high bytes
+  uint8_t  owner[ EMS_MAX_PAGES ]         ; // Handle owning each page, 0xFF = free
+  uint16_t logical[ EMS_MAX_PAGES ]       ; // Logical page number within the owner
+  uint16_t pages[ EMS_MAX_HANDLES ]       ; // Pages allocated to each handle
+  uint8_t  used[ EMS_MAX_HANDLES ]        ; // Handle is open
+  char     name[ EMS_MAX_HANDLES ][ 8 ]   ; // Handle names
+  uint8_t  saved[ EMS_MAX_HANDLES ]       ; // A page map is saved for the handle
+  uint16_t savedmap[ EMS_MAX_HANDLES ][ EMS_FRAME_PAGES ] ;
+  uint8_t  hooked                         ; // INT 67h vector installed since reset
+} stEMSState_t ;
+
+// Board state and the contents of the pages changed since the journal was
+// started, see EMS_StartJournal.
+typedef struct STEMSCHECKPOINT_T
+{
+  stEMSState_t state ;
+  int          count ;                      // Journalled pages held
+  int          size  ;                      // Pages the buffer can hold
+  uint8_t    * pages ;                      // Their contents, in journal order
+  uint8_t      shadow[ EMS_FRAME_PAGES * EMS_PAGE_SIZE ] ; // Guest RAM behind the frame
+} stEMSCheckpoint_t ;
+
+// =============================================================================
+// Function: EMS_Initialise
+//
+// Description:
+// Fit the expanded memory board.
+//
+// Parameters:
+//
+//   SizeKB       : Expanded memory size in KB. 0 means no board is fitted.
+//
+//   FrameSegment : Page frame segment. Must be 16KB aligned and between
+//                  C000 and EC00, otherwise EMS_DEFAULT_FRAME is used.
+//
+// Returns:
+//
+//   bool : true if the board is fitted.
+//
+bool EMS_Initialise( int SizeKB , int FrameSegment ) ;
+
+// =============================================================================
+// Function: EMS_Cleanup
+//
+// Description:
+// Remove the board and release expanded memory.
+//
+// Parameters:
+//
+//   None.
+//
+// Returns:
+//
+//   None.
+//
+void EMS_Cleanup( void ) ;
+
+// =============================================================================
+// Function: EMS_Reset
+//
+// Description:
+// Free all handles, clear the page frame and install the INT 67h driver
+// code. Must be called after guest memory has been cleared.
+//
+// Parameters:
+//
+//   None.
+//
+// Returns:
+//
+//   None.
+//
+void EMS_Reset( void ) ;
+
+// =============================================================================
+// Function: EMS_Bootstrap
+//
+// Description:
+// Point the INT 67h vector at the driver if it is not set.
+// The BIOS clears the interrupt vector table during POST and only enables
+// interrupts once it has set the table up, so this is called when a
+// hardware interrupt is delivered. A warm boot clears the vector again.
+//
+// Parameters:
+//
+//   None.
+//
+// Returns:
+//
+//   None.
+//
+void EMS_Bootstrap( void ) ;
+
+// =============================================================================
+// Function: EMS_WritePort
+//
+// Description:
+// Write a page register.
+//
+// Parameters:
+//
+//   Address : The I/O port address.
+//
+//   Value   : The value written.
+//
+// Returns:
+//
+//   bool : true if the port belongs to the board.
+//
+bool EMS_WritePort( int Address , uint8_t Value ) ;
+
+// =============================================================================
+// Function: EMS_ReadPort
+//
+// Description:
+// Read a page register.
+//
+// Parameters:
+//
+//   Address : The I/O port address.
+//
+//   Value   : Set to the register value.
+//
+// Returns:
+//
+//   bool : true if the port belongs to the board.
+//
+bool EMS_ReadPort( int Address , uint8_t & Value ) ;
+
+// =============================================================================
+// Function: EMS_Interrupt
+//
+// Description:
+// Handle an INT 67h call, taking the function from the emulated registers
+// and returning the status in AH.
+//
+// Parameters:
+//
+//   None.
+//
+// Returns:
+//
+//   None.
+//
+void EMS_Interrupt( void ) ;
+
+// =============================================================================
+// Function: EMS_UnmapFrame
+//
+// Description:
+// Show guest RAM in all frame pages, leaving the page allocation unchanged.
+// EMS_SetState maps pages into the frame again.
+//
+// Parameters:
+//
+//   None.
+//
+// Returns:
+//
+//   None.
+//
+void EMS_UnmapFrame( void ) ;
+
+// =============================================================================
+// Function: EMS_GetPages
+//
+// Description:
+// Get the contents of expanded memory. When pages are copied rather than
+// remapped, pages in the page frame are only up to date after
+// EMS_UnmapFrame.
+//
+// Parameters:
+//
+//   Count : Set to the number of pages.
+//
+// Returns:
+//
+//   uint8_t * : The pages, Count * EMS_PAGE_SIZE bytes, or NULL if no
+//               board is fitted.
+//
+uint8_t * EMS_GetPages( int & Count ) ;
+
+// =============================================================================
+// Function: EMS_GetState
+//
+// Description:
+// Copy the board state. The contents of expanded memory pages that are not
+// in the page frame are not included.
+//
+// Parameters:
+//
+//   State : Set to the current board state.
+//
+// Returns:
+//
+//   None.
+//
+void EMS_GetState( stEMSState_t * State ) ;
+
+// =============================================================================
+// Function: EMS_SetState
+//
+// Description:
+// Restore board state previously read with EMS_GetState, remapping the
+// page frame as needed.
+//
+// Parameters:
+//
+//   State : The board state to restore.
+//
+// Returns:
+//
+//   None.
+//
+void EMS_SetState( const stEMSState_t * State ) ;
+
+// =============================================================================
+// Function: EMS_StartJournal
+//
+// Description:
+// Start recording which expanded memory pages change, keeping the contents
+// each page had before its first change, so checkpoints taken from now on
+// only need the pages in the journal. Any previous journal is forgotten.
+//
+// Parameters:
+//
+//   None.
+//
+// Returns:
+//
+//   None.
+//
+void EMS_StartJournal( void ) ;
+
+// =============================================================================
+// Function: EMS_StopJournal
+//
+// Description:
+// Stop recording page changes.
+//
+// Parameters:
+//
+//   None.
+//
+// Returns:
+//
+//   None.
+//
+void EMS_StopJournal( void ) ;
+
+// =============================================================================
+// Function: EMS_SaveCheckpoint
+//
+// Description:
+// Save the board state and the pages in the journal.
+//
+// Parameters:
+//
+//   Checkpoint : The checkpoint to save to. Zero it before first use.
+//
+// Returns:
+//
+//   bool : false if there was not enough memory for the checkpoint or the
+//          journal, in which case the checkpoint cannot be restored.
+//
+bool EMS_SaveCheckpoint( stEMSCheckpoint_t * Checkpoint ) ;
+
+// =============================================================================
+// Function: EMS_RestoreCheckpoint
+//
+// Description:
+// Restore a checkpoint saved since the journal was started. Pages changed
+// after the checkpoint was saved are put back as they were then. Guest RAM
+// must be restored afterwards, as it holds the frame pages.
+//
+// Parameters:
+//
+//   Checkpoint : The checkpoint to restore.
+//
+// Returns:
+//
+//   None.
+//
+void EMS_RestoreCheckpoint( const stEMSCheckpoint_t * Checkpoint ) ;
+
+// =============================================================================
+// Function: EMS_FreeCheckpoint
+//
+// Description:
+// Release the memory held by a checkpoint.
+//
+// Parameters:
+//
+//   Checkpoint : The checkpoint to release.
+//
+// Returns:
+//
+//   None.
+//
+void EMS_FreeCheckpoint( stEMSCheckpoint_t * Checkpoint ) ;
+
+#endif // _XTEMS_
@@ -0,0 +1,1161 @@
+// =============================================================================
+// File: XTfpu.cpp
+//
+// Description:
+// 8087 numeric coprocessor emulation.
+// See XTfpu.h for a description of the implementation.
+//
+// This work is licensed under the MIT License. See included LICENSE.TXT.
+//
+
+#include <math.h>
+#include <fenv.h>
+#include <string.h>
+
+#include "XTfpu.h"
+#include "XTmemory.h"
+
+// Status word fields
+#define SW_IE                                    0x0001 // Invalid operation
+#define SW_DE                                    0x0002 // Denormalised operand
+#define SW_ZE                                    0x0004 // Zero divide
+#define SW_OE                                    0x0008 // Overflow
+#define SW_UE                                    0x0010 // Underflow
+#define SW_PE                                    0x0020 // Precision
+#define SW_ES                                    0x0080 // Error summary
+#define SW_C0                                    0x0100
+#define SW_C1                                    0x0200
+#define SW_C2                                    0x0400
+#define SW_TOP                                   0x3800
+#define SW_C3                                    0x4000
+#define SW_B                                     0x8000 // Busy
+
+// Control word fields
+#define CW_IEM                                   0x0080 // Interrupt enable mask
+#define CW_PC                                    0x0300 // Precision control
+#define CW_RC                                    0x0C00 // Rounding control
+
+// Register tags
+#define TAG_VALID                                0
+#define TAG_ZERO                                 1
+#define TAG_SPECIAL                              2
+#define TAG_EMPTY                                3
+
+// The power on control word: all exceptions masked, interrupts disabled,
+// 64-bit precision, round to nearest.
+#define CONTROL_INIT                             0x03FF
+
+// =============================================================================
+// Local variables
+//
+
+static int          Mode = FPU_MODE_NONE ;
+static stFPUState_t Fpu ;
+
+// Host rounding modes for each value of the rounding control field
+static const int RoundModes[ 4 ] =
+{
+  FE_TONEAREST , FE_DOWNWARD , FE_UPWARD , FE_TOWARDZERO
+} ;
+
+// =============================================================================
+// Local functions
+//
+
+static int GetTop( void )
+{
+  return( ( Fpu.status & SW_TOP ) >> 11 ) ;
+}
+
+static void SetTop( int Top )
+{
+  Fpu.status = ( Fpu.status & ~SW_TOP ) | ( ( Top & 7 ) << 11 ) ;
+}
+
+// Physical register number of ST(i)
+static int Phys( int i )
+{
+  return( ( GetTop() + i ) & 7 ) ;
+}
+
+static int GetTag( int PhysReg )
+{
+  return( ( Fpu.tag >> ( 2 * PhysReg ) ) & 3 ) ;
+}
+
+static void SetTag( int PhysReg , int Tag )
+{
+  Fpu.tag = ( Fpu.tag & ~( 3 << ( 2 * PhysReg ) ) ) | ( Tag << ( 2 * PhysReg ) ) ;
+}
+
+// The real indefinite, returned by masked invalid operations
+static long double Indefinite( void )
+{
+  return( -( long double ) NAN ) ;
+}
+
+// Record exceptions. Unmasked exceptions also set the error summary and
+// busy bits unless interrupts are disabled.
+static void Exception( uint16_t Flags )
+{
+  Fpu.status |= Flags ;
+
+  if( ( Flags & ~Fpu.control & 0x003F ) && !( Fpu.control & CW_IEM ) )
+  {
+    Fpu.status |= SW_ES | SW_B ;
+  }
+}
+
+static long double ReadST( int i )
+{
+  if( GetTag( Phys( i ) ) == TAG_EMPTY )
+  {
+    // Stack underflow
+    Exception( SW_IE ) ;
+    return( Indefinite() ) ;
+  }
+
+  return( Fpu.st[ Phys( i ) ] ) ;
+}
+
+static void WriteST( int i , long double Value )
+{
+  Fpu.st[ Phys( i ) ] = Value ;
+  SetTag( Phys( i ) , TAG_VALID ) ;
+}
+
+static void Push( long double Value )
+{
+  SetTop( GetTop() - 1 ) ;
+
+  if( GetTag( Phys( 0 ) ) != TAG_EMPTY )
+  {
+    // Stack overflow
+    Exception( SW_IE ) ;
+    Value = Indefinite() ;
+  }
+
+  WriteST( 0 , Value ) ;
+}
+
+static void Pop( void )
+{
+  SetTag( Phys( 0 ) , TAG_EMPTY ) ;
+  SetTop( GetTop() + 1 ) ;
+}
+
+// Tag of a register as reported by FSTENV and FSAVE
+static int ClassifyTag( int PhysReg )
+{
+  if( GetTag( PhysReg ) == TAG_EMPTY )
+  {
+    return( TAG_EMPTY ) ;
+  }
+
+  switch( fpclassify( Fpu.st[ PhysReg ] ) )
+  {
+  case FP_NORMAL :
+    return( TAG_VALID ) ;
+
+  case FP_ZERO :
+    return( TAG_ZERO ) ;
+
+  default :
+    return( TAG_SPECIAL ) ;
+  }
+}
+
+// Set up the host floating point environment for an instruction.
+static void HostBegin( void )
+{
+  feclearexcept( FE_ALL_EXCEPT ) ;
+
+  if( Fpu.control & CW_RC )
+  {
+    fesetround( RoundModes[ ( Fpu.control & CW_RC ) >> 10 ] ) ;
+  }
+}
+
+// Collect the exceptions raised by the host and restore its environment.
+static void HostEnd( void )
+{
+  int      Raised = fetestexcept( FE_ALL_EXCEPT ) ;
+  uint16_t Flags  = 0 ;
+
+  if( Raised & FE_INVALID   ) Flags |= SW_IE ;
+  if( Raised & FE_DIVBYZERO ) Flags |= SW_ZE ;
+  if( Raised & FE_OVERFLOW  ) Flags |= SW_OE ;
+  if( Raised & FE_UNDERFLOW ) Flags |= SW_UE ;
+  if( Raised & FE_INEXACT   ) Flags |= SW_PE ;
+
+  if( Flags )
+  {
+    Exception( Flags ) ;
+  }
+
+  if( Fpu.control & CW_RC )
+  {
+    fesetround( FE_TONEAREST ) ;
+  }
+}
+
+static void CheckDenormal( long double Value )
+{
+  if( fpclassify( Value ) == FP_SUBNORMAL )
+  {
+    Exception( SW_DE ) ;
+  }
+}
+
+// Round a result to the precision selected by the control word.
+// Fast mode results are already rounded to double precision.
+static long double Result( long double Value )
+{
+  int         Bits ;
+  int         Exp  ;
+  long double Mant ;
+  long double Rounded ;
+
+  if( Mode != FPU_MODE_EXACT )
+  {
+    return( Value ) ;
+  }
+
+  switch( ( Fpu.control & CW_PC ) >> 8 )
+  {
+  case 0 :
+    Bits = 24 ;
+    break ;
+
+  case 2 :
+    Bits = 53 ;
+    break ;
+
+  default :
+    return( Value ) ;
+  }
+
+  if( !isfinite( Value ) || ( Value == 0 ) )
+  {
+    return( Value ) ;
+  }
+
+  // Round the significand only, the exponent range is not reduced.
+  Mant    = ldexpl( frexpl( Value , &Exp ) , Bits ) ;
+  Rounded = nearbyintl( Mant ) ;
+  if( Rounded != Mant )
+  {
+    Exception( SW_PE ) ;
+  }
+
+  return( ldexpl( Rounded , Exp - Bits ) ) ;
+}
+
+// FADD, FMUL, FSUB, FSUBR, FDIV and FDIVR, selected by the ModR/M reg field.
+static long double Arith( int Op , long double a , long double b )
+{
+  long double Tmp ;
+
+  CheckDenormal( a ) ;
+  CheckDenormal( b ) ;
+
+  if( ( Op == 5 ) || ( Op == 7 ) )
+  {
+    // Reversed operations
+    Tmp = a ;
+    a   = b ;
+    b   = Tmp ;
+  }
+
+  if( Mode == FPU_MODE_FAST )
+  {
+    double x = ( double ) a ;
+    double y = ( double ) b ;
+
+    switch( Op )
+    {
+    case 0 :
+      return( x + y ) ;
+
+    case 1 :
+      return( x * y ) ;
+
+    case 4 :
+    case 5 :
+      return( x - y ) ;
+
+    default :
+      return( x / y ) ;
+    }
+  }
+
+  switch( Op )
+  {
+  case 0 :
+    return( Result( a + b ) ) ;
+
+  case 1 :
+    return( Result( a * b ) ) ;
+
+  case 4 :
+  case 5 :
+    return( Result( a - b ) ) ;
+
+  default :
+    return( Result( a / b ) ) ;
+  }
+}
+
+// FCOM and FTST
+static void Compare( long double a , long double b )
+{
+  Fpu.status &= ~( SW_C0 | SW_C2 | SW_C3 ) ;
+
+  if( isnan( a ) || isnan( b ) )
+  {
+    // Unordered
+    Exception( SW_IE ) ;
+    Fpu.status |= SW_C0 | SW_C2 | SW_C3 ;
+  }
+  else if( a < b )
+  {
+    Fpu.status |= SW_C0 ;
+  }
+  else if( a == b )
+  {
+    Fpu.status |= SW_C3 ;
+  }
+}
+
+// FXAM
+static void Examine( void )
+{
+  long double Value = Fpu.st[ Phys( 0 ) ] ;
+
+  Fpu.status &= ~( SW_C0 | SW_C1 | SW_C2 | SW_C3 ) ;
+
+  if( signbit( Value ) )
+  {
+    Fpu.status |= SW_C1 ;
+  }
+
+  if( GetTag( Phys( 0 ) ) == TAG_EMPTY )
+  {
+    Fpu.status |= SW_C3 | SW_C0 ;
+    return ;
+  }
+
+  switch( fpclassify( Value ) )
+  {
+  case FP_NAN :
+    Fpu.status |= SW_C0 ;
+    break ;
+
+  case FP_INFINITE :
+    Fpu.status |= SW_C2 | SW_C0 ;
+    break ;
+
+  case FP_ZERO :
+    Fpu.status |= SW_C3 ;
+    break ;
+
+  case FP_SUBNORMAL :
+    Fpu.status |= SW_C3 | SW_C2 ;
+    break ;
+
+  default :
+    Fpu.status |= SW_C2 ;
+    break ;
+  }
+}
+
+// FPREM: partial remainder of ST(0) / ST(1). The low three bits of the
+// quotient are returned in C0, C3 and C1. C2 is set if the reduction is
+// incomplete.
+static void PartialRemainder( void )
+{
+  long double a = ReadST( 0 ) ;
+  long double b = ReadST( 1 ) ;
+  long double r ;
+  long double Step ;
+  int         Diff ;
+  int         q = 0 ;
+  int         k ;
+
+  Fpu.status &= ~( SW_C0 | SW_C1 | SW_C2 | SW_C3 ) ;
+
+  if( isnan( a ) || isnan( b ) || isinf( a ) || ( b == 0 ) )
+  {
+    Exception( SW_IE ) ;
+    WriteST( 0 , Indefinite() ) ;
+    return ;
+  }
+
+  if( ( a == 0 ) || isinf( b ) )
+  {
+    return ;
+  }
+
+  Diff = ilogbl( a ) - ilogbl( b ) ;
+  if( Diff >= 64 )
+  {
+    // Reduce the exponent difference by at most 63 per instruction.
+    WriteST( 0 , fmodl( a , ldexpl( b , Diff - 32 ) ) ) ;
+    Fpu.status |= SW_C2 ;
+    return ;
+  }
+
+  // The remainder modulo 8|b| gives the low quotient bits exactly.
+  r    = fmodl( fabsl( a ) , 8 * fabsl( b ) ) ;
+  Step = 4 * fabsl( b ) ;
+  for( k = 4 ; k > 0 ; k >>= 1 )
+  {
+    if( r >= Step )
+    {
+      r -= Step ;
+      q |= k ;
+    }
+    Step /= 2 ;
+  }
+
+  WriteST( 0 , ( signbit( a ) ) ? ( -r ) : ( r ) ) ;
+
+  if( q & 4 ) Fpu.status |= SW_C0 ;
+  if( q & 2 ) Fpu.status |= SW_C3 ;
+  if( q & 1 ) Fpu.status |= SW_C1 ;
+}
+
+// Convert to an integer using the current rounding mode.
+// Returns false, after signalling an invalid operation, if the value is out
+// of range.
+static bool ToInteger( long double Value , long double Min , long double Max , int64_t & Result )
+{
+  long double Rounded ;
+
+  if( isnan( Value ) )
+  {
+    Exception( SW_IE ) ;
+    return( false ) ;
+  }
+
+  Rounded = nearbyintl( Value ) ;
+  if( ( Rounded < Min ) || ( Rounded > Max ) )
+  {
+    Exception( SW_IE ) ;
+    return( false ) ;
+  }
+
+  if( Rounded != Value )
+  {
+    Exception( SW_PE ) ;
+  }
+
+  Result = ( int64_t ) Rounded ;
+  return( true ) ;
+}
+
+// Store an integer of Size bytes, or the integer indefinite if the value is
+// out of range.
+static void StoreInteger( uint32_t Addr , long double Value , int Size )
+{
+  int64_t     Int ;
+  long double Max = ldexpl( 1.0L , 8 * Size - 1 ) ;
+
+  if( !ToInteger( Value , -Max , Max - 1 , Int ) )
+  {
+    // Integer indefinite: the most negative value
+    Int = ( int64_t ) ( ~( uint64_t ) 0 << ( 8 * Size - 1 ) ) ;
+  }
+
+  memcpy( &mem[ Addr ] , &Int , Size ) ;
+}
+
+// Load a temporary real.
+static long double LoadExtended( uint32_t Addr )
+{
+  uint64_t    Mant    ;
+  uint16_t    SignExp ;
+  int         Exp     ;
+  long double Value   ;
+
+  memcpy( &Mant , &mem[ Addr ] , 8 ) ;
+  memcpy( &SignExp , &mem[ Addr + 8 ] , 2 ) ;
+
+  Exp = SignExp & 0x7FFF ;
+  if( Exp == 0x7FFF )
+  {
+    Value = ( Mant << 1 ) ? ( ( long double ) NAN ) : ( ( long double ) INFINITY ) ;
+  }
+  else
+  {
+    // Denormals have an exponent field of 0 but the scale of exponent 1.
+    Value = ldexpl( ( long double ) Mant , ( ( Exp ) ? ( Exp ) : ( 1 ) ) - 16383 - 63 ) ;
+  }
+
+  return( ( SignExp & 0x8000 ) ? ( -Value ) : ( Value ) ) ;
+}
+
+// Store a temporary real.
+static void StoreExtended( uint32_t Addr , long double Value )
+{
+  uint64_t Mant    = 0 ;
+  uint16_t SignExp = ( signbit( Value ) ) ? ( 0x8000 ) : ( 0 ) ;
+  int      Exp     ;
+
+  if( isnan( Value ) )
+  {
+    SignExp |= 0x7FFF ;
+    Mant     = 0xC000000000000000ULL ;
+  }
+  else if( isinf( Value ) )
+  {
+    SignExp |= 0x7FFF ;
+    Mant     = 0x8000000000000000ULL ;
+  }
+  else if( Value != 0 )
+  {
+    Mant = ( uint64_t ) ldexpl( frexpl( fabsl( Value ) , &Exp ) , 64 ) ;
+    Exp += 16382 ;
+    if( Exp <= 0 )
+    {
+      // Denormal
+      Mant = ( 1 - Exp < 64 ) ? ( Mant >> ( 1 - Exp ) ) : ( 0 ) ;
+      Exp  = 0 ;
+    }
+    SignExp |= Exp ;
+  }
+
+  memcpy( &mem[ Addr ] , &Mant , 8 ) ;
+  memcpy( &mem[ Addr + 8 ] , &SignExp , 2 ) ;
+}
+
+// FBLD
+static long double LoadBCD( uint32_t Addr )
+{
+  long double Value = 0 ;
+  int         i ;
+
+  for( i = 8 ; i >= 0 ; i-- )
+  {
+    Value = Value * 100 + ( mem[ Addr + i ] >> 4 ) * 10 + ( mem[ Addr + i ] & 0x0F ) ;
+  }
+
+  return( ( mem[ Addr + 9 ] & 0x80 ) ? ( -Value ) : ( Value ) ) ;
+}
+
+// FBSTP
+static void StoreBCD( uint32_t Addr , long double Value )
+{
+  int64_t  Int ;
+  uint64_t Mag ;
+  int      i ;
+
+  if( !ToInteger( Value , -999999999999999999.0L , 999999999999999999.0L , Int ) )
+  {
+    // Packed decimal indefinite
+    memset( &mem[ Addr ] , 0 , 7 ) ;
+    mem[ Addr + 7 ] = 0xC0 ;
+    mem[ Addr + 8 ] = 0xFF ;
+    mem[ Addr + 9 ] = 0xFF ;
+    return ;
+  }
+
+  Mag = ( Int < 0 ) ? ( -Int ) : ( Int ) ;
+  for( i = 0 ; i < 9 ; i++ )
+  {
+    mem[ Addr + i ] = ( uint8_t ) ( ( Mag % 10 ) | ( ( ( Mag / 10 ) % 10 ) << 4 ) ) ;
+    Mag /= 100 ;
+  }
+  mem[ Addr + 9 ] = ( signbit( Value ) ) ? ( 0x80 ) : ( 0x00 ) ;
+}
+
+// Load the memory operand of a D8, DA, DC or DE instruction.
+static long double LoadOperand( uint8_t Opcode , uint32_t Addr )
+{
+  float   f ;
+  double  d ;
+  int32_t i32 ;
+  int16_t i16 ;
+
+  switch( Opcode )
+  {
+  case 0xD8 :
+    memcpy( &f , &mem[ Addr ] , 4 ) ;
+    return( f ) ;
+
+  case 0xDA :
+    memcpy( &i32 , &mem[ Addr ] , 4 ) ;
+    return( i32 ) ;
+
+  case 0xDC :
+    memcpy( &d , &mem[ Addr ] , 8 ) ;
+    return( d ) ;
+
+  default :
+    memcpy( &i16 , &mem[ Addr ] , 2 ) ;
+    return( i16 ) ;
+  }
+}
+
+// FSTENV: 8087 real mode environment layout.
+static void StoreEnvironment( uint32_t Addr )
+{
+  uint16_t Env[ 7 ] ;
+  uint16_t Tag = 0 ;
+  int      i ;
+
+  for( i = 0 ; i < 8 ; i++ )
+  {
+    Tag |= ClassifyTag( i ) << ( 2 * i ) ;
+  }
+  Fpu.tag = Tag ;
+
+  Env[ 0 ] = Fpu.control ;
+  Env[ 1 ] = Fpu.status  ;
+  Env[ 2 ] = Fpu.tag     ;
+  Env[ 3 ] = ( uint16_t ) Fpu.ip ;
+  Env[ 4 ] = ( uint16_t ) ( ( ( Fpu.ip >> 4 ) & 0xF000 ) | ( Fpu.opcode & 0x07FF ) ) ;
+  Env[ 5 ] = ( uint16_t ) Fpu.operand ;
+  Env[ 6 ] = ( uint16_t ) ( ( Fpu.operand >> 4 ) & 0xF000 ) ;
+
+  memcpy( &mem[ Addr ] , Env , sizeof( Env ) ) ;
+}
+
+// FLDENV
+static void LoadEnvironment( uint32_t Addr )
+{
+  uint16_t Env[ 7 ] ;
+
+  memcpy( Env , &mem[ Addr ] , sizeof( Env ) ) ;
+
+  Fpu.control = Env[ 0 ] ;
+  Fpu.status  = Env[ 1 ] ;
+  Fpu.tag     = Env[ 2 ] ;
+  Fpu.ip      = Env[ 3 ] | ( ( uint32_t ) ( Env[ 4 ] & 0xF000 ) << 4 ) ;
+  Fpu.opcode  = Env[ 4 ] & 0x07FF ;
+  Fpu.operand = Env[ 5 ] | ( ( uint32_t ) ( Env[ 6 ] & 0xF000 ) << 4 ) ;
+}
+
+// D9 register forms other than FLD, FXCH and FSTP
+static void ExecuteD9( uint8_t ModRM )
+{
+  long double Value ;
+
+  // The constants, rounded to nearest in 64-bit precision
+  static const long double Constants[ 7 ] =
+  {
+    1.0L ,
+    ldexpl( ( long double ) 0xD49A784BCD1B8AFEULL , -62 ) , // log2(10)
+    ldexpl( ( long double ) 0xB8AA3B295C17F0BCULL , -63 ) , // log2(e)
+    ldexpl( ( long double ) 0xC90FDAA22168C235ULL , -62 ) , // pi
+    ldexpl( ( long double ) 0x9A209A84FBCFF799ULL , -65 ) , // log10(2)
+    ldexpl( ( long double ) 0xB17217F7D1CF79ACULL , -64 ) , // ln(2)
+    0.0L
+  } ;
+
+  switch( ModRM )
+  {
+  // FNOP
+  case 0xD0 :
+    break ;
+
+  // FCHS
+  case 0xE0 :
+    WriteST( 0 , -ReadST( 0 ) ) ;
+    break ;
+
+  // FABS
+  case 0xE1 :
+    WriteST( 0 , fabsl( ReadST( 0 ) ) ) ;
+    break ;
+
+  // FTST
+  case 0xE4 :
+    Compare( ReadST( 0 ) , 0.0L ) ;
+    break ;
+
+  // FXAM
+  case 0xE5 :
+    Examine() ;
+    break ;
+
+  // FLD1, FLDL2T, FLDL2E, FLDPI, FLDLG2, FLDLN2, FLDZ
+  case 0xE8 :
+  case 0xE9 :
+  case 0xEA :
+  case 0xEB :
+  case 0xEC :
+  case 0xED :
+  case 0xEE :
+    Push( Constants[ ModRM - 0xE8 ] ) ;
+    break ;
+
+  // F2XM1
+  case 0xF0 :
+    WriteST( 0 , Result( expm1l( ReadST( 0 ) * Constants[ 5 ] ) ) ) ;
+    break ;
+
+  // FYL2X
+  case 0xF1 :
+    Value = ReadST( 0 ) ;
+    WriteST( 1 , Result( ReadST( 1 ) * log2l( Value ) ) ) ;
+    Pop() ;
+    break ;
+
+  // FPTAN
+  case 0xF2 :
+    WriteST( 0 , Result( tanl( ReadST( 0 ) ) ) ) ;
+    Push( 1.0L ) ;
+    break ;
+
+  // FPATAN
+  case 0xF3 :
+    Value = ReadST( 0 ) ;
+    WriteST( 1 , Result( atan2l( ReadST( 1 ) , Value ) ) ) ;
+    Pop() ;
+    break ;
+
+  // FXTRACT
+  case 0xF4 :
+    Value = ReadST( 0 ) ;
+    if( Value == 0 )
+    {
+      Exception( SW_ZE ) ;
+      WriteST( 0 , -( long double ) INFINITY ) ;
+      Push( Value ) ;
+    }
+    else
+    {
+      WriteST( 0 , logbl( Value ) ) ;
+      Push( ( isfinite( Value ) ) ? ( ldexpl( Value , -ilogbl( Value ) ) ) : ( Value ) ) ;
+    }
+    break ;
+
+  // FDECSTP
+  case 0xF6 :
+    SetTop( GetTop() - 1 ) ;
+    break ;
+
+  // FINCSTP
+  case 0xF7 :
+    SetTop( GetTop() + 1 ) ;
+    break ;
+
+  // FPREM
+  case 0xF8 :
+    PartialRemainder() ;
+    break ;
+
+  // FYL2XP1
+  case 0xF9 :
+    Value = ReadST( 0 ) ;
+    WriteST( 1 , Result( ReadST( 1 ) * log1pl( Value ) * Constants[ 2 ] ) ) ;
+    Pop() ;
+    break ;
+
+  // FSQRT
+  case 0xFA :
+    Value = ReadST( 0 ) ;
+    CheckDenormal( Value ) ;
+    if( Mode == FPU_MODE_FAST )
+    {
+      WriteST( 0 , sqrt( ( double ) Value ) ) ;
+    }
+    else
+    {
+      WriteST( 0 , Result( sqrtl( Value ) ) ) ;
+    }
+    break ;
+
+  // FRNDINT
+  case 0xFC :
+    Value = ReadST( 0 ) ;
+    WriteST( 0 , nearbyintl( Value ) ) ;
+    if( Fpu.st[ Phys( 0 ) ] != Value )
+    {
+      Exception( SW_PE ) ;
+    }
+    break ;
+
+  // FSCALE
+  case 0xFD :
+    Value = truncl( ReadST( 1 ) ) ;
+    Value = fminl( fmaxl( Value , -65536.0L ) , 65536.0L ) ;
+    WriteST( 0 , Result( ldexpl( ReadST( 0 ) , ( int ) Value ) ) ) ;
+    break ;
+
+  default :
+    break ;
+  }
+}
+
+// =============================================================================
+// Exported functions
+//
+
+void FPU_Initialise( int NewMode )
+{
+  Mode = NewMode ;
+  FPU_Reset() ;
+}
+
+bool FPU_Present( void )
+{
+  return( Mode != FPU_MODE_NONE ) ;
+}
+
+void FPU_Reset( void )
+{
+  memset( &Fpu , 0 , sizeof( Fpu ) ) ;
+  Fpu.control = CONTROL_INIT ;
+  Fpu.tag     = 0xFFFF ;
+}
+
+void FPU_Execute( uint8_t Opcode , uint8_t ModRM , uint32_t Address , uint32_t InstAddress )
+{
+  int         Op      = ( ModRM >> 3 ) & 7 ;
+  int         i       = ModRM & 7 ;
+  bool        RegForm = ( ModRM >= 0xC0 ) ;
+  long double Value   ;
+  int64_t     Int     ;
+  int         n       ;
+
+  // Control instructions leave the instruction and operand pointers of the
+  // last numeric instruction for the exception handler.
+  bool Control = ( ( Opcode == 0xD9 ) && !RegForm && ( Op >= 4 ) ) ||
+                 ( ( Opcode == 0xDB ) && RegForm && ( Op == 4 ) ) ||
+                 ( ( Opcode == 0xDD ) && !RegForm && ( Op >= 4 ) ) ;
+
+  if( !Control )
+  {
+    Fpu.ip     = InstAddress ;
+    Fpu.opcode = ( uint16_t ) ( ( ( Opcode & 7 ) << 8 ) | ModRM ) ;
+    if( !RegForm )
+    {
+      Fpu.operand = Address ;
+    }
+  }
+
+  HostBegin() ;
+
+  switch( Opcode )
+  {
+  // Arithmetic with a memory or ST(i) operand, result in ST(0)
+  case 0xD8 :
+  case 0xDA :
+  case 0xDC :
+  case 0xDE :
+    if( RegForm )
+    {
+      if( Opcode == 0xD8 )
+      {
+        Value = ReadST( i ) ;
+      }
+      else
+      {
+        // DC and DE: result in ST(i). The sense of the subtract and
+        // divide operations is reversed relative to the destination.
+        Value = ReadST( i ) ;
+        switch( Op )
+        {
+        case 2 : // FCOM
+        case 3 : // FCOMP, FCOMPP
+          Compare( ReadST( 0 ) , Value ) ;
+          if( Opcode == 0xDE )
+          {
+            Pop() ;
+          }
+          if( Op == 3 )
+          {
+            Pop() ;
+          }
+          break ;
+
+        default :
+          WriteST( i , Arith( ( Op >= 4 ) ? ( Op ^ 1 ) : ( Op ) , Value , ReadST( 0 ) ) ) ;
+          if( Opcode == 0xDE )
+          {
+            Pop() ;
+          }
+          break ;
+        }
+        break ;
+      }
+    }
+    else
+    {
+      Value = LoadOperand( Opcode , Address ) ;
+    }
+
+    switch( Op )
+    {
+    case 2 : // FCOM
+      Compare( ReadST( 0 ) , Value ) ;
+      break ;
+
+    case 3 : // FCOMP
+      Compare( ReadST( 0 ) , Value ) ;
+      Pop() ;
+      break ;
+
+    default :
+      WriteST( 0 , Arith( Op , ReadST( 0 ) , Value ) ) ;
+      break ;
+    }
+    break ;
+
+  // Loads, stores, environment and the register stack functions
+  case 0xD9 :
+    if( RegForm )
+    {
+      switch( Op )
+      {
+      case 0 : // FLD ST(i)
+        Push( ReadST( i ) ) ;
+        break ;
+
+      case 1 : // FXCH ST(i)
+        Value = ReadST( i ) ;
+        WriteST( i , ReadST( 0 ) ) ;
+        WriteST( 0 , Value ) ;
+        break ;
+
+      case 3 : // FSTP ST(i), undocumented alias of DD D8+i
+        WriteST( i , ReadST( 0 ) ) ;
+        Pop() ;
+        break ;
+
+      default :
+        ExecuteD9( ModRM ) ;
+        break ;
+      }
+      break ;
+    }
+
+    switch( Op )
+    {
+    case 0 : // FLD m32
+      Push( LoadOperand( 0xD8 , Address ) ) ;
+      break ;
+
+    case 2 : // FST m32
+    case 3 : // FSTP m32
+      {
+        float f = ( float ) ReadST( 0 ) ;
+        memcpy( &mem[ Address ] , &f , 4 ) ;
+      }
+      if( Op == 3 )
+      {
+        Pop() ;
+      }
+      break ;
+
+    case 4 : // FLDENV
+      LoadEnvironment( Address ) ;
+      break ;
+
+    case 5 : // FLDCW
+      memcpy( &Fpu.control , &mem[ Address ] , 2 ) ;
+      break ;
+
+    case 6 : // FSTENV
+      StoreEnvironment( Address ) ;
+      break ;
+
+    case 7 : // FSTCW
+      memcpy( &mem[ Address ] , &Fpu.control , 2 ) ;
+      break ;
+
+    default :
+      break ;
+    }
+    break ;
+
+  // 32-bit integer and temporary real loads and stores, and control
+  case 0xDB :
+    if( RegForm )
+    {
+      switch( ModRM )
+      {
+      case 0xE0 : // FENI
+        Fpu.control &= ~CW_IEM ;
+        break ;
+
+      case 0xE1 : // FDISI
+        Fpu.control |= CW_IEM ;
+        break ;
+
+      case 0xE2 : // FCLEX
+        Fpu.status &= ~( SW_B | SW_ES | 0x003F ) ;
+        break ;
+
+      case 0xE3 : // FINIT
+        FPU_Reset() ;
+        break ;
+
+      default :
+        break ;
+      }
+      break ;
+    }
+
+    switch( Op )
+    {
+    case 0 : // FILD m32
+      Push( LoadOperand( 0xDA , Address ) ) ;
+      break ;
+
+    case 2 : // FIST m32
+    case 3 : // FISTP m32
+      StoreInteger( Address , ReadST( 0 ) , 4 ) ;
+      if( Op == 3 )
+      {
+        Pop() ;
+      }
+      break ;
+
+    case 5 : // FLD m80
+      Push( LoadExtended( Address ) ) ;
+      break ;
+
+    case 7 : // FSTP m80
+      StoreExtended( Address , ReadST( 0 ) ) ;
+      Pop() ;
+      break ;
+
+    default :
+      break ;
+    }
+    break ;
+
+  // 64-bit real loads and stores, state save and restore
+  case 0xDD :
+    if( RegForm )
+    {
+      switch( Op )
+      {
+      case 0 : // FFREE ST(i)
+        SetTag( Phys( i ) , TAG_EMPTY ) ;
+        break ;
+
+      case 2 : // FST ST(i)
+      case 3 : // FSTP ST(i)
+        WriteST( i , ReadST( 0 ) ) ;
+        if( Op == 3 )
+        {
+          Pop() ;
+        }
+        break ;
+
+      default :
+        break ;
+      }
+      break ;
+    }
+
+    switch( Op )
+    {
+    case 0 : // FLD m64
+      Push( LoadOperand( 0xDC , Address ) ) ;
+      break ;
+
+    case 2 : // FST m64
+    case 3 : // FSTP m64
+      {
+        double d = ( double ) ReadST( 0 ) ;
+        memcpy( &mem[ Address ] , &d , 8 ) ;
+      }
+      if( Op == 3 )
+      {
+        Pop() ;
+      }
+      break ;
+
+    case 4 : // FRSTOR
+      LoadEnvironment( Address ) ;
+      for( n = 0 ; n < 8 ; n++ )
+      {
+        Fpu.st[ Phys( n ) ] = LoadExtended( Address + 14 + 10 * n ) ;
+      }
+      break ;
+
+    case 6 : // FSAVE
+      StoreEnvironment( Address ) ;
+      for( n = 0 ; n < 8 ; n++ )
+      {
+        StoreExtended( Address + 14 + 10 * n , Fpu.st[ Phys( n ) ] ) ;
+      }
+      FPU_Reset() ;
+      break ;
+
+    case 7 : // FSTSW m16
+      memcpy( &mem[ Address ] , &Fpu.status , 2 ) ;
+      break ;
+
+    default :
+      break ;
+    }
+    break ;
+
+  // 16 and 64-bit integer and packed BCD loads and stores
+  case 0xDF :
+    if( RegForm )
+    {
+      break ;
+    }
+
+    switch( Op )
+    {
+    case 0 : // FILD m16
+      Push( LoadOperand( 0xDE , Address ) ) ;
+      break ;
+
+    case 2 : // FIST m16
+    case 3 : // FISTP m16
+      StoreInteger( Address , ReadST( 0 ) , 2 ) ;
+      if( Op == 3 )
+      {
+        Pop() ;
+      }
+      break ;
+
+    case 4 : // FBLD
+      Push( LoadBCD( Address ) ) ;
+      break ;
+
+    case 5 : // FILD m64
+      memcpy( &Int , &mem[ Address ] , 8 ) ;
+      Push( ( long double ) Int ) ;
+      break ;
+
+    case 6 : // FBSTP
+      StoreBCD( Address , ReadST( 0 ) ) ;
+      Pop() ;
+      break ;
+
+    case 7 : // FISTP m64
+      StoreInteger( Address , ReadST( 0 ) , 8 ) ;
+      Pop() ;
+      break ;
+
+    default :
+      break ;
+    }
+    break ;
+
+  default :
+    break ;
+  }
+
+  HostEnd() ;
+}
+
+void FPU_GetState( stFPUState_t * State )
+{
+  *State = Fpu ;
+}
+
+void FPU_SetState( const stFPUState_t * State )
+{
+  Fpu = *State ;
+}
@@ -0,0 +1,146 @@
+// =============================================================================
+// File: XTfpu.h
+//
+// Description:
+// 8087 numeric coprocessor emulation.
+//
+// The register stack holds host long doubles. Loads and stores convert
+// between the host format and the 8087 memory formats (short, long and
+// temporary real, word, short and long integer and packed BCD) exactly.
+// Arithmetic either runs in host double precision (fast mode) or in host
+// extended precision honouring the precision and rounding control fields of
+// the control word (exact mode).
+//
+// This work is licensed under the MIT License. See included LICENSE.TXT.
+//
+
+#ifndef _XTFPU_
+#define _XTFPU_
+
+#include <stdint.h>
+
+// FPU modes
+#define FPU_MODE_NONE                            0 // No coprocessor fitted
+#define FPU_MODE_FAST                            1 // Arithmetic in host double precision
+#define FPU_MODE_EXACT                           2 // Arithmetic in host extended precision
+
+// Coprocessor state.
+typedef struct STFPUSTATE_T
+{
+  long double st[ 8 ]  ; // Physical registers, ST(i) is st[ ( TOP + i ) & 7 ]
+  uint16_t    control  ;
+  uint16_t    status   ; // Includes TOP in bits 11-13
+  uint16_t    tag      ; // 2 bits per physical register, 3 = empty
+  uint16_t    opcode   ; // Low 11 bits of the last ESC instruction
+  uint32_t    ip       ; // Linear address of the last ESC instruction
+  uint32_t    operand  ; // Linear address of the last memory operand
+} stFPUState_t ;
+
+// =============================================================================
+// Function: FPU_Initialise
+//
+// Description:
+// Select the FPU mode and reset the coprocessor.
+//
+// Parameters:
+//
+//   Mode : One of the FPU_MODE_ values.
+//
+// Returns:
+//
+//   None.
+//
+void FPU_Initialise( int Mode ) ;
+
+// =============================================================================
+// Function: FPU_Present
+//
+// Description:
+// Check if a coprocessor is fitted.
+//
+// Parameters:
+//
+//   None.
+//
+// Returns:
+//
+//   bool : true if ESC instructions should be passed to FPU_Execute.
+//
+bool FPU_Present( void ) ;
+
+// =============================================================================
+// Function: FPU_Reset
+//
+// Description:
+// Put the coprocessor in its power on state, as FINIT.
+//
+// Parameters:
+//
+//   None.
+//
+// Returns:
+//
+//   None.
+//
+void FPU_Reset( void ) ;
+
+// =============================================================================
+// Function: FPU_Execute
+//
+// Description:
+// Execute an ESC (D8-DF) instruction.
+// Exceptions are always given the masked response. Unmasked exceptions set
+// the error summary and busy bits of the status word, but no interrupt is
+// raised as the 8087 INT output is not connected to the emulated PIC.
+//
+// Parameters:
+//
+//   Opcode      : The ESC opcode.
+//
+//   ModRM       : The ModR/M byte following the opcode.
+//
+//   Address     : The linear address of the memory operand. Ignored for
+//                 register operands (ModRM mod field 3).
+//
+//   InstAddress : The linear address of the instruction, reported by
+//                 FSTENV and FSAVE.
+//
+// Returns:
+//
+//   None.
+//
+void FPU_Execute( uint8_t Opcode , uint8_t ModRM , uint32_t Address , uint32_t InstAddress ) ;
+
+// =============================================================================
+// Function: FPU_GetState
+//
+// Description:
+// Copy the coprocessor state.
+//
+// Parameters:
+//
+//   State : Set to the current coprocessor state.
+//
+// Returns:
+//
+//   None.
+//
+void FPU_GetState( stFPUState_t * State ) ;
+
+// =============================================================================
+// Function: FPU_SetState
+//
+// Description:
+// Restore coprocessor state previously read with FPU_GetState.
+//
+// Parameters:
+//
+//   State : The coprocessor state to restore.
+//
+// Returns:
+//
+//   None.
+//
+void FPU_SetState( const stFPUState_t * State ) ;
+
+#endif // _XTFPU_
@@ -0,0 +1,420 @@
+// =============================================================================
+// File: XTimage.cpp
+//
+// Description:
+// Block indexed disk images.
+// See XTimage.h for a description of the image file.
+//
+// This work is licensed under the MIT License. See included LICENSE.TXT.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#include "XTimage.h"
+#include "XTlz.h"
+
+#ifndef O_BINARY
+  #define O_BINARY                               0
+#endif
+
+#define IMAGE_MAGIC                              "XTBI"
+#define IMAGE_VERSION                            1
+
+// Block flags
+#define IMAGE_BLOCK_COMPRESSED                   0x0001
+
+typedef struct STIMAGEHEADER_T
+{
+  char     magic[ 4 ]  ;
+  uint32_t version     ;
+  uint32_t block_size  ;
+  uint32_t block_count ;
+  uint64_t size        ; // Disk size in bytes
+} stImageHeader_t ;
+
+typedef struct STIMAGEBLOCK_T
+{
+  uint64_t offset ; // 0 if the block is not stored
+  uint32_t length ; // Length stored
+  uint32_t flags  ;
+} stImageBlock_t ;
+
+struct STIMAGE_T
+{
+  int64_t          Size       ;
+  int              BlockSize  ;
+  int              BlockCount ;
+  int64_t          FileEnd    ; // Where the next block written is stored
+  stImageBlock_t * Index      ;
+  uint8_t        * Packed     ; // Compressed block read from the file
+  uint8_t        * Data       ; // Block being written
+  uint8_t        * Cache      ; // The last compressed block read, decompressed
+  int              CacheBlock ; // -1 if the cache is empty
+} ;
+
+// =============================================================================
+// Local functions
+//
+
+static int ReadAt( int File , int64_t Offset , void * Buffer , int Length )
+{
+  if( lseek( File , ( off_t ) Offset , SEEK_SET ) == ( off_t ) -1 )
+  {
+    return( 0 ) ;
+  }
+
+  return( read( File , Buffer , Length ) ) ;
+}
+
+static int WriteAt( int File , int64_t Offset , const void * Buffer , int Length )
+{
+  if( lseek( File , ( off_t ) Offset , SEEK_SET ) == ( off_t ) -1 )
+  {
+    return( 0 ) ;
+  }
+
+  return( write( File , Buffer , Length ) ) ;
+}
+
+static bool ValidBlockSize( uint32_t BlockSize )
+{
+  return( ( BlockSize >= IMAGE_MIN_BLOCK ) && ( BlockSize <= IMAGE_MAX_BLOCK ) &&
+          ( ( BlockSize & ( BlockSize - 1 ) ) == 0 ) ) ;
+}
+
+static bool Empty( const uint8_t * Data , int Length )
+{
+  for( int i = 0 ; i < Length ; i++ )
+  {
+    if( Data[ i ] != 0 )
+    {
+      return( false ) ;
+    }
+  }
+
+  return( true ) ;
+}
+
+// Get the whole of a block.
+static bool LoadBlock( stImage_t * Image , int File , int Block , uint8_t * Data )
+{
+  const stImageBlock_t * Entry = &Image->Index[ Block ] ;
+
+  if( Entry->offset == 0 )
+  {
+    memset( Data , 0 , Image->BlockSize ) ;
+    return( true ) ;
+  }
+
+  if( ( Entry->flags & IMAGE_BLOCK_COMPRESSED ) == 0 )
+  {
+    return( ReadAt( File , Entry->offset , Data , Image->BlockSize ) == Image->BlockSize ) ;
+  }
+
+  if( Block == Image->CacheBlock )
+  {
+    memcpy( Data , Image->Cache , Image->BlockSize ) ;
+    return( true ) ;
+  }
+
+  return( ( ReadAt( File , Entry->offset , Image->Packed , Entry->length ) == ( int ) Entry->length ) &&
+          LZ_Decompress( Image->Packed , Entry->length , Data , Image->BlockSize ) ) ;
+}
+
+// =============================================================================
+// Exported functions
+//
+
+stImage_t * IMAGE_Open( int File )
+{
+  stImageHeader_t Header ;
+  stImage_t     * Image ;
+  int64_t         DataStart ;
+  int             IndexLength ;
+  bool            Ok ;
+
+  if( ( ReadAt( File , 0 , &Header , sizeof( Header ) ) != sizeof( Header ) ) ||
+      ( memcmp( Header.magic , IMAGE_MAGIC , sizeof( Header.magic ) ) != 0 ) ||
+      ( Header.version != IMAGE_VERSION ) || !ValidBlockSize( Header.block_size ) ||
+      ( Header.block_count != ( Header.size + Header.block_size - 1 ) / Header.block_size ) ||
+      ( Header.block_count > 0x7FFFFFFF / sizeof( stImageBlock_t ) ) )
+  {
+    return( NULL ) ;
+  }
+
+  Image = ( stImage_t * ) calloc( 1 , sizeof( stImage_t ) ) ;
+  if( Image == NULL )
+  {
+    return( NULL ) ;
+  }
+
+  IndexLength        = ( int ) ( Header.block_count * sizeof( stImageBlock_t ) ) ;
+  DataStart          = sizeof( Header ) + IndexLength ;
+  Image->Size        = ( int64_t ) Header.size ;
+  Image->BlockSize   = ( int ) Header.block_size ;
+  Image->BlockCount  = ( int ) Header.block_count ;
+  Image->FileEnd     = lseek( File , 0 , SEEK_END ) ;
+  Image->CacheBlock  = -1 ;
+  Image->Index       = ( stImageBlock_t * ) malloc( IndexLength + 1 ) ;
+  Image->Packed      = ( uint8_t * ) malloc( Image->BlockSize ) ;
+  Image->Data        = ( uint8_t * ) malloc( Image->BlockSize ) ;
+  Image->Cache       = ( uint8_t * ) malloc( Image->BlockSize ) ;
+
+  Ok = ( Image->Index != NULL ) && ( Image->Packed != NULL ) && ( Image->Data != NULL ) && ( Image->Cache != NULL ) &&
+       ( ReadAt( File , sizeof( Header ) , Image->Index , IndexLength ) == IndexLength ) ;
+
+  // Every block stored must be within the file.
+  for( int i = 0 ; Ok && ( i < Image->BlockCount ) ; i++ )
+  {
+    const stImageBlock_t * Entry = &Image->Index[ i ] ;
+
+    if( Entry->offset != 0 )
+    {
+      Ok = ( Entry->offset >= ( uint64_t ) DataStart ) && ( Entry->length > 0 ) &&
+           ( Entry->length <= ( uint32_t ) Image->BlockSize ) &&
+           ( ( Entry->flags & IMAGE_BLOCK_COMPRESSED ) || ( Entry->length == ( uint32_t ) Image->BlockSize ) ) &&
+           ( Entry->offset + Entry->length <= ( uint64_t ) Image->FileEnd ) ;
+    }
+  }
+
+  if( !Ok )
+  {
+    IMAGE_Close( Image ) ;
+    return( NULL ) ;
+  }
+
+  return( Image ) ;
+}
+
+void IMAGE_Close( stImage_t * Image )
+{
+  if( Image == NULL )
+  {
+    return ;
+  }
+
+  free( Image->Index ) ;
+  free( Image->Packed ) ;
+  free( Image->Data ) ;
+  free( Image->Cache ) ;
+  free( Image ) ;
+}
+
+int64_t IMAGE_Size( const stImage_t * Image )
+{
+  return( Image->Size ) ;
+}
+
+int IMAGE_Read( stImage_t * Image , int File , int64_t Offset , uint8_t * Buffer , int Length )
+{
+  const stImageBlock_t * Entry ;
+  int                    Block ;
+  int                    Start ;
+  int                    Done ;
+  int                    Count ;
+
+  if( ( Offset < 0 ) || ( Offset >= Image->Size ) )
+  {
+    return( 0 ) ;
+  }
+
+  if( Length > Image->Size - Offset )
+  {
+    Length = ( int ) ( Image->Size - Offset ) ;
+  }
+
+  for( Done = 0 ; Done < Length ; Done += Count )
+  {
+    Block = ( int ) ( ( Offset + Done ) / Image->BlockSize ) ;
+    Start = ( int ) ( ( Offset + Done ) % Image->BlockSize ) ;
+    Count = ( Image->BlockSize - Start < Length - Done ) ? ( Image->BlockSize - Start ) : ( Length - Done ) ;
+    Entry = &Image->Index[ Block ] ;
+
+    if( Entry->offset == 0 )
+    {
+      memset( Buffer + Done , 0 , Count ) ;
+    }
+    else if( ( Entry->flags & IMAGE_BLOCK_COMPRESSED ) == 0 )
+    {
+      if( ReadAt( File , Entry->offset + Start , Buffer + Done , Count ) != Count )
+      {
+        return( -1 ) ;
+      }
+    }
+    else
+    {
+      // Sectors are read one at a time, so keep the block for the next one.
+      if( Block != Image->CacheBlock )
+      {
+        Image->CacheBlock = -1 ;
+        if( !LoadBlock( Image , File , Block , Image->Cache ) )
+        {
+          return( -1 ) ;
+        }
+        Image->CacheBlock = Block ;
+      }
+      memcpy( Buffer + Done , Image->Cache + Start , Count ) ;
+    }
+  }
+
+  return( Done ) ;
+}
+
+int IMAGE_Write( stImage_t * Image , int File , int64_t Offset , const uint8_t * Buffer , int Length )
+{
+  stImageBlock_t * Entry ;
+  int              Block ;
+  int              Start ;
+  int              Done ;
+  int              Count ;
+
+  if( ( Offset < 0 ) || ( Offset >= Image->Size ) )
+  {
+    return( 0 ) ;
+  }
+
+  if( Length > Image->Size - Offset )
+  {
+    Length = ( int ) ( Image->Size - Offset ) ;
+  }
+
+  for( Done = 0 ; Done < Length ; Done += Count )
+  {
+    Block = ( int ) ( ( Offset + Done ) / Image->BlockSize ) ;
+    Start = ( int ) ( ( Offset + Done ) % Image->BlockSize ) ;
+    Count = ( Image->BlockSize - Start < Length - Done ) ? ( Image->BlockSize - Start ) : ( Length - Done ) ;
+    Entry = &Image->Index[ Block ] ;
+
+    if( ( Entry->offset != 0 ) && ( ( Entry->flags & IMAGE_BLOCK_COMPRESSED ) == 0 ) )
+    {
+      if( WriteAt( File , Entry->offset + Start , Buffer + Done , Count ) != Count )
+      {
+        return( -1 ) ;
+      }
+      continue ;
+    }
+
+    // Store the block uncompressed at the end of the file, then point the
+    // index at it.
+    if( !LoadBlock( Image , File , Block , Image->Data ) )
+    {
+      return( -1 ) ;
+    }
+    memcpy( Image->Data + Start , Buffer + Done , Count ) ;
+
+    if( WriteAt( File , Image->FileEnd , Image->Data , Image->BlockSize ) != Image->BlockSize )
+    {
+      return( -1 ) ;
+    }
+
+    Entry->offset  = ( uint64_t ) Image->FileEnd ;
+    Entry->length  = ( uint32_t ) Image->BlockSize ;
+    Entry->flags   = 0 ;
+    Image->FileEnd += Image->BlockSize ;
+
+    if( Block == Image->CacheBlock )
+    {
+      Image->CacheBlock = -1 ;
+    }
+
+    if( WriteAt( File , sizeof( stImageHeader_t ) + ( int64_t ) Block * sizeof( stImageBlock_t ) ,
+                 Entry , sizeof( stImageBlock_t ) ) != sizeof( stImageBlock_t ) )
+    {
+      return( -1 ) ;
+    }
+  }
+
+  return( Done ) ;
+}
+
+bool IMAGE_Convert( const char * RawFilename , const char * ImageFilename , int BlockSize , bool Compress )
+{
+  stImageHeader_t  Header ;
+  stImageBlock_t * Index ;
+  uint8_t        * Data ;
+  uint8_t        * Packed ;
+  int64_t          Size ;
+  int64_t          End ;
+  int              Raw ;
+  int              File ;
+  int              IndexLength ;
+  int              Length ;
+  bool             Ok ;
+
+  if( !ValidBlockSize( BlockSize ) )
+  {
+    return( false ) ;
+  }
+
+  Raw = open( RawFilename , O_BINARY | O_RDONLY ) ;
+  if( Raw < 0 )
+  {
+    return( false ) ;
+  }
+
+  Size = lseek( Raw , 0 , SEEK_END ) ;
+
+  memcpy( Header.magic , IMAGE_MAGIC , sizeof( Header.magic ) ) ;
+  Header.version     = IMAGE_VERSION ;
+  Header.block_size  = ( uint32_t ) BlockSize ;
+  Header.block_count = ( uint32_t ) ( ( Size + BlockSize - 1 ) / BlockSize ) ;
+  Header.size        = ( uint64_t ) Size ;
+
+  if( ( Size <= 0 ) || ( Header.block_count > 0x7FFFFFFF / sizeof( stImageBlock_t ) ) )
+  {
+    close( Raw ) ;
+    return( false ) ;
+  }
+
+  IndexLength = ( int ) ( Header.block_count * sizeof( stImageBlock_t ) ) ;
+  Index       = ( stImageBlock_t * ) calloc( IndexLength , 1 ) ;
+  Data        = ( uint8_t * ) malloc( BlockSize ) ;
+  Packed      = ( uint8_t * ) malloc( BlockSize ) ;
+  File        = open( ImageFilename , O_BINARY | O_WRONLY | O_CREAT | O_TRUNC , 0644 ) ;
+
+  Ok  = ( Index != NULL ) && ( Data != NULL ) && ( Packed != NULL ) && ( File >= 0 ) ;
+  End = sizeof( Header ) + IndexLength ;
+
+  // Empty blocks are left out, and blocks are compressed if that saves
+  // anything.
+  for( uint32_t Block = 0 ; Ok && ( Block < Header.block_count ) ; Block++ )
+  {
+    memset( Data , 0 , BlockSize ) ;
+    Ok = ( ReadAt( Raw , ( int64_t ) Block * BlockSize , Data , BlockSize ) > 0 ) ;
+
+    if( Ok && !Empty( Data , BlockSize ) )
+    {
+      Length = ( Compress ) ? LZ_Compress( Data , BlockSize , Packed , BlockSize - 1 ) : 0 ;
+
+      Index[ Block ].offset = ( uint64_t ) End ;
+      Index[ Block ].length = ( uint32_t ) ( ( Length > 0 ) ? Length : BlockSize ) ;
+      Index[ Block ].flags  = ( Length > 0 ) ? IMAGE_BLOCK_COMPRESSED : 0 ;
+
+      Ok   = ( WriteAt( File , End , ( Length > 0 ) ? Packed : Data , Index[ Block ].length ) == ( int ) Index[ Block ].length ) ;
+      End += Index[ Block ].length ;
+    }
+  }
+
+  Ok = Ok && ( WriteAt( File , 0 , &Header , sizeof( Header ) ) == sizeof( Header ) ) &&
+             ( WriteAt( File , sizeof( Header ) , Index , IndexLength ) == IndexLength ) ;
+
+  close( Raw ) ;
+  if( File >= 0 )
+  {
+    close( File ) ;
+  }
+  free( Index ) ;
+  free( Data ) ;
+  free( Packed ) ;
+
+  if( !Ok )
+  {
+    remove( ImageFilename ) ;
+  }
+
+  return( Ok ) ;
+}
@@ -0,0 +1,163 @@
+// =============================================================================
+// File: XTimage.h
+//
+// Description:
+// Block indexed disk images.
+//
+// A raw disk image takes its full size on the host even when the guest has
+// written little of it. A block indexed image divides the disk into blocks
+// and stores only the blocks that hold data, each found through an index
+// at the start of the file:
+//
+//   header : magic "XTBI", version, block size, block count and disk size.
+//   index  : an entry per block giving the file offset of its data, or 0 if
+//            the block has never held data and reads as zeros, the length
+//            stored and whether it is compressed.
+//   blocks : the block data, each compressed with the LZ codec if that
+//            made it smaller.
+//
+// Blocks written by the guest are stored uncompressed. A block that was
+// empty or compressed is written whole at the end of the file and its
+// index entry updated, leaving the old data unused until the image is
+// converted again. Uncompressed blocks are written in place.
+//
+// This work is licensed under the MIT License. See included LICENSE.TXT.
+//
+
+#ifndef _XTIMAGE_
+#define _XTIMAGE_
+
+#include <stdint.h>
+
+// Block size limits. Blocks are compressed whole, so must fit in an LZ
+// block.
+#define IMAGE_MIN_BLOCK                          0x200   // 512B
+#define IMAGE_MAX_BLOCK                          0x10000 // 64KB
+#define IMAGE_DEFAULT_BLOCK                      0x4000  // 16KB
+
+typedef struct STIMAGE_T stImage_t ;
+
+// =============================================================================
+// Function: IMAGE_Open
+//
+// Description:
+// Read the index of a block indexed image.
+//
+// Parameters:
+//
+//   File : The open image file.
+//
+// Returns:
+//
+//   stImage_t * : The image, or NULL if the file is not a valid block
+//                 indexed image.
+//
+stImage_t * IMAGE_Open( int File ) ;
+
+// =============================================================================
+// Function: IMAGE_Close
+//
+// Description:
+// Release an image. The file is left open.
+//
+// Parameters:
+//
+//   Image : The image.
+//
+// Returns:
+//
+//   None.
+//
+void IMAGE_Close( stImage_t * Image ) ;
+
+// =============================================================================
+// Function: IMAGE_Size
+//
+// Description:
+// Get the size of the disk an image holds.
+//
+// Parameters:
+//
+//   Image : The image.
+//
+// Returns:
+//
+//   int64_t : The disk size in bytes.
+//
+int64_t IMAGE_Size( const stImage_t * Image ) ;
+
+// =============================================================================
+// Function: IMAGE_Read
+//
+// Description:
+// Read from the disk an image holds.
+//
+// Parameters:
+//
+//   Image  : The image.
+//
+//   File   : The image file.
+//
+//   Offset : The disk offset to read from.
+//
+//   Buffer : Returns the data read.
+//
+//   Length : The number of bytes to read.
+//
+// Returns:
+//
+//   int : The number of bytes read, which is less than Length at the end of
+//         the disk, or -1 on error.
+//
+int IMAGE_Read( stImage_t * Image , int File , int64_t Offset , uint8_t * Buffer , int Length ) ;
+
+// =============================================================================
+// Function: IMAGE_Write
+//
+// Description:
+// Write to the disk an image holds. The disk does not grow.
+//
+// Parameters:
+//
+//   Image  : The image.
+//
+//   File   : The image file, opened for writing. This need not be the file
+//            the image was opened from.
+//
+//   Offset : The disk offset to write to.
+//
+//   Buffer : The data to write.
+//
+//   Length : The number of bytes to write.
+//
+// Returns:
+//
+//   int : The number of bytes written, which is less than Length at the
+//         end of the disk, or -1 on error.
+//
+int IMAGE_Write( stImage_t * Image , int File , int64_t Offset , const uint8_t * Buffer , int Length ) ;
+
+// =============================================================================
+// Function: IMAGE_Convert
+//
+// Description:
+// Convert a raw disk image to a block indexed image.
+//
+// Parameters:
+//
+//   RawFilename   : The raw image to convert.
+//
+//   ImageFilename : The block indexed image to create.
+//
+//   BlockSize     : The block size, a power of 2 from IMAGE_MIN_BLOCK to
+//                   IMAGE_MAX_BLOCK.
+//
+//   Compress      : true to compress blocks.
+//
+// Returns:
+//
+//   bool : true if the image was created.
+//
+bool IMAGE_Convert( const char * RawFilename , const char * ImageFilename , int BlockSize , bool Compress ) ;
+
+#endif // _XTIMAGE_
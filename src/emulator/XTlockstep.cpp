@@ -0,0 +1,651 @@
+// =============================================================================
+// File: XTlockstep.cpp
+//
+// Description:
+// Lockstep differential execution checker.
+// See XTlockstep.h for a description of the checking scheme.
+//
+// This work is licensed under the MIT License. See included LICENSE.TXT.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "XTlockstep.h"
+#include "XTdisasm.h"
+#include "XTmemory.h"
+#include "XTems.h"
+
+// The architectural register file at the start of the register page:
+// the 16-bit registers followed by the flags.
+#define REGFILE_SIZE                             ( FLAG_OF + 1 )
+
+// Maximum number of differing memory bytes listed in a report
+#define MAX_REPORTED_BYTES                       16
+
+// =============================================================================
+// Local types
+//
+
+typedef enum
+{
+  LOG_PORT_READ  ,
+  LOG_PORT_WRITE ,
+  LOG_HOST_DATA  ,
+  LOG_INTERRUPT
+} LogType_t ;
+
+typedef struct STLOGENTRY_T
+{
+  uint8_t  Type    ;
+  uint8_t  Value   ;
+  int32_t  Address ; // Port address, interrupt number or host data offset
+  uint32_t Length  ; // Host data length
+  int32_t  Step    ; // Instruction in the block an interrupt follows
+} stLogEntry_t ;
+
+typedef struct STSTEP_T
+{
+  uint32_t LogPos                  ; // First log entry of this instruction
+  uint8_t  Regs[ REGFILE_SIZE ]    ; // Reference registers after the instruction
+} stStep_t ;
+
+typedef struct STCHECKPOINT_T
+{
+  uint8_t    * Mem ;
+  uint8_t    * IO  ;
+  stCPUState_t      CPU ;
+  stEMSCheckpoint_t EMS ;
+} stCheckpoint_t ;
+
+// =============================================================================
+// Exported variables
+//
+
+LockstepPhase_t LockstepPhase = LOCKSTEP_LIVE ;
+
+// =============================================================================
+// Local variables
+//
+
+static bool        Enabled     = false ;
+static int         BlockLength = 0     ;
+static CPUEngine_t RefEngine   = NULL  ;
+static CPUEngine_t CandEngine  = NULL  ;
+static void     ( * StepEvents )( void ) = NULL ;
+
+static unsigned long InstructionsChecked = 0 ;
+
+// Event log for the current block
+static stLogEntry_t * Log         = NULL ;
+static uint32_t       LogSize     = 0    ;
+static uint32_t       LogCount    = 0    ;
+static uint32_t       LogPos      = 0    ;
+static uint8_t      * LogData     = NULL ;
+static uint32_t       LogDataSize = 0    ;
+static uint32_t       LogDataLen  = 0    ;
+static bool           LogOverflow = false ;
+
+// Set in the replay phase when the candidate's inputs and outputs do not
+// follow the log.
+static bool           LogMismatch = false ;
+
+static stStep_t     * Steps     = NULL ;
+static int            StepCount = 0    ;
+static int            ReplayStep = 0   ; // Instruction being replayed
+
+// Checkpoints: block start, reference block end, and the pre-instruction and
+// reference post-instruction state used when locating a divergence.
+static stCheckpoint_t BlockStart ;
+static stCheckpoint_t BlockEnd   ;
+static stCheckpoint_t StepStart  ;
+static stCheckpoint_t StepRef    ;
+
+static const char * Reg16Names[ 12 ] =
+{
+  "AX" , "CX" , "DX" , "BX" , "SP" , "BP" , "SI" , "DI" , "ES" , "CS" , "SS" , "DS"
+} ;
+
+static const char * FlagNames[ 9 ] =
+{
+  "CF" , "PF" , "AF" , "ZF" , "SF" , "TF" , "IF" , "DF" , "OF"
+} ;
+
+// =============================================================================
+// Local functions
+//
+
+static bool AllocCheckpoint( stCheckpoint_t * C )
+{
+  C->Mem = ( uint8_t * ) malloc( RAM_SIZE ) ;
+  C->IO  = ( uint8_t * ) malloc( IO_PORT_COUNT ) ;
+
+  return( ( C->Mem != NULL ) && ( C->IO != NULL ) ) ;
+}
+
+static void FreeCheckpoint( stCheckpoint_t * C )
+{
+  free( C->Mem ) ;
+  free( C->IO ) ;
+  C->Mem = NULL ;
+  C->IO  = NULL ;
+  EMS_FreeCheckpoint( &C->EMS ) ;
+}
+
+// Expanded memory pages are only saved if they changed in the block, so
+// the EMS journal is started with the block.
+// Returns false if there was not enough memory for the checkpoint.
+static bool SaveCheckpoint( stCheckpoint_t * C )
+{
+  memcpy( C->Mem , mem , RAM_SIZE ) ;
+  memcpy( C->IO , io_ports , IO_PORT_COUNT ) ;
+  CPU_GetState( &C->CPU ) ;
+
+  return( EMS_SaveCheckpoint( &C->EMS ) ) ;
+}
+
+static void RestoreCheckpoint( const stCheckpoint_t * C )
+{
+  // The page frame is switched back before RAM is restored through it.
+  EMS_RestoreCheckpoint( &C->EMS ) ;
+  memcpy( mem , C->Mem , RAM_SIZE ) ;
+  memcpy( io_ports , C->IO , IO_PORT_COUNT ) ;
+  CPU_SetState( &C->CPU ) ;
+}
+
+static stLogEntry_t * NewLogEntry( void )
+{
+  if( LogCount == LogSize )
+  {
+    stLogEntry_t * NewLog ;
+
+    NewLog = ( stLogEntry_t * ) realloc( Log , ( LogSize * 2 ) * sizeof( stLogEntry_t ) ) ;
+    if( NewLog == NULL )
+    {
+      LogOverflow = true ;
+      return( NULL ) ;
+    }
+    Log      = NewLog ;
+    LogSize *= 2 ;
+  }
+
+  return( &Log[ LogCount++ ] ) ;
+}
+
+// Get the next log entry in the replay phase, flagging a mismatch if it is
+// not of the expected type.
+static stLogEntry_t * NextLogEntry( uint8_t Type , int32_t Address )
+{
+  stLogEntry_t * Entry ;
+
+  if( LogPos >= LogCount )
+  {
+    LogMismatch = true ;
+    return( NULL ) ;
+  }
+
+  Entry = &Log[ LogPos ] ;
+  if( ( Entry->Type != Type ) || ( ( Type != LOG_HOST_DATA ) && ( Entry->Address != Address ) ) )
+  {
+    LogMismatch = true ;
+    return( NULL ) ;
+  }
+
+  LogPos++ ;
+
+  return( Entry ) ;
+}
+
+// Compare the architectural registers of two register files.
+static bool RegistersMatch( const uint8_t * RefRegs , const uint8_t * Regs )
+{
+  int i ;
+
+  for( i = 0 ; i < 12 ; i++ )
+  {
+    if( ( ( uint16_t * ) RefRegs )[ i ] != ( ( uint16_t * ) Regs )[ i ] )
+    {
+      return( false ) ;
+    }
+  }
+
+  if( ( ( uint16_t * ) RefRegs )[ REG_IP ] != ( ( uint16_t * ) Regs )[ REG_IP ] )
+  {
+    return( false ) ;
+  }
+
+  for( i = FLAG_CF ; i <= FLAG_OF ; i++ )
+  {
+    if( ( RefRegs[ i ] != 0 ) != ( Regs[ i ] != 0 ) )
+    {
+      return( false ) ;
+    }
+  }
+
+  return( true ) ;
+}
+
+// Compare memory outside the register file.
+static bool MemoryMatches( const uint8_t * RefMem )
+{
+  return( ( memcmp( RefMem , mem , REGS_BASE ) == 0 ) &&
+          ( memcmp( RefMem + REGS_BASE + REGFILE_SIZE , mem + REGS_BASE + REGFILE_SIZE , RAM_SIZE - REGS_BASE - REGFILE_SIZE ) == 0 ) ) ;
+}
+
+static void ReportDivergence( int Step , bool IOMismatch )
+{
+  const uint8_t * PreRegs ;
+  const uint8_t * RefRegs ;
+  const uint8_t * Regs    ;
+  uint32_t        Addr    ;
+  char            Text[ 80 ] ;
+  int             Len     ;
+  int             Count   ;
+  int             i       ;
+
+  PreRegs = StepStart.Mem + REGS_BASE ;
+  RefRegs = StepRef.Mem   + REGS_BASE ;
+  Regs    = mem           + REGS_BASE ;
+
+  Addr = 16 * ( uint32_t ) ( ( uint16_t * ) PreRegs )[ REG_CS ] + StepStart.CPU.reg_ip ;
+  Len  = DISASM_Instruction( StepStart.Mem + Addr , StepStart.CPU.reg_ip , Text , sizeof( Text ) ) ;
+
+  printf( "Lockstep: divergence at instruction %lu\n" , InstructionsChecked + Step ) ;
+  printf( "  %04X:%04X  " , ( ( uint16_t * ) PreRegs )[ REG_CS ] , StepStart.CPU.reg_ip ) ;
+  for( i = 0 ; i < Len ; i++ )
+  {
+    printf( "%02X " , StepStart.Mem[ Addr + i ] ) ;
+  }
+  printf( " %s\n" , Text ) ;
+
+  for( i = 0 ; i < 12 ; i++ )
+  {
+    if( ( ( uint16_t * ) RefRegs )[ i ] != ( ( uint16_t * ) Regs )[ i ] )
+    {
+      printf( "  %s: reference %04X, candidate %04X\n" , Reg16Names[ i ] ,
+              ( ( uint16_t * ) RefRegs )[ i ] , ( ( uint16_t * ) Regs )[ i ] ) ;
+    }
+  }
+
+  if( ( ( uint16_t * ) RefRegs )[ REG_IP ] != ( ( uint16_t * ) Regs )[ REG_IP ] )
+  {
+    printf( "  IP: reference %04X, candidate %04X\n" ,
+            ( ( uint16_t * ) RefRegs )[ REG_IP ] , ( ( uint16_t * ) Regs )[ REG_IP ] ) ;
+  }
+
+  for( i = FLAG_CF ; i <= FLAG_OF ; i++ )
+  {
+    if( ( RefRegs[ i ] != 0 ) != ( Regs[ i ] != 0 ) )
+    {
+      printf( "  %s: reference %d, candidate %d\n" , FlagNames[ i - FLAG_CF ] , RefRegs[ i ] != 0 , Regs[ i ] != 0 ) ;
+    }
+  }
+
+  Count = 0 ;
+  for( Addr = 0 ; ( Addr < RAM_SIZE ) && ( Count < MAX_REPORTED_BYTES ) ; Addr++ )
+  {
+    if( ( Addr >= REGS_BASE ) && ( Addr < REGS_BASE + REGFILE_SIZE ) )
+    {
+      continue ;
+    }
+
+    if( StepRef.Mem[ Addr ] != mem[ Addr ] )
+    {
+      printf( "  [%05X]: reference %02X, candidate %02X\n" , Addr , StepRef.Mem[ Addr ] , mem[ Addr ] ) ;
+      Count++ ;
+    }
+  }
+
+  if( IOMismatch )
+  {
+    printf( "  Port I/O, hypercall or interrupt sequence differs\n" ) ;
+  }
+}
+
+// Replay the block one instruction at a time from the block start, running
+// both engines on each instruction, to find the first divergent instruction.
+static void LocateDivergence( void )
+{
+  uint32_t RefLogPos ;
+  int      i         ;
+
+  RestoreCheckpoint( &BlockStart ) ;
+
+  for( i = 0 ; i < StepCount ; i++ )
+  {
+    SaveCheckpoint( &StepStart ) ;
+
+    ReplayStep = i ;
+    LogPos = Steps[ i ].LogPos ;
+    RefEngine() ;
+    RefLogPos = LogPos ;
+    SaveCheckpoint( &StepRef ) ;
+
+    RestoreCheckpoint( &StepStart ) ;
+
+    LogPos      = Steps[ i ].LogPos ;
+    LogMismatch = false ;
+    CandEngine() ;
+
+    if( LogMismatch || ( LogPos != RefLogPos ) ||
+        !RegistersMatch( StepRef.Mem + REGS_BASE , mem + REGS_BASE ) ||
+        !MemoryMatches( StepRef.Mem ) )
+    {
+      ReportDivergence( i , LogMismatch || ( LogPos != RefLogPos ) ) ;
+      return ;
+    }
+
+    if( i < StepCount - 1 )
+    {
+      StepEvents() ;
+    }
+  }
+
+  printf( "Lockstep: block ending at instruction %lu differs, but no single instruction diverges\n" ,
+          InstructionsChecked + StepCount ) ;
+}
+
+// =============================================================================
+// Exported functions
+//
+
+bool LOCKSTEP_Initialise( int BlockLen , CPUEngine_t Reference , CPUEngine_t Candidate , void ( * Events )( void ) )
+{
+  if( BlockLen <= 0 )
+  {
+    return( false ) ;
+  }
+
+  BlockLength = BlockLen  ;
+  RefEngine   = Reference ;
+  CandEngine  = Candidate ;
+  StepEvents  = Events    ;
+
+  LogSize     = 1024 ;
+  Log         = ( stLogEntry_t * ) malloc( LogSize * sizeof( stLogEntry_t ) ) ;
+  LogDataSize = 65536 ;
+  LogData     = ( uint8_t * ) malloc( LogDataSize ) ;
+  Steps       = ( stStep_t * ) malloc( ( BlockLength + 1 ) * sizeof( stStep_t ) ) ;
+
+  if( ( Log == NULL ) || ( LogData == NULL ) || ( Steps == NULL ) ||
+      !AllocCheckpoint( &BlockStart ) || !AllocCheckpoint( &BlockEnd ) ||
+      !AllocCheckpoint( &StepStart )  || !AllocCheckpoint( &StepRef ) )
+  {
+    printf( "Lockstep: not enough memory for checkpoints\n" ) ;
+    LOCKSTEP_Cleanup() ;
+    return( false ) ;
+  }
+
+  printf( "Lockstep: checking in blocks of %d instructions\n" , BlockLength ) ;
+  if( Candidate == Reference )
+  {
+    printf( "Lockstep: no candidate engine, checking the reference engine against itself\n" ) ;
+  }
+
+  InstructionsChecked = 0 ;
+  Enabled = true ;
+
+  return( true ) ;
+}
+
+void LOCKSTEP_Cleanup( void )
+{
+  Enabled       = false ;
+  LockstepPhase = LOCKSTEP_LIVE ;
+  EMS_StopJournal() ;
+
+  free( Log ) ;
+  free( LogData ) ;
+  free( Steps ) ;
+  Log     = NULL ;
+  LogData = NULL ;
+  Steps   = NULL ;
+
+  FreeCheckpoint( &BlockStart ) ;
+  FreeCheckpoint( &BlockEnd ) ;
+  FreeCheckpoint( &StepStart ) ;
+  FreeCheckpoint( &StepRef ) ;
+}
+
+bool LOCKSTEP_Enabled( void )
+{
+  return( Enabled ) ;
+}
+
+bool LOCKSTEP_RunBlock( bool ( * TimerTick )( void ) )
+{
+  bool StateChanged ;
+  bool Diverged     ;
+  int  i            ;
+
+  // Run the reference engine, logging all inputs.
+  EMS_StartJournal() ;
+  if( !SaveCheckpoint( &BlockStart ) )
+  {
+    printf( "Lockstep: not enough memory for expanded memory checkpoints, checking disabled\n" ) ;
+    LOCKSTEP_Cleanup() ;
+    return( false ) ;
+  }
+
+  LogCount      = 0 ;
+  LogDataLen    = 0 ;
+  LogOverflow   = false ;
+  StepCount     = 0 ;
+  LockstepPhase = LOCKSTEP_RECORD ;
+
+  for( ;; )
+  {
+    Steps[ StepCount ].LogPos = LogCount ;
+    RefEngine() ;
+    memcpy( Steps[ StepCount ].Regs , mem + REGS_BASE , REGFILE_SIZE ) ;
+    StepCount++ ;
+
+    StateChanged = TimerTick() ;
+    if( StateChanged || ( StepCount == BlockLength ) )
+    {
+      break ;
+    }
+
+    StepEvents() ;
+  }
+  Steps[ StepCount ].LogPos = LogCount ;
+
+  if( LogOverflow )
+  {
+    printf( "Lockstep: event log overflow, checking disabled\n" ) ;
+    LOCKSTEP_Cleanup() ;
+    return( StateChanged ) ;
+  }
+
+  if( !SaveCheckpoint( &BlockEnd ) )
+  {
+    printf( "Lockstep: not enough memory for expanded memory checkpoints, checking disabled\n" ) ;
+    LOCKSTEP_Cleanup() ;
+    return( StateChanged ) ;
+  }
+
+  // Roll back and replay the block on the candidate engine.
+  RestoreCheckpoint( &BlockStart ) ;
+
+  LockstepPhase = LOCKSTEP_REPLAY ;
+  LogMismatch   = false ;
+  Diverged      = false ;
+
+  for( i = 0 ; ( i < StepCount ) && !Diverged ; i++ )
+  {
+    ReplayStep = i ;
+    LogPos = Steps[ i ].LogPos ;
+    CandEngine() ;
+
+    if( !RegistersMatch( Steps[ i ].Regs , mem + REGS_BASE ) )
+    {
+      Diverged = true ;
+    }
+    else if( i < StepCount - 1 )
+    {
+      StepEvents() ;
+    }
+
+    if( LogMismatch || ( LogPos != Steps[ i + 1 ].LogPos ) )
+    {
+      Diverged = true ;
+    }
+  }
+
+  if( !Diverged )
+  {
+    Diverged = !MemoryMatches( BlockEnd.Mem ) ;
+  }
+
+  if( Diverged )
+  {
+    LocateDivergence() ;
+    printf( "Lockstep: continuing on the reference engine, checking disabled\n" ) ;
+
+    RestoreCheckpoint( &BlockEnd ) ;
+    LOCKSTEP_Cleanup() ;
+    return( StateChanged ) ;
+  }
+
+  InstructionsChecked += StepCount ;
+  LockstepPhase = LOCKSTEP_LIVE ;
+  EMS_StopJournal() ;
+
+  return( StateChanged ) ;
+}
+
+uint8_t LOCKSTEP_PortRead( int Address , uint8_t Value )
+{
+  stLogEntry_t * Entry ;
+
+  if( LockstepPhase == LOCKSTEP_RECORD )
+  {
+    Entry = NewLogEntry() ;
+    if( Entry != NULL )
+    {
+      Entry->Type    = LOG_PORT_READ ;
+      Entry->Value   = Value   ;
+      Entry->Address = Address ;
+      Entry->Length  = 0       ;
+      Entry->Step    = 0       ;
+    }
+  }
+  else if( LockstepPhase == LOCKSTEP_REPLAY )
+  {
+    Entry = NextLogEntry( LOG_PORT_READ , Address ) ;
+    Value = ( Entry != NULL ) ? ( Entry->Value ) : ( 0xFF ) ;
+  }
+
+  return( Value ) ;
+}
+
+void LOCKSTEP_PortWrite( int Address , uint8_t Value )
+{
+  stLogEntry_t * Entry ;
+
+  if( LockstepPhase == LOCKSTEP_RECORD )
+  {
+    Entry = NewLogEntry() ;
+    if( Entry != NULL )
+    {
+      Entry->Type    = LOG_PORT_WRITE ;
+      Entry->Value   = Value   ;
+      Entry->Address = Address ;
+      Entry->Length  = 0       ;
+      Entry->Step    = 0       ;
+    }
+  }
+  else if( LockstepPhase == LOCKSTEP_REPLAY )
+  {
+    Entry = NextLogEntry( LOG_PORT_WRITE , Address ) ;
+    if( ( Entry != NULL ) && ( Entry->Value != Value ) )
+    {
+      LogMismatch = true ;
+    }
+  }
+}
+
+void LOCKSTEP_HostData( void * Data , uint32_t Length )
+{
+  stLogEntry_t * Entry ;
+
+  if( LockstepPhase == LOCKSTEP_RECORD )
+  {
+    if( LogDataLen + Length > LogDataSize )
+    {
+      uint8_t * NewData ;
+      uint32_t  NewSize ;
+
+      NewSize = LogDataSize ;
+      while( LogDataLen + Length > NewSize )
+      {
+        NewSize *= 2 ;
+      }
+
+      NewData = ( uint8_t * ) realloc( LogData , NewSize ) ;
+      if( NewData == NULL )
+      {
+        LogOverflow = true ;
+        return ;
+      }
+      LogData     = NewData ;
+      LogDataSize = NewSize ;
+    }
+
+    Entry = NewLogEntry() ;
+    if( Entry != NULL )
+    {
+      Entry->Type    = LOG_HOST_DATA ;
+      Entry->Value   = 0          ;
+      Entry->Address = LogDataLen ;
+      Entry->Length  = Length     ;
+      Entry->Step    = 0          ;
+
+      memcpy( LogData + LogDataLen , Data , Length ) ;
+      LogDataLen += Length ;
+    }
+  }
+  else if( LockstepPhase == LOCKSTEP_REPLAY )
+  {
+    Entry = NextLogEntry( LOG_HOST_DATA , 0 ) ;
+    if( Entry == NULL )
+    {
+      return ;
+    }
+
+    if( Entry->Length != Length )
+    {
+      LogMismatch = true ;
+      return ;
+    }
+
+    memcpy( Data , LogData + Entry->Address , Length ) ;
+  }
+}
+
+void LOCKSTEP_LogInterrupt( int IntNo )
+{
+  stLogEntry_t * Entry ;
+
+  Entry = NewLogEntry() ;
+  if( Entry != NULL )
+  {
+    Entry->Type    = LOG_INTERRUPT ;
+    Entry->Value   = 0     ;
+    Entry->Address = IntNo ;
+    Entry->Length  = 0     ;
+    Entry->Step    = StepCount - 1 ;
+  }
+}
+
+bool LOCKSTEP_ReplayInterrupt( int & IntNo )
+{
+  if( ( LogPos < LogCount ) && ( Log[ LogPos ].Type == LOG_INTERRUPT ) && ( Log[ LogPos ].Step == ReplayStep ) )
+  {
+    IntNo = Log[ LogPos++ ].Address ;
+    return( true ) ;
+  }
+
+  return( false ) ;
+}
@@ -0,0 +1,212 @@
+// =============================================================================
+// File: XTlockstep.h
+//
+// Description:
+// Lockstep differential execution checker.
+//
+// Execution is split into blocks. Each block is first run on the reference
+// engine while every external input (port reads, host data returned by
+// hypercalls and delivered hardware interrupts) is logged. The machine is
+// then rolled back to the start of the block and the candidate engine is run
+// with the logged inputs replayed, so device side effects happen only once.
+// Rolling back covers guest RAM, the I/O ports, the CPU and the expanded
+// memory board, including the expanded memory pages changed in the block.
+// The two runs are compared register by register after every instruction and
+// over all of memory at the end of the block. On a mismatch the block is
+// replayed one instruction at a time to report the first divergent
+// instruction with a disassembly and the differing state.
+//
+// The core checks its decode cache engine against the reference engine.
+//
+// This work is licensed under the MIT License. See included LICENSE.TXT.
+//
+
+#ifndef _XTLOCKSTEP_
+#define _XTLOCKSTEP_
+
+#include <stdint.h>
+
+#include "XTcpu.h"
+
+typedef enum
+{
+  LOCKSTEP_LIVE   , // No checking: inputs come from the interface
+  LOCKSTEP_RECORD , // Reference run: inputs come from the interface and are logged
+  LOCKSTEP_REPLAY   // Candidate run: inputs come from the log
+} LockstepPhase_t ;
+
+// The current lockstep phase, checked by the core wherever it takes an
+// input from outside the CPU.
+extern LockstepPhase_t LockstepPhase ;
+
+// =============================================================================
+// Function: LOCKSTEP_Initialise
+//
+// Description:
+// Enable lockstep checking.
+//
+// Parameters:
+//
+//   BlockLength : The maximum number of instructions per block.
+//
+//   Reference   : The engine treated as correct.
+//
+//   Candidate   : The engine being validated. If it is the reference
+//                 engine, only the checker and the replay of logged inputs
+//                 are tested.
+//
+//   Events      : Called between instructions to deliver trap and hardware
+//                 interrupts. Must use LOCKSTEP_ReplayInterrupt when
+//                 LockstepPhase is LOCKSTEP_REPLAY.
+//
+// Returns:
+//
+//   bool : true if lockstep checking is enabled.
+//
+bool LOCKSTEP_Initialise( int BlockLength , CPUEngine_t Reference , CPUEngine_t Candidate , void ( * Events )( void ) ) ;
+
+// =============================================================================
+// Function: LOCKSTEP_Cleanup
+//
+// Description:
+// Disable lockstep checking and release the checkpoint buffers.
+//
+// Parameters:
+//
+//   None.
+//
+// Returns:
+//
+//   None.
+//
+void LOCKSTEP_Cleanup( void ) ;
+
+// =============================================================================
+// Function: LOCKSTEP_Enabled
+//
+// Description:
+// Check if lockstep checking is active.
+//
+// Parameters:
+//
+//   None.
+//
+// Returns:
+//
+//   bool : true while blocks should be run through LOCKSTEP_RunBlock.
+//
+bool LOCKSTEP_Enabled( void ) ;
+
+// =============================================================================
+// Function: LOCKSTEP_RunBlock
+//
+// Description:
+// Run one block of instructions on the reference engine, then replay it on
+// the candidate engine and compare.
+// The block ends early when the interface reports a state change, which is
+// left for the caller to handle once the block has been checked.
+// If a divergence is found it is reported, the reference state is kept and
+// lockstep checking is disabled.
+//
+// Parameters:
+//
+//   TimerTick : Updates the interface after each reference instruction.
+//               Returns true if the interface state changed.
+//
+// Returns:
+//
+//   bool : The result of the last call to TimerTick.
+//
+bool LOCKSTEP_RunBlock( bool ( * TimerTick )( void ) ) ;
+
+// =============================================================================
+// Function: LOCKSTEP_PortRead
+//
+// Description:
+// Log a port read in the record phase, or return the logged value in the
+// replay phase.
+//
+// Parameters:
+//
+//   Address : The I/O port address.
+//
+//   Value   : The value read from the interface (record phase).
+//
+// Returns:
+//
+//   uint8_t : The value the instruction should see.
+//
+uint8_t LOCKSTEP_PortRead( int Address , uint8_t Value ) ;
+
+// =============================================================================
+// Function: LOCKSTEP_PortWrite
+//
+// Description:
+// Log a port write in the record phase, or check it against the log in the
+// replay phase.
+//
+// Parameters:
+//
+//   Address : The I/O port address.
+//
+//   Value   : The value written.
+//
+// Returns:
+//
+//   None.
+//
+void LOCKSTEP_PortWrite( int Address , uint8_t Value ) ;
+
+// =============================================================================
+// Function: LOCKSTEP_HostData
+//
+// Description:
+// Log data supplied by the host in the record phase, or restore it from the
+// log in the replay phase.
+//
+// Parameters:
+//
+//   Data   : The host data.
+//
+//   Length : The number of bytes.
+//
+// Returns:
+//
+//   None.
+//
+void LOCKSTEP_HostData( void * Data , uint32_t Length ) ;
+
+// =============================================================================
+// Function: LOCKSTEP_LogInterrupt
+//
+// Description:
+// Log a hardware interrupt delivered in the record phase.
+//
+// Parameters:
+//
+//   IntNo : The interrupt number.
+//
+// Returns:
+//
+//   None.
+//
+void LOCKSTEP_LogInterrupt( int IntNo ) ;
+
+// =============================================================================
+// Function: LOCKSTEP_ReplayInterrupt
+//
+// Description:
+// Check if a hardware interrupt was delivered after the current instruction
+// in the record phase.
+//
+// Parameters:
+//
+//   IntNo : Set to the interrupt number.
+//
+// Returns:
+//
+//   bool : true if the interrupt should be delivered.
+//
+bool LOCKSTEP_ReplayInterrupt( int & IntNo ) ;
+
+#endif // _XTLOCKSTEP_
@@ -0,0 +1,231 @@
+// =============================================================================
+// File: XTlz.cpp
+//
+// Description:
+// A small LZ77 codec for machine state.
+// See XTlz.h for a description of the compressed data.
+//
+// This work is licensed under the MIT License. See included LICENSE.TXT.
+//
+
+#include <string.h>
+
+#include "XTlz.h"
+
+// Matches are found through a hash of the next 4 bytes. Only the latest
+// position for each hash is kept, which is fast and good enough for the
+// small blocks of mostly code and tables in guest memory.
+#define LZ_HASH_BITS                             12
+#define LZ_HASH_SIZE                             ( 1 << LZ_HASH_BITS )
+
+// =============================================================================
+// Local functions
+//
+
+static uint32_t HashAt( const uint8_t * Data )
+{
+  uint32_t Value ;
+
+  memcpy( &Value , Data , sizeof( Value ) ) ;
+
+  return( ( Value * 2654435761u ) >> ( 32 - LZ_HASH_BITS ) ) ;
+}
+
+// Write the part of a length that does not fit in its nibble.
+static int WriteLength( uint8_t * Dst , int Out , int Length )
+{
+  for( Length -= 15 ; Length >= 255 ; Length -= 255 )
+  {
+    Dst[ Out++ ] = 255 ;
+  }
+  Dst[ Out++ ] = ( uint8_t ) Length ;
+
+  return( Out ) ;
+}
+
+// Read the rest of a length whose nibble was 15.
+static bool ReadLength( const uint8_t * Src , int SrcLength , int & In , int & Length , int Limit )
+{
+  uint8_t Byte ;
+
+  if( Length != 15 )
+  {
+    return( true ) ;
+  }
+
+  do
+  {
+    if( ( In >= SrcLength ) || ( Length > Limit ) )
+    {
+      return( false ) ;
+    }
+    Byte    = Src[ In++ ] ;
+    Length += Byte ;
+  } while( Byte == 255 ) ;
+
+  return( true ) ;
+}
+
+// Add a sequence of literals and a match, MatchLength 0 for none.
+// Returns the new output length, or -1 if the sequence does not fit.
+static int WriteSequence( uint8_t * Dst , int DstLength , int Out , const uint8_t * Literal , int LiteralLength , int Offset , int MatchLength )
+{
+  int MatchCode = ( MatchLength > 0 ) ? MatchLength - LZ_MIN_MATCH : 0 ;
+  int Worst     = 1 + ( LiteralLength / 255 + 1 ) + LiteralLength + 2 + ( MatchCode / 255 + 1 ) ;
+  uint8_t * Token ;
+
+  if( Worst > DstLength - Out )
+  {
+    return( -1 ) ;
+  }
+
+  Token  = &Dst[ Out++ ] ;
+  *Token = ( uint8_t ) ( ( ( LiteralLength < 15 ) ? LiteralLength : 15 ) << 4 ) ;
+  if( LiteralLength >= 15 )
+  {
+    Out = WriteLength( Dst , Out , LiteralLength ) ;
+  }
+
+  memcpy( Dst + Out , Literal , LiteralLength ) ;
+  Out += LiteralLength ;
+
+  if( MatchLength > 0 )
+  {
+    Dst[ Out++ ] = ( uint8_t ) Offset ;
+    Dst[ Out++ ] = ( uint8_t ) ( Offset >> 8 ) ;
+
+    *Token |= ( uint8_t ) ( ( MatchCode < 15 ) ? MatchCode : 15 ) ;
+    if( MatchCode >= 15 )
+    {
+      Out = WriteLength( Dst , Out , MatchCode ) ;
+    }
+  }
+
+  return( Out ) ;
+}
+
+// =============================================================================
+// Exported functions
+//
+
+int LZ_Compress( const uint8_t * Src , int SrcLength , uint8_t * Dst , int DstLength )
+{
+  uint16_t Table[ LZ_HASH_SIZE ] ;
+  uint32_t Hash ;
+  int      Candidate ;
+  int      Length ;
+  int      Pos    = 0 ;
+  int      Anchor = 0 ;
+  int      Out    = 0 ;
+
+  memset( Table , 0 , sizeof( Table ) ) ;
+
+  while( Pos + LZ_MIN_MATCH <= SrcLength )
+  {
+    Hash          = HashAt( Src + Pos ) ;
+    Candidate     = Table[ Hash ] ;
+    Table[ Hash ] = ( uint16_t ) Pos ;
+
+    if( ( Candidate >= Pos ) || ( Pos - Candidate > LZ_MAX_OFFSET ) ||
+        ( memcmp( Src + Candidate , Src + Pos , LZ_MIN_MATCH ) != 0 ) )
+    {
+      Pos++ ;
+      continue ;
+    }
+
+    Length = LZ_MIN_MATCH ;
+    while( ( Pos + Length < SrcLength ) && ( Src[ Candidate + Length ] == Src[ Pos + Length ] ) )
+    {
+      Length++ ;
+    }
+
+    Out = WriteSequence( Dst , DstLength , Out , Src + Anchor , Pos - Anchor , Pos - Candidate , Length ) ;
+    if( Out < 0 )
+    {
+      return( 0 ) ;
+    }
+
+    Pos   += Length ;
+    Anchor = Pos ;
+  }
+
+  if( Anchor < SrcLength )
+  {
+    Out = WriteSequence( Dst , DstLength , Out , Src + Anchor , SrcLength - Anchor , 0 , 0 ) ;
+  }
+
+  return( ( Out < 0 ) ? 0 : Out ) ;
+}
+
+bool LZ_Decompress( const uint8_t * Src , int SrcLength , uint8_t * Dst , int DstLength )
+{
+  int       In  = 0 ;
+  int       Out = 0 ;
+  int       Token ;
+  int       Length ;
+  int       Offset ;
+  uint8_t * To ;
+
+  while( In < SrcLength )
+  {
+    Token  = Src[ In++ ] ;
+    Length = Token >> 4 ;
+    if( !ReadLength( Src , SrcLength , In , Length , DstLength ) ||
+        ( Length > SrcLength - In ) || ( Length > DstLength - Out ) )
+    {
+      return( false ) ;
+    }
+
+    if( Dst != NULL )
+    {
+      memcpy( Dst + Out , Src + In , Length ) ;
+    }
+    In  += Length ;
+    Out += Length ;
+
+    // The last sequence has no match.
+    if( In == SrcLength )
+    {
+      break ;
+    }
+
+    if( SrcLength - In < 2 )
+    {
+      return( false ) ;
+    }
+    Offset = Src[ In ] | ( Src[ In + 1 ] << 8 ) ;
+    In    += 2 ;
+
+    Length = Token & 15 ;
+    if( !ReadLength( Src , SrcLength , In , Length , DstLength ) )
+    {
+      return( false ) ;
+    }
+    Length += LZ_MIN_MATCH ;
+
+    if( ( Offset == 0 ) || ( Offset > Out ) || ( Length > DstLength - Out ) )
+    {
+      return( false ) ;
+    }
+
+    if( Dst != NULL )
+    {
+      // A match may overlap its own output, as for runs of one byte.
+      To = Dst + Out ;
+      if( Offset >= Length )
+      {
+        memcpy( To , To - Offset , Length ) ;
+      }
+      else
+      {
+        for( int i = 0 ; i < Length ; i++ )
+        {
+          To[ i ] = To[ i - Offset ] ;
+        }
+      }
+    }
+    Out += Length ;
+  }
+
+  return( Out == DstLength ) ;
+}
@@ -0,0 +1,78 @@
+// =============================================================================
+// File: XTlz.h
+//
+// Description:
+// A small LZ77 codec for machine state.
+//
+// Compressed data is a series of sequences, each a token byte followed by
+// literal bytes and then a match to copy from earlier output:
+//
+//   token   : literal count in the high nibble, match length - 4 in the low
+//             nibble. A nibble of 15 is followed by bytes added to it, up to
+//             and including the first byte that is not 255.
+//   literal : the literal bytes.
+//   offset  : 2 bytes, little endian, the distance back to the match.
+//
+// The last sequence has no offset or match when it ends the data. Blocks
+// are compressed independently, so any block can be decompressed on its
+// own.
+//
+// This work is licensed under the MIT License. See included LICENSE.TXT.
+//
+
+#ifndef _XTLZ_
+#define _XTLZ_
+
+#include <stdint.h>
+
+#define LZ_MIN_MATCH                             4
+#define LZ_MAX_OFFSET                            0xFFFF
+
+// =============================================================================
+// Function: LZ_Compress
+//
+// Description:
+// Compress a block.
+//
+// Parameters:
+//
+//   Src      : The data to compress.
+//
+//   SrcLength: The length of the data, at most 64KB.
+//
+//   Dst      : Buffer for the compressed data.
+//
+//   DstLength: The size of the buffer.
+//
+// Returns:
+//
+//   int : The compressed length, or 0 if it would not fit in the buffer.
+//
+int LZ_Compress( const uint8_t * Src , int SrcLength , uint8_t * Dst , int DstLength ) ;
+
+// =============================================================================
+// Function: LZ_Decompress
+//
+// Description:
+// Decompress a block. Compressed data from a file may be damaged, so every
+// length and offset is checked and nothing is written outside the buffer.
+//
+// Parameters:
+//
+//   Src      : The compressed data.
+//
+//   SrcLength: The compressed length.
+//
+//   Dst      : Buffer for the data, or NULL to only check the compressed
+//              data.
+//
+//   DstLength: The length the data must decompress to.
+//
+// Returns:
+//
+//   bool : true if the compressed data is valid and decompresses to exactly
+//          DstLength bytes.
+//
+bool LZ_Decompress( const uint8_t * Src , int SrcLength , uint8_t * Dst , int DstLength ) ;
+
+#endif // _XTLZ_
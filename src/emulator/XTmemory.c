@@ -1,4 +1,647 @@
 #include "XTmemory.h"
 
-unsigned char mem[ RAM_SIZE ] ;
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined( _WIN32 )
+  #include <windows.h>
+#else
+  #include <fcntl.h>
+  #include <unistd.h>
+  #include <sys/mman.h>
+#endif
+
+ #define MEM_BACKING_SIZE                        ( MEM_LOW_SIZE + MEM_HIGH_SIZE )
+ #define MEM_REGION_SIZE                         ( MEM_GUARD_SIZE + MEM_LOW_SIZE + MEM_HIGH_SIZE + MEM_GUARD_SIZE )
+
+// A RAM image is mapped from this address up to 1MB. Below it the mirrored
+// first 64KB is copied.
+ #define MEM_IMAGE_START                         MEM_HIGH_SIZE
+ #define MEM_IMAGE_UNIT                          0x4000   // 16KB
+ #define MEM_IMAGE_UNITS                         ( MEM_LOW_SIZE / MEM_IMAGE_UNIT )
+
+unsigned char * mem ;
 unsigned char io_ports[ IO_PORT_COUNT ] ;
+
+// Used when the host cannot map the mirrored region.
+static unsigned char mem_array[ RAM_SIZE ] ;
+
+static unsigned char * mem_region = 0 ;
+static int             mem_a20    = 1 ;
+
+// Expanded memory store, see MEM_ExpandedAlloc.
+static unsigned char * mem_expanded        = 0 ;
+static int             mem_expanded_length = 0 ;
+
+// Read a RAM image into guest memory.
+static int MEM_ReadImage( const char * filename , long long offset )
+{
+  FILE * fp ;
+  int    ok ;
+
+  fp = fopen( filename , "rb" ) ;
+  if( fp == NULL )
+  {
+    return( 0 ) ;
+  }
+
+  ok = ( fseek( fp , ( long ) offset , SEEK_SET ) == 0 ) && ( fread( mem , 1 , RAM_SIZE , fp ) == RAM_SIZE ) ;
+  fclose( fp ) ;
+
+  return( ok ) ;
+}
+
+#if defined( _WIN32 )
+
+static HANDLE mem_backing = NULL ;
+
+// Set while guest memory above the first 64KB is a view of a RAM image, see
+// MEM_MapImage.
+static int mem_image_mapped = 0 ;
+
+static int MEM_MapHigh( int enable )
+{
+  DWORD offset = ( enable ) ? MEM_LOW_SIZE : 0 ;
+
+  return( MapViewOfFileEx( mem_backing , FILE_MAP_ALL_ACCESS , 0 , offset , MEM_HIGH_SIZE , mem + MEM_LOW_SIZE ) != NULL ) ;
+}
+
+static void MEM_Unmap( void )
+{
+  if( mem_image_mapped )
+  {
+    UnmapViewOfFile( mem_region + MEM_GUARD_SIZE + MEM_IMAGE_START ) ;
+    mem_image_mapped = 0 ;
+  }
+  UnmapViewOfFile( mem_region + MEM_GUARD_SIZE ) ;
+  UnmapViewOfFile( mem_region + MEM_GUARD_SIZE + MEM_LOW_SIZE ) ;
+  VirtualFree( mem_region , 0 , MEM_RELEASE ) ;
+  VirtualFree( mem_region + MEM_REGION_SIZE - MEM_GUARD_SIZE , 0 , MEM_RELEASE ) ;
+}
+
+int MEM_Initialise( void )
+{
+  int attempt ;
+
+  mem = mem_array ;
+
+  mem_backing = CreateFileMapping( INVALID_HANDLE_VALUE , NULL , PAGE_READWRITE , 0 , MEM_BACKING_SIZE , NULL ) ;
+  if( mem_backing == NULL )
+  {
+    return( 0 ) ;
+  }
+
+  // Views cannot be placed in reserved address space, so find a free range
+  // then map into it. Another thread may take the range in between, in
+  // which case try again.
+  for( attempt = 0 ; attempt < 8 ; attempt++ )
+  {
+    mem_region = ( unsigned char * ) VirtualAlloc( NULL , MEM_REGION_SIZE , MEM_RESERVE , PAGE_NOACCESS ) ;
+    if( mem_region == NULL )
+    {
+      break ;
+    }
+    VirtualFree( mem_region , 0 , MEM_RELEASE ) ;
+
+    mem = mem_region + MEM_GUARD_SIZE ;
+    if( ( VirtualAlloc( mem_region , MEM_GUARD_SIZE , MEM_RESERVE , PAGE_NOACCESS ) != NULL ) &&
+        ( VirtualAlloc( mem_region + MEM_REGION_SIZE - MEM_GUARD_SIZE , MEM_GUARD_SIZE , MEM_RESERVE , PAGE_NOACCESS ) != NULL ) &&
+        ( MapViewOfFileEx( mem_backing , FILE_MAP_ALL_ACCESS , 0 , 0 , MEM_LOW_SIZE , mem ) != NULL ) &&
+        MEM_MapHigh( 0 ) )
+    {
+      mem_a20 = 0 ;
+      return( 1 ) ;
+    }
+
+    MEM_Unmap() ;
+  }
+
+  CloseHandle( mem_backing ) ;
+  mem_backing = NULL ;
+  mem_region  = 0 ;
+  mem         = mem_array ;
+
+  return( 0 ) ;
+}
+
+void MEM_Cleanup( void )
+{
+  MEM_ExpandedFree() ;
+
+  if( mem_region )
+  {
+    MEM_Unmap() ;
+    CloseHandle( mem_backing ) ;
+    mem_backing = NULL ;
+    mem_region  = 0 ;
+  }
+
+  mem     = mem_array ;
+  mem_a20 = 1 ;
+}
+
+int MEM_SetA20( int enable )
+{
+  enable = ( enable != 0 ) ;
+
+  if( enable == mem_a20 )
+  {
+    return( 1 ) ;
+  }
+
+  if( mem_region == 0 )
+  {
+    return( 0 ) ;
+  }
+
+  UnmapViewOfFile( mem + MEM_LOW_SIZE ) ;
+  if( !MEM_MapHigh( enable ) )
+  {
+    // The range was taken while it was unmapped, put the old view back.
+    MEM_MapHigh( mem_a20 ) ;
+    return( 0 ) ;
+  }
+
+  mem_a20 = enable ;
+
+  return( 1 ) ;
+}
+
+// Read part of a file into guest memory.
+static int MEM_ReadAt( HANDLE file , unsigned char * data , DWORD length , long long offset )
+{
+  OVERLAPPED position ;
+  DWORD      done ;
+
+  memset( &position , 0 , sizeof( position ) ) ;
+  position.Offset     = ( DWORD ) offset ;
+  position.OffsetHigh = ( DWORD ) ( offset >> 32 ) ;
+
+  return( ReadFile( file , data , length , &done , &position ) && ( done == length ) ) ;
+}
+
+int MEM_MapImage( const char * filename , long long offset )
+{
+  HANDLE    file ;
+  HANDLE    image ;
+  HANDLE    backing ;
+  long long start ;
+  int       ok ;
+
+  if( mem_region == 0 )
+  {
+    return( MEM_ReadImage( filename , offset ) ) ;
+  }
+
+  file = CreateFile( filename , GENERIC_READ , FILE_SHARE_READ , NULL , OPEN_EXISTING , FILE_ATTRIBUTE_NORMAL , NULL ) ;
+  if( file == INVALID_HANDLE_VALUE )
+  {
+    return( 0 ) ;
+  }
+
+  image   = CreateFileMapping( file , NULL , PAGE_WRITECOPY , 0 , 0 , NULL ) ;
+  backing = CreateFileMapping( INVALID_HANDLE_VALUE , NULL , PAGE_READWRITE , 0 , MEM_BACKING_SIZE , NULL ) ;
+  if( ( image == NULL ) || ( backing == NULL ) )
+  {
+    if( image != NULL )
+    {
+      CloseHandle( image ) ;
+    }
+    if( backing != NULL )
+    {
+      CloseHandle( backing ) ;
+    }
+    CloseHandle( file ) ;
+    return( 0 ) ;
+  }
+
+  if( mem_image_mapped )
+  {
+    UnmapViewOfFile( mem + MEM_IMAGE_START ) ;
+    mem_image_mapped = 0 ;
+  }
+  UnmapViewOfFile( mem ) ;
+  UnmapViewOfFile( mem + MEM_LOW_SIZE ) ;
+  CloseHandle( mem_backing ) ;
+  mem_backing = backing ;
+
+  // The first 64KB and the 64KB above 1MB stay in the backing for the A20
+  // mirror, everything else is a copy-on-write view of the image. Views are
+  // shared with the other processes mapping the image until written.
+  start = offset + MEM_IMAGE_START ;
+  ok = ( MapViewOfFileEx( mem_backing , FILE_MAP_ALL_ACCESS , 0 , 0 , MEM_IMAGE_START , mem ) != NULL ) &&
+       ( MapViewOfFileEx( image , FILE_MAP_COPY , ( DWORD ) ( start >> 32 ) , ( DWORD ) start , MEM_LOW_SIZE - MEM_IMAGE_START , mem + MEM_IMAGE_START ) != NULL ) ;
+  mem_image_mapped = ok ;
+
+  if( !ok )
+  {
+    // Put the whole of the backing back and copy the image instead.
+    UnmapViewOfFile( mem ) ;
+    ok = ( MapViewOfFileEx( mem_backing , FILE_MAP_ALL_ACCESS , 0 , 0 , MEM_LOW_SIZE , mem ) != NULL ) &&
+         MEM_MapHigh( mem_a20 ) ;
+    ok = ok && MEM_ReadImage( filename , offset ) ;
+  }
+  else
+  {
+    ok = MEM_MapHigh( mem_a20 ) &&
+         MEM_ReadAt( file , mem , MEM_IMAGE_START , offset ) &&
+         ( !mem_a20 || MEM_ReadAt( file , mem + MEM_LOW_SIZE , RAM_SIZE - MEM_LOW_SIZE , offset + MEM_LOW_SIZE ) ) ;
+  }
+
+  // The view keeps the image mapped.
+  CloseHandle( image ) ;
+  CloseHandle( file ) ;
+
+  return( ok ) ;
+}
+
+unsigned char * MEM_ExpandedAlloc( int length )
+{
+  MEM_ExpandedFree() ;
+
+  mem_expanded = ( unsigned char * ) calloc( length , 1 ) ;
+  mem_expanded_length = ( mem_expanded ) ? length : 0 ;
+
+  return( mem_expanded ) ;
+}
+
+void MEM_ExpandedFree( void )
+{
+  free( mem_expanded ) ;
+  mem_expanded        = 0 ;
+  mem_expanded_length = 0 ;
+}
+
+int MEM_MapExpanded( int addr , int offset , int length )
+{
+  // Views must start on 64KB boundaries, which is coarser than an
+  // expanded memory page, so the caller has to copy.
+  ( void ) addr ;
+  ( void ) offset ;
+  ( void ) length ;
+
+  return( 0 ) ;
+}
+
+void MEM_UnmapExpanded( int addr , int length )
+{
+  ( void ) addr ;
+  ( void ) length ;
+}
+
+#else
+
+static int mem_backing          = -1 ;
+static int mem_expanded_backing = -1 ;
+
+// Set for each unit of guest memory still mapped copy-on-write from a RAM
+// image, see MEM_MapImage.
+static unsigned char mem_image[ MEM_IMAGE_UNITS ] ;
+
+// Create an anonymous shared memory object of the given length.
+static int MEM_CreateBacking( const char * suffix , int length )
+{
+  char name[ 48 ] ;
+  int  fd ;
+
+  // The name is only needed until the object is open.
+  snprintf( name , sizeof( name ) , "/tinyxt.%ld%s" , ( long ) getpid() , suffix ) ;
+  fd = shm_open( name , O_RDWR | O_CREAT | O_EXCL , 0600 ) ;
+  if( fd < 0 )
+  {
+    return( -1 ) ;
+  }
+  shm_unlink( name ) ;
+
+  if( ftruncate( fd , length ) != 0 )
+  {
+    close( fd ) ;
+    return( -1 ) ;
+  }
+
+  return( fd ) ;
+}
+
+static int MEM_MapHigh( int enable )
+{
+  off_t offset = ( enable ) ? MEM_LOW_SIZE : 0 ;
+
+  return( mmap( mem + MEM_LOW_SIZE , MEM_HIGH_SIZE , PROT_READ | PROT_WRITE , MAP_SHARED | MAP_FIXED , mem_backing , offset ) != MAP_FAILED ) ;
+}
+
+// Move units of a range still mapped from a RAM image into the backing, so
+// the range can be mapped over and put back without losing guest writes.
+static void MEM_TakeImage( int addr , int length )
+{
+  int unit ;
+  int last ;
+
+  last = ( addr + length - 1 ) / MEM_IMAGE_UNIT ;
+  for( unit = addr / MEM_IMAGE_UNIT ; ( unit <= last ) && ( unit < MEM_IMAGE_UNITS ) ; unit++ )
+  {
+    if( mem_image[ unit ] && ( pwrite( mem_backing , mem + unit * MEM_IMAGE_UNIT , MEM_IMAGE_UNIT , unit * MEM_IMAGE_UNIT ) == MEM_IMAGE_UNIT ) )
+    {
+      mem_image[ unit ] = 0 ;
+    }
+  }
+}
+
+int MEM_Initialise( void )
+{
+  mem = mem_array ;
+
+  mem_backing = MEM_CreateBacking( "" , MEM_BACKING_SIZE ) ;
+  if( mem_backing < 0 )
+  {
+    return( 0 ) ;
+  }
+
+  // Reserve the whole region inaccessible, then map RAM over the middle.
+  mem_region = ( unsigned char * ) mmap( 0 , MEM_REGION_SIZE , PROT_NONE , MAP_PRIVATE | MAP_ANONYMOUS , -1 , 0 ) ;
+  if( mem_region != ( unsigned char * ) MAP_FAILED )
+  {
+    mem = mem_region + MEM_GUARD_SIZE ;
+    if( ( mmap( mem , MEM_LOW_SIZE , PROT_READ | PROT_WRITE , MAP_SHARED | MAP_FIXED , mem_backing , 0 ) != MAP_FAILED ) &&
+        MEM_MapHigh( 0 ) )
+    {
+      mem_a20 = 0 ;
+      return( 1 ) ;
+    }
+
+    munmap( mem_region , MEM_REGION_SIZE ) ;
+  }
+
+  close( mem_backing ) ;
+  mem_backing = -1 ;
+  mem_region  = 0 ;
+  mem         = mem_array ;
+
+  return( 0 ) ;
+}
+
+void MEM_Cleanup( void )
+{
+  MEM_ExpandedFree() ;
+
+  if( mem_region )
+  {
+    munmap( mem_region , MEM_REGION_SIZE ) ;
+    close( mem_backing ) ;
+    mem_backing = -1 ;
+    mem_region  = 0 ;
+    memset( mem_image , 0 , sizeof( mem_image ) ) ;
+  }
+
+  mem     = mem_array ;
+  mem_a20 = 1 ;
+}
+
+int MEM_SetA20( int enable )
+{
+  enable = ( enable != 0 ) ;
+
+  if( enable == mem_a20 )
+  {
+    return( 1 ) ;
+  }
+
+  // MAP_FIXED replaces the old view in place.
+  if( ( mem_region == 0 ) || !MEM_MapHigh( enable ) )
+  {
+    return( 0 ) ;
+  }
+
+  mem_a20 = enable ;
+
+  return( 1 ) ;
+}
+
+int MEM_MapImage( const char * filename , long long offset )
+{
+  int fd ;
+  int backing ;
+  int ok ;
+  int unit ;
+
+  if( mem_region == 0 )
+  {
+    return( MEM_ReadImage( filename , offset ) ) ;
+  }
+
+  fd = open( filename , O_RDONLY ) ;
+  if( fd < 0 )
+  {
+    return( 0 ) ;
+  }
+
+  backing = MEM_CreateBacking( "" , MEM_BACKING_SIZE ) ;
+  if( backing < 0 )
+  {
+    close( fd ) ;
+    return( 0 ) ;
+  }
+
+  close( mem_backing ) ;
+  mem_backing = backing ;
+
+  // The first 64KB and the 64KB above 1MB stay in the backing for the A20
+  // mirror, everything else is a private view of the image.
+  ok = ( mmap( mem , MEM_IMAGE_START , PROT_READ | PROT_WRITE , MAP_SHARED | MAP_FIXED , mem_backing , 0 ) != MAP_FAILED ) &&
+       ( mmap( mem + MEM_IMAGE_START , MEM_LOW_SIZE - MEM_IMAGE_START , PROT_READ | PROT_WRITE , MAP_PRIVATE | MAP_FIXED , fd , ( off_t ) ( offset + MEM_IMAGE_START ) ) != MAP_FAILED ) &&
+       MEM_MapHigh( mem_a20 ) &&
+       ( pread( fd , mem , MEM_IMAGE_START , ( off_t ) offset ) == MEM_IMAGE_START ) &&
+       ( !mem_a20 || ( pread( fd , mem + MEM_LOW_SIZE , RAM_SIZE - MEM_LOW_SIZE , ( off_t ) ( offset + MEM_LOW_SIZE ) ) == RAM_SIZE - MEM_LOW_SIZE ) ) ;
+
+  close( fd ) ;
+
+  for( unit = 0 ; unit < MEM_IMAGE_UNITS ; unit++ )
+  {
+    mem_image[ unit ] = ( ok && ( unit * MEM_IMAGE_UNIT >= MEM_IMAGE_START ) ) ;
+  }
+
+  return( ok ) ;
+}
+
+unsigned char * MEM_ExpandedAlloc( int length )
+{
+  void * view ;
+
+  MEM_ExpandedFree() ;
+
+  // Expanded memory is a shared object so its pages can also be mapped
+  // into the guest address space. Without the guest mapping there is no
+  // point, so use plain memory.
+  if( mem_region )
+  {
+    mem_expanded_backing = MEM_CreateBacking( ".ems" , length ) ;
+    if( mem_expanded_backing >= 0 )
+    {
+      view = mmap( 0 , length , PROT_READ | PROT_WRITE , MAP_SHARED , mem_expanded_backing , 0 ) ;
+      if( view != MAP_FAILED )
+      {
+        mem_expanded        = ( unsigned char * ) view ;
+        mem_expanded_length = length ;
+        return( mem_expanded ) ;
+      }
+
+      close( mem_expanded_backing ) ;
+      mem_expanded_backing = -1 ;
+    }
+  }
+
+  mem_expanded = ( unsigned char * ) calloc( length , 1 ) ;
+  mem_expanded_length = ( mem_expanded ) ? length : 0 ;
+
+  return( mem_expanded ) ;
+}
+
+void MEM_ExpandedFree( void )
+{
+  if( mem_expanded_backing >= 0 )
+  {
+    munmap( mem_expanded , mem_expanded_length ) ;
+    close( mem_expanded_backing ) ;
+    mem_expanded_backing = -1 ;
+  }
+  else
+  {
+    free( mem_expanded ) ;
+  }
+
+  mem_expanded        = 0 ;
+  mem_expanded_length = 0 ;
+}
+
+int MEM_MapExpanded( int addr , int offset , int length )
+{
+  if( mem_expanded_backing < 0 )
+  {
+    return( 0 ) ;
+  }
+
+  MEM_TakeImage( addr , length ) ;
+
+  return( mmap( mem + addr , length , PROT_READ | PROT_WRITE , MAP_SHARED | MAP_FIXED , mem_expanded_backing , offset ) != MAP_FAILED ) ;
+}
+
+void MEM_UnmapExpanded( int addr , int length )
+{
+  if( mem_expanded_backing >= 0 )
+  {
+    MEM_TakeImage( addr , length ) ;
+    mmap( mem + addr , length , PROT_READ | PROT_WRITE , MAP_SHARED | MAP_FIXED , mem_backing , addr ) ;
+  }
+}
+
+#endif
+
+unsigned char mem_page_map[ MEM_PAGE_COUNT ] ;
+
+typedef struct STMEMDEVICE_T
+{
+  MemRead_t       read       ;
+  MemWrite_t      write      ;
+  MemInvalidate_t invalidate ;
+} stMemDevice_t ;
+
+static stMemDevice_t mem_devices[ MEM_MAX_DEVICES ] ;
+static int           mem_device_count = 0 ;
+
+static void MEM_SetPages( int start , int length , unsigned char value )
+{
+  int page ;
+  int last ;
+
+  page = start >> MEM_PAGE_SHIFT ;
+  last = ( start + length - 1 ) >> MEM_PAGE_SHIFT ;
+  for( ; ( page <= last ) && ( page < MEM_PAGE_COUNT ) ; page++ )
+  {
+    mem_page_map[ page ] = value ;
+  }
+}
+
+int MEM_MapDevice( int start , int length , MemRead_t read , MemWrite_t write , MemInvalidate_t invalidate )
+{
+  int i ;
+
+  // Reuse the entry if the handlers are already registered.
+  for( i = 0 ; i < mem_device_count ; i++ )
+  {
+    if( ( mem_devices[ i ].read == read ) && ( mem_devices[ i ].write == write ) )
+    {
+      break ;
+    }
+  }
+
+  if( i == mem_device_count )
+  {
+    if( mem_device_count == MEM_MAX_DEVICES )
+    {
+      return( 0 ) ;
+    }
+
+    mem_devices[ i ].read       = read       ;
+    mem_devices[ i ].write      = write      ;
+    mem_devices[ i ].invalidate = invalidate ;
+    mem_device_count++ ;
+  }
+
+  MEM_SetPages( start , length , ( unsigned char ) ( i + 1 ) ) ;
+
+  return( 1 ) ;
+}
+
+void MEM_MapRAM( int start , int length )
+{
+  MEM_SetPages( start , length , 0 ) ;
+}
+
+unsigned int MEM_DeviceRead( int Width , int addr )
+{
+  return( mem_devices[ mem_page_map[ addr >> MEM_PAGE_SHIFT ] - 1 ].read( Width , addr ) ) ;
+}
+
+void MEM_DeviceWrite( int Width , int addr , unsigned int val )
+{
+  mem_devices[ mem_page_map[ addr >> MEM_PAGE_SHIFT ] - 1 ].write( Width , addr , val ) ;
+}
+
+void MEM_HostWrite( int start , int length )
+{
+  int page ;
+  int last ;
+  int end  ;
+
+  if( length <= 0 )
+  {
+    return ;
+  }
+
+  end  = start + length ;
+  page = start >> MEM_PAGE_SHIFT ;
+  last = ( end - 1 ) >> MEM_PAGE_SHIFT ;
+  for( ; ( page <= last ) && ( page < MEM_PAGE_COUNT ) ; page++ )
+  {
+    int first ;
+    int limit ;
+
+    if( mem_page_map[ page ] == 0 )
+    {
+      continue ;
+    }
+
+    first = page << MEM_PAGE_SHIFT ;
+    limit = first + ( 1 << MEM_PAGE_SHIFT ) ;
+    if( first < start )
+    {
+      first = start ;
+    }
+    if( limit > end )
+    {
+      limit = end ;
+    }
+
+    mem_devices[ mem_page_map[ page ] - 1 ].invalidate( first , limit - first ) ;
+  }
+}
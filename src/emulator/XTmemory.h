@@ -25,7 +25,198 @@
  #define RAM_SIZE                                0x10FFF0 // 1M + 65,520 B
  #define IO_PORT_COUNT                           0x10000  // 64KB
 
-extern unsigned char mem[] ;
+// Guest memory layout. The 64KB above 1MB either mirrors the first 64KB, as
+// the 20 address lines of the 8086 wrap, or is separate memory as with the
+// A20 line enabled. Unmapped guard areas surround the whole region.
+ #define MEM_LOW_SIZE                            0x100000 // 1MB
+ #define MEM_HIGH_SIZE                           0x10000  // 64KB
+ #define MEM_GUARD_SIZE                          0x10000  // 64KB
+
+// Memory map page size. Each page is either plain RAM, accessed directly in
+// mem[], or belongs to a device and is accessed through its handlers.
+ #define MEM_PAGE_SHIFT                          11       // 2KB pages
+ #define MEM_PAGE_COUNT                          ( ( RAM_SIZE >> MEM_PAGE_SHIFT ) + 1 )
+ #define MEM_MAX_DEVICES                         8
+
+/**
+ * @brief Check if an address is in a device page.
+ *
+ * This is the fast path test made before every memory operand access that
+ * may need to be routed to a device.
+ */
+ #define MEM_IS_DEVICE( addr )                   ( mem_page_map[ ( addr ) >> MEM_PAGE_SHIFT ] != 0 )
+
+/**
+ * @brief Device memory read handler.
+ *
+ * @param Width Non-zero for a word access.
+ * @param addr  Linear address.
+ * @return The value read.
+ */
+typedef unsigned int ( * MemRead_t )( int Width , int addr ) ;
+
+/**
+ * @brief Device memory write handler.
+ *
+ * @param Width Non-zero for a word access.
+ * @param addr  Linear address.
+ * @param val   The value written by the CPU.
+ * @return Nothing useful.
+ */
+typedef unsigned int ( * MemWrite_t )( int Width , int addr , unsigned int val ) ;
+
+/**
+ * @brief Device memory invalidate handler.
+ *
+ * @param start  First linear address the host wrote directly.
+ * @param length Length in bytes.
+ */
+typedef void ( * MemInvalidate_t )( int start , int length ) ;
+
+extern unsigned char * mem ;
 extern unsigned char io_ports[] ;
 
+// Device number + 1 for each page, 0 for plain RAM.
+extern unsigned char mem_page_map[] ;
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * @brief Allocate guest memory.
+ *
+ * Sets mem to a region whose first 64KB is mapped again above 1MB and which
+ * is surrounded by guard pages, so accesses past the end of a segment need
+ * no masking and stray accesses fault. If the host refuses the mapping a
+ * plain array is used instead, without the mirror or guard pages.
+ *
+ * @return 1 if the mirrored, guarded region was mapped, 0 otherwise.
+ */
+int MEM_Initialise( void ) ;
+
+/**
+ * @brief Release guest memory allocated by MEM_Initialise.
+ */
+void MEM_Cleanup( void ) ;
+
+/**
+ * @brief Select what the 64KB above 1MB maps to.
+ *
+ * @param enable 0 to mirror the first 64KB (8086 wraparound), non-zero for
+ *               separate memory (A20 enabled).
+ * @return 1 on success, 0 if the mapping could not be changed.
+ */
+int MEM_SetA20( int enable ) ;
+
+/**
+ * @brief Load guest memory from a RAM image in a file.
+ *
+ * Where the host allows it, the image is mapped copy-on-write, so processes
+ * loading the same image share every page they have not written. Only the
+ * first 64KB, which is mirrored above 1MB, is copied. Guest memory also
+ * gets a backing of its own, no longer shared with a process it was forked
+ * from. mem does not move.
+ *
+ * @param filename The file holding the image.
+ * @param offset   Offset of the RAM_SIZE byte image in the file, a multiple
+ *                 of 64KB.
+ * @return 1 on success, 0 on failure, in which case the contents of guest
+ *         memory are undefined.
+ */
+int MEM_MapImage( const char * filename , long long offset ) ;
+
+/**
+ * @brief Allocate the expanded memory store.
+ *
+ * Replaces any previous store. Where the host allows it, the store can
+ * have its pages mapped into the guest address space with MEM_MapExpanded.
+ *
+ * @param length Size in bytes, a multiple of the host page size.
+ * @return Host pointer to the store, or 0 if it could not be allocated.
+ */
+unsigned char * MEM_ExpandedAlloc( int length ) ;
+
+/**
+ * @brief Release the expanded memory store.
+ */
+void MEM_ExpandedFree( void ) ;
+
+/**
+ * @brief Map part of the expanded memory store into the guest.
+ *
+ * No data is copied: after the call mem[ addr ] and the store at offset
+ * are the same host memory.
+ *
+ * @param addr   Linear guest address, below 1MB, page aligned.
+ * @param offset Offset in the expanded memory store, page aligned.
+ * @param length Length in bytes.
+ * @return 1 if mapped, 0 if the host cannot remap pages this finely, in
+ *         which case the caller has to copy the data.
+ */
+int MEM_MapExpanded( int addr , int offset , int length ) ;
+
+/**
+ * @brief Put guest RAM back where MEM_MapExpanded mapped expanded memory.
+ *
+ * @param addr   Linear guest address passed to MEM_MapExpanded.
+ * @param length Length in bytes.
+ */
+void MEM_UnmapExpanded( int addr , int length ) ;
+
+/**
+ * @brief Route a range of pages to a device.
+ *
+ * @param start  First linear address, rounded down to a page boundary.
+ * @param length Length in bytes, rounded up to whole pages.
+ * @param read       Read handler.
+ * @param write      Write handler.
+ * @param invalidate Invalidate handler, told when the host wrote the
+ *                   device's pages directly.
+ * @return 1 if the device was mapped, 0 if the device table is full.
+ */
+int MEM_MapDevice( int start , int length , MemRead_t read , MemWrite_t write , MemInvalidate_t invalidate ) ;
+
+/**
+ * @brief Return a range of pages to plain RAM.
+ *
+ * @param start  First linear address, rounded down to a page boundary.
+ * @param length Length in bytes, rounded up to whole pages.
+ */
+void MEM_MapRAM( int start , int length ) ;
+
+/**
+ * @brief Read from a device page through its handler.
+ *
+ * @param Width Non-zero for a word access.
+ * @param addr  Linear address. Must satisfy MEM_IS_DEVICE().
+ * @return The value read.
+ */
+unsigned int MEM_DeviceRead( int Width , int addr ) ;
+
+/**
+ * @brief Write to a device page through its handler.
+ *
+ * @param Width Non-zero for a word access.
+ * @param addr  Linear address. Must satisfy MEM_IS_DEVICE().
+ * @param val   The value to write.
+ */
+void MEM_DeviceWrite( int Width , int addr , unsigned int val ) ;
+
+/**
+ * @brief Tell devices the host wrote guest memory directly.
+ *
+ * Disk transfers, the coprocessor and other host code write mem[] without
+ * going through the device handlers. Devices whose pages are in the range
+ * get their invalidate handler called for the part of it in their pages.
+ *
+ * @param start  First linear address written.
+ * @param length Length in bytes.
+ */
+void MEM_HostWrite( int start , int length ) ;
+
+#ifdef __cplusplus
+}
+#endif
+
 #endif // _XTMEMORY_
@@ -0,0 +1,408 @@
+// =============================================================================
+// File: XTprefetch.cpp
+//
+// Description:
+// Disk image prefetch from boot traces.
+// See XTprefetch.h for details.
+//
+// This work is licensed under the MIT License. See included LICENSE.TXT.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+#if defined( _WIN32 )
+  #include <windows.h>
+  #include <io.h>
+#else
+  #include <pthread.h>
+#endif
+
+#include "XTprefetch.h"
+
+#ifndef O_BINARY
+  #define O_BINARY                               0
+#endif
+
+#ifndef O_NOINHERIT
+  #define O_NOINHERIT                            0
+#endif
+
+#define PREFETCH_MAX_PATH                        1024
+
+#define PREFETCH_MAGIC                           "XTBT"
+#define PREFETCH_VERSION                         1
+
+#define PREFETCH_SECTOR_SIZE                     512
+#define PREFETCH_KEY_BYTES                       0x10000 // Image bytes hashed to name the trace
+#define PREFETCH_MAX_SECTORS                     0x10000 // Most sectors traced, 32MB
+#define PREFETCH_CHUNK                           0x10000 // Longest read made when prefetching
+
+typedef struct STPREFETCHHEADER_T
+{
+  char     magic[ 4 ]   ;
+  uint32_t version      ;
+  uint32_t extent_count ;
+  uint32_t reserved     ;
+} stPrefetchHeader_t ;
+
+typedef struct STPREFETCHEXTENT_T
+{
+  uint64_t sector   ;
+  uint32_t count    ;
+  uint32_t reserved ;
+} stPrefetchExtent_t ;
+
+struct STPREFETCH_T
+{
+  int                  File        ;
+  int64_t              Sectors     ; // Sectors in the image
+  char                 TraceName[ PREFETCH_MAX_PATH ] ;
+  stPrefetchExtent_t * Extents     ;
+  int                  ExtentCount ;
+  int                  ExtentSpace ;
+  bool                 Recording   ; // false when prefetching
+  uint8_t            * Seen        ; // Sectors in the trace, NULL when prefetching
+  int                  Traced      ; // Number of sectors in the trace
+  volatile bool        Stop        ; // Tells the prefetch thread to stop
+  bool                 Running     ;
+#if defined( _WIN32 )
+  HANDLE               Thread      ;
+#else
+  pthread_t            Thread      ;
+#endif
+} ;
+
+// =============================================================================
+// Local variables
+//
+
+static char Directory[ PREFETCH_MAX_PATH ] = "" ;
+
+// =============================================================================
+// Local functions
+//
+
+static int ReadAt( int File , int64_t Offset , void * Buffer , int Length )
+{
+  if( lseek( File , ( off_t ) Offset , SEEK_SET ) == ( off_t ) -1 )
+  {
+    return( 0 ) ;
+  }
+
+  return( read( File , Buffer , Length ) ) ;
+}
+
+// The trace is named by an FNV-1a hash of the image size and its first
+// bytes.
+static uint64_t ImageKey( int File , int64_t Size )
+{
+  uint64_t  Hash   = 14695981039346656037ull ;
+  uint8_t * Buffer = ( uint8_t * ) malloc( PREFETCH_KEY_BYTES ) ;
+  int       Length ;
+
+  for( int i = 0 ; i < 8 ; i++ )
+  {
+    Hash = ( Hash ^ ( uint8_t ) ( Size >> ( i * 8 ) ) ) * 1099511628211ull ;
+  }
+
+  if( Buffer != NULL )
+  {
+    Length = ReadAt( File , 0 , Buffer , PREFETCH_KEY_BYTES ) ;
+    for( int i = 0 ; i < Length ; i++ )
+    {
+      Hash = ( Hash ^ Buffer[ i ] ) * 1099511628211ull ;
+    }
+    free( Buffer ) ;
+  }
+
+  return( Hash ) ;
+}
+
+static bool LoadTrace( stPrefetch_t * Prefetch )
+{
+  stPrefetchHeader_t Header ;
+  FILE             * fp = fopen( Prefetch->TraceName , "rb" ) ;
+  bool               Ok = false ;
+
+  if( fp == NULL )
+  {
+    return( false ) ;
+  }
+
+  if( ( fread( &Header , sizeof( Header ) , 1 , fp ) == 1 ) &&
+      ( memcmp( Header.magic , PREFETCH_MAGIC , 4 ) == 0 ) && ( Header.version == PREFETCH_VERSION ) &&
+      ( Header.extent_count > 0 ) && ( Header.extent_count <= PREFETCH_MAX_SECTORS ) )
+  {
+    Prefetch->Extents = ( stPrefetchExtent_t * ) malloc( Header.extent_count * sizeof( stPrefetchExtent_t ) ) ;
+    if( ( Prefetch->Extents != NULL ) &&
+        ( fread( Prefetch->Extents , sizeof( stPrefetchExtent_t ) , Header.extent_count , fp ) == Header.extent_count ) )
+    {
+      Prefetch->ExtentCount = ( int ) Header.extent_count ;
+      Ok                    = true ;
+    }
+  }
+
+  fclose( fp ) ;
+
+  return( Ok ) ;
+}
+
+static void SaveTrace( const stPrefetch_t * Prefetch )
+{
+  stPrefetchHeader_t Header ;
+  FILE             * fp = fopen( Prefetch->TraceName , "wb" ) ;
+
+  if( fp == NULL )
+  {
+    return ;
+  }
+
+  memcpy( Header.magic , PREFETCH_MAGIC , 4 ) ;
+  Header.version      = PREFETCH_VERSION ;
+  Header.extent_count = ( uint32_t ) Prefetch->ExtentCount ;
+  Header.reserved     = 0 ;
+
+  // A trace that cannot be written whole is removed, so it is recorded
+  // again next time.
+  if( ( fwrite( &Header , sizeof( Header ) , 1 , fp ) != 1 ) ||
+      ( fwrite( Prefetch->Extents , sizeof( stPrefetchExtent_t ) , Prefetch->ExtentCount , fp ) != ( size_t ) Prefetch->ExtentCount ) ||
+      ( fclose( fp ) != 0 ) )
+  {
+    remove( Prefetch->TraceName ) ;
+  }
+}
+
+// Reading the traced sectors brings them into the host's file cache, which
+// is all the guest's reads need.
+static void ReadTrace( stPrefetch_t * Prefetch )
+{
+  uint8_t * Buffer = ( uint8_t * ) malloc( PREFETCH_CHUNK ) ;
+  int64_t   Offset ;
+  int64_t   End ;
+  int       Length ;
+
+  if( Buffer == NULL )
+  {
+    return ;
+  }
+
+  for( int i = 0 ; ( i < Prefetch->ExtentCount ) && !Prefetch->Stop ; i++ )
+  {
+    Offset = ( int64_t ) Prefetch->Extents[ i ].sector * PREFETCH_SECTOR_SIZE ;
+    End    = Offset + ( int64_t ) Prefetch->Extents[ i ].count * PREFETCH_SECTOR_SIZE ;
+    End    = ( End < Prefetch->Sectors * PREFETCH_SECTOR_SIZE ) ? End : Prefetch->Sectors * PREFETCH_SECTOR_SIZE ;
+
+    while( ( Offset < End ) && !Prefetch->Stop )
+    {
+      Length = ( End - Offset < PREFETCH_CHUNK ) ? ( int ) ( End - Offset ) : PREFETCH_CHUNK ;
+      if( ReadAt( Prefetch->File , Offset , Buffer , Length ) != Length )
+      {
+        break ;
+      }
+      Offset += Length ;
+    }
+  }
+
+  free( Buffer ) ;
+}
+
+#if defined( _WIN32 )
+static DWORD WINAPI PrefetchThread( LPVOID Parameter )
+#else
+static void * PrefetchThread( void * Parameter )
+#endif
+{
+  ReadTrace( ( stPrefetch_t * ) Parameter ) ;
+
+  return( 0 ) ;
+}
+
+static bool StartPrefetch( stPrefetch_t * Prefetch )
+{
+  Prefetch->Stop = false ;
+
+#if defined( _WIN32 )
+  Prefetch->Thread  = CreateThread( NULL , 0 , PrefetchThread , Prefetch , 0 , NULL ) ;
+  Prefetch->Running = ( Prefetch->Thread != NULL ) ;
+#else
+  Prefetch->Running = ( pthread_create( &Prefetch->Thread , NULL , PrefetchThread , Prefetch ) == 0 ) ;
+#endif
+
+  return( Prefetch->Running ) ;
+}
+
+static void StopPrefetch( stPrefetch_t * Prefetch )
+{
+  if( !Prefetch->Running )
+  {
+    return ;
+  }
+
+  Prefetch->Stop = true ;
+
+#if defined( _WIN32 )
+  WaitForSingleObject( Prefetch->Thread , INFINITE ) ;
+  CloseHandle( Prefetch->Thread ) ;
+#else
+  pthread_join( Prefetch->Thread , NULL ) ;
+#endif
+
+  Prefetch->Running = false ;
+}
+
+static bool AddSector( stPrefetch_t * Prefetch , int64_t Sector )
+{
+  stPrefetchExtent_t * Last = ( Prefetch->ExtentCount > 0 ) ? &Prefetch->Extents[ Prefetch->ExtentCount - 1 ] : NULL ;
+  stPrefetchExtent_t * Extents ;
+
+  if( ( Last != NULL ) && ( Last->sector + Last->count == ( uint64_t ) Sector ) )
+  {
+    Last->count++ ;
+    return( true ) ;
+  }
+
+  if( Prefetch->ExtentCount == Prefetch->ExtentSpace )
+  {
+    Extents = ( stPrefetchExtent_t * ) realloc( Prefetch->Extents , ( Prefetch->ExtentSpace + 256 ) * sizeof( stPrefetchExtent_t ) ) ;
+    if( Extents == NULL )
+    {
+      return( false ) ;
+    }
+    Prefetch->Extents      = Extents ;
+    Prefetch->ExtentSpace += 256 ;
+  }
+
+  Prefetch->Extents[ Prefetch->ExtentCount ].sector   = ( uint64_t ) Sector ;
+  Prefetch->Extents[ Prefetch->ExtentCount ].count    = 1 ;
+  Prefetch->Extents[ Prefetch->ExtentCount ].reserved = 0 ;
+  Prefetch->ExtentCount++ ;
+
+  return( true ) ;
+}
+
+// =============================================================================
+// Exported functions
+//
+
+void PREFETCH_SetDirectory( const char * Path )
+{
+  Directory[ 0 ] = 0 ;
+
+  if( Path != NULL )
+  {
+    strncpy( Directory , Path , PREFETCH_MAX_PATH - 1 ) ;
+    Directory[ PREFETCH_MAX_PATH - 1 ] = 0 ;
+  }
+}
+
+stPrefetch_t * PREFETCH_Open( const char * Filename )
+{
+  stPrefetch_t * Prefetch ;
+  int64_t        Size ;
+  size_t         Length = strlen( Directory ) ;
+
+  if( Length == 0 )
+  {
+    return( NULL ) ;
+  }
+
+  Prefetch = ( stPrefetch_t * ) calloc( 1 , sizeof( stPrefetch_t ) ) ;
+  if( Prefetch == NULL )
+  {
+    return( NULL ) ;
+  }
+
+  // The prefetch thread reads through its own file, so it does not move
+  // the file position of the disk module's reads.
+  Prefetch->File = open( Filename , O_BINARY | O_NOINHERIT | O_RDONLY ) ;
+  Size           = ( Prefetch->File >= 0 ) ? lseek( Prefetch->File , 0 , SEEK_END ) : 0 ;
+
+  if( Size < PREFETCH_SECTOR_SIZE )
+  {
+    PREFETCH_Close( Prefetch ) ;
+    return( NULL ) ;
+  }
+
+  Prefetch->Sectors = Size / PREFETCH_SECTOR_SIZE ;
+
+  snprintf( Prefetch->TraceName , PREFETCH_MAX_PATH , "%s%s%016llx.xtt" , Directory ,
+            ( ( Directory[ Length - 1 ] == '/' ) || ( Directory[ Length - 1 ] == '\\' ) ) ? "" : "/" ,
+            ( unsigned long long ) ImageKey( Prefetch->File , Size ) ) ;
+
+  if( LoadTrace( Prefetch ) )
+  {
+    StartPrefetch( Prefetch ) ;
+    return( Prefetch ) ;
+  }
+
+  // An image without a trace is traced.
+  free( Prefetch->Extents ) ;
+  Prefetch->Extents     = NULL ;
+  Prefetch->ExtentCount = 0 ;
+
+  Prefetch->Seen      = ( uint8_t * ) calloc( ( size_t ) ( ( Prefetch->Sectors + 7 ) / 8 ) , 1 ) ;
+  Prefetch->Recording = ( Prefetch->Seen != NULL ) ;
+
+  return( Prefetch ) ;
+}
+
+void PREFETCH_Read( stPrefetch_t * Prefetch , int64_t Offset , int Length )
+{
+  int64_t Sector ;
+  int64_t Last ;
+
+  if( ( Prefetch == NULL ) || !Prefetch->Recording || ( Offset < 0 ) || ( Length <= 0 ) )
+  {
+    return ;
+  }
+
+  Last = ( Offset + Length - 1 ) / PREFETCH_SECTOR_SIZE ;
+  Last = ( Last < Prefetch->Sectors ) ? Last : Prefetch->Sectors - 1 ;
+
+  for( Sector = Offset / PREFETCH_SECTOR_SIZE ; Sector <= Last ; Sector++ )
+  {
+    if( ( Prefetch->Seen[ Sector >> 3 ] & ( 1 << ( Sector & 7 ) ) ) != 0 )
+    {
+      continue ;
+    }
+
+    // The trace ends when it is full.
+    if( ( Prefetch->Traced == PREFETCH_MAX_SECTORS ) || !AddSector( Prefetch , Sector ) )
+    {
+      Prefetch->Recording = false ;
+      return ;
+    }
+
+    Prefetch->Seen[ Sector >> 3 ] |= ( uint8_t ) ( 1 << ( Sector & 7 ) ) ;
+    Prefetch->Traced++ ;
+  }
+}
+
+void PREFETCH_Close( stPrefetch_t * Prefetch )
+{
+  if( Prefetch == NULL )
+  {
+    return ;
+  }
+
+  StopPrefetch( Prefetch ) ;
+
+  // A trace is saved whether or not it filled, as long as it is not empty.
+  if( ( Prefetch->Seen != NULL ) && ( Prefetch->ExtentCount > 0 ) )
+  {
+    SaveTrace( Prefetch ) ;
+  }
+
+  if( Prefetch->File >= 0 )
+  {
+    close( Prefetch->File ) ;
+  }
+
+  free( Prefetch->Extents ) ;
+  free( Prefetch->Seen ) ;
+  free( Prefetch ) ;
+}
@@ -0,0 +1,110 @@
+// =============================================================================
+// File: XTprefetch.h
+//
+// Description:
+// Disk image prefetch from boot traces.
+//
+// Booting from an image that is not in the host's file cache, such as one
+// on shared network storage, is slowed by the guest waiting for each read
+// in turn. The first time an image is booted, the sectors the guest reads
+// are recorded in the order first read, and saved as a boot trace when the
+// image is closed. The next time the image is opened, a prefetch thread
+// reads the sectors in the trace ahead of the guest, so they are in the
+// host's file cache by the time the guest reads them, whether the image is
+// mapped into memory or read through file I/O.
+//
+// Traces are kept in a directory, one file for each image, named by a hash
+// of the image size and its first 64KB, which hold the partition table,
+// boot sector and FAT. The same trace is used for copies of an image, and
+// an image whose disk structures have changed is traced again.
+//
+// A trace file is a header, magic "XTBT", version and extent count,
+// followed by the extents, each a start sector and a sector count.
+//
+// Only raw images are prefetched, as the sectors of a block indexed image
+// are not at their disk offsets in the file.
+//
+// This work is licensed under the MIT License. See included LICENSE.TXT.
+//
+
+#ifndef _XTPREFETCH_
+#define _XTPREFETCH_
+
+#include <stdint.h>
+
+typedef struct STPREFETCH_T stPrefetch_t ;
+
+// =============================================================================
+// Function: PREFETCH_SetDirectory
+//
+// Description:
+// Set the directory boot traces are kept in. Images opened later are
+// traced or prefetched.
+//
+// Parameters:
+//
+//   Path : The trace directory, or NULL to neither trace nor prefetch.
+//
+// Returns:
+//
+//   None.
+//
+void PREFETCH_SetDirectory( const char * Path ) ;
+
+// =============================================================================
+// Function: PREFETCH_Open
+//
+// Description:
+// Start prefetching a raw image if it has a boot trace, or else start
+// tracing it.
+//
+// Parameters:
+//
+//   Filename : The image file.
+//
+// Returns:
+//
+//   stPrefetch_t * : The prefetch state for the image, or NULL if there is
+//                    no trace directory or the image cannot be read.
+//
+stPrefetch_t * PREFETCH_Open( const char * Filename ) ;
+
+// =============================================================================
+// Function: PREFETCH_Read
+//
+// Description:
+// Add a guest read to the trace being recorded. Sectors already in the
+// trace are not added again.
+//
+// Parameters:
+//
+//   Prefetch : The prefetch state, which may be NULL.
+//
+//   Offset   : The disk offset read.
+//
+//   Length   : The number of bytes read.
+//
+// Returns:
+//
+//   None.
+//
+void PREFETCH_Read( stPrefetch_t * Prefetch , int64_t Offset , int Length ) ;
+
+// =============================================================================
+// Function: PREFETCH_Close
+//
+// Description:
+// Stop prefetching, or save the trace recorded, and release the prefetch
+// state.
+//
+// Parameters:
+//
+//   Prefetch : The prefetch state, which may be NULL.
+//
+// Returns:
+//
+//   None.
+//
+void PREFETCH_Close( stPrefetch_t * Prefetch ) ;
+
+#endif // _XTPREFETCH_
@@ -0,0 +1,1421 @@
+// =============================================================================
+// File: XTredir.cpp
+//
+// Description:
+// Host directory network drive.
+// See XTredir.h for details.
+//
+// This work is licensed under the MIT License. See included LICENSE.TXT.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#if defined( _WIN32 )
+  #include <windows.h>
+  #include <io.h>
+  #include <direct.h>
+#else
+  #include <dirent.h>
+  #include <sys/statvfs.h>
+#endif
+
+#include "XTredir.h"
+#include "XTcpu.h"
+#include "XTmemory.h"
+
+#ifndef O_BINARY
+  #define O_BINARY                               0
+#endif
+
+#define REDIR_MAX_PATH                           1024
+#define REDIR_MAX_FILES                          64
+#define REDIR_MAX_SEARCHES                       16 // Directories being searched
+
+// INT 2Fh function 11h subfunctions
+#define REDIR_INSTALL_CHECK                      0x00
+#define REDIR_RMDIR                              0x01
+#define REDIR_MKDIR                              0x03
+#define REDIR_CHDIR                              0x05
+#define REDIR_CLOSE                              0x06
+#define REDIR_COMMIT                             0x07
+#define REDIR_READ                               0x08
+#define REDIR_WRITE                              0x09
+#define REDIR_LOCK                               0x0A
+#define REDIR_UNLOCK                             0x0B
+#define REDIR_GET_SPACE                          0x0C
+#define REDIR_SET_ATTR                           0x0E
+#define REDIR_GET_ATTR                           0x0F
+#define REDIR_RENAME                             0x11
+#define REDIR_DELETE                             0x13
+#define REDIR_OPEN                               0x16
+#define REDIR_CREATE                             0x17
+#define REDIR_FIND_FIRST                         0x1B
+#define REDIR_FIND_NEXT                          0x1C
+#define REDIR_SEEK_END                           0x21
+#define REDIR_EXT_OPEN                           0x2E
+
+// DOS error codes
+#define REDIR_OK                                 0x00
+#define REDIR_ERR_FILE_NOT_FOUND                 0x02
+#define REDIR_ERR_PATH_NOT_FOUND                 0x03
+#define REDIR_ERR_TOO_MANY_FILES                 0x04
+#define REDIR_ERR_ACCESS_DENIED                  0x05
+#define REDIR_ERR_HANDLE                         0x06
+#define REDIR_ERR_WRITE_FAULT                    0x1D
+#define REDIR_ERR_READ_FAULT                     0x1E
+#define REDIR_ERR_FILE_EXISTS                    0x50
+#define REDIR_ERR_NO_MORE_FILES                  0x12
+
+// Swappable data area offsets, DOS 4.0 and later
+#define SDA_DTA                                  0x0C
+#define SDA_FILENAME1                            0x9E
+#define SDA_FILENAME2                            0x11E
+#define SDA_FOUND_ENTRY                          0x1B3
+#define SDA_SEARCH_ATTR                          0x24D
+#define SDA_EXT_ACTION                           0x2DD
+#define SDA_EXT_ATTR                             0x2DF
+#define SDA_EXT_MODE                             0x2E1
+
+// List of lists offsets
+#define LOL_CDS                                  0x16
+#define LOL_LAST_DRIVE                           0x21
+
+// Current directory structure, DOS 4.0 and later
+#define CDS_SIZE                                 0x58
+#define CDS_FLAGS                                0x43
+#define CDS_DPB                                  0x45
+#define CDS_ROOT_LENGTH                          0x4F
+#define CDS_NETWORK                              0x8000
+#define CDS_PHYSICAL                             0x4000
+
+// System file table entry
+#define SFT_HANDLES                              0x00
+#define SFT_MODE                                 0x02
+#define SFT_ATTR                                 0x04
+#define SFT_DEVICE_INFO                          0x05
+#define SFT_DEVICE                               0x07
+#define SFT_CLUSTER                              0x0B // Holds the host file index
+#define SFT_TIME                                 0x0D
+#define SFT_DATE                                 0x0F
+#define SFT_SIZE                                 0x11
+#define SFT_POSITION                             0x15
+#define SFT_REL_CLUSTER                          0x19
+#define SFT_ABS_CLUSTER                          0x1B
+#define SFT_DIR_SECTOR                           0x1D
+#define SFT_DIR_ENTRY                            0x1F
+#define SFT_NAME                                 0x20
+#define SFT_NETWORK                              0x8000
+#define SFT_NOT_WRITTEN                          0x0040
+
+// Search data block, kept by DOS in the DTA between searches
+#define SDB_DRIVE                                0x00
+#define SDB_NAME                                 0x01
+#define SDB_ATTR                                 0x0C
+#define SDB_ENTRY                                0x0D // Next entry to look at
+#define SDB_DIRECTORY                            0x0F // Search slot
+#define SDB_NETWORK                              0x80
+
+// Directory entry attributes
+#define REDIR_ATTR_READ_ONLY                     0x01
+#define REDIR_ATTR_HIDDEN                        0x02
+#define REDIR_ATTR_SYSTEM                        0x04
+#define REDIR_ATTR_VOLUME                        0x08
+#define REDIR_ATTR_DIRECTORY                     0x10
+#define REDIR_ATTR_ARCHIVE                       0x20
+
+// A host directory entry with its 8.3 name.
+typedef struct STREDIRENTRY_T
+{
+  char     Host[ REDIR_MAX_PATH ] ;
+  char     Name[ 11 ] ; // 8.3 name, space padded
+  uint8_t  Attributes ;
+  uint32_t Size       ;
+  uint16_t Time       ;
+  uint16_t Date       ;
+} stRedirEntry_t ;
+
+// =============================================================================
+// Local variables
+//
+
+static char             Root[ REDIR_MAX_PATH ] = "" ; // Empty for no host drive
+static int              Drive    = -1 ; // Mounted drive, 0 for A:, or -1
+static uint32_t         Cds      = 0  ; // Linear address of its CDS
+static uint32_t         Sda      = 0  ; // Linear address of the swappable data area
+static int              Files[ REDIR_MAX_FILES ] ; // Host files, -1 if free
+
+// The last directory listed, kept for searches through it.
+static char             Listed[ REDIR_MAX_PATH ] = "" ;
+static stRedirEntry_t * Entries    = NULL ;
+static int              EntryCount = 0 ;
+
+// The directories being searched, used round robin.
+static char             Searches[ REDIR_MAX_SEARCHES ][ REDIR_MAX_PATH ] ;
+static int              NextSearch = 0 ;
+
+// =============================================================================
+// Local functions
+//
+
+static uint16_t * Regs16( void )
+{
+  return( ( uint16_t * ) ( mem + REGS_BASE ) ) ;
+}
+
+static uint8_t * Regs8( void )
+{
+  return( mem + REGS_BASE ) ;
+}
+
+static uint32_t Linear( uint16_t Segment , uint16_t Offset )
+{
+  return( 16 * ( uint32_t ) Segment + Offset ) ;
+}
+
+static uint32_t FarPointer( uint32_t Addr )
+{
+  return( Linear( *( uint16_t * ) &mem[ Addr + 2 ] , *( uint16_t * ) &mem[ Addr ] ) ) ;
+}
+
+static uint16_t Get16( uint32_t Addr )
+{
+  return( *( uint16_t * ) &mem[ Addr ] ) ;
+}
+
+static uint32_t Get32( uint32_t Addr )
+{
+  return( *( uint32_t * ) &mem[ Addr ] ) ;
+}
+
+static void Put16( uint32_t Addr , uint16_t Value )
+{
+  *( uint16_t * ) &mem[ Addr ] = Value ;
+}
+
+static void Put32( uint32_t Addr , uint32_t Value )
+{
+  *( uint32_t * ) &mem[ Addr ] = Value ;
+}
+
+// The word DOS pushed before the call, at the top of the caller's stack as
+// no interrupt frame is pushed for calls serviced here.
+static uint16_t StackWord( void )
+{
+  return( Get16( Linear( Regs16()[ REG_SS ] , Regs16()[ REG_SP ] ) ) ) ;
+}
+
+static void CloseFiles( void )
+{
+  for( int i = 0 ; i < REDIR_MAX_FILES ; i++ )
+  {
+    if( Files[ i ] >= 0 )
+    {
+      close( Files[ i ] ) ;
+      Files[ i ] = -1 ;
+    }
+  }
+}
+
+static int HostError( void )
+{
+  switch( errno )
+  {
+  case ENOENT  : return( REDIR_ERR_FILE_NOT_FOUND ) ;
+  case ENOTDIR : return( REDIR_ERR_PATH_NOT_FOUND ) ;
+  case EMFILE  :
+  case ENFILE  : return( REDIR_ERR_TOO_MANY_FILES ) ;
+  case EEXIST  : return( REDIR_ERR_FILE_EXISTS ) ;
+  default      : return( REDIR_ERR_ACCESS_DENIED ) ;
+  }
+}
+
+static void DosDateTime( time_t Modified , uint16_t * Date , uint16_t * Time )
+{
+  struct tm * Local = localtime( &Modified ) ;
+
+  if( ( Local != NULL ) && ( Local->tm_year >= 80 ) )
+  {
+    *Date = ( uint16_t ) ( ( ( Local->tm_year - 80 ) << 9 ) | ( ( Local->tm_mon + 1 ) << 5 ) | Local->tm_mday ) ;
+    *Time = ( uint16_t ) ( ( Local->tm_hour << 11 ) | ( Local->tm_min << 5 ) | ( Local->tm_sec / 2 ) ) ;
+  }
+  else
+  {
+    *Date = ( 1 << 5 ) | 1 ; // 1st January 1980
+    *Time = 0 ;
+  }
+}
+
+static bool ValidChar( char c )
+{
+  return( ( isalnum( ( unsigned char ) c ) && ( ( unsigned char ) c < 0x80 ) ) || ( strchr( "!#$%&'()-@^_`{}~" , c ) != NULL ) ) ;
+}
+
+// Copy part of a name into an 8.3 name field, in upper case. A '*' fills
+// the rest of the field with '?' wildcards.
+static void FcbPart( const char * From , const char * End , char * To , int Length )
+{
+  for( int i = 0 ; ( From + i < End ) && ( i < Length ) ; i++ )
+  {
+    if( From[ i ] == '*' )
+    {
+      memset( To + i , '?' , Length - i ) ;
+      break ;
+    }
+    To[ i ] = ( char ) toupper( ( unsigned char ) From[ i ] ) ;
+  }
+}
+
+// Put a name in 8.3 form, upper case and space padded.
+// Returns false if it is not a valid 8.3 name.
+static bool FcbName( const char * From , const char * End , char * Name )
+{
+  const char * Dot    = NULL ;
+  bool         Valid  = ( From < End ) && ( *From != '.' ) ;
+  int          Length ;
+
+  memset( Name , ' ' , 11 ) ;
+
+  // "." and "..", which only the guest gives.
+  if( ( ( End - From ) <= 2 ) && ( strspn( From , "." ) == ( size_t ) ( End - From ) ) )
+  {
+    memcpy( Name , From , End - From ) ;
+    return( true ) ;
+  }
+
+  for( const char * c = From ; c < End ; c++ )
+  {
+    if( *c == '.' )
+    {
+      Valid = Valid && ( Dot == NULL ) ;
+      Dot   = c ;
+    }
+    else
+    {
+      Valid = Valid && ValidChar( ( char ) toupper( ( unsigned char ) *c ) ) ;
+    }
+  }
+
+  if( Dot == NULL )
+  {
+    Dot = End ;
+  }
+  Length = ( int ) ( Dot - From ) ;
+  Valid  = Valid && ( Length <= 8 ) && ( ( End - Dot ) <= 4 ) && ( ( Dot == End ) || ( Dot + 1 < End ) ) ;
+
+  FcbPart( From , From + Length , Name , 8 ) ;
+  if( Dot < End )
+  {
+    FcbPart( Dot + 1 , End , Name + 8 , 3 ) ;
+  }
+
+  return( Valid ) ;
+}
+
+// Copy the valid characters of part of a host name into an 8.3 name field.
+static void ShortPart( const char * From , const char * End , char * To , int Length )
+{
+  int Out = 0 ;
+
+  for( ; ( From < End ) && ( Out < Length ) ; From++ )
+  {
+    char c = ( char ) toupper( ( unsigned char ) *From ) ;
+
+    if( c == ' ' )
+    {
+      continue ;
+    }
+    To[ Out++ ] = ValidChar( c ) ? c : '_' ;
+  }
+}
+
+static bool NameUsed( const char * Name , int Count )
+{
+  for( int i = 0 ; i < Count ; i++ )
+  {
+    if( ( Entries[ i ].Name[ 0 ] != 0 ) && ( memcmp( Entries[ i ].Name , Name , 11 ) == 0 ) )
+    {
+      return( true ) ;
+    }
+  }
+
+  return( false ) ;
+}
+
+// Make a unique 8.3 name with a ~N tail for a host name that has no 8.3
+// name of its own, as virtual FAT disks do.
+static void ShortName( const char * Host , char * Name )
+{
+  const char * Dot = strrchr( Host , '.' ) ;
+  char         Base[ 8 ] ;
+  char         Tail[ 8 ] ;
+  int          TailLength ;
+  int          Position ;
+
+  if( ( Dot == NULL ) || ( Dot == Host ) )
+  {
+    Dot = Host + strlen( Host ) ;
+  }
+
+  memset( Name , ' ' , 11 ) ;
+  ShortPart( Host , Dot , Name , 8 ) ;
+  if( *Dot == '.' )
+  {
+    ShortPart( Dot + 1 , Dot + strlen( Dot ) , Name + 8 , 3 ) ;
+  }
+  if( Name[ 0 ] == ' ' )
+  {
+    Name[ 0 ] = '_' ;
+  }
+  memcpy( Base , Name , 8 ) ;
+
+  for( int n = 1 ; NameUsed( Name , EntryCount ) && ( n < 100000 ) ; n++ )
+  {
+    TailLength = snprintf( Tail , sizeof( Tail ) , "~%d" , n ) ;
+    Position   = 0 ;
+    while( ( Position < 8 - TailLength ) && ( Base[ Position ] != ' ' ) )
+    {
+      Position++ ;
+    }
+    memcpy( Name , Base , Position ) ;
+    memset( Name + Position , ' ' , 8 - Position ) ;
+    memcpy( Name + Position , Tail , TailLength ) ;
+  }
+}
+
+static stRedirEntry_t * AddEntry( int * Size )
+{
+  if( EntryCount == *Size )
+  {
+    stRedirEntry_t * Grown ;
+
+    *Size = ( *Size == 0 ) ? 64 : *Size * 2 ;
+    Grown = ( stRedirEntry_t * ) realloc( Entries , *Size * sizeof( stRedirEntry_t ) ) ;
+    if( Grown == NULL )
+    {
+      return( NULL ) ;
+    }
+    Entries = Grown ;
+  }
+
+  memset( &Entries[ EntryCount ] , 0 , sizeof( stRedirEntry_t ) ) ;
+
+  return( &Entries[ EntryCount++ ] ) ;
+}
+
+static int CompareEntries( const void * a , const void * b )
+{
+  return( strcmp( ( ( const stRedirEntry_t * ) a )->Host , ( ( const stRedirEntry_t * ) b )->Host ) ) ;
+}
+
+// List a host directory, sorted by name, with 8.3 names. Subdirectories
+// start with "." and "..". Host names that are valid 8.3 names keep them,
+// so a name does not change as other files come and go.
+// Returns false if the directory cannot be read.
+static bool ListDirectory( const char * Path )
+{
+  stRedirEntry_t * Entry ;
+  int              Size  = 0 ;
+  int              First = 0 ;
+
+  Listed[ 0 ] = 0 ;
+  free( Entries ) ;
+  Entries    = NULL ;
+  EntryCount = 0 ;
+
+  if( strcmp( Path , Root ) != 0 )
+  {
+    for( int i = 1 ; i <= 2 ; i++ )
+    {
+      Entry = AddEntry( &Size ) ;
+      if( Entry == NULL )
+      {
+        return( false ) ;
+      }
+      memset( Entry->Name , ' ' , 11 ) ;
+      memset( Entry->Name , '.' , i ) ;
+      strcpy( Entry->Host , ( i == 1 ) ? "." : ".." ) ;
+      Entry->Attributes = REDIR_ATTR_DIRECTORY ;
+      Entry->Date       = ( 1 << 5 ) | 1 ;
+    }
+    First = EntryCount ;
+  }
+
+#if defined( _WIN32 )
+  WIN32_FIND_DATAA Find ;
+  FILETIME         Local ;
+  HANDLE           Handle ;
+  char             Pattern[ REDIR_MAX_PATH ] ;
+
+  if( snprintf( Pattern , sizeof( Pattern ) , "%s\\*" , Path ) >= ( int ) sizeof( Pattern ) )
+  {
+    return( false ) ;
+  }
+
+  Handle = FindFirstFileA( Pattern , &Find ) ;
+  if( Handle == INVALID_HANDLE_VALUE )
+  {
+    return( false ) ;
+  }
+
+  do
+  {
+    // DOS files are at most 4GB - 1.
+    if( ( Find.cFileName[ 0 ] == '.' ) || ( Find.nFileSizeHigh != 0 ) )
+    {
+      continue ;
+    }
+
+    Entry = AddEntry( &Size ) ;
+    if( Entry == NULL )
+    {
+      break ;
+    }
+    strncpy( Entry->Host , Find.cFileName , REDIR_MAX_PATH - 1 ) ;
+    Entry->Attributes = ( Find.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY ) ? REDIR_ATTR_DIRECTORY : REDIR_ATTR_ARCHIVE ;
+    Entry->Attributes = ( uint8_t ) ( Entry->Attributes | ( ( Find.dwFileAttributes & FILE_ATTRIBUTE_READONLY ) ? REDIR_ATTR_READ_ONLY : 0 ) ) ;
+    Entry->Size       = ( Entry->Attributes & REDIR_ATTR_DIRECTORY ) ? 0 : Find.nFileSizeLow ;
+    FileTimeToLocalFileTime( &Find.ftLastWriteTime , &Local ) ;
+    FileTimeToDosDateTime( &Local , ( LPWORD ) &Entry->Date , ( LPWORD ) &Entry->Time ) ;
+  } while( FindNextFileA( Handle , &Find ) ) ;
+
+  FindClose( Handle ) ;
+#else
+  struct dirent * Dirent ;
+  struct stat     Stat ;
+  char            Name[ REDIR_MAX_PATH ] ;
+  DIR           * Dir ;
+
+  Dir = opendir( Path ) ;
+  if( Dir == NULL )
+  {
+    return( false ) ;
+  }
+
+  while( ( Dirent = readdir( Dir ) ) != NULL )
+  {
+    // Names too long for a host path are left out.
+    if( ( Dirent->d_name[ 0 ] == '.' ) ||
+        ( snprintf( Name , sizeof( Name ) , "%s/%s" , Path , Dirent->d_name ) >= ( int ) sizeof( Name ) ) ||
+        ( stat( Name , &Stat ) != 0 ) ||
+        !( S_ISDIR( Stat.st_mode ) || S_ISREG( Stat.st_mode ) ) || ( ( uint64_t ) Stat.st_size > 0xFFFFFFFFull ) )
+    {
+      continue ;
+    }
+
+    Entry = AddEntry( &Size ) ;
+    if( Entry == NULL )
+    {
+      break ;
+    }
+    strncpy( Entry->Host , Dirent->d_name , REDIR_MAX_PATH - 1 ) ;
+    Entry->Attributes = S_ISDIR( Stat.st_mode ) ? REDIR_ATTR_DIRECTORY : REDIR_ATTR_ARCHIVE ;
+    Entry->Attributes = ( uint8_t ) ( Entry->Attributes | ( ( access( Name , W_OK ) != 0 ) ? REDIR_ATTR_READ_ONLY : 0 ) ) ;
+    Entry->Size       = S_ISDIR( Stat.st_mode ) ? 0 : ( uint32_t ) Stat.st_size ;
+    DosDateTime( Stat.st_mtime , &Entry->Date , &Entry->Time ) ;
+  }
+
+  closedir( Dir ) ;
+#endif
+
+  qsort( Entries + First , EntryCount - First , sizeof( stRedirEntry_t ) , CompareEntries ) ;
+
+  // Names are only compared once given, so the 8.3 names go first.
+  for( int i = First ; i < EntryCount ; i++ )
+  {
+    char Short[ 11 ] ;
+
+    if( FcbName( Entries[ i ].Host , Entries[ i ].Host + strlen( Entries[ i ].Host ) , Short ) && !NameUsed( Short , EntryCount ) )
+    {
+      memcpy( Entries[ i ].Name , Short , 11 ) ;
+    }
+  }
+  for( int i = First ; i < EntryCount ; i++ )
+  {
+    char Short[ 11 ] ;
+
+    if( Entries[ i ].Name[ 0 ] == 0 )
+    {
+      ShortName( Entries[ i ].Host , Short ) ;
+      memcpy( Entries[ i ].Name , Short , 11 ) ;
+    }
+  }
+
+  strcpy( Listed , Path ) ;
+
+  return( true ) ;
+}
+
+static int FindEntry( const char * Name )
+{
+  for( int i = 0 ; i < EntryCount ; i++ )
+  {
+    if( memcmp( Entries[ i ].Name , Name , 11 ) == 0 )
+    {
+      return( i ) ;
+    }
+  }
+
+  return( -1 ) ;
+}
+
+// Find the host path of a guest path on the host drive, such as
+// "E:\SUB\FILE.TXT", matching each name against the 8.3 names of the host
+// directory it is in. A last name that is not found is added as given, for
+// files and directories about to be made. Parent, if not NULL, is set to
+// the host directory the last name is in.
+// Returns REDIR_OK if the path exists, REDIR_ERR_FILE_NOT_FOUND if only the
+// last name does not, or REDIR_ERR_PATH_NOT_FOUND.
+static int HostPath( uint32_t Guest , char * Path , char * Parent , stRedirEntry_t * Found )
+{
+  const char * Name = ( const char * ) &mem[ Guest + 2 ] ;
+  const char * End ;
+  char         Fcb[ 11 ] ;
+  int          Index ;
+  int          Length ;
+
+  strcpy( Path , Root ) ;
+  if( Parent != NULL )
+  {
+    strcpy( Parent , Root ) ;
+  }
+  if( Found != NULL )
+  {
+    memset( Found , 0 , sizeof( stRedirEntry_t ) ) ;
+    Found->Attributes = REDIR_ATTR_DIRECTORY ;
+  }
+
+  while( *Name == '\\' )
+  {
+    Name++ ;
+  }
+
+  while( *Name != 0 )
+  {
+    End = Name + strcspn( Name , "\\" ) ;
+    if( Parent != NULL )
+    {
+      strcpy( Parent , Path ) ;
+    }
+
+    FcbName( Name , End , Fcb ) ;
+    Index = ( ListDirectory( Path ) ) ? FindEntry( Fcb ) : -1 ;
+    if( ( Index < 0 ) || ( strcmp( Entries[ Index ].Host , "." ) == 0 ) || ( strcmp( Entries[ Index ].Host , ".." ) == 0 ) )
+    {
+      if( ( *End != 0 ) || ( Index >= 0 ) || ( Listed[ 0 ] == 0 ) )
+      {
+        return( REDIR_ERR_PATH_NOT_FOUND ) ;
+      }
+
+      Length = ( int ) strlen( Path ) ;
+      if( snprintf( Path + Length , REDIR_MAX_PATH - Length , "/%.*s" , ( int ) ( End - Name ) , Name ) >= REDIR_MAX_PATH - Length )
+      {
+        return( REDIR_ERR_PATH_NOT_FOUND ) ;
+      }
+      return( REDIR_ERR_FILE_NOT_FOUND ) ;
+    }
+
+    if( ( *End != 0 ) && !( Entries[ Index ].Attributes & REDIR_ATTR_DIRECTORY ) )
+    {
+      return( REDIR_ERR_PATH_NOT_FOUND ) ;
+    }
+
+    // A truncated path could name another host file.
+    Length = ( int ) strlen( Path ) ;
+    if( snprintf( Path + Length , REDIR_MAX_PATH - Length , "/%s" , Entries[ Index ].Host ) >= REDIR_MAX_PATH - Length )
+    {
+      return( REDIR_ERR_PATH_NOT_FOUND ) ;
+    }
+    if( Found != NULL )
+    {
+      *Found = Entries[ Index ] ;
+    }
+
+    Name = ( *End == 0 ) ? End : End + 1 ;
+  }
+
+  return( REDIR_OK ) ;
+}
+
+// Put the last name of a guest path in 8.3 form, with wildcards. Not all
+// DOS versions give the search name in 8.3 form, so it is taken from the
+// path.
+static void LastName( uint32_t Guest , char * Name )
+{
+  const char * Path = ( const char * ) &mem[ Guest ] ;
+  const char * Last = strrchr( Path , '\\' ) ;
+
+  Last = ( Last == NULL ) ? Path + 2 : Last + 1 ;
+  FcbName( Last , Last + strlen( Last ) , Name ) ;
+}
+
+// Match an 8.3 name against a search name that may hold '?' wildcards.
+static bool Matches( const char * Name , const char * Search )
+{
+  for( int i = 0 ; i < 11 ; i++ )
+  {
+    if( ( Search[ i ] != '?' ) && ( toupper( ( unsigned char ) Search[ i ] ) != Name[ i ] ) )
+    {
+      return( false ) ;
+    }
+  }
+
+  return( true ) ;
+}
+
+// Find the next entry of the listed directory from Index that matches a
+// search name and attributes. Normal files always match, and hidden,
+// system and directory entries only if their attributes are searched for.
+// Returns the entry's index, or -1 if none match.
+static int SearchEntries( int Index , const char * Search , uint8_t Attributes )
+{
+  for( ; Index < EntryCount ; Index++ )
+  {
+    uint8_t Extra = Entries[ Index ].Attributes & ( REDIR_ATTR_HIDDEN | REDIR_ATTR_SYSTEM | REDIR_ATTR_DIRECTORY ) ;
+
+    if( ( ( Extra & ~Attributes ) == 0 ) && Matches( Entries[ Index ].Name , Search ) )
+    {
+      return( Index ) ;
+    }
+  }
+
+  return( -1 ) ;
+}
+
+// Give a found entry to DOS, and the search data block to continue from it.
+static void FoundEntry( uint32_t Sdb , int Index )
+{
+  const stRedirEntry_t * Entry = &Entries[ Index ] ;
+  uint32_t               Dir   = Sda + SDA_FOUND_ENTRY ;
+
+  Put16( Sdb + SDB_ENTRY , ( uint16_t ) ( Index + 1 ) ) ;
+
+  memset( &mem[ Dir ] , 0 , 32 ) ;
+  memcpy( &mem[ Dir ] , Entry->Name , 11 ) ;
+  mem[ Dir + 11 ] = Entry->Attributes ;
+  Put16( Dir + 22 , Entry->Time ) ;
+  Put16( Dir + 24 , Entry->Date ) ;
+  Put32( Dir + 28 , Entry->Size ) ;
+}
+
+static int FindFirst( void )
+{
+  uint32_t       Sdb        = FarPointer( Sda + SDA_DTA ) ;
+  uint8_t        Attributes = mem[ Sda + SDA_SEARCH_ATTR ] ;
+  char           Search[ 11 ] ;
+  char           Path[ REDIR_MAX_PATH ] ;
+  char           Parent[ REDIR_MAX_PATH ] ;
+  stRedirEntry_t Found ;
+  int            Index ;
+
+  LastName( Sda + SDA_FILENAME1 , Search ) ;
+  mem[ Sdb + SDB_DRIVE ] = ( uint8_t ) ( Drive | SDB_NETWORK ) ;
+  memcpy( &mem[ Sdb + SDB_NAME ] , Search , 11 ) ;
+  mem[ Sdb + SDB_ATTR ] = Attributes ;
+
+  // The host drive has no volume label.
+  if( Attributes == REDIR_ATTR_VOLUME )
+  {
+    return( REDIR_ERR_NO_MORE_FILES ) ;
+  }
+
+  // The directory searched is the path without its last name, which is the
+  // search name.
+  if( HostPath( Sda + SDA_FILENAME1 , Path , Parent , &Found ) == REDIR_ERR_PATH_NOT_FOUND )
+  {
+    return( REDIR_ERR_PATH_NOT_FOUND ) ;
+  }
+  if( ( strcmp( Listed , Parent ) != 0 ) && !ListDirectory( Parent ) )
+  {
+    return( REDIR_ERR_PATH_NOT_FOUND ) ;
+  }
+
+  Index = SearchEntries( 0 , Search , Attributes ) ;
+  if( Index < 0 )
+  {
+    return( REDIR_ERR_NO_MORE_FILES ) ;
+  }
+
+  strcpy( Searches[ NextSearch ] , Parent ) ;
+  Put16( Sdb + SDB_DIRECTORY , ( uint16_t ) NextSearch ) ;
+  NextSearch = ( NextSearch + 1 ) % REDIR_MAX_SEARCHES ;
+
+  FoundEntry( Sdb , Index ) ;
+
+  return( REDIR_OK ) ;
+}
+
+static int FindNext( void )
+{
+  uint32_t Sdb    = FarPointer( Sda + SDA_DTA ) ;
+  uint16_t Slot   = Get16( Sdb + SDB_DIRECTORY ) ;
+  int      Index ;
+
+  if( Slot >= REDIR_MAX_SEARCHES )
+  {
+    return( REDIR_ERR_NO_MORE_FILES ) ;
+  }
+  if( ( strcmp( Listed , Searches[ Slot ] ) != 0 ) && !ListDirectory( Searches[ Slot ] ) )
+  {
+    return( REDIR_ERR_NO_MORE_FILES ) ;
+  }
+
+  Index = SearchEntries( Get16( Sdb + SDB_ENTRY ) , ( const char * ) &mem[ Sdb + SDB_NAME ] , mem[ Sdb + SDB_ATTR ] ) ;
+  if( Index < 0 )
+  {
+    return( REDIR_ERR_NO_MORE_FILES ) ;
+  }
+
+  FoundEntry( Sdb , Index ) ;
+
+  return( REDIR_OK ) ;
+}
+
+// Fill in the SFT of a host file opened, all but the handle count, which
+// DOS keeps.
+static void FillSft( uint32_t Sft , int File , uint8_t Mode , const stRedirEntry_t * Entry )
+{
+  Put16( Sft + SFT_MODE , ( uint16_t ) ( ( Get16( Sft + SFT_MODE ) & 0xFF00 ) | Mode ) ) ;
+  mem[ Sft + SFT_ATTR ] = Entry->Attributes ;
+  Put16( Sft + SFT_DEVICE_INFO , ( uint16_t ) ( SFT_NETWORK | SFT_NOT_WRITTEN | Drive ) ) ;
+  Put32( Sft + SFT_DEVICE , 0 ) ;
+  Put16( Sft + SFT_CLUSTER , ( uint16_t ) File ) ;
+  Put16( Sft + SFT_TIME , Entry->Time ) ;
+  Put16( Sft + SFT_DATE , Entry->Date ) ;
+  Put32( Sft + SFT_SIZE , Entry->Size ) ;
+  Put32( Sft + SFT_POSITION , 0 ) ;
+  Put16( Sft + SFT_REL_CLUSTER , 0xFFFF ) ;
+  Put16( Sft + SFT_ABS_CLUSTER , 0xFFFF ) ;
+  Put16( Sft + SFT_DIR_SECTOR , 0 ) ;
+  mem[ Sft + SFT_DIR_ENTRY ] = 0xFF ;
+  memcpy( &mem[ Sft + SFT_NAME ] , Entry->Name , 11 ) ;
+}
+
+// Open or create a host file for an SFT.
+// Action is 1 to open, 2 to create and 3 to replace, as extended open
+// returns.
+static int OpenFile( uint32_t Sft , uint8_t Mode , uint8_t Attributes , bool Open , bool Create , bool Truncate , uint16_t * Action )
+{
+  char           Path[ REDIR_MAX_PATH ] ;
+  stRedirEntry_t Found ;
+  int            Result = HostPath( Sda + SDA_FILENAME1 , Path , NULL , &Found ) ;
+  int            Flags  = O_BINARY ;
+  int            File   = 0 ;
+
+  while( ( File < REDIR_MAX_FILES ) && ( Files[ File ] >= 0 ) )
+  {
+    File++ ;
+  }
+
+  if( Result == REDIR_ERR_PATH_NOT_FOUND )
+  {
+    return( Result ) ;
+  }
+  if( ( Result == REDIR_OK ) && ( Found.Attributes & REDIR_ATTR_DIRECTORY ) )
+  {
+    return( REDIR_ERR_ACCESS_DENIED ) ;
+  }
+  if( ( Result == REDIR_OK ) ? !Open : !Create )
+  {
+    return( ( Result == REDIR_OK ) ? REDIR_ERR_FILE_EXISTS : REDIR_ERR_FILE_NOT_FOUND ) ;
+  }
+  if( File == REDIR_MAX_FILES )
+  {
+    return( REDIR_ERR_TOO_MANY_FILES ) ;
+  }
+
+  if( Result != REDIR_OK )
+  {
+    Flags   = Flags | O_RDWR | O_CREAT | O_EXCL ;
+    *Action = 2 ;
+  }
+  else if( Truncate )
+  {
+    Flags   = Flags | O_RDWR | O_TRUNC ;
+    *Action = 3 ;
+  }
+  else
+  {
+    Flags   = Flags | ( ( ( Mode & 3 ) == 0 ) ? O_RDONLY : ( ( Mode & 3 ) == 1 ) ? O_WRONLY : O_RDWR ) ;
+    *Action = 1 ;
+  }
+
+  Files[ File ] = open( Path , Flags , 0666 ) ;
+  if( Files[ File ] < 0 )
+  {
+    return( HostError() ) ;
+  }
+
+  if( *Action != 1 )
+  {
+    FcbName( strrchr( Path , '/' ) + 1 , Path + strlen( Path ) , Found.Name ) ;
+    Found.Attributes = ( uint8_t ) ( ( Attributes & ( REDIR_ATTR_READ_ONLY | REDIR_ATTR_HIDDEN | REDIR_ATTR_SYSTEM ) ) | REDIR_ATTR_ARCHIVE ) ;
+    Found.Size       = 0 ;
+    DosDateTime( time( NULL ) , &Found.Date , &Found.Time ) ;
+    Listed[ 0 ]      = 0 ;
+  }
+  FillSft( Sft , File , Mode , &Found ) ;
+
+  return( REDIR_OK ) ;
+}
+
+// Returns the host file of an SFT, or -1 if it is not open.
+static int SftFile( uint32_t Sft )
+{
+  uint16_t File = Get16( Sft + SFT_CLUSTER ) ;
+
+  return( ( File < REDIR_MAX_FILES ) ? Files[ File ] : -1 ) ;
+}
+
+static int ReadWrite( uint32_t Sft , bool Write )
+{
+  uint16_t * Regs     = Regs16() ;
+  int        File     = SftFile( Sft ) ;
+  uint32_t   Buffer   = FarPointer( Sda + SDA_DTA ) ;
+  uint32_t   Position = Get32( Sft + SFT_POSITION ) ;
+  int        Count ;
+
+  if( File < 0 )
+  {
+    return( REDIR_ERR_HANDLE ) ;
+  }
+  if( lseek( File , Position , SEEK_SET ) < 0 )
+  {
+    return( ( Write ) ? REDIR_ERR_WRITE_FAULT : REDIR_ERR_READ_FAULT ) ;
+  }
+
+  if( !Write )
+  {
+    Count = read( File , &mem[ Buffer ] , Regs[ REG_CX ] ) ;
+    if( Count > 0 )
+    {
+      MEM_HostWrite( Buffer , Count ) ;
+    }
+  }
+  else if( Regs[ REG_CX ] != 0 )
+  {
+    Count = write( File , &mem[ Buffer ] , Regs[ REG_CX ] ) ;
+  }
+  else
+  {
+    // Writing nothing sets the file size to the position.
+#if defined( _WIN32 )
+    Count = ( _chsize( File , Position ) == 0 ) ? 0 : -1 ;
+#else
+    Count = ( ftruncate( File , Position ) == 0 ) ? 0 : -1 ;
+#endif
+    Put32( Sft + SFT_SIZE , Position ) ;
+  }
+
+  if( Count < 0 )
+  {
+    return( HostError() ) ;
+  }
+
+  Regs[ REG_CX ] = ( uint16_t ) Count ;
+  Position      += Count ;
+  Put32( Sft + SFT_POSITION , Position ) ;
+  if( Write )
+  {
+    if( Position > Get32( Sft + SFT_SIZE ) )
+    {
+      Put32( Sft + SFT_SIZE , Position ) ;
+    }
+    Put16( Sft + SFT_DEVICE_INFO , Get16( Sft + SFT_DEVICE_INFO ) & ~SFT_NOT_WRITTEN ) ;
+    Listed[ 0 ] = 0 ;
+  }
+
+  return( REDIR_OK ) ;
+}
+
+static int Close( uint32_t Sft )
+{
+  uint16_t File = Get16( Sft + SFT_CLUSTER ) ;
+
+  if( Get16( Sft + SFT_HANDLES ) > 0 )
+  {
+    Put16( Sft + SFT_HANDLES , Get16( Sft + SFT_HANDLES ) - 1 ) ;
+  }
+
+  if( ( Get16( Sft + SFT_HANDLES ) == 0 ) && ( File < REDIR_MAX_FILES ) && ( Files[ File ] >= 0 ) )
+  {
+    close( Files[ File ] ) ;
+    Files[ File ] = -1 ;
+  }
+
+  return( REDIR_OK ) ;
+}
+
+static int GetAttributes( void )
+{
+  uint16_t     * Regs = Regs16() ;
+  char           Path[ REDIR_MAX_PATH ] ;
+  stRedirEntry_t Found ;
+  int            Result = HostPath( Sda + SDA_FILENAME1 , Path , NULL , &Found ) ;
+
+  if( Result != REDIR_OK )
+  {
+    return( Result ) ;
+  }
+
+  Regs[ REG_AX ] = Found.Attributes ;
+  Regs[ REG_BX ] = ( uint16_t ) ( Found.Size >> 16 ) ;
+  Regs[ REG_DI ] = ( uint16_t ) Found.Size ;
+  Regs[ REG_CX ] = Found.Time ;
+  Regs[ REG_DX ] = Found.Date ;
+
+  return( REDIR_OK ) ;
+}
+
+static int MakeDirectory( bool Remove )
+{
+  char Path[ REDIR_MAX_PATH ] ;
+  int  Result = HostPath( Sda + SDA_FILENAME1 , Path , NULL , NULL ) ;
+
+  if( ( Result == REDIR_ERR_PATH_NOT_FOUND ) || ( Remove && ( Result != REDIR_OK ) ) )
+  {
+    return( REDIR_ERR_PATH_NOT_FOUND ) ;
+  }
+  if( !Remove && ( Result == REDIR_OK ) )
+  {
+    return( REDIR_ERR_ACCESS_DENIED ) ;
+  }
+
+  Listed[ 0 ] = 0 ;
+
+#if defined( _WIN32 )
+  Result = ( Remove ) ? _rmdir( Path ) : _mkdir( Path ) ;
+#else
+  Result = ( Remove ) ? rmdir( Path ) : mkdir( Path , 0777 ) ;
+#endif
+
+  // DOS gives access denied for directories that are not empty.
+  return( ( Result == 0 ) ? REDIR_OK : ( errno == ENOENT ) ? REDIR_ERR_PATH_NOT_FOUND : REDIR_ERR_ACCESS_DENIED ) ;
+}
+
+static int ChangeDirectory( void )
+{
+  char           Path[ REDIR_MAX_PATH ] ;
+  stRedirEntry_t Found ;
+
+  if( ( HostPath( Sda + SDA_FILENAME1 , Path , NULL , &Found ) != REDIR_OK ) || !( Found.Attributes & REDIR_ATTR_DIRECTORY ) )
+  {
+    return( REDIR_ERR_PATH_NOT_FOUND ) ;
+  }
+
+  return( REDIR_OK ) ;
+}
+
+static int Rename( void )
+{
+  char From[ REDIR_MAX_PATH ] ;
+  char To[ REDIR_MAX_PATH ] ;
+  int  Result = HostPath( Sda + SDA_FILENAME1 , From , NULL , NULL ) ;
+
+  if( Result != REDIR_OK )
+  {
+    return( Result ) ;
+  }
+
+  Result = HostPath( Sda + SDA_FILENAME2 , To , NULL , NULL ) ;
+  if( Result == REDIR_ERR_PATH_NOT_FOUND )
+  {
+    return( Result ) ;
+  }
+  if( Result == REDIR_OK )
+  {
+    return( REDIR_ERR_ACCESS_DENIED ) ;
+  }
+
+  Listed[ 0 ] = 0 ;
+
+  return( ( rename( From , To ) == 0 ) ? REDIR_OK : HostError() ) ;
+}
+
+// Delete the files matching a name that may hold wildcards.
+static int Delete( void )
+{
+  char     Path[ REDIR_MAX_PATH ] ;
+  char     Parent[ REDIR_MAX_PATH ] ;
+  char     Search[ 11 ] ;
+  int      Result ;
+  int      Count = 0 ;
+
+  if( HostPath( Sda + SDA_FILENAME1 , Path , Parent , NULL ) == REDIR_ERR_PATH_NOT_FOUND )
+  {
+    return( REDIR_ERR_PATH_NOT_FOUND ) ;
+  }
+
+  LastName( Sda + SDA_FILENAME1 , Search ) ;
+  if( !ListDirectory( Parent ) )
+  {
+    return( REDIR_ERR_PATH_NOT_FOUND ) ;
+  }
+
+  Result = REDIR_ERR_FILE_NOT_FOUND ;
+  for( int i = SearchEntries( 0 , Search , 0 ) ; i >= 0 ; i = SearchEntries( i + 1 , Search , 0 ) )
+  {
+    if( snprintf( Path , sizeof( Path ) , "%s/%s" , Parent , Entries[ i ].Host ) >= ( int ) sizeof( Path ) )
+    {
+      Result = REDIR_ERR_PATH_NOT_FOUND ;
+    }
+    else if( Entries[ i ].Attributes & REDIR_ATTR_READ_ONLY )
+    {
+      Result = REDIR_ERR_ACCESS_DENIED ;
+    }
+    else if( remove( Path ) == 0 )
+    {
+      Count++ ;
+    }
+    else
+    {
+      Result = HostError() ;
+    }
+  }
+
+  Listed[ 0 ] = 0 ;
+
+  return( ( Count > 0 ) ? REDIR_OK : Result ) ;
+}
+
+static void GetSpace( void )
+{
+  uint16_t * Regs  = Regs16() ;
+  uint64_t   Total = 0 ;
+  uint64_t   Free  = 0 ;
+
+#if defined( _WIN32 )
+  ULARGE_INTEGER Available ;
+  ULARGE_INTEGER Bytes ;
+
+  if( GetDiskFreeSpaceExA( Root , &Available , &Bytes , NULL ) )
+  {
+    Total = Bytes.QuadPart ;
+    Free  = Available.QuadPart ;
+  }
+#else
+  struct statvfs Stat ;
+
+  if( statvfs( Root , &Stat ) == 0 )
+  {
+    Total = ( uint64_t ) Stat.f_blocks * Stat.f_frsize ;
+    Free  = ( uint64_t ) Stat.f_bavail * Stat.f_frsize ;
+  }
+#endif
+
+  // 32KB clusters, with counts capped to what DOS can show.
+  Total = Total >> 15 ;
+  Free  = Free >> 15 ;
+  Regs[ REG_AX ] = 64 ;
+  Regs[ REG_BX ] = ( uint16_t ) ( ( Total > 0xFFFF ) ? 0xFFFF : Total ) ;
+  Regs[ REG_CX ] = 512 ;
+  Regs[ REG_DX ] = ( uint16_t ) ( ( Free > 0xFFFF ) ? 0xFFFF : Free ) ;
+}
+
+// Returns true if a path in the swappable data area is on the host drive.
+static bool OwnPath( uint32_t Offset )
+{
+  return( ( toupper( mem[ Sda + Offset ] ) == 'A' + Drive ) && ( mem[ Sda + Offset + 1 ] == ':' ) ) ;
+}
+
+// Returns true if ES:DI is the SFT of a file on the host drive.
+static bool OwnSft( uint32_t Sft )
+{
+  uint16_t Info = Get16( Sft + SFT_DEVICE_INFO ) ;
+
+  return( ( Info & SFT_NETWORK ) && ( ( Info & 0x3F ) == Drive ) && ( SftFile( Sft ) >= 0 ) ) ;
+}
+
+// =============================================================================
+// Exported functions
+//
+
+bool REDIR_Initialise( const char * Path )
+{
+  struct stat Stat ;
+
+  REDIR_Cleanup() ;
+
+  if( ( Path == NULL ) || ( stat( Path , &Stat ) != 0 ) || !S_ISDIR( Stat.st_mode ) || ( strlen( Path ) >= REDIR_MAX_PATH - 256 ) )
+  {
+    return( false ) ;
+  }
+
+  strcpy( Root , Path ) ;
+  while( ( strlen( Root ) > 1 ) && ( ( Root[ strlen( Root ) - 1 ] == '/' ) || ( Root[ strlen( Root ) - 1 ] == '\\' ) ) )
+  {
+    Root[ strlen( Root ) - 1 ] = 0 ;
+  }
+
+  return( true ) ;
+}
+
+void REDIR_Cleanup( void )
+{
+  REDIR_Reset() ;
+  Root[ 0 ] = 0 ;
+}
+
+void REDIR_Reset( void )
+{
+  static bool Initialised = false ;
+
+  if( !Initialised )
+  {
+    memset( Files , -1 , sizeof( Files ) ) ;
+    Initialised = true ;
+  }
+
+  // Restored or rewound memory may still hold the CDS as mounted.
+  if( ( Cds != 0 ) && ( mem[ Cds ] == 'A' + Drive ) && ( Get16( Cds + CDS_FLAGS ) & CDS_NETWORK ) && ( Get32( Cds + CDS_DPB ) == 0 ) )
+  {
+    Put16( Cds + CDS_FLAGS , 0 ) ;
+  }
+
+  CloseFiles() ;
+  free( Entries ) ;
+  Entries     = NULL ;
+  EntryCount  = 0 ;
+  Listed[ 0 ] = 0 ;
+  Drive       = -1 ;
+  Cds         = 0 ;
+  Sda         = 0 ;
+}
+
+void REDIR_Mount( void )
+{
+  uint16_t * Regs      = Regs16() ;
+  uint8_t  * Regs8b    = Regs8() ;
+  uint32_t   Lol       = Linear( Regs[ REG_ES ] , Regs[ REG_BX ] ) ;
+  uint32_t   CdsArray  = FarPointer( Lol + LOL_CDS ) ;
+  int        LastDrive = mem[ Lol + LOL_LAST_DRIVE ] ;
+  int        Wanted    = Regs8b[ REG_DL ] - 1 ;
+  int        Found     = -1 ;
+  uint32_t   Entry ;
+
+  Regs8b[ REG_AL ] = 0 ;
+
+  if( Root[ 0 ] == 0 )
+  {
+    return ;
+  }
+
+  for( int i = ( Wanted >= 0 ) ? Wanted : 2 ; ( Found < 0 ) && ( i < LastDrive ) ; i++ )
+  {
+    Entry = CdsArray + i * CDS_SIZE ;
+    if( ( ( Get16( Entry + CDS_FLAGS ) & ( CDS_NETWORK | CDS_PHYSICAL ) ) == 0 ) || ( Entry == Cds ) )
+    {
+      Found = i ;
+    }
+    else if( Wanted >= 0 )
+    {
+      break ;
+    }
+  }
+
+  if( Found < 0 )
+  {
+    return ;
+  }
+
+  // Mounting again moves the drive.
+  if( ( Cds != 0 ) && ( Cds != CdsArray + Found * CDS_SIZE ) )
+  {
+    Put16( Cds + CDS_FLAGS , 0 ) ;
+  }
+  CloseFiles() ;
+
+  Drive = Found ;
+  Cds   = CdsArray + Found * CDS_SIZE ;
+  Sda   = Linear( Regs[ REG_DS ] , Regs[ REG_SI ] ) ;
+
+  memset( &mem[ Cds ] , 0 , CDS_SIZE ) ;
+  mem[ Cds + 0 ] = ( uint8_t ) ( 'A' + Drive ) ;
+  mem[ Cds + 1 ] = ':' ;
+  mem[ Cds + 2 ] = '\\' ;
+  Put16( Cds + CDS_FLAGS , CDS_NETWORK | CDS_PHYSICAL ) ;
+  Put32( Cds + CDS_DPB , 0 ) ;
+  Put16( Cds + CDS_ROOT_LENGTH , 2 ) ;
+
+  Regs8b[ REG_AL ] = ( uint8_t ) ( Drive + 1 ) ;
+}
+
+bool REDIR_Interrupt( void )
+{
+  uint16_t * Regs   = Regs16() ;
+  uint8_t  * Regs8b = Regs8() ;
+  uint32_t   Sft    = Linear( Regs[ REG_ES ] , Regs[ REG_DI ] ) ;
+  uint16_t   Action = 0 ;
+  int        Result = REDIR_OK ;
+
+  if( ( Drive < 0 ) || ( Regs8b[ REG_AH ] != 0x11 ) )
+  {
+    return( false ) ;
+  }
+
+  switch( Regs8b[ REG_AL ] )
+  {
+  case REDIR_INSTALL_CHECK :
+    Regs8b[ REG_AL ] = 0xFF ;
+    return( true ) ;
+
+  case REDIR_RMDIR :
+  case REDIR_MKDIR :
+    if( !OwnPath( SDA_FILENAME1 ) )
+    {
+      return( false ) ;
+    }
+    Result = MakeDirectory( Regs8b[ REG_AL ] == REDIR_RMDIR ) ;
+    break ;
+
+  case REDIR_CHDIR :
+    if( !OwnPath( SDA_FILENAME1 ) )
+    {
+      return( false ) ;
+    }
+    Result = ChangeDirectory() ;
+    break ;
+
+  case REDIR_CLOSE :
+  case REDIR_COMMIT :
+  case REDIR_READ :
+  case REDIR_WRITE :
+  case REDIR_LOCK :
+  case REDIR_UNLOCK :
+  case REDIR_SEEK_END :
+    if( !OwnSft( Sft ) )
+    {
+      return( false ) ;
+    }
+    switch( Regs8b[ REG_AL ] )
+    {
+    case REDIR_CLOSE :
+      Result = Close( Sft ) ;
+      break ;
+
+    case REDIR_READ :
+    case REDIR_WRITE :
+      Result = ReadWrite( Sft , Regs8b[ REG_AL ] == REDIR_WRITE ) ;
+      break ;
+
+    case REDIR_SEEK_END :
+      {
+        uint32_t Position = Get32( Sft + SFT_SIZE ) + ( ( uint32_t ) Regs[ REG_CX ] << 16 | Regs[ REG_DX ] ) ;
+
+        Put32( Sft + SFT_POSITION , Position ) ;
+        Regs[ REG_DX ] = ( uint16_t ) ( Position >> 16 ) ;
+        Regs[ REG_AX ] = ( uint16_t ) Position ;
+      }
+      break ;
+    }
+    break ;
+
+  case REDIR_GET_SPACE :
+    if( Sft != Cds )
+    {
+      return( false ) ;
+    }
+    GetSpace() ;
+    break ;
+
+  case REDIR_SET_ATTR :
+    if( !OwnPath( SDA_FILENAME1 ) )
+    {
+      return( false ) ;
+    }
+    // Host files keep their own attributes, so only the path is checked.
+    {
+      char Path[ REDIR_MAX_PATH ] ;
+
+      Result = HostPath( Sda + SDA_FILENAME1 , Path , NULL , NULL ) ;
+    }
+    break ;
+
+  case REDIR_GET_ATTR :
+    if( !OwnPath( SDA_FILENAME1 ) )
+    {
+      return( false ) ;
+    }
+    Result = GetAttributes() ;
+    break ;
+
+  case REDIR_RENAME :
+    if( !OwnPath( SDA_FILENAME1 ) )
+    {
+      return( false ) ;
+    }
+    Result = ( OwnPath( SDA_FILENAME2 ) ) ? Rename() : REDIR_ERR_ACCESS_DENIED ;
+    break ;
+
+  case REDIR_DELETE :
+    if( !OwnPath( SDA_FILENAME1 ) )
+    {
+      return( false ) ;
+    }
+    Result = Delete() ;
+    break ;
+
+  case REDIR_OPEN :
+  case REDIR_CREATE :
+  case REDIR_EXT_OPEN :
+    if( !OwnPath( SDA_FILENAME1 ) )
+    {
+      return( false ) ;
+    }
+    if( Regs8b[ REG_AL ] == REDIR_OPEN )
+    {
+      Result = OpenFile( Sft , ( uint8_t ) StackWord() , 0 , true , false , false , &Action ) ;
+    }
+    else if( Regs8b[ REG_AL ] == REDIR_CREATE )
+    {
+      Result = OpenFile( Sft , 2 , ( uint8_t ) StackWord() , true , true , true , &Action ) ;
+    }
+    else
+    {
+      // Action: low nibble 1 opens an existing file and 2 replaces it, high
+      // nibble 1 creates a new one.
+      uint16_t Open = Get16( Sda + SDA_EXT_ACTION ) ;
+
+      Result = OpenFile( Sft , mem[ Sda + SDA_EXT_MODE ] , mem[ Sda + SDA_EXT_ATTR ] ,
+                         ( Open & 0x0F ) != 0 , ( Open & 0xF0 ) != 0 , ( Open & 0x0F ) == 2 , &Action ) ;
+      Regs[ REG_CX ] = Action ;
+    }
+    break ;
+
+  case REDIR_FIND_FIRST :
+    if( !OwnPath( SDA_FILENAME1 ) )
+    {
+      return( false ) ;
+    }
+    Result = FindFirst() ;
+    break ;
+
+  case REDIR_FIND_NEXT :
+    if( mem[ FarPointer( Sda + SDA_DTA ) + SDB_DRIVE ] != ( SDB_NETWORK | Drive ) )
+    {
+      return( false ) ;
+    }
+    Result = FindNext() ;
+    break ;
+
+  default :
+    // Calls that do not name a file, such as flushing buffers or closing
+    // the files of a process, are for every redirector in the chain.
+    return( false ) ;
+  }
+
+  Regs8b[ FLAG_CF ] = ( Result != REDIR_OK ) ;
+  if( Result != REDIR_OK )
+  {
+    Regs[ REG_AX ] = ( uint16_t ) Result ;
+  }
+
+  return( true ) ;
+}
@@ -0,0 +1,133 @@
+// =============================================================================
+// File: XTredir.h
+//
+// Description:
+// Host directory network drive.
+//
+// A host directory can be shown to DOS as a network drive. DOS passes the
+// file operations on a network drive to the network redirector through INT
+// 2Fh function 11h, the interface used by MSCDEX and network clients. The
+// emulator answers these calls for the host drive itself, against the host
+// file system, before the guest's INT 2Fh handlers are run, so files copied
+// to and from the drive go through neither the guest's FAT code, the BIOS
+// nor a disk image.
+//
+// DOS only passes calls for a drive to the redirector once the drive's
+// current directory structure (CDS) marks it as a network drive. The guest
+// program tools/xtmount.asm gets the addresses of the DOS list of lists and
+// swappable data area and gives them to the emulator with the REDIR_MOUNT
+// hypercall, which marks the first unused drive, or the one asked for, as
+// the host drive. DOS 4.0 or later is needed.
+//
+// Host names that are valid 8.3 names are shown as they are, and others
+// are given unique 8.3 names with a ~N tail, as on virtual FAT disks.
+// Hidden host files, whose names start with a dot, are left out. New files
+// and directories take the names the guest gives them.
+//
+// Host files are not part of the machine state, so rewinding or restoring
+// a snapshot does not undo changes to them. Nor are the host files DOS has
+// open, so both unmount the drive, which must then be mounted again. The
+// drive is not available while replaying, running ahead or checking in
+// lockstep, as the guest would see host files change under it.
+//
+// This work is licensed under the MIT License. See included LICENSE.TXT.
+//
+
+#ifndef _XTREDIR_
+#define _XTREDIR_
+
+// =============================================================================
+// Function: REDIR_Initialise
+//
+// Description:
+// Set the host directory shown as the host drive once it is mounted.
+//
+// Parameters:
+//
+//   Path : The host directory, or NULL for no host drive.
+//
+// Returns:
+//
+//   bool : true if the directory can be used.
+//
+bool REDIR_Initialise( const char * Path ) ;
+
+// =============================================================================
+// Function: REDIR_Cleanup
+//
+// Description:
+// Close the host files open on the host drive and remove the drive.
+//
+// Parameters:
+//
+//   None.
+//
+// Returns:
+//
+//   None.
+//
+void REDIR_Cleanup( void ) ;
+
+// =============================================================================
+// Function: REDIR_Reset
+//
+// Description:
+// Unmount the host drive, closing the host files open on it, when the
+// machine is reset, rewound or restored from a snapshot. If DOS still
+// shows the drive it is shown as unused, so DOS stops passing calls for it
+// to the redirector.
+//
+// Parameters:
+//
+//   None.
+//
+// Returns:
+//
+//   None.
+//
+void REDIR_Reset( void ) ;
+
+// =============================================================================
+// Function: REDIR_Mount
+//
+// Description:
+// Service the REDIR_MOUNT hypercall, mounting the host drive.
+//
+//   ES:BX : The DOS list of lists, from INT 21h function 52h.
+//
+//   DS:SI : The DOS swappable data area, from INT 21h function 5D06h.
+//
+//   DL    : The drive to mount on, 1 for A:, or 0 for the first unused
+//           drive from C:.
+//
+// Returns AL = the drive mounted on, 1 for A:, or 0 if the drive cannot be
+// mounted.
+//
+// Parameters:
+//
+//   None.
+//
+// Returns:
+//
+//   None.
+//
+void REDIR_Mount( void ) ;
+
+// =============================================================================
+// Function: REDIR_Interrupt
+//
+// Description:
+// Service an INT 2Fh call from DOS if it is a redirector call for the host
+// drive, leaving other calls to the guest's INT 2Fh handlers.
+//
+// Parameters:
+//
+//   None.
+//
+// Returns:
+//
+//   bool : true if the interrupt was serviced.
+//
+bool REDIR_Interrupt( void ) ;
+
+#endif // _XTREDIR_
@@ -0,0 +1,275 @@
+// =============================================================================
+// File: XTreplay.cpp
+//
+// Description:
+// Deterministic input recording and replay.
+// See XTreplay.h for details.
+//
+// This work is licensed under the MIT License. See included LICENSE.TXT.
+//
+
+#include <stdio.h>
+#include <string.h>
+
+#include "XTreplay.h"
+#include "XTmemory.h"
+#include "XTems.h"
+
+#define REPLAY_MAGIC                             "XTRL"
+#define REPLAY_VERSION                           1
+
+typedef struct STREPLAYHEADER_T
+{
+  char     magic[ 4 ] ;
+  uint32_t version    ;
+} stReplayHeader_t ;
+
+// Each event is a record followed by its data.
+typedef struct STREPLAYRECORD_T
+{
+  uint64_t time     ; // ReplayTime when the event was logged
+  uint16_t type     ;
+  uint16_t length   ;
+  uint32_t reserved ;
+} stReplayRecord_t ;
+
+// =============================================================================
+// Local variables
+//
+
+uint64_t ReplayTime = 0 ;
+
+static int              Mode     = REPLAY_OFF ;
+static FILE           * fp       = NULL ;
+static int              Frames   = 0 ;
+static int              Checks   = 0 ;
+static bool             Diverged = false ;
+
+// The next event to replay.
+static bool             HaveNext = false ;
+static stReplayRecord_t Next ;
+static uint8_t          NextData[ REPLAY_MAX_DATA ] ;
+
+// =============================================================================
+// Local functions
+//
+
+static void WriteEvent( int Type , const void * Data , int Length )
+{
+  stReplayRecord_t Record ;
+
+  Record.time     = ReplayTime ;
+  Record.type     = ( uint16_t ) Type ;
+  Record.length   = ( uint16_t ) Length ;
+  Record.reserved = 0 ;
+
+  fwrite( &Record , sizeof( Record ) , 1 , fp ) ;
+  fwrite( Data , 1 , Length , fp ) ;
+}
+
+// Read the next event to replay. At the end of the log replaying stops and
+// host inputs are taken again.
+static void ReadNext( void )
+{
+  HaveNext = ( fread( &Next , sizeof( Next ) , 1 , fp ) == 1 ) &&
+             ( Next.length <= REPLAY_MAX_DATA ) &&
+             ( fread( NextData , 1 , Next.length , fp ) == Next.length ) ;
+
+  if( !HaveNext )
+  {
+    printf( "Replay: finished at tick %llu, %d state checks %s\n" ,
+            ( unsigned long long ) ReplayTime , Checks , ( Diverged ) ? "with divergence" : "passed" ) ;
+    REPLAY_Cleanup() ;
+  }
+}
+
+// Report the first divergence from the recording.
+static void ReportDivergence( const char * Reason )
+{
+  if( !Diverged )
+  {
+    printf( "Replay: diverged at tick %llu: %s\n" , ( unsigned long long ) ReplayTime , Reason ) ;
+    Diverged = true ;
+  }
+}
+
+// FNV-1a over 64 bit words.
+static uint64_t HashData( uint64_t Hash , const uint8_t * Data , int Length )
+{
+  uint64_t Word ;
+
+  for( int i = 0 ; i + 8 <= Length ; i += 8 )
+  {
+    memcpy( &Word , Data + i , sizeof( Word ) ) ;
+    Hash = ( Hash ^ Word ) * 0x100000001B3ull ;
+  }
+
+  return( Hash ) ;
+}
+
+static uint64_t HashState( void )
+{
+  uint64_t  Hash = 0xCBF29CE484222325ull ;
+  uint8_t * Pages ;
+  int       PageCount ;
+
+  Pages = EMS_GetPages( PageCount ) ;
+
+  Hash = HashData( Hash , mem , RAM_SIZE ) ;
+  Hash = HashData( Hash , io_ports , IO_PORT_COUNT ) ;
+  Hash = HashData( Hash , Pages , PageCount * EMS_PAGE_SIZE ) ;
+
+  return( Hash ) ;
+}
+
+// =============================================================================
+// Exported functions
+//
+
+bool REPLAY_Initialise( int NewMode , const char * Filename )
+{
+  stReplayHeader_t Header ;
+
+  REPLAY_Cleanup() ;
+
+  if( ( NewMode == REPLAY_OFF ) || ( Filename == NULL ) )
+  {
+    return( false ) ;
+  }
+
+  fp = fopen( Filename , ( NewMode == REPLAY_RECORD ) ? "wb" : "rb" ) ;
+  if( fp == NULL )
+  {
+    printf( "Replay: cannot open %s\n" , Filename ) ;
+    return( false ) ;
+  }
+
+  Mode     = NewMode ;
+  Frames   = 0 ;
+  Checks   = 0 ;
+  Diverged = false ;
+
+  if( Mode == REPLAY_RECORD )
+  {
+    memcpy( Header.magic , REPLAY_MAGIC , sizeof( Header.magic ) ) ;
+    Header.version = REPLAY_VERSION ;
+    fwrite( &Header , sizeof( Header ) , 1 , fp ) ;
+  }
+  else if( ( fread( &Header , sizeof( Header ) , 1 , fp ) != 1 ) ||
+           ( memcmp( Header.magic , REPLAY_MAGIC , sizeof( Header.magic ) ) != 0 ) ||
+           ( Header.version != REPLAY_VERSION ) )
+  {
+    printf( "Replay: %s is not a replay log\n" , Filename ) ;
+    REPLAY_Cleanup() ;
+    return( false ) ;
+  }
+  else
+  {
+    ReadNext() ;
+  }
+
+  return( Mode != REPLAY_OFF ) ;
+}
+
+void REPLAY_Cleanup( void )
+{
+  if( fp != NULL )
+  {
+    fclose( fp ) ;
+    fp = NULL ;
+  }
+
+  Mode     = REPLAY_OFF ;
+  HaveNext = false ;
+}
+
+bool REPLAY_Active( void )
+{
+  return( Mode != REPLAY_OFF ) ;
+}
+
+bool REPLAY_Playing( void )
+{
+  return( Mode == REPLAY_PLAY ) ;
+}
+
+void REPLAY_Input( int Type , const void * Data , int Length )
+{
+  if( Mode == REPLAY_RECORD )
+  {
+    WriteEvent( Type , Data , Length ) ;
+  }
+}
+
+bool REPLAY_NextInput( int Type , void * Data , int & Length )
+{
+  if( ( Mode != REPLAY_PLAY ) || !HaveNext ||
+      ( Next.type != Type ) || ( Next.time > ReplayTime ) || ( Next.length > Length ) )
+  {
+    return( false ) ;
+  }
+
+  memcpy( Data , NextData , Next.length ) ;
+  Length = Next.length ;
+
+  ReadNext() ;
+
+  return( true ) ;
+}
+
+void REPLAY_HostData( int Type , void * Data , int Length )
+{
+  if( Mode == REPLAY_RECORD )
+  {
+    WriteEvent( Type , Data , Length ) ;
+  }
+  else if( Mode == REPLAY_PLAY )
+  {
+    if( HaveNext && ( Next.type == Type ) && ( Next.time <= ReplayTime ) && ( Next.length == Length ) )
+    {
+      memcpy( Data , NextData , Length ) ;
+      ReadNext() ;
+    }
+    else
+    {
+      // Keep the host data, the replay is no longer exact anyway.
+      ReportDivergence( "host data requested that was not logged" ) ;
+    }
+  }
+}
+
+void REPLAY_CheckState( void )
+{
+  uint64_t Hash ;
+
+  if( Mode == REPLAY_RECORD )
+  {
+    if( ( Frames++ % REPLAY_HASH_INTERVAL ) == 0 )
+    {
+      Hash = HashState() ;
+      WriteEvent( REPLAY_EVENT_HASH , &Hash , sizeof( Hash ) ) ;
+
+      // Keep the log up to date in case the emulator does not exit cleanly.
+      fflush( fp ) ;
+    }
+  }
+  else if( Mode == REPLAY_PLAY )
+  {
+    // Every input logged before now should have been taken.
+    if( Next.time < ReplayTime )
+    {
+      ReportDivergence( "logged input not taken" ) ;
+    }
+
+    if( ( Next.type == REPLAY_EVENT_HASH ) && ( Next.time <= ReplayTime ) )
+    {
+      memcpy( &Hash , NextData , sizeof( Hash ) ) ;
+      if( Hash != HashState() )
+      {
+        ReportDivergence( "machine state differs" ) ;
+      }
+      Checks++ ;
+      ReadNext() ;
+    }
+  }
+}
@@ -0,0 +1,209 @@
+// =============================================================================
+// File: XTreplay.h
+//
+// Description:
+// Deterministic input recording and replay.
+//
+// Everything that reaches the machine from outside the emulator is an input:
+// key presses, bytes received by the serial ports (including the serial
+// mouse), the real time clock and changes of floppy disk. When recording,
+// each input is written to a log with the emulated CPU tick at which it was
+// taken. When replaying, inputs are taken from the log instead of the host
+// at the same ticks, so the machine runs exactly as it did when recorded,
+// and as there is nothing to wait for it runs as fast as the host allows.
+//
+// A hash of the machine state is logged periodically when recording and
+// checked when replaying to detect the replay diverging from the recording.
+//
+// Replay must start from the machine state recording started from, so the
+// disk images must be as they were then. Disk writes while recording and
+// while replaying go to private overlays and leave the images unchanged, so
+// the same log can be replayed any number of times. Changes made to the
+// disks during a recording are lost when it ends.
+//
+// This work is licensed under the MIT License. See included LICENSE.TXT.
+//
+
+#ifndef _XTREPLAY_
+#define _XTREPLAY_
+
+#include <stdint.h>
+
+// Replay modes.
+#define REPLAY_OFF                               0
+#define REPLAY_RECORD                            1
+#define REPLAY_PLAY                              2
+
+// Input event types. Each module logging inputs defines its own event data.
+#define REPLAY_EVENT_KEY                         1 // Keyboard scan code
+#define REPLAY_EVENT_SERIAL                      2 // Serial port host event
+#define REPLAY_EVENT_RTC                         3 // Real time clock hypercall
+#define REPLAY_EVENT_FD_CHANGE                   4 // Floppy disk image filename
+#define REPLAY_EVENT_RESET                       5 // Machine reset
+#define REPLAY_EVENT_HASH                        6 // Machine state hash
+
+#define REPLAY_MAX_DATA                          1024
+
+// The number of calls to REPLAY_CheckState between state hashes when
+// recording. One call per video frame is about one hash a second.
+#define REPLAY_HASH_INTERVAL                     64
+
+// Emulated CPU ticks since the machine started. The core adds the ticks of
+// each instruction before updating the interface.
+extern uint64_t ReplayTime ;
+
+// =============================================================================
+// Function: REPLAY_Initialise
+//
+// Description:
+// Start recording or replaying. Must be called once guest memory, the
+// expanded memory board and the interface are set up.
+//
+// Parameters:
+//
+//   Mode     : REPLAY_OFF, REPLAY_RECORD or REPLAY_PLAY.
+//
+//   Filename : The log file to write or read.
+//
+// Returns:
+//
+//   bool : true if recording or replaying started.
+//
+bool REPLAY_Initialise( int Mode , const char * Filename ) ;
+
+// =============================================================================
+// Function: REPLAY_Cleanup
+//
+// Description:
+// Finish writing or reading the log.
+//
+// Parameters:
+//
+//   None.
+//
+// Returns:
+//
+//   None.
+//
+void REPLAY_Cleanup( void ) ;
+
+// =============================================================================
+// Function: REPLAY_Active
+//
+// Description:
+// Check if inputs are being recorded or replayed. Anything that changes the
+// machine state other than by running it, such as restoring a snapshot,
+// must not be done while active.
+//
+// Parameters:
+//
+//   None.
+//
+// Returns:
+//
+//   bool : true if recording or replaying.
+//
+bool REPLAY_Active( void ) ;
+
+// =============================================================================
+// Function: REPLAY_Playing
+//
+// Description:
+// Check if inputs are being replayed. While replaying host inputs must be
+// ignored and the emulator should not wait for real time. Replaying stops
+// at the end of the log, after which host inputs are taken again.
+//
+// Parameters:
+//
+//   None.
+//
+// Returns:
+//
+//   bool : true if replaying.
+//
+bool REPLAY_Playing( void ) ;
+
+// =============================================================================
+// Function: REPLAY_Input
+//
+// Description:
+// Log an input from the host at the current tick. Does nothing unless
+// recording.
+//
+// Parameters:
+//
+//   Type   : The event type.
+//
+//   Data   : The event data.
+//
+//   Length : The length of the event data, up to REPLAY_MAX_DATA.
+//
+// Returns:
+//
+//   None.
+//
+void REPLAY_Input( int Type , const void * Data , int Length ) ;
+
+// =============================================================================
+// Function: REPLAY_NextInput
+//
+// Description:
+// Get the next logged input when replaying, if it is of the type given and
+// is due at the current tick. Inputs must be taken at the same points in
+// the same order as they were logged by REPLAY_Input.
+//
+// Parameters:
+//
+//   Type   : The event type.
+//
+//   Data   : Returns the event data.
+//
+//   Length : The size of Data. Returns the length of the event data.
+//
+// Returns:
+//
+//   bool : true if an input was returned.
+//
+bool REPLAY_NextInput( int Type , void * Data , int & Length ) ;
+
+// =============================================================================
+// Function: REPLAY_HostData
+//
+// Description:
+// Log data returned by the host when recording, or replace it with the
+// logged data when replaying.
+//
+// Parameters:
+//
+//   Type   : The event type.
+//
+//   Data   : The host data.
+//
+//   Length : The length of the host data, up to REPLAY_MAX_DATA.
+//
+// Returns:
+//
+//   None.
+//
+void REPLAY_HostData( int Type , void * Data , int Length ) ;
+
+// =============================================================================
+// Function: REPLAY_CheckState
+//
+// Description:
+// Log a hash of the machine state periodically when recording, or check it
+// against the log when replaying. Divergence from the recording is reported
+// once, with the tick at which it was found. Must be called between
+// instructions, once per video frame.
+//
+// Parameters:
+//
+//   None.
+//
+// Returns:
+//
+//   None.
+//
+void REPLAY_CheckState( void ) ;
+
+#endif // _XTREPLAY_
@@ -0,0 +1,367 @@
+// =============================================================================
+// File: XTrewind.cpp
+//
+// Description:
+// Rewind buffer.
+// See XTrewind.h for details.
+//
+// This work is licensed under the MIT License. See included LICENSE.TXT.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "XTrewind.h"
+#include "XTmemory.h"
+#include "XTcpu.h"
+#include "XTems.h"
+#include "XTdisk.h"
+#include "8086tiny_interface.h"
+
+// Core state saved with the CPU.
+extern T8086TinyInterface_t Interface ;
+extern int InstrSinceInt8 ;
+
+// Machine state is compared in these regions.
+#define REWIND_REGION_RAM                        0
+#define REWIND_REGION_IO                         1
+#define REWIND_REGION_EMS_STATE                  2
+#define REWIND_REGION_EMS_PAGES                  3
+#define REWIND_REGION_DEVICES                    4
+#define REWIND_REGION_COUNT                      5
+
+// A saved page is identified by its region and page number.
+#define REWIND_PAGE_ID( region , page )          ( ( ( uint32_t ) ( region ) << 24 ) | ( uint32_t ) ( page ) )
+#define REWIND_ID_REGION( id )                   ( ( id ) >> 24 )
+#define REWIND_ID_PAGE( id )                     ( ( id ) & 0x00FFFFFF )
+
+typedef struct STREWINDREGION_T
+{
+  uint8_t * data   ; // The live state
+  int       length ;
+  uint8_t * ref    ; // The state at the newest checkpoint
+} stRewindRegion_t ;
+
+typedef struct STREWINDENTRY_T
+{
+  stCPUState_t cpu              ;
+  int          instr_since_int8 ;
+  uint32_t     disk_writes      ; // DISK_GetWriteCount when taken
+  int          count            ; // Pages saved
+  uint32_t   * id               ; // The region and page number of each page
+  uint8_t    * data             ; // The pages at the previous checkpoint
+} stRewindEntry_t ;
+
+// =============================================================================
+// Local variables
+//
+
+static bool               Enabled  = false ;
+static bool               RefValid = false ;
+static stRewindRegion_t   Regions[ REWIND_REGION_COUNT ] ;
+static stEMSState_t       EMSState ;
+static uint8_t          * Devices  = NULL ;
+static int                DevicesLength ;
+
+static stRewindEntry_t  * Entries  = NULL ;
+static int                Capacity = 0 ;
+static int                Oldest   = 0 ;
+static int                Count    = 0 ;
+static size_t             Bytes    = 0 ;
+
+// Pages changed since the last checkpoint are collected here.
+static uint32_t         * ScratchId   = NULL ;
+static uint8_t          * ScratchData = NULL ;
+
+// =============================================================================
+// Local functions
+//
+
+static int PageLength( const stRewindRegion_t * Region , int Page )
+{
+  int Length = Region->length - Page * REWIND_PAGE_SIZE ;
+
+  return( ( Length < REWIND_PAGE_SIZE ) ? Length : REWIND_PAGE_SIZE ) ;
+}
+
+static stRewindEntry_t * Entry( int Index )
+{
+  return( &Entries[ ( Oldest + Index ) % Capacity ] ) ;
+}
+
+static void FreeEntry( stRewindEntry_t * Entry )
+{
+  Bytes -= ( size_t ) Entry->count * ( sizeof( uint32_t ) + REWIND_PAGE_SIZE ) ;
+  free( Entry->id ) ;
+  Entry->id    = NULL ;
+  Entry->data  = NULL ;
+  Entry->count = 0 ;
+}
+
+// Drop the oldest checkpoint. The pages saved by the new oldest checkpoint
+// rewind to a checkpoint that is gone, so they are dropped too.
+static void DropOldest( void )
+{
+  FreeEntry( Entry( 0 ) ) ;
+  Oldest = ( Oldest + 1 ) % Capacity ;
+  Count-- ;
+
+  if( Count > 0 )
+  {
+    FreeEntry( Entry( 0 ) ) ;
+  }
+}
+
+// Read the machine state that is not held in place into the regions.
+static void GetState( void )
+{
+  EMS_GetState( &EMSState ) ;
+  Interface.SaveDeviceState( Devices ) ;
+}
+
+// =============================================================================
+// Exported functions
+//
+
+bool REWIND_Initialise( int Checkpoints )
+{
+  int PageCount ;
+  int Total ;
+
+  REWIND_Cleanup() ;
+
+  if( Checkpoints <= 0 )
+  {
+    return( false ) ;
+  }
+
+  DevicesLength = Interface.SaveDeviceState( NULL ) ;
+  Devices       = ( uint8_t * ) malloc( DevicesLength + 1 ) ;
+
+  Regions[ REWIND_REGION_RAM       ].data   = mem ;
+  Regions[ REWIND_REGION_RAM       ].length = RAM_SIZE ;
+  Regions[ REWIND_REGION_IO        ].data   = io_ports ;
+  Regions[ REWIND_REGION_IO        ].length = IO_PORT_COUNT ;
+  Regions[ REWIND_REGION_EMS_STATE ].data   = ( uint8_t * ) &EMSState ;
+  Regions[ REWIND_REGION_EMS_STATE ].length = sizeof( EMSState ) ;
+  Regions[ REWIND_REGION_EMS_PAGES ].data   = EMS_GetPages( PageCount ) ;
+  Regions[ REWIND_REGION_EMS_PAGES ].length = PageCount * EMS_PAGE_SIZE ;
+  Regions[ REWIND_REGION_DEVICES   ].data   = Devices ;
+  Regions[ REWIND_REGION_DEVICES   ].length = DevicesLength ;
+
+  Total = 0 ;
+  for( int i = 0 ; i < REWIND_REGION_COUNT ; i++ )
+  {
+    Regions[ i ].ref = ( uint8_t * ) malloc( Regions[ i ].length + 1 ) ;
+    Total += ( Regions[ i ].length + REWIND_PAGE_SIZE - 1 ) / REWIND_PAGE_SIZE ;
+  }
+
+  Entries     = ( stRewindEntry_t * ) calloc( Checkpoints , sizeof( stRewindEntry_t ) ) ;
+  ScratchId   = ( uint32_t * ) malloc( Total * sizeof( uint32_t ) ) ;
+  ScratchData = ( uint8_t * ) malloc( ( size_t ) Total * REWIND_PAGE_SIZE ) ;
+
+  Enabled = ( Devices != NULL ) && ( Entries != NULL ) && ( ScratchId != NULL ) && ( ScratchData != NULL ) ;
+  for( int i = 0 ; i < REWIND_REGION_COUNT ; i++ )
+  {
+    Enabled = Enabled && ( Regions[ i ].ref != NULL ) ;
+  }
+
+  if( !Enabled )
+  {
+    REWIND_Cleanup() ;
+    return( false ) ;
+  }
+
+  Capacity = Checkpoints ;
+
+  return( true ) ;
+}
+
+void REWIND_Cleanup( void )
+{
+  while( Count > 0 )
+  {
+    DropOldest() ;
+  }
+
+  for( int i = 0 ; i < REWIND_REGION_COUNT ; i++ )
+  {
+    free( Regions[ i ].ref ) ;
+    Regions[ i ].ref = NULL ;
+  }
+
+  free( Devices ) ;
+  free( Entries ) ;
+  free( ScratchId ) ;
+  free( ScratchData ) ;
+  Devices     = NULL ;
+  Entries     = NULL ;
+  ScratchId   = NULL ;
+  ScratchData = NULL ;
+
+  Enabled  = false ;
+  RefValid = false ;
+  Capacity = 0 ;
+  Oldest   = 0 ;
+  Bytes    = 0 ;
+}
+
+void REWIND_Checkpoint( void )
+{
+  stRewindEntry_t  * New ;
+  stRewindRegion_t * Region ;
+  stEMSState_t       Frame ;
+  int                Saved ;
+  int                Offset ;
+  int                Length ;
+
+  if( !Enabled )
+  {
+    return ;
+  }
+
+  // Guest RAM is compared with guest RAM showing in the EMS page frame.
+  GetState() ;
+  Frame = EMSState ;
+  EMS_UnmapFrame() ;
+
+  // Save the old contents of the pages that changed and bring the
+  // reference up to date.
+  Saved = 0 ;
+  for( int i = 0 ; i < REWIND_REGION_COUNT ; i++ )
+  {
+    Region = &Regions[ i ] ;
+    if( !RefValid )
+    {
+      memcpy( Region->ref , Region->data , Region->length ) ;
+      continue ;
+    }
+
+    for( int Page = 0 ; Page * REWIND_PAGE_SIZE < Region->length ; Page++ )
+    {
+      Offset = Page * REWIND_PAGE_SIZE ;
+      Length = PageLength( Region , Page ) ;
+      if( memcmp( Region->data + Offset , Region->ref + Offset , Length ) != 0 )
+      {
+        ScratchId[ Saved ] = REWIND_PAGE_ID( i , Page ) ;
+        memcpy( ScratchData + ( size_t ) Saved * REWIND_PAGE_SIZE , Region->ref + Offset , Length ) ;
+        memcpy( Region->ref + Offset , Region->data + Offset , Length ) ;
+        Saved++ ;
+      }
+    }
+  }
+
+  EMS_SetState( &Frame ) ;
+
+  // Disk contents are not saved, so checkpoints from before a disk write
+  // can no longer be rewound to.
+  if( ( Count > 0 ) && ( Entry( Count - 1 )->disk_writes != DISK_GetWriteCount() ) )
+  {
+    while( Count > 0 )
+    {
+      DropOldest() ;
+    }
+  }
+
+  while( ( Count > 0 ) &&
+         ( ( Count == Capacity ) || ( Bytes + ( size_t ) Saved * ( sizeof( uint32_t ) + REWIND_PAGE_SIZE ) > REWIND_MAX_BYTES ) ) )
+  {
+    DropOldest() ;
+  }
+
+  New = Entry( Count ) ;
+  CPU_GetState( &New->cpu ) ;
+  New->instr_since_int8 = InstrSinceInt8 ;
+  New->disk_writes      = DISK_GetWriteCount() ;
+  New->count            = 0 ;
+  New->id               = NULL ;
+  New->data             = NULL ;
+
+  // The oldest checkpoint never needs its pages.
+  if( ( Count > 0 ) && ( Saved > 0 ) )
+  {
+    New->id = ( uint32_t * ) malloc( ( size_t ) Saved * ( sizeof( uint32_t ) + REWIND_PAGE_SIZE ) ) ;
+    if( New->id == NULL )
+    {
+      // Without the pages the checkpoints before this one are unreachable.
+      while( Count > 0 )
+      {
+        DropOldest() ;
+      }
+      New = Entry( 0 ) ;
+      CPU_GetState( &New->cpu ) ;
+      New->instr_since_int8 = InstrSinceInt8 ;
+      New->disk_writes      = DISK_GetWriteCount() ;
+    }
+    else
+    {
+      New->data  = ( uint8_t * ) ( New->id + Saved ) ;
+      New->count = Saved ;
+      memcpy( New->id , ScratchId , Saved * sizeof( uint32_t ) ) ;
+      memcpy( New->data , ScratchData , ( size_t ) Saved * REWIND_PAGE_SIZE ) ;
+      Bytes += ( size_t ) Saved * ( sizeof( uint32_t ) + REWIND_PAGE_SIZE ) ;
+    }
+  }
+
+  Count++ ;
+  RefValid = true ;
+}
+
+bool REWIND_Rewind( int Back )
+{
+  stRewindEntry_t  * Newest ;
+  stRewindRegion_t * Region ;
+  uint32_t           Id ;
+
+  if( !Enabled || ( Count == 0 ) )
+  {
+    return( false ) ;
+  }
+
+  // All the checkpoints are from after the last disk write but the newest
+  // may be from before one made since.
+  if( Entry( Count - 1 )->disk_writes != DISK_GetWriteCount() )
+  {
+    printf( "Rewind: the disks have been written since the last checkpoint, not rewinding\n" ) ;
+    return( false ) ;
+  }
+
+  if( ( Back < 0 ) || ( Back > Count - 1 ) )
+  {
+    Back = Count - 1 ;
+  }
+
+  // Take the reference back to the target checkpoint.
+  for( ; Back > 0 ; Back-- )
+  {
+    Newest = Entry( Count - 1 ) ;
+    for( int i = 0 ; i < Newest->count ; i++ )
+    {
+      Id     = Newest->id[ i ] ;
+      Region = &Regions[ REWIND_ID_REGION( Id ) ] ;
+      memcpy( Region->ref + REWIND_ID_PAGE( Id ) * REWIND_PAGE_SIZE ,
+              Newest->data + ( size_t ) i * REWIND_PAGE_SIZE ,
+              PageLength( Region , REWIND_ID_PAGE( Id ) ) ) ;
+    }
+    FreeEntry( Newest ) ;
+    Count-- ;
+  }
+
+  // Then the machine. Guest RAM is restored with guest RAM showing in the
+  // EMS page frame.
+  EMS_UnmapFrame() ;
+  for( int i = 0 ; i < REWIND_REGION_COUNT ; i++ )
+  {
+    memcpy( Regions[ i ].data , Regions[ i ].ref , Regions[ i ].length ) ;
+  }
+  EMS_SetState( &EMSState ) ;
+
+  Newest = Entry( Count - 1 ) ;
+  CPU_SetState( &Newest->cpu ) ;
+  InstrSinceInt8 = Newest->instr_since_int8 ;
+
+  Interface.RestoreDeviceState( Devices , DevicesLength , false ) ;
+
+  return( true ) ;
+}
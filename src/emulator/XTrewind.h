@@ -0,0 +1,100 @@
+// =============================================================================
+// File: XTrewind.h
+//
+// Description:
+// Rewind buffer.
+//
+// Checkpoints of the machine are taken periodically and kept in a bounded
+// ring, so the machine can be rewound to any of them. A checkpoint only
+// stores the pages of machine state that changed since the one before it:
+// guest RAM, the I/O port latches, the expanded memory board and the
+// interface device state are compared page by page with a reference copy
+// of the state at the last checkpoint, and the old contents of the pages
+// that differ are kept. Rewinding applies these in reverse.
+//
+// Like snapshots, checkpoints do not include disk contents, so the machine
+// is never rewound past a disk write: checkpoints taken before one are
+// dropped when the next is taken, and rewinding is refused until then.
+//
+// This work is licensed under the MIT License. See included LICENSE.TXT.
+//
+
+#ifndef _XTREWIND_
+#define _XTREWIND_
+
+#include <stdint.h>
+
+#define REWIND_PAGE_SIZE                         0x800     // 2KB, the memory map page size
+#define REWIND_MAX_BYTES                         0x4000000 // 64MB of saved pages in the ring
+
+// =============================================================================
+// Function: REWIND_Initialise
+//
+// Description:
+// Set up the rewind buffer. Must be called once guest memory, the expanded
+// memory board and the interface are set up.
+//
+// Parameters:
+//
+//   Checkpoints : The most checkpoints to keep, 0 to disable rewinding.
+//
+// Returns:
+//
+//   bool : true if rewinding is enabled.
+//
+bool REWIND_Initialise( int Checkpoints ) ;
+
+// =============================================================================
+// Function: REWIND_Cleanup
+//
+// Description:
+// Release the rewind buffer.
+//
+// Parameters:
+//
+//   None.
+//
+// Returns:
+//
+//   None.
+//
+void REWIND_Cleanup( void ) ;
+
+// =============================================================================
+// Function: REWIND_Checkpoint
+//
+// Description:
+// Add a checkpoint of the current machine state, dropping the oldest if the
+// ring is full or holds more than REWIND_MAX_BYTES of saved pages. Must be
+// called between instructions.
+//
+// Parameters:
+//
+//   None.
+//
+// Returns:
+//
+//   None.
+//
+void REWIND_Checkpoint( void ) ;
+
+// =============================================================================
+// Function: REWIND_Rewind
+//
+// Description:
+// Rewind the machine to an earlier checkpoint. Checkpoints newer than that
+// one are discarded. Must be called between instructions.
+//
+// Parameters:
+//
+//   Back : The number of checkpoints to go back from the newest, 0 for the
+//          newest. Larger values go back to the oldest checkpoint.
+//
+// Returns:
+//
+//   bool : true if the machine was rewound, false if there are no
+//          checkpoints or the disks were written since the newest.
+//
+bool REWIND_Rewind( int Back ) ;
+
+#endif // _XTREWIND_
@@ -0,0 +1,177 @@
+// =============================================================================
+// File: XTrunahead.cpp
+//
+// Description:
+// Run-ahead state.
+// See XTrunahead.h for details.
+//
+// This work is licensed under the MIT License. See included LICENSE.TXT.
+//
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "XTrunahead.h"
+#include "XTmemory.h"
+#include "XTcpu.h"
+#include "XTems.h"
+#include "XTdisk.h"
+#include "8086tiny_interface.h"
+
+// Core state saved with the CPU.
+extern T8086TinyInterface_t Interface ;
+extern int InstrSinceInt8 ;
+
+// State is compared and copied in memory map pages.
+#define RUNAHEAD_PAGE_SIZE                       ( 1 << MEM_PAGE_SHIFT )
+
+#define RUNAHEAD_REGION_RAM                      0
+#define RUNAHEAD_REGION_IO                       1
+#define RUNAHEAD_REGION_EMS_PAGES                2
+#define RUNAHEAD_REGION_COUNT                    3
+
+typedef struct STRUNAHEADREGION_T
+{
+  uint8_t * data   ; // The live state
+  int       length ;
+  uint8_t * saved  ;
+} stRunAheadRegion_t ;
+
+// =============================================================================
+// Local variables
+//
+
+static bool               Enabled = false ;
+static stRunAheadRegion_t Regions[ RUNAHEAD_REGION_COUNT ] ;
+static stCPUState_t       CPUState ;
+static int                SavedInstrSinceInt8 ;
+static stEMSState_t       EMSState ;
+static uint8_t          * Devices = NULL ;
+static int                DevicesLength ;
+
+// =============================================================================
+// Local functions
+//
+
+// Copy the pages that differ. Pages left alone stay shared with any process
+// they were mapped copy-on-write from. Guest is set when To is guest RAM,
+// so devices mapped over it are told which pages changed.
+static void CopyChanged( uint8_t * To , const uint8_t * From , int Length , bool Guest )
+{
+  int Page ;
+
+  for( int Offset = 0 ; Offset < Length ; Offset += RUNAHEAD_PAGE_SIZE )
+  {
+    Page = ( Length - Offset < RUNAHEAD_PAGE_SIZE ) ? Length - Offset : RUNAHEAD_PAGE_SIZE ;
+    if( memcmp( To + Offset , From + Offset , Page ) != 0 )
+    {
+      memcpy( To + Offset , From + Offset , Page ) ;
+      if( Guest )
+      {
+        MEM_HostWrite( Offset , Page ) ;
+      }
+    }
+  }
+}
+
+// =============================================================================
+// Exported functions
+//
+
+bool RUNAHEAD_Initialise( int Frames )
+{
+  int PageCount ;
+
+  RUNAHEAD_Cleanup() ;
+
+  if( Frames <= 0 )
+  {
+    return( false ) ;
+  }
+
+  DevicesLength = Interface.SaveDeviceState( NULL ) ;
+  Devices       = ( uint8_t * ) malloc( DevicesLength + 1 ) ;
+
+  Regions[ RUNAHEAD_REGION_RAM       ].data   = mem ;
+  Regions[ RUNAHEAD_REGION_RAM       ].length = RAM_SIZE ;
+  Regions[ RUNAHEAD_REGION_IO        ].data   = io_ports ;
+  Regions[ RUNAHEAD_REGION_IO        ].length = IO_PORT_COUNT ;
+  Regions[ RUNAHEAD_REGION_EMS_PAGES ].data   = EMS_GetPages( PageCount ) ;
+  Regions[ RUNAHEAD_REGION_EMS_PAGES ].length = PageCount * EMS_PAGE_SIZE ;
+
+  Enabled = ( Devices != NULL ) ;
+  for( int i = 0 ; i < RUNAHEAD_REGION_COUNT ; i++ )
+  {
+    // Calloc, so pages that start as zero in both are never copied.
+    Regions[ i ].saved = ( uint8_t * ) calloc( Regions[ i ].length + 1 , 1 ) ;
+    Enabled = Enabled && ( Regions[ i ].saved != NULL ) ;
+  }
+
+  if( !Enabled )
+  {
+    RUNAHEAD_Cleanup() ;
+  }
+
+  return( Enabled ) ;
+}
+
+void RUNAHEAD_Cleanup( void )
+{
+  for( int i = 0 ; i < RUNAHEAD_REGION_COUNT ; i++ )
+  {
+    free( Regions[ i ].saved ) ;
+    Regions[ i ].saved = NULL ;
+  }
+
+  free( Devices ) ;
+  Devices = NULL ;
+  Enabled = false ;
+}
+
+bool RUNAHEAD_Save( void )
+{
+  if( !Enabled )
+  {
+    return( false ) ;
+  }
+
+  CPU_GetState( &CPUState ) ;
+  SavedInstrSinceInt8 = InstrSinceInt8 ;
+  Interface.SaveDeviceState( Devices ) ;
+
+  // Guest RAM is saved with guest RAM showing in the EMS page frame.
+  EMS_GetState( &EMSState ) ;
+  EMS_UnmapFrame() ;
+  for( int i = 0 ; i < RUNAHEAD_REGION_COUNT ; i++ )
+  {
+    CopyChanged( Regions[ i ].saved , Regions[ i ].data , Regions[ i ].length , false ) ;
+  }
+  EMS_SetState( &EMSState ) ;
+
+  // Disk writes made running ahead are thrown away by RUNAHEAD_Load.
+  DISK_SetScratch( true ) ;
+
+  return( true ) ;
+}
+
+void RUNAHEAD_Load( void )
+{
+  if( !Enabled )
+  {
+    return ;
+  }
+
+  EMS_UnmapFrame() ;
+  for( int i = 0 ; i < RUNAHEAD_REGION_COUNT ; i++ )
+  {
+    CopyChanged( Regions[ i ].data , Regions[ i ].saved , Regions[ i ].length , i == RUNAHEAD_REGION_RAM ) ;
+  }
+  EMS_SetState( &EMSState ) ;
+
+  CPU_SetState( &CPUState ) ;
+  InstrSinceInt8 = SavedInstrSinceInt8 ;
+  Interface.RestoreDeviceState( Devices , DevicesLength , true ) ;
+
+  DISK_SetScratch( false ) ;
+}
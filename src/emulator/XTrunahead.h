@@ -0,0 +1,92 @@
+// =============================================================================
+// File: XTrunahead.h
+//
+// Description:
+// Run-ahead state.
+//
+// To show the response to input sooner, the interface can present a frame
+// from a few frames in the future: at the end of each frame the machine
+// state is saved, the machine runs ahead with the current input until the
+// frame to present, and the saved state is loaded again. The state is held
+// in memory and only the pages that changed are copied each way, so saving
+// and loading costs a compare of guest memory rather than a copy of it.
+//
+// Disk writes made while running ahead go to scratch blocks that loading
+// throws away, and disk accesses are left out of the disk statistics and
+// boot traces, so only the frames run for real reach the disks.
+//
+// This work is licensed under the MIT License. See included LICENSE.TXT.
+//
+
+#ifndef _XTRUNAHEAD_
+#define _XTRUNAHEAD_
+
+// =============================================================================
+// Function: RUNAHEAD_Initialise
+//
+// Description:
+// Set up the run-ahead state. Must be called once guest memory, the
+// expanded memory board and the interface are set up.
+//
+// Parameters:
+//
+//   Frames : The number of frames the interface runs ahead, 0 to disable
+//            running ahead.
+//
+// Returns:
+//
+//   bool : true if running ahead is enabled.
+//
+bool RUNAHEAD_Initialise( int Frames ) ;
+
+// =============================================================================
+// Function: RUNAHEAD_Cleanup
+//
+// Description:
+// Release the run-ahead state.
+//
+// Parameters:
+//
+//   None.
+//
+// Returns:
+//
+//   None.
+//
+void RUNAHEAD_Cleanup( void ) ;
+
+// =============================================================================
+// Function: RUNAHEAD_Save
+//
+// Description:
+// Save the machine state before running ahead and set the disks to
+// scratch mode. Must be called between instructions.
+//
+// Parameters:
+//
+//   None.
+//
+// Returns:
+//
+//   bool : true if the state was saved, false if running ahead is disabled.
+//
+bool RUNAHEAD_Save( void ) ;
+
+// =============================================================================
+// Function: RUNAHEAD_Load
+//
+// Description:
+// Load the machine state saved by RUNAHEAD_Save, discarding everything the
+// machine did while running ahead. Must be called between instructions.
+//
+// Parameters:
+//
+//   None.
+//
+// Returns:
+//
+//   None.
+//
+void RUNAHEAD_Load( void ) ;
+
+#endif // _XTRUNAHEAD_
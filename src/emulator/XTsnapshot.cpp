@@ -0,0 +1,1105 @@
+// =============================================================================
+// File: XTsnapshot.cpp
+//
+// Description:
+// Machine snapshots.
+// See XTsnapshot.h for a description of the snapshot file.
+//
+// This work is licensed under the MIT License. See included LICENSE.TXT.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#if defined( _WIN32 )
+  #include <windows.h>
+#else
+  #include <fcntl.h>
+  #include <unistd.h>
+  #include <sys/mman.h>
+  #include <sys/stat.h>
+  #include <sys/wait.h>
+  #include <errno.h>
+#endif
+
+#include "XTsnapshot.h"
+#include "XTmemory.h"
+#include "XTems.h"
+#include "XTdisk.h"
+#include "XTlz.h"
+#include "8086tiny_interface.h"
+
+// Core state saved with the CPU.
+extern T8086TinyInterface_t Interface ;
+extern int InstrSinceInt8 ;
+
+// A snapshot file mapped for reading.
+typedef struct STMAPPEDFILE_T
+{
+  const uint8_t * Data   ;
+  uint64_t        Length ;
+#if defined( _WIN32 )
+  HANDLE          File    ;
+  HANDLE          Mapping ;
+#else
+  int             File    ;
+#endif
+} stMappedFile_t ;
+
+// A section found in a snapshot file.
+typedef struct STSNAPCONTENT_T
+{
+  const uint8_t * Data     ;
+  uint64_t        Length   ; // Length in the file
+  uint32_t        Encoding ;
+} stSnapContent_t ;
+
+// Section data in memory, in up to two parts.
+typedef struct STSNAPBUFFER_T
+{
+  uint8_t * Data[ 2 ]   ;
+  uint64_t  Length[ 2 ] ;
+} stSnapBuffer_t ;
+
+// A snapshot file being written.
+typedef struct STSNAPWRITER_T
+{
+  FILE           * File   ;
+  stSnapHeader_t   Header ;
+  uint64_t         Align  ; // Section alignment
+} stSnapWriter_t ;
+
+// A snapshot file checked against the machine.
+typedef struct STSNAPIMAGE_T
+{
+  stMappedFile_t          Map     ;
+  const stSnapMachine_t * Machine ;
+  stSnapContent_t         RAM     ;
+  stSnapContent_t         IO      ;
+  stSnapContent_t         EMS     ;
+  stSnapContent_t         Devices ;
+} stSnapImage_t ;
+
+// =============================================================================
+// Local functions
+//
+
+static bool MapFile( const char * Filename , stMappedFile_t * Map )
+{
+#if defined( _WIN32 )
+  LARGE_INTEGER Size ;
+
+  Map->Data    = NULL ;
+  Map->Mapping = NULL ;
+  Map->File    = CreateFile( Filename , GENERIC_READ , FILE_SHARE_READ , NULL , OPEN_EXISTING , FILE_ATTRIBUTE_NORMAL , NULL ) ;
+  if( Map->File == INVALID_HANDLE_VALUE )
+  {
+    return( false ) ;
+  }
+
+  if( GetFileSizeEx( Map->File , &Size ) && ( Size.QuadPart > 0 ) )
+  {
+    Map->Length  = Size.QuadPart ;
+    Map->Mapping = CreateFileMapping( Map->File , NULL , PAGE_READONLY , 0 , 0 , NULL ) ;
+    if( Map->Mapping != NULL )
+    {
+      Map->Data = ( const uint8_t * ) MapViewOfFile( Map->Mapping , FILE_MAP_READ , 0 , 0 , 0 ) ;
+    }
+  }
+
+  if( Map->Data == NULL )
+  {
+    if( Map->Mapping != NULL )
+    {
+      CloseHandle( Map->Mapping ) ;
+    }
+    CloseHandle( Map->File ) ;
+    return( false ) ;
+  }
+#else
+  struct stat Info ;
+  void * Data ;
+
+  Map->File = open( Filename , O_RDONLY ) ;
+  if( Map->File < 0 )
+  {
+    return( false ) ;
+  }
+
+  Data = MAP_FAILED ;
+  if( ( fstat( Map->File , &Info ) == 0 ) && ( Info.st_size > 0 ) )
+  {
+    Map->Length = Info.st_size ;
+    Data = mmap( NULL , Map->Length , PROT_READ , MAP_PRIVATE , Map->File , 0 ) ;
+  }
+
+  if( Data == MAP_FAILED )
+  {
+    close( Map->File ) ;
+    return( false ) ;
+  }
+
+  Map->Data = ( const uint8_t * ) Data ;
+#endif
+
+  return( true ) ;
+}
+
+static void UnmapFile( stMappedFile_t * Map )
+{
+#if defined( _WIN32 )
+  UnmapViewOfFile( ( LPCVOID ) Map->Data ) ;
+  CloseHandle( Map->Mapping ) ;
+  CloseHandle( Map->File ) ;
+#else
+  munmap( ( void * ) Map->Data , Map->Length ) ;
+  close( Map->File ) ;
+#endif
+}
+
+// Get the identity of a disk image.
+static void IdentifyDisk( const char * Filename , stSnapDisk_t * Disk )
+{
+  uint8_t Sector[ 512 ] ;
+  FILE  * fp ;
+  size_t  Count ;
+
+  memset( Disk , 0 , sizeof( stSnapDisk_t ) ) ;
+  Disk->size = -1 ;
+
+  if( Filename == NULL )
+  {
+    return ;
+  }
+
+  strncpy( Disk->filename , Filename , SNAP_MAX_PATH - 1 ) ;
+
+  fp = fopen( Filename , "rb" ) ;
+  if( fp == NULL )
+  {
+    return ;
+  }
+
+  Count = fread( Sector , 1 , sizeof( Sector ) , fp ) ;
+  fseek( fp , 0 , SEEK_END ) ;
+  Disk->size = ftell( fp ) ;
+  fclose( fp ) ;
+
+  Disk->sector_hash = 2166136261u ;
+  for( size_t i = 0 ; i < Count ; i++ )
+  {
+    Disk->sector_hash = ( Disk->sector_hash ^ Sector[ i ] ) * 16777619u ;
+  }
+}
+
+static void IdentifyDisks( stSnapDisk_t * Disks )
+{
+  IdentifyDisk( Interface.GetHDImageFilename() , &Disks[ 0 ] ) ;
+  IdentifyDisk( Interface.GetFDImageFilename() , &Disks[ 1 ] ) ;
+  IdentifyDisk( Interface.GetBIOSFilename() , &Disks[ 2 ] ) ;
+}
+
+static void GetMachine( stSnapMachine_t * Machine )
+{
+  memset( Machine , 0 , sizeof( stSnapMachine_t ) ) ;
+  Machine->cpu_model        = Interface.GetCPUModel() ;
+  Machine->fpu_mode         = Interface.GetFPUMode() ;
+  Machine->a20_enabled      = Interface.GetA20Enabled() ;
+  Machine->ems_size         = Interface.GetEMSSize() ;
+  Machine->ems_frame        = Interface.GetEMSFrame() ;
+  Machine->instr_since_int8 = InstrSinceInt8 ;
+  CPU_GetState( &Machine->cpu ) ;
+}
+
+static stSnapBuffer_t MakeBuffer( void * Data1 , uint64_t Length1 , void * Data2 , uint64_t Length2 )
+{
+  stSnapBuffer_t Buffer ;
+
+  Buffer.Data[ 0 ]   = ( uint8_t * ) Data1 ;
+  Buffer.Length[ 0 ] = Length1 ;
+  Buffer.Data[ 1 ]   = ( uint8_t * ) Data2 ;
+  Buffer.Length[ 1 ] = Length2 ;
+
+  return( Buffer ) ;
+}
+
+// Get part of a buffer in place, or NULL if it spans both parts.
+static uint8_t * BufferAt( const stSnapBuffer_t * Buffer , uint64_t Offset , int Length )
+{
+  if( Offset + Length <= Buffer->Length[ 0 ] )
+  {
+    return( Buffer->Data[ 0 ] + Offset ) ;
+  }
+
+  if( Offset >= Buffer->Length[ 0 ] )
+  {
+    return( Buffer->Data[ 1 ] + ( Offset - Buffer->Length[ 0 ] ) ) ;
+  }
+
+  return( NULL ) ;
+}
+
+// Copy between part of a buffer and Data, whichever parts it spans.
+static void CopyBuffer( const stSnapBuffer_t * Buffer , uint64_t Offset , uint8_t * Data , uint64_t Length , bool ToBuffer )
+{
+  uint64_t Part ;
+
+  for( int i = 0 ; ( i < 2 ) && ( Length > 0 ) ; i++ )
+  {
+    if( Offset >= Buffer->Length[ i ] )
+    {
+      Offset -= Buffer->Length[ i ] ;
+      continue ;
+    }
+
+    Part = Buffer->Length[ i ] - Offset ;
+    Part = ( Part < Length ) ? Part : Length ;
+    if( ToBuffer )
+    {
+      memcpy( Buffer->Data[ i ] + Offset , Data , Part ) ;
+    }
+    else
+    {
+      memcpy( Data , Buffer->Data[ i ] + Offset , Part ) ;
+    }
+
+    Data   += Part ;
+    Length -= Part ;
+    Offset  = 0 ;
+  }
+}
+
+static int PageLength( uint64_t Length , uint32_t Page )
+{
+  uint64_t Rest = Length - ( uint64_t ) Page * SNAP_PAGE_SIZE ;
+
+  return( ( Rest < SNAP_PAGE_SIZE ) ? ( int ) Rest : SNAP_PAGE_SIZE ) ;
+}
+
+// FNV-1a hash of a page, to find pages equal to an earlier one.
+static uint64_t HashPage( const uint8_t * Data , int Length )
+{
+  uint64_t Hash = 14695981039346656037ull ;
+
+  for( int i = 0 ; i < Length ; i++ )
+  {
+    Hash = ( Hash ^ Data[ i ] ) * 1099511628211ull ;
+  }
+
+  return( Hash ) ;
+}
+
+// Write page encoded section data.
+static bool WritePages( FILE * fp , const stSnapBuffer_t * Source , uint64_t & Written )
+{
+  stSnapPages_t   Pages ;
+  uint8_t         Page[ SNAP_PAGE_SIZE ] ;
+  uint8_t         Other[ SNAP_PAGE_SIZE ] ;
+  uint8_t         Packed[ SNAP_PAGE_SIZE ] ;
+  const uint8_t * Data ;
+  const uint8_t * Body ;
+  const uint8_t * Earlier ;
+  uint64_t      * Hashes ;
+  uint32_t      * Table ;
+  uint32_t        TableSize ;
+  uint32_t        Slot ;
+  uint32_t        Record ;
+  int             Length ;
+  int             BodyLength ;
+  bool            Ok ;
+
+  Pages.length     = Source->Length[ 0 ] + Source->Length[ 1 ] ;
+  Pages.page_size  = SNAP_PAGE_SIZE ;
+  Pages.page_count = ( uint32_t ) ( ( Pages.length + SNAP_PAGE_SIZE - 1 ) / SNAP_PAGE_SIZE ) ;
+
+  // Pages that are not zero or repeats are hashed into an open addressed
+  // table, kept at most half full.
+  for( TableSize = 1 ; TableSize < 2 * Pages.page_count ; TableSize <<= 1 )
+  {
+  }
+  Hashes = ( uint64_t * ) malloc( ( Pages.page_count + 1 ) * sizeof( uint64_t ) ) ;
+  Table  = ( uint32_t * ) calloc( TableSize , sizeof( uint32_t ) ) ;
+
+  Ok      = ( Hashes != NULL ) && ( Table != NULL ) && ( fwrite( &Pages , sizeof( Pages ) , 1 , fp ) == 1 ) ;
+  Written = sizeof( Pages ) ;
+
+  for( uint32_t i = 0 ; Ok && ( i < Pages.page_count ) ; i++ )
+  {
+    Length = PageLength( Pages.length , i ) ;
+    Data   = BufferAt( Source , ( uint64_t ) i * SNAP_PAGE_SIZE , Length ) ;
+    if( Data == NULL )
+    {
+      CopyBuffer( Source , ( uint64_t ) i * SNAP_PAGE_SIZE , Page , Length , false ) ;
+      Data = Page ;
+    }
+
+    Record     = SNAP_PAGE_RECORD( SNAP_PAGE_ZERO , 0 ) ;
+    Body       = Data ;
+    BodyLength = 0 ;
+
+    if( ( Data[ 0 ] != 0 ) || ( memcmp( Data , Data + 1 , Length - 1 ) != 0 ) )
+    {
+      Hashes[ i ] = HashPage( Data , Length ) ;
+      for( Slot = Hashes[ i ] & ( TableSize - 1 ) ; Table[ Slot ] != 0 ; Slot = ( Slot + 1 ) & ( TableSize - 1 ) )
+      {
+        uint32_t j = Table[ Slot ] - 1 ;
+
+        if( Hashes[ j ] != Hashes[ i ] )
+        {
+          continue ;
+        }
+
+        Earlier = BufferAt( Source , ( uint64_t ) j * SNAP_PAGE_SIZE , Length ) ;
+        if( Earlier == NULL )
+        {
+          CopyBuffer( Source , ( uint64_t ) j * SNAP_PAGE_SIZE , Other , Length , false ) ;
+          Earlier = Other ;
+        }
+
+        if( memcmp( Earlier , Data , Length ) == 0 )
+        {
+          Record = SNAP_PAGE_RECORD( SNAP_PAGE_SAME , j ) ;
+          break ;
+        }
+      }
+
+      if( Table[ Slot ] == 0 )
+      {
+        Table[ Slot ] = i + 1 ;
+
+        // Pages that do not get smaller are stored.
+        BodyLength = LZ_Compress( Data , Length , Packed , Length - 1 ) ;
+        if( BodyLength > 0 )
+        {
+          Record = SNAP_PAGE_RECORD( SNAP_PAGE_PACKED , BodyLength ) ;
+          Body   = Packed ;
+        }
+        else
+        {
+          Record     = SNAP_PAGE_RECORD( SNAP_PAGE_STORED , 0 ) ;
+          BodyLength = Length ;
+        }
+      }
+    }
+
+    Ok = ( fwrite( &Record , sizeof( Record ) , 1 , fp ) == 1 ) &&
+         ( ( BodyLength == 0 ) || ( fwrite( Body , 1 , BodyLength , fp ) == ( size_t ) BodyLength ) ) ;
+    Written += sizeof( Record ) + BodyLength ;
+  }
+
+  free( Hashes ) ;
+  free( Table ) ;
+
+  return( Ok ) ;
+}
+
+// Check the page records of page encoded section data fit the section and
+// describe the expected length. Packed pages are only checked as they are
+// decoded, by ReadSection, so each is decompressed once.
+static bool CheckPages( const stSnapContent_t * Content , uint64_t Length )
+{
+  stSnapPages_t Pages ;
+  uint64_t      In ;
+  uint32_t      Record ;
+  uint32_t      Value ;
+  int           Page ;
+
+  if( Content->Length < sizeof( Pages ) )
+  {
+    return( false ) ;
+  }
+
+  memcpy( &Pages , Content->Data , sizeof( Pages ) ) ;
+  if( ( Pages.length != Length ) || ( Pages.page_size != SNAP_PAGE_SIZE ) ||
+      ( Pages.page_count != ( Length + SNAP_PAGE_SIZE - 1 ) / SNAP_PAGE_SIZE ) )
+  {
+    return( false ) ;
+  }
+
+  In = sizeof( Pages ) ;
+  for( uint32_t i = 0 ; i < Pages.page_count ; i++ )
+  {
+    if( Content->Length - In < sizeof( Record ) )
+    {
+      return( false ) ;
+    }
+    memcpy( &Record , Content->Data + In , sizeof( Record ) ) ;
+    In += sizeof( Record ) ;
+
+    Value = SNAP_PAGE_VALUE( Record ) ;
+    Page  = PageLength( Length , i ) ;
+    switch( SNAP_PAGE_KIND( Record ) )
+    {
+    case SNAP_PAGE_ZERO :
+      break ;
+
+    case SNAP_PAGE_SAME :
+      if( Value >= i )
+      {
+        return( false ) ;
+      }
+      break ;
+
+    case SNAP_PAGE_PACKED :
+      if( ( Value == 0 ) || ( Value > Content->Length - In ) )
+      {
+        return( false ) ;
+      }
+      In += Value ;
+      break ;
+
+    case SNAP_PAGE_STORED :
+      if( ( uint64_t ) Page > Content->Length - In )
+      {
+        return( false ) ;
+      }
+      In += Page ;
+      break ;
+    }
+  }
+
+  return( In == Content->Length ) ;
+}
+
+// Read section data checked by FindSection into a buffer. Page encoded
+// data is decoded a page at a time straight into place.
+// Returns false if a packed page does not decode, in which case the buffer
+// is left partly written.
+static bool ReadSection( const stSnapContent_t * Content , stSnapBuffer_t Target )
+{
+  stSnapPages_t   Pages ;
+  uint8_t         Page[ SNAP_PAGE_SIZE ] ;
+  uint8_t       * To ;
+  uint8_t       * From ;
+  uint64_t        In ;
+  uint32_t        Record ;
+  uint32_t        Value ;
+  int             Length ;
+
+  if( Content->Encoding == SNAP_ENCODING_RAW )
+  {
+    CopyBuffer( &Target , 0 , ( uint8_t * ) Content->Data , Content->Length , true ) ;
+    return( true ) ;
+  }
+
+  memcpy( &Pages , Content->Data , sizeof( Pages ) ) ;
+
+  In = sizeof( Pages ) ;
+  for( uint32_t i = 0 ; i < Pages.page_count ; i++ )
+  {
+    memcpy( &Record , Content->Data + In , sizeof( Record ) ) ;
+    In += sizeof( Record ) ;
+
+    Value  = SNAP_PAGE_VALUE( Record ) ;
+    Length = PageLength( Pages.length , i ) ;
+    To     = BufferAt( &Target , ( uint64_t ) i * SNAP_PAGE_SIZE , Length ) ;
+    if( To == NULL )
+    {
+      To = Page ;
+    }
+
+    switch( SNAP_PAGE_KIND( Record ) )
+    {
+    case SNAP_PAGE_ZERO :
+      memset( To , 0 , Length ) ;
+      break ;
+
+    case SNAP_PAGE_SAME :
+      From = BufferAt( &Target , ( uint64_t ) Value * SNAP_PAGE_SIZE , Length ) ;
+      if( From != NULL )
+      {
+        memcpy( To , From , Length ) ;
+      }
+      else
+      {
+        CopyBuffer( &Target , ( uint64_t ) Value * SNAP_PAGE_SIZE , To , Length , false ) ;
+      }
+      break ;
+
+    case SNAP_PAGE_PACKED :
+      if( !LZ_Decompress( Content->Data + In , Value , To , Length ) )
+      {
+        return( false ) ;
+      }
+      In += Value ;
+      break ;
+
+    case SNAP_PAGE_STORED :
+      memcpy( To , Content->Data + In , Length ) ;
+      In += Length ;
+      break ;
+    }
+
+    if( To == Page )
+    {
+      CopyBuffer( &Target , ( uint64_t ) i * SNAP_PAGE_SIZE , Page , Length , true ) ;
+    }
+  }
+
+  return( true ) ;
+}
+
+// Write a section at the next aligned offset and add it to the header.
+static bool WriteSection( stSnapWriter_t * Writer , uint32_t Id , uint32_t Encoding , const void * Data1 , uint64_t Length1 , const void * Data2 , uint64_t Length2 )
+{
+  stSnapHeader_t  * Header  = &Writer->Header ;
+  stSnapSection_t * Section = &Header->section[ Header->count++ ] ;
+  uint64_t          Offset  = sizeof( stSnapHeader_t ) ;
+  uint64_t          Written ;
+  stSnapBuffer_t    Source ;
+  bool              Ok ;
+
+  if( Header->count > 1 )
+  {
+    Offset = Section[ -1 ].offset + Section[ -1 ].length ;
+  }
+  Offset = ( Offset + Writer->Align - 1 ) & ~( Writer->Align - 1 ) ;
+
+  Section->id       = Id ;
+  Section->encoding = Encoding ;
+  Section->offset   = Offset ;
+
+  if( fseek( Writer->File , ( long ) Offset , SEEK_SET ) != 0 )
+  {
+    return( false ) ;
+  }
+
+  if( Encoding == SNAP_ENCODING_PAGES )
+  {
+    Source = MakeBuffer( ( void * ) Data1 , Length1 , ( void * ) Data2 , Length2 ) ;
+    Ok     = WritePages( Writer->File , &Source , Written ) ;
+  }
+  else
+  {
+    Written = Length1 + Length2 ;
+    Ok      = ( fwrite( Data1 , 1 , Length1 , Writer->File ) == Length1 ) &&
+              ( ( Length2 == 0 ) || ( fwrite( Data2 , 1 , Length2 , Writer->File ) == Length2 ) ) ;
+  }
+
+  Section->length = Written ;
+
+  return( Ok ) ;
+}
+
+// Find a section and check it holds the expected length of data.
+static bool FindSection( const stMappedFile_t * Map , uint32_t Id , uint64_t Length , stSnapContent_t * Content )
+{
+  const stSnapHeader_t * Header = ( const stSnapHeader_t * ) Map->Data ;
+
+  for( uint32_t i = 0 ; i < Header->count ; i++ )
+  {
+    const stSnapSection_t * Section = &Header->section[ i ] ;
+
+    if( Section->id == Id )
+    {
+      if( ( Section->offset > Map->Length ) ||
+          ( Section->length > Map->Length - Section->offset ) )
+      {
+        return( false ) ;
+      }
+
+      Content->Data     = Map->Data + Section->offset ;
+      Content->Length   = Section->length ;
+      Content->Encoding = Section->encoding ;
+
+      switch( Section->encoding )
+      {
+      case SNAP_ENCODING_RAW :
+        return( Section->length == Length ) ;
+      case SNAP_ENCODING_PAGES :
+        return( CheckPages( Content , Length ) ) ;
+      default :
+        return( false ) ;
+      }
+    }
+  }
+
+  return( false ) ;
+}
+
+// Find a section that must be stored as is, aligned to be used in place.
+static const uint8_t * FindRawSection( const stMappedFile_t * Map , uint32_t Id , uint64_t Length )
+{
+  stSnapContent_t Content ;
+
+  if( !FindSection( Map , Id , Length , &Content ) || ( Content.Encoding != SNAP_ENCODING_RAW ) ||
+      ( ( Content.Data - Map->Data ) % SNAP_PACKED_ALIGN != 0 ) )
+  {
+    return( NULL ) ;
+  }
+
+  return( Content.Data ) ;
+}
+
+// Map a snapshot and check it can be restored on this machine.
+static int OpenSnapshot( const char * Filename , stSnapImage_t * Image )
+{
+  const stSnapHeader_t  * Header ;
+  const stSnapMachine_t * Saved ;
+  const stSnapDisk_t    * SavedDisks ;
+  stSnapMachine_t         Machine ;
+  stSnapDisk_t            Disks[ DISK_COUNT ] ;
+  int                     PageCount ;
+  int                     Result = SNAP_OK ;
+
+  if( !MapFile( Filename , &Image->Map ) )
+  {
+    return( SNAP_ERR_FILE ) ;
+  }
+
+  EMS_GetPages( PageCount ) ;
+
+  Header = ( const stSnapHeader_t * ) Image->Map.Data ;
+  if( ( Image->Map.Length < sizeof( stSnapHeader_t ) ) ||
+      ( memcmp( Header->magic , SNAP_MAGIC , sizeof( Header->magic ) ) != 0 ) ||
+      ( Header->version < 1 ) || ( Header->version > SNAP_VERSION ) ||
+      ( Header->count > SNAP_MAX_SECTIONS ) )
+  {
+    UnmapFile( &Image->Map ) ;
+    return( SNAP_ERR_FORMAT ) ;
+  }
+
+  Saved          = ( const stSnapMachine_t * ) FindRawSection( &Image->Map , SNAP_SECTION_MACHINE , sizeof( stSnapMachine_t ) ) ;
+  SavedDisks     = ( const stSnapDisk_t * ) FindRawSection( &Image->Map , SNAP_SECTION_DISKS , sizeof( Disks ) ) ;
+  Image->Machine = Saved ;
+
+  GetMachine( &Machine ) ;
+  IdentifyDisks( Disks ) ;
+
+  if( ( Saved == NULL ) || ( SavedDisks == NULL ) ||
+      !FindSection( &Image->Map , SNAP_SECTION_RAM , RAM_SIZE , &Image->RAM ) ||
+      !FindSection( &Image->Map , SNAP_SECTION_IO , IO_PORT_COUNT , &Image->IO ) )
+  {
+    Result = SNAP_ERR_FORMAT ;
+  }
+  else if( ( Saved->cpu_model != Machine.cpu_model ) || ( Saved->fpu_mode != Machine.fpu_mode ) ||
+           ( Saved->a20_enabled != Machine.a20_enabled ) || ( Saved->ems_size != Machine.ems_size ) ||
+           ( Saved->ems_frame != Machine.ems_frame ) ||
+           !FindSection( &Image->Map , SNAP_SECTION_EMS , sizeof( stEMSState_t ) + ( uint64_t ) PageCount * EMS_PAGE_SIZE , &Image->EMS ) )
+  {
+    Result = SNAP_ERR_CONFIG ;
+  }
+  else if( !FindSection( &Image->Map , SNAP_SECTION_DEVICES , Interface.SaveDeviceState( NULL ) , &Image->Devices ) )
+  {
+    Result = SNAP_ERR_DEVICES ;
+  }
+  else
+  {
+    for( int i = 0 ; i < DISK_COUNT ; i++ )
+    {
+      if( ( strncmp( SavedDisks[ i ].filename , Disks[ i ].filename , SNAP_MAX_PATH ) != 0 ) ||
+          ( SavedDisks[ i ].size != Disks[ i ].size ) ||
+          ( SavedDisks[ i ].sector_hash != Disks[ i ].sector_hash ) )
+      {
+        Result = SNAP_ERR_DISK ;
+      }
+    }
+  }
+
+  if( Result != SNAP_OK )
+  {
+    UnmapFile( &Image->Map ) ;
+  }
+
+  return( Result ) ;
+}
+
+// Restore the machine from a checked snapshot. A clone maps guest RAM from
+// the file and gets expanded memory and disk overlays of its own, so it
+// shares nothing it can write with the process that started it.
+static int ApplySnapshot( const char * Filename , const stSnapImage_t * Image , bool Clone )
+{
+  const uint8_t * SavedPages ;
+  stEMSState_t    EMSState ;
+  int             PageCount ;
+  uint8_t       * Pages ;
+  uint8_t       * Devices ;
+  int             DevicesLength ;
+
+  DevicesLength = Interface.SaveDeviceState( NULL ) ;
+  Devices       = ( uint8_t * ) malloc( DevicesLength + 1 ) ;
+  if( Devices == NULL )
+  {
+    return( SNAP_ERR_FILE ) ;
+  }
+  // Nothing has been restored yet if the device state does not decode.
+  if( !ReadSection( &Image->Devices , MakeBuffer( Devices , DevicesLength , NULL , 0 ) ) )
+  {
+    free( Devices ) ;
+    return( SNAP_ERR_FORMAT ) ;
+  }
+
+  // RAM was saved with guest RAM showing in the EMS page frame.
+  if( Clone )
+  {
+    // SNAP_Clone only starts clones of uncompressed snapshots.
+    SavedPages = Image->EMS.Data + sizeof( stEMSState_t ) ;
+    memcpy( &EMSState , Image->EMS.Data , sizeof( EMSState ) ) ;
+
+    EMS_Cleanup() ;
+
+    if( !MEM_MapImage( Filename , Image->RAM.Data - Image->Map.Data ) ||
+        ( ( Image->Machine->ems_size > 0 ) && !EMS_Initialise( Image->Machine->ems_size , Image->Machine->ems_frame ) ) )
+    {
+      free( Devices ) ;
+      return( SNAP_ERR_CLONE ) ;
+    }
+
+    // Only pages allocated to a handle are copied, free pages read as zero.
+    Pages = EMS_GetPages( PageCount ) ;
+    for( int i = 0 ; i < PageCount ; i++ )
+    {
+      if( EMSState.owner[ i ] != 0xFF )
+      {
+        memcpy( Pages + i * EMS_PAGE_SIZE , SavedPages + i * EMS_PAGE_SIZE , EMS_PAGE_SIZE ) ;
+      }
+    }
+
+    for( int i = 0 ; i < DISK_COUNT ; i++ )
+    {
+      if( !DISK_SetOverlay( i ) )
+      {
+        free( Devices ) ;
+        return( SNAP_ERR_CLONE ) ;
+      }
+    }
+  }
+  else
+  {
+    EMS_UnmapFrame() ;
+    Pages = EMS_GetPages( PageCount ) ;
+    if( !ReadSection( &Image->RAM , MakeBuffer( mem , RAM_SIZE , NULL , 0 ) ) ||
+        !ReadSection( &Image->EMS , MakeBuffer( &EMSState , sizeof( EMSState ) , Pages , ( uint64_t ) PageCount * EMS_PAGE_SIZE ) ) )
+    {
+      free( Devices ) ;
+      return( SNAP_ERR_DAMAGED ) ;
+    }
+  }
+
+  EMS_SetState( &EMSState ) ;
+
+  if( !ReadSection( &Image->IO , MakeBuffer( io_ports , IO_PORT_COUNT , NULL , 0 ) ) )
+  {
+    free( Devices ) ;
+    return( SNAP_ERR_DAMAGED ) ;
+  }
+  CPU_SetState( &Image->Machine->cpu ) ;
+  InstrSinceInt8 = Image->Machine->instr_since_int8 ;
+
+  Interface.RestoreDeviceState( Devices , DevicesLength , false ) ;
+  free( Devices ) ;
+
+  return( SNAP_OK ) ;
+}
+
+#if defined( _WIN32 )
+
+// Set in the environment of a clone process to its clone number.
+#define SNAP_CLONE_VARIABLE                      "TINYXT_CLONE"
+
+// Wait for a clone to exit.
+static void WaitClone( HANDLE * Clones , int & Running )
+{
+  DWORD Done ;
+
+  Done = WaitForMultipleObjects( Running , Clones , FALSE , INFINITE ) - WAIT_OBJECT_0 ;
+  if( Done >= ( DWORD ) Running )
+  {
+    Done = 0 ;
+  }
+
+  CloseHandle( Clones[ Done ] ) ;
+  Clones[ Done ] = Clones[ --Running ] ;
+}
+
+#else
+
+// Wait for a clone to exit.
+static void WaitClone( int & Running )
+{
+  while( ( wait( NULL ) < 0 ) && ( errno == EINTR ) )
+  {
+  }
+
+  Running-- ;
+}
+
+#endif
+
+// =============================================================================
+// Exported functions
+//
+
+int SNAP_Save( const char * Filename , bool Compress )
+{
+  stSnapWriter_t  Writer ;
+  stSnapMachine_t Machine ;
+  stSnapDisk_t    Disks[ DISK_COUNT ] ;
+  stEMSState_t    EMS ;
+  uint8_t       * Pages ;
+  uint8_t       * Devices ;
+  int             PageCount ;
+  int             DevicesLength ;
+  uint32_t        Encoding ;
+  bool            Ok ;
+  FILE          * fp ;
+
+  // Replace the file rather than rewrite it, as clones may have it mapped.
+  remove( Filename ) ;
+
+  fp = fopen( Filename , "wb" ) ;
+  if( fp == NULL )
+  {
+    return( SNAP_ERR_FILE ) ;
+  }
+
+  DevicesLength = Interface.SaveDeviceState( NULL ) ;
+  Devices       = ( uint8_t * ) malloc( DevicesLength + 1 ) ;
+  if( Devices == NULL )
+  {
+    fclose( fp ) ;
+    return( SNAP_ERR_FILE ) ;
+  }
+  Interface.SaveDeviceState( Devices ) ;
+
+  GetMachine( &Machine ) ;
+  IdentifyDisks( Disks ) ;
+
+  memset( &Writer , 0 , sizeof( Writer ) ) ;
+  memcpy( Writer.Header.magic , SNAP_MAGIC , sizeof( Writer.Header.magic ) ) ;
+  Writer.Header.version = SNAP_VERSION ;
+  Writer.File           = fp ;
+
+  // Only uncompressed snapshots need the RAM section aligned for mapping.
+  Writer.Align = ( Compress ) ? SNAP_PACKED_ALIGN : SNAP_ALIGN ;
+  Encoding     = ( Compress ) ? SNAP_ENCODING_PAGES : SNAP_ENCODING_RAW ;
+
+  // RAM is saved with guest RAM showing in the EMS page frame.
+  EMS_GetState( &EMS ) ;
+  EMS_UnmapFrame() ;
+  Pages = EMS_GetPages( PageCount ) ;
+
+  Ok = WriteSection( &Writer , SNAP_SECTION_RAM , Encoding , mem , RAM_SIZE , NULL , 0 ) &&
+       WriteSection( &Writer , SNAP_SECTION_MACHINE , SNAP_ENCODING_RAW , &Machine , sizeof( Machine ) , NULL , 0 ) &&
+       WriteSection( &Writer , SNAP_SECTION_IO , Encoding , io_ports , IO_PORT_COUNT , NULL , 0 ) &&
+       WriteSection( &Writer , SNAP_SECTION_EMS , Encoding , &EMS , sizeof( EMS ) , Pages , ( uint64_t ) PageCount * EMS_PAGE_SIZE ) &&
+       WriteSection( &Writer , SNAP_SECTION_DISKS , SNAP_ENCODING_RAW , Disks , sizeof( Disks ) , NULL , 0 ) &&
+       WriteSection( &Writer , SNAP_SECTION_DEVICES , Encoding , Devices , DevicesLength , NULL , 0 ) ;
+
+  EMS_SetState( &EMS ) ;
+  free( Devices ) ;
+
+  // The header is written last, so an incomplete file is not a snapshot.
+  Ok = Ok && ( fseek( fp , 0 , SEEK_SET ) == 0 ) && ( fwrite( &Writer.Header , sizeof( Writer.Header ) , 1 , fp ) == 1 ) ;
+  Ok = ( fclose( fp ) == 0 ) && Ok ;
+
+  if( !Ok )
+  {
+    remove( Filename ) ;
+    return( SNAP_ERR_FILE ) ;
+  }
+
+  return( SNAP_OK ) ;
+}
+
+int SNAP_Restore( const char * Filename )
+{
+  stSnapImage_t Image ;
+  int           Result ;
+
+  Result = OpenSnapshot( Filename , &Image ) ;
+  if( Result == SNAP_OK )
+  {
+    Result = ApplySnapshot( Filename , &Image , false ) ;
+    UnmapFile( &Image.Map ) ;
+  }
+
+  return( Result ) ;
+}
+
+int SNAP_Clone( const char * Filename , int Count , int Parallel , int & Index )
+{
+  Index = -1 ;
+
+#if defined( _WIN32 )
+  stSnapImage_t       Image ;
+  STARTUPINFO         Startup ;
+  PROCESS_INFORMATION Process ;
+  HANDLE              Clones[ MAXIMUM_WAIT_OBJECTS ] ;
+  char                Program[ MAX_PATH ] ;
+  char              * CommandLine ;
+  char                Value[ 16 ] ;
+  int                 Result ;
+  int                 Running ;
+
+  Result = OpenSnapshot( Filename , &Image ) ;
+  if( Result != SNAP_OK )
+  {
+    return( Result ) ;
+  }
+
+  // Clones map guest RAM and read expanded memory from the file as is.
+  if( ( Image.RAM.Encoding != SNAP_ENCODING_RAW ) || ( Image.EMS.Encoding != SNAP_ENCODING_RAW ) )
+  {
+    UnmapFile( &Image.Map ) ;
+    return( SNAP_ERR_CLONE ) ;
+  }
+
+  // A clone is this program run again with its clone number in the
+  // environment. It starts its machine from the same configuration, so it
+  // gets here and only has to restore the snapshot.
+  if( GetEnvironmentVariable( SNAP_CLONE_VARIABLE , Value , sizeof( Value ) ) > 0 )
+  {
+    Index  = atoi( Value ) ;
+    Result = ApplySnapshot( Filename , &Image , true ) ;
+    UnmapFile( &Image.Map ) ;
+    return( Result ) ;
+  }
+
+  // Clones open the disk images for themselves, so no writes may be left
+  // waiting in this process.
+  DISK_Flush() ;
+  fflush( stdout ) ;
+
+  CommandLine = strdup( GetCommandLine() ) ;
+  if( ( CommandLine == NULL ) || ( GetModuleFileName( NULL , Program , sizeof( Program ) ) == 0 ) )
+  {
+    free( CommandLine ) ;
+    UnmapFile( &Image.Map ) ;
+    return( SNAP_ERR_CLONE ) ;
+  }
+
+  if( ( Parallel <= 0 ) || ( Parallel > MAXIMUM_WAIT_OBJECTS ) )
+  {
+    Parallel = MAXIMUM_WAIT_OBJECTS ;
+  }
+
+  Running = 0 ;
+  for( int i = 0 ; ( i < Count ) && ( Result == SNAP_OK ) ; i++ )
+  {
+    if( Running >= Parallel )
+    {
+      WaitClone( Clones , Running ) ;
+    }
+
+    memset( &Startup , 0 , sizeof( Startup ) ) ;
+    Startup.cb = sizeof( Startup ) ;
+    sprintf( Value , "%d" , i ) ;
+
+    if( SetEnvironmentVariable( SNAP_CLONE_VARIABLE , Value ) &&
+        CreateProcess( Program , CommandLine , NULL , NULL , FALSE , 0 , NULL , NULL , &Startup , &Process ) )
+    {
+      CloseHandle( Process.hThread ) ;
+      Clones[ Running++ ] = Process.hProcess ;
+    }
+    else
+    {
+      Result = SNAP_ERR_CLONE ;
+    }
+  }
+
+  SetEnvironmentVariable( SNAP_CLONE_VARIABLE , NULL ) ;
+  free( CommandLine ) ;
+
+  while( Running > 0 )
+  {
+    WaitClone( Clones , Running ) ;
+  }
+
+  UnmapFile( &Image.Map ) ;
+
+  return( Result ) ;
+#else
+  stSnapImage_t Image ;
+  stEMSState_t  EMS ;
+  int           Result ;
+  int           Running ;
+  pid_t         Pid ;
+
+  Result = OpenSnapshot( Filename , &Image ) ;
+  if( Result != SNAP_OK )
+  {
+    return( Result ) ;
+  }
+
+  // Clones map guest RAM and read expanded memory from the file as is.
+  if( ( Image.RAM.Encoding != SNAP_ENCODING_RAW ) || ( Image.EMS.Encoding != SNAP_ENCODING_RAW ) )
+  {
+    UnmapFile( &Image.Map ) ;
+    return( SNAP_ERR_CLONE ) ;
+  }
+
+  // Clones replace guest memory without touching what this process sees
+  // in the page frame, so take the frame down while forking.
+  EMS_GetState( &EMS ) ;
+  EMS_UnmapFrame() ;
+  fflush( stdout ) ;
+
+  // The disk writer thread would not run in the clones, so no writes may
+  // be waiting for it.
+  DISK_Flush() ;
+
+  Running = 0 ;
+  for( int i = 0 ; ( i < Count ) && ( Result == SNAP_OK ) ; i++ )
+  {
+    if( ( Parallel > 0 ) && ( Running >= Parallel ) )
+    {
+      WaitClone( Running ) ;
+    }
+
+    Pid = fork() ;
+    if( Pid == 0 )
+    {
+      Index  = i ;
+      Result = ApplySnapshot( Filename , &Image , true ) ;
+      UnmapFile( &Image.Map ) ;
+      return( Result ) ;
+    }
+
+    if( Pid < 0 )
+    {
+      Result = SNAP_ERR_CLONE ;
+    }
+    else
+    {
+      Running++ ;
+    }
+  }
+
+  while( Running > 0 )
+  {
+    WaitClone( Running ) ;
+  }
+
+  EMS_SetState( &EMS ) ;
+  UnmapFile( &Image.Map ) ;
+
+  return( Result ) ;
+#endif
+}
+
+const char * SNAP_ErrorText( int Result )
+{
+  switch( Result )
+  {
+  case SNAP_OK :
+    return( "OK" ) ;
+  case SNAP_ERR_FILE :
+    return( "The snapshot file could not be written or read" ) ;
+  case SNAP_ERR_FORMAT :
+    return( "Not a snapshot from this version of the emulator" ) ;
+  case SNAP_ERR_CONFIG :
+    return( "The snapshot was saved with a different machine configuration" ) ;
+  case SNAP_ERR_DISK :
+    return( "The snapshot was saved with different disk or BIOS images" ) ;
+  case SNAP_ERR_DEVICES :
+    return( "The snapshot device state does not match this interface" ) ;
+  case SNAP_ERR_CLONE :
+    return( "A clone of the machine could not be started" ) ;
+  case SNAP_ERR_DAMAGED :
+    return( "The snapshot is damaged, the machine has been reset" ) ;
+  default :
+    return( "Unknown error" ) ;
+  }
+}
@@ -0,0 +1,222 @@
+// =============================================================================
+// File: XTsnapshot.h
+//
+// Description:
+// Machine snapshots.
+//
+// A snapshot holds the complete machine state: guest RAM, the CPU and
+// coprocessor, the I/O port latches, the expanded memory board, the state
+// of the devices emulated by the interface (PIC, PIT, keyboard, video and
+// serial ports) and the identity of each disk image. Disk contents are not
+// included, so a snapshot can only be restored with the same disk images.
+//
+// The file starts with a header listing the sections. Each section starts
+// on a SNAP_ALIGN boundary, which is the Win32 allocation granularity, so
+// the RAM section is an exact image of guest memory that can be mapped in
+// place. Structures are stored in host layout, so snapshots are only
+// portable between hosts with the same layout.
+//
+// A compressed snapshot stores the RAM, I/O, EMS and device sections page
+// encoded and packs all sections without alignment. Page encoded data is a
+// stSnapPages_t followed by one record per SNAP_PAGE_SIZE page: a uint32_t
+// with the page kind in the top 2 bits and a value in the rest, followed by
+// the page data for packed and stored pages. Zero pages and pages equal to
+// an earlier page of the section take only their record, and the reader
+// decodes each page straight into place.
+//
+// Clones are machines started in child processes from the same snapshot.
+// Their guest RAM is mapped copy-on-write from the RAM section, so starting
+// a clone costs the pages it writes rather than a copy of memory and a boot.
+// This needs an uncompressed snapshot.
+//
+// This work is licensed under the MIT License. See included LICENSE.TXT.
+//
+
+#ifndef _XTSNAPSHOT_
+#define _XTSNAPSHOT_
+
+#include <stdint.h>
+
+#include "XTcpu.h"
+
+#define SNAP_MAGIC                               "TXTSNAP"  // 8 bytes with the terminator
+#define SNAP_VERSION                             2         // Version 1 snapshots are also read
+#define SNAP_ALIGN                               0x10000
+#define SNAP_PACKED_ALIGN                        16        // Section alignment in compressed snapshots
+#define SNAP_MAX_SECTIONS                        16
+#define SNAP_MAX_PATH                            1024
+
+// Sections
+#define SNAP_SECTION_MACHINE                     1 // stSnapMachine_t
+#define SNAP_SECTION_RAM                         2 // RAM_SIZE bytes of guest memory
+#define SNAP_SECTION_IO                          3 // IO_PORT_COUNT port latches
+#define SNAP_SECTION_EMS                         4 // stEMSState_t then the expanded memory pages
+#define SNAP_SECTION_DISKS                       5 // stSnapDisk_t for the HD, FD and BIOS images
+#define SNAP_SECTION_DEVICES                     6 // Interface device state
+
+// Section encodings
+#define SNAP_ENCODING_RAW                        0 // The data as is
+#define SNAP_ENCODING_PAGES                      1 // Page encoded, see above
+
+// Page encoding
+#define SNAP_PAGE_SIZE                           0x1000
+#define SNAP_PAGE_KIND( record )                 ( ( record ) >> 30 )
+#define SNAP_PAGE_VALUE( record )                ( ( record ) & 0x3FFFFFFF )
+#define SNAP_PAGE_RECORD( kind , value )         ( ( ( uint32_t ) ( kind ) << 30 ) | ( uint32_t ) ( value ) )
+#define SNAP_PAGE_ZERO                           0 // All zero, no data
+#define SNAP_PAGE_SAME                           1 // Same as the earlier page whose number is the value, no data
+#define SNAP_PAGE_PACKED                         2 // Value bytes of XTlz.h compressed data follow
+#define SNAP_PAGE_STORED                         3 // The page follows as is
+
+// Results
+#define SNAP_OK                                  0
+#define SNAP_ERR_FILE                            1 // The file could not be written or read
+#define SNAP_ERR_FORMAT                          2 // Not a snapshot of this version and host
+#define SNAP_ERR_CONFIG                          3 // Saved with a different machine configuration
+#define SNAP_ERR_DISK                            4 // Saved with different disk images
+#define SNAP_ERR_DEVICES                         5 // The interface rejected the device state
+#define SNAP_ERR_CLONE                           6 // A clone could not be started
+#define SNAP_ERR_DAMAGED                         7 // Compressed data did not decode part way through restoring
+
+// Snapshot requests from the interface
+#define SNAP_REQUEST_NONE                        0
+#define SNAP_REQUEST_SAVE                        1
+#define SNAP_REQUEST_RESTORE                     2
+#define SNAP_REQUEST_CHECKPOINT                  3 // Add a rewind checkpoint, see XTrewind.h
+#define SNAP_REQUEST_REWIND                      4 // Rewind to the oldest checkpoint
+#define SNAP_REQUEST_RUNAHEAD                    5 // Save the state and run ahead, see XTrunahead.h
+#define SNAP_REQUEST_RUNAHEAD_END                6 // Load the state saved before running ahead
+
+typedef struct STSNAPSECTION_T
+{
+  uint32_t id       ;
+  uint32_t encoding ; // SNAP_ENCODING_ value, 0 in version 1
+  uint64_t offset   ;
+  uint64_t length   ; // Length in the file
+} stSnapSection_t ;
+
+typedef struct STSNAPHEADER_T
+{
+  char            magic[ 8 ] ;
+  uint32_t        version    ;
+  uint32_t        count      ; // Sections used
+  stSnapSection_t section[ SNAP_MAX_SECTIONS ] ;
+} stSnapHeader_t ;
+
+// Start of page encoded section data.
+typedef struct STSNAPPAGES_T
+{
+  uint64_t length     ; // Length of the data once decoded
+  uint32_t page_size  ; // SNAP_PAGE_SIZE
+  uint32_t page_count ;
+} stSnapPages_t ;
+
+// The machine configuration must match when a snapshot is restored.
+typedef struct STSNAPMACHINE_T
+{
+  int32_t      cpu_model        ;
+  int32_t      fpu_mode         ;
+  int32_t      a20_enabled      ;
+  int32_t      ems_size         ;
+  int32_t      ems_frame        ;
+  int32_t      instr_since_int8 ;
+  stCPUState_t cpu              ;
+} stSnapMachine_t ;
+
+// A disk image is identified by its file name, size and first sector.
+typedef struct STSNAPDISK_T
+{
+  char     filename[ SNAP_MAX_PATH ] ;
+  int64_t  size                      ; // -1 if no image
+  uint32_t sector_hash               ; // FNV-1a hash of the first 512 bytes
+  uint32_t reserved                  ;
+} stSnapDisk_t ;
+
+// =============================================================================
+// Function: SNAP_Save
+//
+// Description:
+// Save the machine state. Must be called between instructions.
+//
+// Parameters:
+//
+//   Filename : The snapshot file to create.
+//
+//   Compress : true to save a compressed snapshot.
+//
+// Returns:
+//
+//   int : SNAP_OK or one of the SNAP_ERR_ values.
+//
+int SNAP_Save( const char * Filename , bool Compress ) ;
+
+// =============================================================================
+// Function: SNAP_Restore
+//
+// Description:
+// Restore the machine state from a snapshot. Must be called between
+// instructions. The snapshot is checked before anything is changed, so the
+// machine is unchanged if restoring fails, except with SNAP_ERR_DAMAGED.
+// Compressed pages are only checked as they are decoded into place, so
+// then the machine is partly restored and must be reset.
+//
+// Parameters:
+//
+//   Filename : The snapshot file to read.
+//
+// Returns:
+//
+//   int : SNAP_OK or one of the SNAP_ERR_ values.
+//
+int SNAP_Restore( const char * Filename ) ;
+
+// =============================================================================
+// Function: SNAP_Clone
+//
+// Description:
+// Start clones of the machine from a snapshot. Each clone is a child
+// process which restores the snapshot, with guest RAM mapped copy-on-write
+// from the file, and which gets its own expanded memory and private
+// overlays on its disk images. Expanded memory pages not allocated to a
+// handle read as zero in a clone. The calling process waits for the clones
+// to exit and its own machine is left as it was.
+// Clones need an uncompressed snapshot. They are forked where the host
+// allows it. On Win32 each clone runs the program again, with the same
+// command line, and this function restores the snapshot when it is called
+// in the clone. At most MAXIMUM_WAIT_OBJECTS clones run at once there.
+//
+// Parameters:
+//
+//   Filename : The snapshot file.
+//
+//   Count    : The number of clones.
+//
+//   Parallel : The most clones to run at once, 0 for no limit.
+//
+//   Index    : Set to the clone number, from 0 to Count - 1, in each clone
+//              and to -1 in the calling process.
+//
+// Returns:
+//
+//   int : SNAP_OK or one of the SNAP_ERR_ values. A clone must exit if
+//         restoring the snapshot failed.
+//
+int SNAP_Clone( const char * Filename , int Count , int Parallel , int & Index ) ;
+
+// =============================================================================
+// Function: SNAP_ErrorText
+//
+// Description:
+// Describe a snapshot result.
+//
+// Parameters:
+//
+//   Result : A result returned by SNAP_Save or SNAP_Restore.
+//
+// Returns:
+//
+//   const char * : The description.
+//
+const char * SNAP_ErrorText( int Result ) ;
+
+#endif // _XTSNAPSHOT_
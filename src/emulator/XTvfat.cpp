@@ -0,0 +1,904 @@
+// =============================================================================
+// File: XTvfat.cpp
+//
+// Description:
+// Virtual FAT disks made from host directories.
+// See XTvfat.h for details.
+//
+// This work is licensed under the MIT License. See included LICENSE.TXT.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <ctype.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+
+#if defined( _WIN32 )
+  #include <windows.h>
+#else
+  #include <dirent.h>
+#endif
+
+#include "XTvfat.h"
+
+#ifndef O_BINARY
+  #define O_BINARY                               0
+#endif
+
+#define VFAT_SECTOR_SIZE                         512
+#define VFAT_ENTRY_SIZE                          32
+#define VFAT_MAX_PATH                            1024
+#define VFAT_MAX_DEPTH                           16
+#define VFAT_MAX_ENTRIES                         4096 // Entries in a subdirectory
+
+// Hard disk geometry. The BIOS gives the disk 63 sectors per track and
+// 1024 cylinders once it has more than one head.
+#define VFAT_HD_SECTORS                          63
+#define VFAT_HD_CYLINDERS                        1024
+#define VFAT_HD_MAX_HEADS                        64 // Keeps FAT16 clusters to 32KB
+#define VFAT_HD_ROOT_ENTRIES                     512
+#define VFAT_HD_SPARE                            0x1000000 // 16MB free at least
+
+// Directory entry attributes
+#define VFAT_ATTR_DIRECTORY                      0x10
+#define VFAT_ATTR_ARCHIVE                        0x20
+
+#define VFAT_DELETED                             0xE5
+
+typedef struct STVFATNODE_T
+{
+  char     Name[ 11 ] ; // 8.3 name, space padded
+  uint8_t  Attributes ;
+  uint16_t Time       ;
+  uint16_t Date       ;
+  uint32_t Size       ; // 0 for directories
+  uint32_t Cluster    ; // First cluster, 0 if none
+  uint32_t Clusters   ;
+  bool     Skipped    ; // Did not fit on the disk
+  int      Parent     ;
+  int      FirstChild ; // Children are consecutive nodes
+  int      ChildCount ;
+  char   * HostPath   ;
+} stVFatNode_t ;
+
+// A host directory entry.
+typedef struct STVFATHOSTENTRY_T
+{
+  char     Name[ VFAT_MAX_PATH ] ;
+  bool     Directory ;
+  uint32_t Size      ;
+  uint16_t Time      ;
+  uint16_t Date      ;
+} stVFatHostEntry_t ;
+
+struct STVFAT_T
+{
+  stVFatNode_t * Nodes        ; // Node 0 is the root directory
+  int            NodeCount    ;
+  int            NodeSize     ;
+  int          * ByCluster    ; // Nodes with clusters, in cluster order
+  int            ByClusterCount ;
+
+  bool           Partitioned  ; // Hard disks have a partition table
+  bool           Fat16        ;
+  uint32_t       TotalSectors ;
+  uint32_t       Start        ; // First sector of the volume
+  uint32_t       VolumeSectors ;
+  uint16_t       SectorsPerTrack ;
+  uint16_t       Heads        ;
+  uint8_t        Media        ;
+  uint32_t       SectorsPerCluster ;
+  uint32_t       RootEntries  ;
+  uint32_t       FatSectors   ;
+  uint32_t       Clusters     ;
+  uint32_t       RootStart    ; // Volume sectors
+  uint32_t       DataStart    ;
+
+  int            OpenNode     ; // The host file open for reading, -1 if none
+  int            OpenFile     ;
+} ;
+
+// =============================================================================
+// Local functions
+//
+
+static void Put16( uint8_t * Data , uint16_t Value )
+{
+  Data[ 0 ] = ( uint8_t ) Value ;
+  Data[ 1 ] = ( uint8_t ) ( Value >> 8 ) ;
+}
+
+static void Put32( uint8_t * Data , uint32_t Value )
+{
+  Put16( Data , ( uint16_t ) Value ) ;
+  Put16( Data + 2 , ( uint16_t ) ( Value >> 16 ) ) ;
+}
+
+static int CompareEntries( const void * a , const void * b )
+{
+  return( strcmp( ( ( const stVFatHostEntry_t * ) a )->Name , ( ( const stVFatHostEntry_t * ) b )->Name ) ) ;
+}
+
+// List a host directory, sorted by name.
+// Returns the number of entries, or -1 if the directory cannot be read.
+static int ListDirectory( const char * Path , stVFatHostEntry_t ** List )
+{
+  stVFatHostEntry_t * Entries = NULL ;
+  stVFatHostEntry_t * Entry ;
+  int                 Count = 0 ;
+  int                 Size  = 0 ;
+
+#if defined( _WIN32 )
+  WIN32_FIND_DATAA Find ;
+  FILETIME         Local ;
+  HANDLE           Handle ;
+  char             Pattern[ VFAT_MAX_PATH ] ;
+
+  snprintf( Pattern , sizeof( Pattern ) , "%s\\*" , Path ) ;
+  Handle = FindFirstFileA( Pattern , &Find ) ;
+  if( Handle == INVALID_HANDLE_VALUE )
+  {
+    return( -1 ) ;
+  }
+
+  do
+  {
+    // FAT files are at most 4GB - 1.
+    if( ( Find.cFileName[ 0 ] == '.' ) || ( Find.nFileSizeHigh != 0 ) )
+    {
+      continue ;
+    }
+#else
+  struct dirent * Dirent ;
+  struct stat     Stat ;
+  struct tm     * Time ;
+  char            Name[ VFAT_MAX_PATH ] ;
+  DIR           * Dir ;
+
+  Dir = opendir( Path ) ;
+  if( Dir == NULL )
+  {
+    return( -1 ) ;
+  }
+
+  while( ( Dirent = readdir( Dir ) ) != NULL )
+  {
+    snprintf( Name , sizeof( Name ) , "%s/%s" , Path , Dirent->d_name ) ;
+    if( ( Dirent->d_name[ 0 ] == '.' ) || ( stat( Name , &Stat ) != 0 ) ||
+        !( S_ISDIR( Stat.st_mode ) || S_ISREG( Stat.st_mode ) ) || ( ( uint64_t ) Stat.st_size > 0xFFFFFFFFull ) )
+    {
+      continue ;
+    }
+#endif
+
+    if( Count == Size )
+    {
+      Size    = ( Size == 0 ) ? 64 : Size * 2 ;
+      Entries = ( stVFatHostEntry_t * ) realloc( Entries , Size * sizeof( stVFatHostEntry_t ) ) ;
+      if( Entries == NULL )
+      {
+        break ;
+      }
+    }
+    Entry = &Entries[ Count++ ] ;
+
+#if defined( _WIN32 )
+    strncpy( Entry->Name , Find.cFileName , VFAT_MAX_PATH - 1 ) ;
+    Entry->Name[ VFAT_MAX_PATH - 1 ] = 0 ;
+    Entry->Directory = ( ( Find.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY ) != 0 ) ;
+    Entry->Size      = ( Entry->Directory ) ? 0 : Find.nFileSizeLow ;
+    FileTimeToLocalFileTime( &Find.ftLastWriteTime , &Local ) ;
+    FileTimeToDosDateTime( &Local , ( LPWORD ) &Entry->Date , ( LPWORD ) &Entry->Time ) ;
+  } while( FindNextFileA( Handle , &Find ) ) ;
+
+  FindClose( Handle ) ;
+#else
+    strncpy( Entry->Name , Dirent->d_name , VFAT_MAX_PATH - 1 ) ;
+    Entry->Name[ VFAT_MAX_PATH - 1 ] = 0 ;
+    Entry->Directory = S_ISDIR( Stat.st_mode ) ;
+    Entry->Size      = ( Entry->Directory ) ? 0 : ( uint32_t ) Stat.st_size ;
+
+    Time = localtime( &Stat.st_mtime ) ;
+    if( ( Time != NULL ) && ( Time->tm_year >= 80 ) )
+    {
+      Entry->Date = ( uint16_t ) ( ( ( Time->tm_year - 80 ) << 9 ) | ( ( Time->tm_mon + 1 ) << 5 ) | Time->tm_mday ) ;
+      Entry->Time = ( uint16_t ) ( ( Time->tm_hour << 11 ) | ( Time->tm_min << 5 ) | ( Time->tm_sec / 2 ) ) ;
+    }
+    else
+    {
+      Entry->Date = ( 1 << 5 ) | 1 ; // 1st January 1980
+      Entry->Time = 0 ;
+    }
+  }
+
+  closedir( Dir ) ;
+#endif
+
+  if( ( Entries == NULL ) && ( Count > 0 ) )
+  {
+    return( -1 ) ;
+  }
+
+  qsort( Entries , Count , sizeof( stVFatHostEntry_t ) , CompareEntries ) ;
+  *List = Entries ;
+
+  return( Count ) ;
+}
+
+// Copy the valid characters of part of a host name into an 8.3 name field.
+static void ShortPart( const char * From , const char * End , char * To , int Length )
+{
+  int Out = 0 ;
+
+  for( ; ( From < End ) && ( Out < Length ) ; From++ )
+  {
+    char c = ( char ) toupper( ( unsigned char ) *From ) ;
+
+    if( c == ' ' )
+    {
+      continue ;
+    }
+    To[ Out++ ] = ( isalnum( ( unsigned char ) c ) && ( ( unsigned char ) c < 0x80 ) ) || ( strchr( "!#$%&'()-@^_`{}~" , c ) != NULL ) ? c : '_' ;
+  }
+}
+
+// Make a unique 8.3 name for a host name among the nodes from First, for
+// the last node.
+static void ShortName( stVFat_t * VFat , int First , const char * Host , char * Name )
+{
+  const char * Dot = strrchr( Host , '.' ) ;
+  char         Base[ 8 ] ;
+  char         Tail[ 8 ] ;
+  bool         Unique = false ;
+  int          TailLength ;
+  int          Position ;
+
+  if( ( Dot == NULL ) || ( Dot == Host ) )
+  {
+    Dot = Host + strlen( Host ) ;
+  }
+
+  memset( Name , ' ' , 11 ) ;
+  ShortPart( Host , Dot , Name , 8 ) ;
+  if( *Dot == '.' )
+  {
+    ShortPart( Dot + 1 , Dot + strlen( Dot ) , Name + 8 , 3 ) ;
+  }
+  if( Name[ 0 ] == ' ' )
+  {
+    Name[ 0 ] = '_' ;
+  }
+  memcpy( Base , Name , 8 ) ;
+
+  // Names that collide get a ~N tail, as Windows gives them.
+  for( int n = 1 ; !Unique && ( n < 100000 ) ; n++ )
+  {
+    Unique = true ;
+    for( int i = First ; Unique && ( i < VFat->NodeCount - 1 ) ; i++ )
+    {
+      Unique = ( memcmp( VFat->Nodes[ i ].Name , Name , 11 ) != 0 ) ;
+    }
+
+    if( !Unique )
+    {
+      TailLength = snprintf( Tail , sizeof( Tail ) , "~%d" , n ) ;
+      Position   = 0 ;
+      while( ( Position < 8 - TailLength ) && ( Base[ Position ] != ' ' ) )
+      {
+        Position++ ;
+      }
+      memcpy( Name , Base , Position ) ;
+      memset( Name + Position , ' ' , 8 - Position ) ;
+      memcpy( Name + Position , Tail , TailLength ) ;
+    }
+  }
+}
+
+static int AddNode( stVFat_t * VFat )
+{
+  if( VFat->NodeCount == VFat->NodeSize )
+  {
+    VFat->NodeSize = ( VFat->NodeSize == 0 ) ? 256 : VFat->NodeSize * 2 ;
+    VFat->Nodes    = ( stVFatNode_t * ) realloc( VFat->Nodes , VFat->NodeSize * sizeof( stVFatNode_t ) ) ;
+    if( VFat->Nodes == NULL )
+    {
+      return( -1 ) ;
+    }
+  }
+
+  memset( &VFat->Nodes[ VFat->NodeCount ] , 0 , sizeof( stVFatNode_t ) ) ;
+
+  return( VFat->NodeCount++ ) ;
+}
+
+// Add the entries of a host directory as the children of a node, then add
+// the entries of its subdirectories.
+static bool AddDirectory( stVFat_t * VFat , int Parent , const char * Path , int Depth , int MaxEntries )
+{
+  stVFatHostEntry_t * Entries = NULL ;
+  stVFatNode_t      * Node ;
+  char                HostPath[ VFAT_MAX_PATH ] ;
+  int                 Count ;
+  int                 First = VFat->NodeCount ;
+  int                 Index ;
+
+  Count = ListDirectory( Path , &Entries ) ;
+  if( Count < 0 )
+  {
+    return( false ) ;
+  }
+
+  for( int i = 0 ; ( i < Count ) && ( i < MaxEntries ) ; i++ )
+  {
+    Index = AddNode( VFat ) ;
+    if( Index < 0 )
+    {
+      free( Entries ) ;
+      return( false ) ;
+    }
+
+    snprintf( HostPath , sizeof( HostPath ) ,
+#if defined( _WIN32 )
+              "%s\\%s" ,
+#else
+              "%s/%s" ,
+#endif
+              Path , Entries[ i ].Name ) ;
+
+    Node             = &VFat->Nodes[ Index ] ;
+    Node->Attributes = ( Entries[ i ].Directory ) ? VFAT_ATTR_DIRECTORY : VFAT_ATTR_ARCHIVE ;
+    Node->Time       = Entries[ i ].Time ;
+    Node->Date       = Entries[ i ].Date ;
+    Node->Size       = Entries[ i ].Size ;
+    Node->Parent     = Parent ;
+    Node->HostPath   = strdup( HostPath ) ;
+    ShortName( VFat , First , Entries[ i ].Name , Node->Name ) ;
+  }
+
+  free( Entries ) ;
+
+  VFat->Nodes[ Parent ].FirstChild = First ;
+  VFat->Nodes[ Parent ].ChildCount = VFat->NodeCount - First ;
+
+  // Subdirectories too deep for DOS paths are left empty.
+  for( int i = First ; ( i < First + VFat->Nodes[ Parent ].ChildCount ) && ( Depth < VFAT_MAX_DEPTH ) ; i++ )
+  {
+    if( ( VFat->Nodes[ i ].Attributes & VFAT_ATTR_DIRECTORY ) && ( VFat->Nodes[ i ].HostPath != NULL ) )
+    {
+      // The path string stays put when the nodes grow.
+      AddDirectory( VFat , i , VFat->Nodes[ i ].HostPath , Depth + 1 , VFAT_MAX_ENTRIES - 2 ) ;
+    }
+  }
+
+  return( true ) ;
+}
+
+// The clusters a node needs with the given cluster size.
+static uint32_t NodeClusters( const stVFatNode_t * Node , uint32_t ClusterBytes )
+{
+  if( Node->Attributes & VFAT_ATTR_DIRECTORY )
+  {
+    return( ( ( Node->ChildCount + 2 ) * VFAT_ENTRY_SIZE + ClusterBytes - 1 ) / ClusterBytes ) ;
+  }
+
+  return( ( uint32_t ) ( ( ( uint64_t ) Node->Size + ClusterBytes - 1 ) / ClusterBytes ) ) ;
+}
+
+// Lay out a FAT volume of the size set, with the cluster size given.
+static void LayOut( stVFat_t * VFat , uint32_t SectorsPerCluster )
+{
+  uint32_t RootSectors = VFat->RootEntries * VFAT_ENTRY_SIZE / VFAT_SECTOR_SIZE ;
+  uint32_t Entries ;
+
+  VFat->SectorsPerCluster = SectorsPerCluster ;
+
+  // The FAT needs an entry per cluster, plus the two reserved entries.
+  Entries          = ( VFat->VolumeSectors - 1 - RootSectors ) / SectorsPerCluster + 2 ;
+  VFat->FatSectors = ( ( VFat->Fat16 ) ? Entries * 2 : ( Entries * 3 + 1 ) / 2 ) ;
+  VFat->FatSectors = ( VFat->FatSectors + VFAT_SECTOR_SIZE - 1 ) / VFAT_SECTOR_SIZE ;
+  VFat->RootStart  = 1 + 2 * VFat->FatSectors ;
+  VFat->DataStart  = VFat->RootStart + RootSectors ;
+  VFat->Clusters   = ( VFat->VolumeSectors - VFat->DataStart ) / SectorsPerCluster ;
+}
+
+// Set the geometry and layout of a hard disk big enough for the nodes.
+static void LayOutHD( stVFat_t * VFat )
+{
+  uint64_t Needed ;
+  uint32_t ClusterBytes ;
+  uint32_t SectorsPerCluster ;
+
+  VFat->Partitioned     = true ;
+  VFat->Fat16           = true ;
+  VFat->Media           = 0xF8 ;
+  VFat->SectorsPerTrack = VFAT_HD_SECTORS ;
+  VFat->RootEntries     = VFAT_HD_ROOT_ENTRIES ;
+  VFat->Start           = VFAT_HD_SECTORS ;
+
+  for( VFat->Heads = 1 ; VFat->Heads <= VFAT_HD_MAX_HEADS ; VFat->Heads++ )
+  {
+    VFat->TotalSectors  = VFat->Heads * VFAT_HD_CYLINDERS * VFAT_HD_SECTORS ;
+    VFat->VolumeSectors = VFat->TotalSectors - VFat->Start ;
+
+    // The smallest clusters of 2KB or more that FAT16 can number.
+    for( SectorsPerCluster = 4 ; SectorsPerCluster < 64 ; SectorsPerCluster *= 2 )
+    {
+      LayOut( VFat , SectorsPerCluster ) ;
+      if( VFat->Clusters <= 65524 )
+      {
+        break ;
+      }
+    }
+    LayOut( VFat , SectorsPerCluster ) ;
+
+    // Leave a quarter as much again free, and at least the spare space.
+    ClusterBytes = SectorsPerCluster * VFAT_SECTOR_SIZE ;
+    Needed       = 0 ;
+    for( int i = 1 ; i < VFat->NodeCount ; i++ )
+    {
+      Needed += NodeClusters( &VFat->Nodes[ i ] , ClusterBytes ) ;
+    }
+
+    if( Needed + Needed / 4 + VFAT_HD_SPARE / ClusterBytes <= VFat->Clusters )
+    {
+      return ;
+    }
+  }
+
+  // The largest disk, with what does not fit left out.
+  VFat->Heads = VFAT_HD_MAX_HEADS ;
+}
+
+static void LayOutFD( stVFat_t * VFat )
+{
+  // A 1.44MB floppy disk.
+  VFat->Partitioned     = false ;
+  VFat->Fat16           = false ;
+  VFat->Media           = 0xF0 ;
+  VFat->SectorsPerTrack = 18 ;
+  VFat->Heads           = 2 ;
+  VFat->RootEntries     = 224 ;
+  VFat->Start           = 0 ;
+  VFat->TotalSectors    = 2880 ;
+  VFat->VolumeSectors   = 2880 ;
+
+  LayOut( VFat , 1 ) ;
+}
+
+// Give each node its clusters, leaving out those that do not fit.
+static bool Allocate( stVFat_t * VFat )
+{
+  uint32_t       ClusterBytes = VFat->SectorsPerCluster * VFAT_SECTOR_SIZE ;
+  uint32_t       Cluster = 2 ;
+  uint32_t       Count ;
+  stVFatNode_t * Node ;
+
+  VFat->ByCluster = ( int * ) malloc( VFat->NodeCount * sizeof( int ) ) ;
+  if( VFat->ByCluster == NULL )
+  {
+    return( false ) ;
+  }
+
+  for( int i = 1 ; i < VFat->NodeCount ; i++ )
+  {
+    Node  = &VFat->Nodes[ i ] ;
+    Count = NodeClusters( Node , ClusterBytes ) ;
+
+    if( VFat->Nodes[ Node->Parent ].Skipped || ( Count > VFat->Clusters + 2 - Cluster ) )
+    {
+      Node->Skipped = true ;
+    }
+    else if( Count > 0 )
+    {
+      Node->Cluster  = Cluster ;
+      Node->Clusters = Count ;
+      Cluster       += Count ;
+
+      VFat->ByCluster[ VFat->ByClusterCount++ ] = i ;
+    }
+  }
+
+  return( true ) ;
+}
+
+// Find the node a cluster is given to.
+// Returns the node, or -1 if the cluster is free.
+static int FindCluster( const stVFat_t * VFat , uint32_t Cluster )
+{
+  int Low  = 0 ;
+  int High = VFat->ByClusterCount - 1 ;
+  int Mid ;
+
+  while( Low <= High )
+  {
+    Mid = ( Low + High ) / 2 ;
+
+    const stVFatNode_t * Node = &VFat->Nodes[ VFat->ByCluster[ Mid ] ] ;
+
+    if( Cluster < Node->Cluster )
+    {
+      High = Mid - 1 ;
+    }
+    else if( Cluster >= Node->Cluster + Node->Clusters )
+    {
+      Low = Mid + 1 ;
+    }
+    else
+    {
+      return( VFat->ByCluster[ Mid ] ) ;
+    }
+  }
+
+  return( -1 ) ;
+}
+
+static uint32_t FatEntry( const stVFat_t * VFat , uint32_t Cluster )
+{
+  uint32_t End = ( VFat->Fat16 ) ? 0xFFFF : 0xFFF ;
+  int      Node ;
+
+  if( Cluster == 0 )
+  {
+    return( ( End & ~0xFFu ) | VFat->Media ) ;
+  }
+
+  if( Cluster == 1 )
+  {
+    return( End ) ;
+  }
+
+  Node = FindCluster( VFat , Cluster ) ;
+  if( Node < 0 )
+  {
+    return( 0 ) ;
+  }
+
+  // Each node's clusters are a single chain.
+  return( ( Cluster + 1 < VFat->Nodes[ Node ].Cluster + VFat->Nodes[ Node ].Clusters ) ? Cluster + 1 : End ) ;
+}
+
+static void MakeFat( const stVFat_t * VFat , uint32_t Sector , uint8_t * Data )
+{
+  uint32_t Base = Sector * VFAT_SECTOR_SIZE ;
+  uint32_t Value ;
+  int      Offset ;
+
+  if( VFat->Fat16 )
+  {
+    for( int i = 0 ; i < VFAT_SECTOR_SIZE / 2 ; i++ )
+    {
+      Put16( Data + i * 2 , ( uint16_t ) FatEntry( VFat , Base / 2 + i ) ) ;
+    }
+    return ;
+  }
+
+  // FAT12 entries are 1.5 bytes, so may span sectors.
+  for( uint32_t Entry = Base * 2 / 3 ; Entry <= ( Base + VFAT_SECTOR_SIZE ) * 2 / 3 ; Entry++ )
+  {
+    Value  = ( Entry < VFat->Clusters + 2 ) ? FatEntry( VFat , Entry ) : 0 ;
+    Offset = ( int ) ( Entry + Entry / 2 ) - ( int ) Base ;
+    if( Entry & 1 )
+    {
+      Value <<= 4 ;
+    }
+
+    for( int i = 0 ; i < 2 ; i++ , Offset++ , Value >>= 8 )
+    {
+      if( ( Offset >= 0 ) && ( Offset < VFAT_SECTOR_SIZE ) )
+      {
+        Data[ Offset ] |= ( uint8_t ) Value ;
+      }
+    }
+  }
+}
+
+// Set a cylinder, head and sector address in a partition table entry.
+static void PutCHS( const stVFat_t * VFat , uint8_t * Data , uint32_t Sector )
+{
+  uint32_t Cylinder = Sector / ( VFat->Heads * VFat->SectorsPerTrack ) ;
+
+  Data[ 0 ] = ( uint8_t ) ( ( Sector / VFat->SectorsPerTrack ) % VFat->Heads ) ;
+  Data[ 1 ] = ( uint8_t ) ( ( Sector % VFat->SectorsPerTrack + 1 ) | ( ( Cylinder >> 2 ) & 0xC0 ) ) ;
+  Data[ 2 ] = ( uint8_t ) Cylinder ;
+}
+
+static void MakeMBR( const stVFat_t * VFat , uint8_t * Data )
+{
+  uint8_t * Partition = Data + 0x1BE ;
+
+  // Not bootable, ask the BIOS for another boot disk.
+  Data[ 0 ] = 0xCD ; // INT 18h
+  Data[ 1 ] = 0x18 ;
+
+  Partition[ 0 ] = 0x00 ;
+  PutCHS( VFat , Partition + 1 , VFat->Start ) ;
+  Partition[ 4 ] = ( VFat->VolumeSectors < 0x10000 ) ? 0x04 : 0x06 ; // FAT16 or FAT16 over 32MB
+  PutCHS( VFat , Partition + 5 , VFat->TotalSectors - 1 ) ;
+  Put32( Partition + 8 , VFat->Start ) ;
+  Put32( Partition + 12 , VFat->VolumeSectors ) ;
+
+  Data[ 0x1FE ] = 0x55 ;
+  Data[ 0x1FF ] = 0xAA ;
+}
+
+static void MakeBootSector( const stVFat_t * VFat , uint8_t * Data )
+{
+  Data[ 0 ] = 0xEB ; // JMP 3Eh
+  Data[ 1 ] = 0x3C ;
+  Data[ 2 ] = 0x90 ;
+  memcpy( Data + 3 , "TINYXT  " , 8 ) ;
+
+  Put16( Data + 0x0B , VFAT_SECTOR_SIZE ) ;
+  Data[ 0x0D ] = ( uint8_t ) VFat->SectorsPerCluster ;
+  Put16( Data + 0x0E , 1 ) ; // Reserved sectors
+  Data[ 0x10 ] = 2 ;         // FATs
+  Put16( Data + 0x11 , ( uint16_t ) VFat->RootEntries ) ;
+  Put16( Data + 0x13 , ( VFat->VolumeSectors < 0x10000 ) ? ( uint16_t ) VFat->VolumeSectors : 0 ) ;
+  Data[ 0x15 ] = VFat->Media ;
+  Put16( Data + 0x16 , ( uint16_t ) VFat->FatSectors ) ;
+  Put16( Data + 0x18 , VFat->SectorsPerTrack ) ;
+  Put16( Data + 0x1A , VFat->Heads ) ;
+  Put32( Data + 0x1C , VFat->Start ) ; // Hidden sectors
+  Put32( Data + 0x20 , ( VFat->VolumeSectors < 0x10000 ) ? 0 : VFat->VolumeSectors ) ;
+  Data[ 0x24 ] = ( VFat->Partitioned ) ? 0x80 : 0x00 ;
+  Data[ 0x26 ] = 0x29 ; // Extended boot signature
+  Put32( Data + 0x27 , 0x58540000 | VFat->Clusters ) ;
+  memcpy( Data + 0x2B , "NO NAME    " , 11 ) ;
+  memcpy( Data + 0x36 , ( VFat->Fat16 ) ? "FAT16   " : "FAT12   " , 8 ) ;
+
+  Data[ 0x3E ] = 0xCD ; // INT 18h
+  Data[ 0x3F ] = 0x18 ;
+
+  Data[ 0x1FE ] = 0x55 ;
+  Data[ 0x1FF ] = 0xAA ;
+}
+
+static void PutEntry( uint8_t * Data , const char * Name , const stVFatNode_t * Node , uint32_t Cluster )
+{
+  memcpy( Data , Name , 11 ) ;
+  Data[ 11 ] = Node->Attributes ;
+  Put16( Data + 22 , Node->Time ) ;
+  Put16( Data + 24 , Node->Date ) ;
+  Put16( Data + 26 , ( uint16_t ) Cluster ) ;
+  Put32( Data + 28 , Node->Size ) ;
+}
+
+// Make a sector of the entries of a directory, from the entry given.
+static void MakeDirectory( const stVFat_t * VFat , int Index , uint32_t Entry , uint8_t * Data )
+{
+  const stVFatNode_t * Directory = &VFat->Nodes[ Index ] ;
+  const stVFatNode_t * Node ;
+  uint32_t             Child ;
+
+  for( int i = 0 ; i < VFAT_SECTOR_SIZE / VFAT_ENTRY_SIZE ; i++ , Entry++ )
+  {
+    Child = Entry ;
+
+    // Subdirectories start with . and .. entries.
+    if( Index != 0 )
+    {
+      if( Entry == 0 )
+      {
+        PutEntry( Data + i * VFAT_ENTRY_SIZE , ".          " , Directory , Directory->Cluster ) ;
+        continue ;
+      }
+
+      if( Entry == 1 )
+      {
+        PutEntry( Data + i * VFAT_ENTRY_SIZE , "..         " , Directory , VFat->Nodes[ Directory->Parent ].Cluster ) ;
+        continue ;
+      }
+
+      Child -= 2 ;
+    }
+
+    if( Child >= ( uint32_t ) Directory->ChildCount )
+    {
+      break ;
+    }
+
+    Node = &VFat->Nodes[ Directory->FirstChild + Child ] ;
+    PutEntry( Data + i * VFAT_ENTRY_SIZE , Node->Name , Node , Node->Cluster ) ;
+
+    // Entries that did not fit are shown deleted.
+    if( Node->Skipped )
+    {
+      Data[ i * VFAT_ENTRY_SIZE ] = VFAT_DELETED ;
+    }
+  }
+}
+
+static void ReadHostFile( stVFat_t * VFat , int Index , uint32_t Offset , uint8_t * Data )
+{
+  const stVFatNode_t * Node = &VFat->Nodes[ Index ] ;
+
+  if( VFat->OpenNode != Index )
+  {
+    if( VFat->OpenNode >= 0 )
+    {
+      close( VFat->OpenFile ) ;
+    }
+    VFat->OpenFile = open( Node->HostPath , O_BINARY | O_RDONLY ) ;
+    VFat->OpenNode = ( VFat->OpenFile >= 0 ) ? Index : -1 ;
+  }
+
+  // A host file that cannot be read reads as zeros.
+  if( ( VFat->OpenNode == Index ) && ( Offset < Node->Size ) &&
+      ( lseek( VFat->OpenFile , ( off_t ) Offset , SEEK_SET ) != ( off_t ) -1 ) )
+  {
+    if( read( VFat->OpenFile , Data , ( Node->Size - Offset < VFAT_SECTOR_SIZE ) ? Node->Size - Offset : VFAT_SECTOR_SIZE ) < 0 )
+    {
+      memset( Data , 0 , VFAT_SECTOR_SIZE ) ;
+    }
+  }
+}
+
+static void ReadSector( stVFat_t * VFat , uint32_t Sector , uint8_t * Data )
+{
+  uint32_t Volume ;
+  uint32_t Cluster ;
+  uint32_t Offset ;
+  int      Node ;
+
+  memset( Data , 0 , VFAT_SECTOR_SIZE ) ;
+
+  if( Sector < VFat->Start )
+  {
+    if( Sector == 0 )
+    {
+      MakeMBR( VFat , Data ) ;
+    }
+    return ;
+  }
+
+  Volume = Sector - VFat->Start ;
+
+  if( Volume == 0 )
+  {
+    MakeBootSector( VFat , Data ) ;
+  }
+  else if( Volume < VFat->RootStart )
+  {
+    MakeFat( VFat , ( Volume - 1 ) % VFat->FatSectors , Data ) ;
+  }
+  else if( Volume < VFat->DataStart )
+  {
+    MakeDirectory( VFat , 0 , ( Volume - VFat->RootStart ) * ( VFAT_SECTOR_SIZE / VFAT_ENTRY_SIZE ) , Data ) ;
+  }
+  else if( Volume < VFat->VolumeSectors )
+  {
+    Cluster = 2 + ( Volume - VFat->DataStart ) / VFat->SectorsPerCluster ;
+    Node    = FindCluster( VFat , Cluster ) ;
+    if( Node < 0 )
+    {
+      return ;
+    }
+
+    Offset = ( Cluster - VFat->Nodes[ Node ].Cluster ) * VFat->SectorsPerCluster * VFAT_SECTOR_SIZE +
+             ( ( Volume - VFat->DataStart ) % VFat->SectorsPerCluster ) * VFAT_SECTOR_SIZE ;
+
+    if( VFat->Nodes[ Node ].Attributes & VFAT_ATTR_DIRECTORY )
+    {
+      MakeDirectory( VFat , Node , Offset / VFAT_ENTRY_SIZE , Data ) ;
+    }
+    else
+    {
+      ReadHostFile( VFat , Node , Offset , Data ) ;
+    }
+  }
+}
+
+// =============================================================================
+// Exported functions
+//
+
+bool VFAT_IsDirectory( const char * Path )
+{
+  struct stat Stat ;
+
+  return( ( Path != NULL ) && ( stat( Path , &Stat ) == 0 ) && S_ISDIR( Stat.st_mode ) ) ;
+}
+
+stVFat_t * VFAT_Open( const char * Path , bool Floppy )
+{
+  stVFat_t * VFat ;
+
+  if( !VFAT_IsDirectory( Path ) )
+  {
+    return( NULL ) ;
+  }
+
+  VFat = ( stVFat_t * ) calloc( 1 , sizeof( stVFat_t ) ) ;
+  if( VFat == NULL )
+  {
+    return( NULL ) ;
+  }
+
+  VFat->OpenNode = -1 ;
+
+  // The root directory holds as many entries as the layout allows.
+  if( ( AddNode( VFat ) != 0 ) ||
+      !AddDirectory( VFat , 0 , Path , 1 , ( Floppy ) ? 224 : VFAT_HD_ROOT_ENTRIES ) )
+  {
+    VFAT_Close( VFat ) ;
+    return( NULL ) ;
+  }
+
+  if( Floppy )
+  {
+    LayOutFD( VFat ) ;
+  }
+  else
+  {
+    LayOutHD( VFat ) ;
+  }
+
+  if( !Allocate( VFat ) )
+  {
+    VFAT_Close( VFat ) ;
+    return( NULL ) ;
+  }
+
+  return( VFat ) ;
+}
+
+void VFAT_Close( stVFat_t * VFat )
+{
+  if( VFat == NULL )
+  {
+    return ;
+  }
+
+  if( VFat->OpenNode >= 0 )
+  {
+    close( VFat->OpenFile ) ;
+  }
+
+  for( int i = 0 ; i < VFat->NodeCount ; i++ )
+  {
+    free( VFat->Nodes[ i ].HostPath ) ;
+  }
+
+  free( VFat->Nodes ) ;
+  free( VFat->ByCluster ) ;
+  free( VFat ) ;
+}
+
+int64_t VFAT_Size( const stVFat_t * VFat )
+{
+  return( ( int64_t ) VFat->TotalSectors * VFAT_SECTOR_SIZE ) ;
+}
+
+int VFAT_Read( stVFat_t * VFat , int64_t Offset , uint8_t * Buffer , int Length )
+{
+  uint8_t Data[ VFAT_SECTOR_SIZE ] ;
+  int64_t Size = VFAT_Size( VFat ) ;
+  int     Done ;
+  int     Start ;
+  int     Count ;
+
+  if( ( Offset < 0 ) || ( Offset >= Size ) )
+  {
+    return( 0 ) ;
+  }
+
+  if( Length > Size - Offset )
+  {
+    Length = ( int ) ( Size - Offset ) ;
+  }
+
+  for( Done = 0 ; Done < Length ; Done += Count )
+  {
+    Start = ( int ) ( ( Offset + Done ) % VFAT_SECTOR_SIZE ) ;
+    Count = ( VFAT_SECTOR_SIZE - Start < Length - Done ) ? ( VFAT_SECTOR_SIZE - Start ) : ( Length - Done ) ;
+
+    ReadSector( VFat , ( uint32_t ) ( ( Offset + Done ) / VFAT_SECTOR_SIZE ) , Data ) ;
+    memcpy( Buffer + Done , Data + Start , Count ) ;
+  }
+
+  return( Done ) ;
+}
@@ -0,0 +1,128 @@
+// =============================================================================
+// File: XTvfat.h
+//
+// Description:
+// Virtual FAT disks made from host directories.
+//
+// A host directory can be used in place of a disk image. The directory
+// tree is scanned when the disk is opened, but nothing is read from the
+// host files then. Each file and directory is given a contiguous run of
+// clusters, and the boot sector, FAT and directory sectors are generated
+// from that layout when the guest reads them. File data is read from the
+// host file when the guest reads the clusters given to it.
+//
+// On the floppy disk drive the directory is a 1.44MB FAT12 disk. On the
+// hard disk drive it is a disk with a single FAT16 partition, big enough
+// for the files with space to spare. The disk is laid out in host name
+// order, so the same directory always gives the same disk. Host names are
+// made into unique 8.3 names. Hidden host files, whose names start with a
+// dot, are left out, as are files that do not fit on the disk, which show
+// as deleted entries.
+//
+// The virtual disk is read only. The disk access module keeps guest writes
+// in an overlay, so the host directory is never changed.
+//
+// The boot sectors only call INT 18h, so the machine must be booted from
+// another disk.
+//
+// This work is licensed under the MIT License. See included LICENSE.TXT.
+//
+
+#ifndef _XTVFAT_
+#define _XTVFAT_
+
+#include <stdint.h>
+
+typedef struct STVFAT_T stVFat_t ;
+
+// =============================================================================
+// Function: VFAT_IsDirectory
+//
+// Description:
+// Check if a path is a host directory.
+//
+// Parameters:
+//
+//   Path : The path.
+//
+// Returns:
+//
+//   bool : true if the path is a directory.
+//
+bool VFAT_IsDirectory( const char * Path ) ;
+
+// =============================================================================
+// Function: VFAT_Open
+//
+// Description:
+// Scan a host directory and lay out a virtual disk for it.
+//
+// Parameters:
+//
+//   Path   : The host directory.
+//
+//   Floppy : true for a floppy disk, false for a hard disk.
+//
+// Returns:
+//
+//   stVFat_t * : The virtual disk, or NULL if the directory cannot be
+//                read.
+//
+stVFat_t * VFAT_Open( const char * Path , bool Floppy ) ;
+
+// =============================================================================
+// Function: VFAT_Close
+//
+// Description:
+// Release a virtual disk.
+//
+// Parameters:
+//
+//   VFat : The virtual disk.
+//
+// Returns:
+//
+//   None.
+//
+void VFAT_Close( stVFat_t * VFat ) ;
+
+// =============================================================================
+// Function: VFAT_Size
+//
+// Description:
+// Get the size of a virtual disk.
+//
+// Parameters:
+//
+//   VFat : The virtual disk.
+//
+// Returns:
+//
+//   int64_t : The disk size in bytes.
+//
+int64_t VFAT_Size( const stVFat_t * VFat ) ;
+
+// =============================================================================
+// Function: VFAT_Read
+//
+// Description:
+// Read from a virtual disk.
+//
+// Parameters:
+//
+//   VFat   : The virtual disk.
+//
+//   Offset : The disk offset to read from.
+//
+//   Buffer : Returns the data read.
+//
+//   Length : The number of bytes to read.
+//
+// Returns:
+//
+//   int : The number of bytes read, which is less than Length at the end of
+//         the disk.
+//
+int VFAT_Read( stVFat_t * VFat , int64_t Offset , uint8_t * Buffer , int Length ) ;
+
+#endif // _XTVFAT_
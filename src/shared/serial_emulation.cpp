@@ -16,8 +16,10 @@
 
 #include <stdio.h>
 #include <ctype.h>
+#include <string.h>
 #include "serial_emulation.h"
 #include "serial_hw.h"
+#include "emulator/XTreplay.h"
 
 #define GET_TICKS timeGetTime
 
@@ -27,6 +29,19 @@
 
 #define FIFO_SIZE 16
 
+// Host events logged for replay: a byte received, a byte sent or a change
+// of modem status.
+#define SERIAL_EVENT_RX  0
+#define SERIAL_EVENT_TX  1
+#define SERIAL_EVENT_MSR 2
+
+struct SerialEvent_t
+{
+  unsigned char ComPort;
+  unsigned char Event;
+  unsigned char Value;
+};
+
 struct ComPortInfo_t
 {
   SerialMapping_t Mapping;
@@ -341,6 +356,75 @@ static void UpdateMSR(int ComPort, unsigned char NewMSRStateBits)
   ComData[ComPort].Reg[6] = NewMSR;
 }
 
+//
+// Host event functions.
+// Everything the host does to a serial port goes through these so it can be
+// recorded and replayed.
+//
+
+static void LogHostEvent(int ComPort, int Event, unsigned char Value)
+{
+  SerialEvent_t HostEvent;
+
+  HostEvent.ComPort = (unsigned char) ComPort;
+  HostEvent.Event = (unsigned char) Event;
+  HostEvent.Value = Value;
+  REPLAY_Input(REPLAY_EVENT_SERIAL, &HostEvent, sizeof(HostEvent));
+}
+
+static void HostRxByte(int ComPort, unsigned char Byte)
+{
+  LogHostEvent(ComPort, SERIAL_EVENT_RX, Byte);
+  AddRxByte(ComPort, Byte);
+}
+
+static void HostTxByte(int ComPort)
+{
+  LogHostEvent(ComPort, SERIAL_EVENT_TX, 0);
+  GetTxByte(ComPort);
+}
+
+static void HostUpdateMSR(int ComPort, unsigned char NewMSRStateBits)
+{
+  unsigned char OldMSR = ComData[ComPort].Reg[6];
+
+  UpdateMSR(ComPort, NewMSRStateBits);
+  if (ComData[ComPort].Reg[6] != OldMSR)
+  {
+    LogHostEvent(ComPort, SERIAL_EVENT_MSR, ComData[ComPort].Reg[6]);
+  }
+}
+
+// Apply the host events logged for now, instead of taking them from the host.
+static void ReplayHostEvents(void)
+{
+  SerialEvent_t HostEvent;
+  int Length = sizeof(HostEvent);
+
+  while (REPLAY_NextInput(REPLAY_EVENT_SERIAL, &HostEvent, Length))
+  {
+    int ComPort = HostEvent.ComPort & 3;
+
+    switch (HostEvent.Event)
+    {
+      case SERIAL_EVENT_RX:
+        AddRxByte(ComPort, HostEvent.Value);
+        break;
+
+      case SERIAL_EVENT_TX:
+        GetTxByte(ComPort);
+        break;
+
+      case SERIAL_EVENT_MSR:
+        ComData[ComPort].Reg[6] = HostEvent.Value;
+        ReevaluateInterrupts(ComPort);
+        break;
+    }
+
+    Length = sizeof(HostEvent);
+  }
+}
+
 //
 // Hardware serial port functions
 //
@@ -359,7 +443,7 @@ void HandleHWComPort(int ComPort)
     nBytesRead = SERIAL_HW_Read(ComPort, Buffer, 1);
     if (nBytesRead > 0)
     {
-      AddRxByte(ComPort, Buffer[0]);
+      HostRxByte(ComPort, Buffer[0]);
       nBytesToRead--;
     }
     else
@@ -376,7 +460,7 @@ void HandleHWComPort(int ComPort)
     nBytesWritten = SERIAL_HW_Write(ComPort, Buffer, 1);
     if (nBytesWritten > 0)
     {
-      GetTxByte(ComPort);
+      HostTxByte(ComPort);
       TxDone = (ComData[ComPort].TxBufferLen == 0);
     }
     else
@@ -391,7 +475,7 @@ void HandleHWComPort(int ComPort)
   SERIAL_HW_GetModemStatusBits(ComPort, NewMSRStateBits);
 
   // Update the MSR, including delta bits
-  UpdateMSR(ComPort, NewMSRStateBits);
+  HostUpdateMSR(ComPort, NewMSRStateBits);
 
   ReevaluateInterrupts(ComPort);
 }
@@ -525,7 +609,7 @@ static void HandleTCPTxRx(int ComPort)
     idx = 0;
     while (nbytes > 0)
     {
-      AddRxByte(ComPort, Buffer[idx]);
+      HostRxByte(ComPort, Buffer[idx]);
       idx++;
       nbytes--;
     }
@@ -541,7 +625,7 @@ static void HandleTCPTxRx(int ComPort)
 
     if (nbytes == 1)
     {
-      GetTxByte(ComPort);
+      HostTxByte(ComPort);
       TxDone = (ComData[ComPort].TxBufferLen == 0);
     }
     else
@@ -601,7 +685,7 @@ static void HandleTCPServer(int ComPort)
       ComData[ComPort].IsSocketConnected = true;
 
       // Now we are connected assert DCD, CTS and RTS
-      UpdateMSR(ComPort, 0xb0); // DCD, CTS and DTR on
+      HostUpdateMSR(ComPort, 0xb0); // DCD, CTS and DTR on
 
       ReevaluateInterrupts(ComPort);
     }
@@ -662,7 +746,7 @@ static void HandleTCPClient(int ComPort)
         ComData[ComPort].IsSocketConnected = true;
 
         // Now we are connected assert DCD, CTS and RTS
-        UpdateMSR(ComPort, 0xb0); // DCD, CTS and DTR on
+        HostUpdateMSR(ComPort, 0xb0); // DCD, CTS and DTR on
 
         ReevaluateInterrupts(ComPort);
       }
@@ -698,6 +782,7 @@ static void HandleTCPClient(int ComPort)
       }
 
       ComData[ComPort].Reg[6] = NewMSR;
+      LogHostEvent(ComPort, SERIAL_EVENT_MSR, NewMSR);
 
       ReevaluateInterrupts(ComPort);
     }
@@ -1035,6 +1120,127 @@ bool SERIAL_Configure(int ComPort, SerialMapping_t Mapping, const char *ComName)
   return true;
 }
 
+// UART state saved in machine snapshots
+struct UARTState_t
+{
+  unsigned char Reg[8];
+  bool DivisorLatch;
+  int DivisorL;
+  int DivisorH;
+  int Divisor;
+  int BaudRate;
+  int DataBits;
+  SerialStopBits_t StopBits;
+  SerialParity_t   Parity;
+  int RxTriggerLevel;
+  char RxBuffer[FIFO_SIZE];
+  int  RxBufferLen;
+  int  RxHead;
+  int  RxTail;
+  bool RTS_High;
+  bool DTR_High;
+  char TxBuffer[FIFO_SIZE];
+  int  TxBufferLen;
+  int  TxBufferLenI;
+  int  TxHead;
+  int  TxTail;
+  unsigned char IIR;
+  int IRQ;
+};
+
+struct SerialState_t
+{
+  UARTState_t UART[4];
+  bool MousePowerOn;
+};
+
+int SERIAL_SaveState(unsigned char *Buffer)
+{
+  SerialState_t *State = (SerialState_t *) Buffer;
+
+  if (State == NULL) return sizeof(SerialState_t);
+
+  memset(State, 0, sizeof(SerialState_t));
+  for (int i = 0 ; i < 4 ; i++)
+  {
+    UARTState_t &UART = State->UART[i];
+
+    memcpy(UART.Reg, ComData[i].Reg, sizeof(UART.Reg));
+    UART.DivisorLatch = ComData[i].DivisorLatch;
+    UART.DivisorL = ComData[i].DivisorL;
+    UART.DivisorH = ComData[i].DivisorH;
+    UART.Divisor = ComData[i].Divisor;
+    UART.BaudRate = ComData[i].BaudRate;
+    UART.DataBits = ComData[i].DataBits;
+    UART.StopBits = ComData[i].StopBits;
+    UART.Parity = ComData[i].Parity;
+    UART.RxTriggerLevel = ComData[i].RxTriggerLevel;
+    memcpy(UART.RxBuffer, ComData[i].RxBuffer, FIFO_SIZE);
+    UART.RxBufferLen = ComData[i].RxBufferLen;
+    UART.RxHead = ComData[i].RxHead;
+    UART.RxTail = ComData[i].RxTail;
+    UART.RTS_High = ComData[i].RTS_High;
+    UART.DTR_High = ComData[i].DTR_High;
+    memcpy(UART.TxBuffer, ComData[i].TxBuffer, FIFO_SIZE);
+    UART.TxBufferLen = ComData[i].TxBufferLen;
+    UART.TxBufferLenI = ComData[i].TxBufferLenI;
+    UART.TxHead = ComData[i].TxHead;
+    UART.TxTail = ComData[i].TxTail;
+    UART.IIR = ComData[i].IIR;
+    UART.IRQ = ComData[i].IRQ;
+  }
+  State->MousePowerOn = MousePowerOn;
+
+  return sizeof(SerialState_t);
+}
+
+bool SERIAL_RestoreState(const unsigned char *Buffer, int Length)
+{
+  const SerialState_t *State = (const SerialState_t *) Buffer;
+
+  if (Length != sizeof(SerialState_t)) return false;
+
+  for (int i = 0 ; i < 4 ; i++)
+  {
+    const UARTState_t &UART = State->UART[i];
+
+    memcpy(ComData[i].Reg, UART.Reg, sizeof(UART.Reg));
+    ComData[i].DivisorLatch = UART.DivisorLatch;
+    ComData[i].DivisorL = UART.DivisorL;
+    ComData[i].DivisorH = UART.DivisorH;
+    ComData[i].Divisor = UART.Divisor;
+    ComData[i].BaudRate = UART.BaudRate;
+    ComData[i].DataBits = UART.DataBits;
+    ComData[i].StopBits = UART.StopBits;
+    ComData[i].Parity = UART.Parity;
+    ComData[i].RxTriggerLevel = UART.RxTriggerLevel;
+    memcpy(ComData[i].RxBuffer, UART.RxBuffer, FIFO_SIZE);
+    ComData[i].RxBufferLen = UART.RxBufferLen;
+    ComData[i].RxHead = UART.RxHead;
+    ComData[i].RxTail = UART.RxTail;
+    ComData[i].RTS_High = UART.RTS_High;
+    ComData[i].DTR_High = UART.DTR_High;
+    memcpy(ComData[i].TxBuffer, UART.TxBuffer, FIFO_SIZE);
+    ComData[i].TxBufferLen = UART.TxBufferLen;
+    ComData[i].TxBufferLenI = UART.TxBufferLenI;
+    ComData[i].TxHead = UART.TxHead;
+    ComData[i].TxTail = UART.TxTail;
+    ComData[i].IIR = UART.IIR;
+    ComData[i].IRQ = UART.IRQ;
+
+    // Apply the line settings to the mapped host port.
+    ConfigureComPort(i);
+  }
+  MousePowerOn = State->MousePowerOn;
+
+  // Mouse movement since the snapshot was saved is host input.
+  MouseEventPending = false;
+  Mouse_dx = 0;
+  Mouse_dy = 0;
+
+  return true;
+}
+
 void SERIAL_MouseMove(int dx, int dy, bool LButtonDown, bool RButtonDown)
 {
   if (SerialMousePort == -1) return;
@@ -1050,6 +1256,13 @@ void SERIAL_HandleSerial()
 {
   DWORD CurrentTime = GET_TICKS();
 
+  // When replaying, the mouse and serial connections are not used.
+  if (REPLAY_Playing())
+  {
+    ReplayHostEvents();
+    return;
+  }
+
   if ((SerialMousePort != -1) &&
       ((ComData[SerialMousePort].Reg[4] & 0x10) == 0))
   {
@@ -1077,9 +1290,9 @@ void SERIAL_HandleSerial()
         EventByte2 = Mouse_dx & 0x3F;
         EventByte3 = Mouse_dy & 0x3F;
 
-        AddRxByte(SerialMousePort, EventByte1);
-        AddRxByte(SerialMousePort, EventByte2);
-        AddRxByte(SerialMousePort, EventByte3);
+        HostRxByte(SerialMousePort, EventByte1);
+        HostRxByte(SerialMousePort, EventByte2);
+        HostRxByte(SerialMousePort, EventByte3);
 
         MouseEventPending = false;
       }
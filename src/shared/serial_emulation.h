@@ -190,6 +190,41 @@ void SERIAL_MouseMove(int dx, int dy, bool LButtonDown, bool RButtonDown);
 //
 void SERIAL_HandleSerial(void);
 
+// =============================================================================
+// Function: SERIAL_SaveState
+//
+// Description:
+// Save the emulated UART state for a machine snapshot.
+// The port mappings are configuration and are not saved.
+//
+// Parameters:
+//
+//   Buffer : The buffer to save to, or NULL to get the length needed.
+//
+// Returns:
+//
+//   int : The length of the saved state in bytes.
+//
+int SERIAL_SaveState(unsigned char *Buffer);
+
+// =============================================================================
+// Function: SERIAL_RestoreState
+//
+// Description:
+// Restore state saved by SERIAL_SaveState.
+//
+// Parameters:
+//
+//   Buffer : The saved state.
+//
+//   Length : The length of the saved state in bytes.
+//
+// Returns:
+//
+//   bool : true if the state was restored.
+//
+bool SERIAL_RestoreState(const unsigned char *Buffer, int Length);
+
 // =============================================================================
 // Function: SERIAL_WritePort
 //
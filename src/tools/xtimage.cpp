@@ -0,0 +1,69 @@
+// =============================================================================
+// File: xtimage.cpp
+//
+// Description:
+// Convert a raw disk image to a block indexed image. See
+// emulator/XTimage.h for the image format.
+//
+// Usage: xtimage [-b block_size] [-n] raw_image block_image
+//
+//   -b : The block size in bytes, 16384 if not given.
+//   -n : Do not compress blocks.
+//
+// Build with the emulator's image and LZ modules, for example:
+//
+//   g++ -O2 -Iemulator tools/xtimage.cpp emulator/XTimage.cpp emulator/XTlz.cpp -o xtimage
+//
+// This work is licensed under the MIT License. See included LICENSE.TXT.
+//
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "XTimage.h"
+
+static void Usage( void )
+{
+  printf( "Usage: xtimage [-b block_size] [-n] raw_image block_image\n" ) ;
+  printf( "  -b : block size, a power of 2 from %d to %d, default %d\n" , IMAGE_MIN_BLOCK , IMAGE_MAX_BLOCK , IMAGE_DEFAULT_BLOCK ) ;
+  printf( "  -n : do not compress blocks\n" ) ;
+}
+
+int main( int argc , char * argv[] )
+{
+  int  BlockSize = IMAGE_DEFAULT_BLOCK ;
+  bool Compress  = true ;
+  int  Arg ;
+
+  for( Arg = 1 ; ( Arg < argc ) && ( argv[ Arg ][ 0 ] == '-' ) ; Arg++ )
+  {
+    if( ( strcmp( argv[ Arg ] , "-b" ) == 0 ) && ( Arg + 1 < argc ) )
+    {
+      BlockSize = atoi( argv[ ++Arg ] ) ;
+    }
+    else if( strcmp( argv[ Arg ] , "-n" ) == 0 )
+    {
+      Compress = false ;
+    }
+    else
+    {
+      Usage() ;
+      return( 1 ) ;
+    }
+  }
+
+  if( Arg + 2 != argc )
+  {
+    Usage() ;
+    return( 1 ) ;
+  }
+
+  if( !IMAGE_Convert( argv[ Arg ] , argv[ Arg + 1 ] , BlockSize , Compress ) )
+  {
+    printf( "Cannot convert %s to %s\n" , argv[ Arg ] , argv[ Arg + 1 ] ) ;
+    return( 1 ) ;
+  }
+
+  return( 0 ) ;
+}
@@ -0,0 +1,94 @@
+; XTMOUNT - mount the emulator's host drive under DOS. Compiles with NASM:
+;
+;   nasm -f bin -o xtmount.com xtmount.asm
+;
+; Usage: XTMOUNT [drive]
+;
+; Shows the host directory set by [HOST_DRIVE] in the emulator config as a
+; network drive, on the first unused drive from C: or on the drive given.
+; The emulator serves the drive's redirector calls itself, so nothing stays
+; resident. Needs DOS 4.0 or later, and a LASTDRIVE past the drives in use.
+;
+; This work is licensed under the MIT License. See included LICENSE.TXT.
+
+	cpu	8086
+
+; Emulator hypercall: ES:BX = DOS list of lists, DS:SI = DOS swappable data
+; area, DL = drive (1 = A:, 0 = first unused). Returns AL = drive, 0 if none.
+
+%macro	extended_redir_mount 0
+	db	0x0f, 0x05
+%endmacro
+
+org	100h
+
+main:
+	mov	ah, 0x30		; Get DOS version
+	int	0x21
+	cmp	al, 4
+	jb	old_dos
+
+	; The drive letter, if any, is the first thing on the command line.
+
+	xor	bp, bp
+	mov	si, 0x81
+
+skip_space:
+	lodsb
+	cmp	al, ' '
+	je	skip_space
+	cmp	al, 0x0d
+	je	mount
+
+	and	al, 0xdf		; Upper case
+	sub	al, 'A' - 1
+	cmp	al, 26
+	ja	usage
+	mov	bp, ax
+	and	bp, 0xff
+	jz	usage
+
+mount:
+	mov	ah, 0x52		; ES:BX = list of lists
+	int	0x21
+
+	push	ds
+	mov	ax, 0x5d06		; DS:SI = swappable data area
+	int	0x21
+	mov	dx, bp
+	extended_redir_mount
+	pop	ds
+
+	test	al, al
+	jz	failed
+
+	add	al, 'A' - 1
+	mov	[drive_letter], al
+	mov	dx, mounted_msg
+	mov	ah, 0x09
+	int	0x21
+	mov	ax, 0x4c00
+	int	0x21
+
+old_dos:
+	mov	dx, old_dos_msg
+	jmp	error
+
+usage:
+	mov	dx, usage_msg
+	jmp	error
+
+failed:
+	mov	dx, failed_msg
+
+error:
+	mov	ah, 0x09
+	int	0x21
+	mov	ax, 0x4c01
+	int	0x21
+
+mounted_msg	db	'Host directory mounted as drive '
+drive_letter	db	'?:', 0x0d, 0x0a, '$'
+old_dos_msg	db	'DOS 4.0 or later is needed', 0x0d, 0x0a, '$'
+usage_msg	db	'Usage: XTMOUNT [drive]', 0x0d, 0x0a, '$'
+failed_msg	db	'No host drive, or no unused drive to mount it on', 0x0d, 0x0a, '$'
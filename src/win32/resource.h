@@ -9,8 +9,14 @@
 #define IDD_DIALOG_SOUND_CFG                    108
 #define IDM_RESET                               40000
 #define IDM_QUIT                                40001
+#define IDM_SAVE_SNAPSHOT                       40002
+#define IDM_RESTORE_SNAPSHOT                    40003
 #define IDM_TEXT_CGA                            40004
 #define IDM_TEXT_VGA_8x16                       40005
+#define IDM_REWIND                              40006
+#define IDM_COMMIT_DISK                         40007
+#define IDM_DISCARD_DISK                        40008
+#define IDM_DISK_STATS                          40009
 #define IDM_SET_SERIAL_PORTS                    40013
 #define IDM_CONFIGURE_SOUND                     40015
 #define IDC_EDIT_CS                             40101
@@ -8,6 +8,12 @@
 //
 
 #include "8086tiny_interface.h"
+#include "emulator/XTcpu.h"
+#include "emulator/XTfpu.h"
+#include "emulator/XTems.h"
+#include "emulator/XTsnapshot.h"
+#include "emulator/XTreplay.h"
+#include "emulator/XTdisk.h"
 #include "resource.h"
 
 #include <Windows.h>
@@ -48,7 +54,76 @@ static char BiosFilename[1024];
 static char HDFilename[1024];
 static char FDFilename[1024];
 
+// Delta file for hard disk writes, and commit or discard requested from
+// the menu.
+static char HDDeltaFilename[1024];
+static int DiskPending = DISK_REQUEST_NONE;
+
+// How disk writes are cached
+static int DiskCacheMode = DISK_CACHE_OFF;
+
+// Directory of disk boot traces, empty to not prefetch
+static char DiskTraceDirectory[1024];
+
+// Print disk statistics at exit
+static bool DiskStats = false;
+
+// Host directory shown as a network drive, empty for none
+static char HostDriveDirectory[1024];
+
 int CPU_Clock_Hz = 4770000;
+
+// Instructions per lockstep block, 0 = lockstep checking disabled
+static int LockstepBlockLength = 0;
+
+// The CPU model to emulate
+static int CPUModel = CPU_MODEL_80186;
+
+// The numeric coprocessor fitted
+static int FPUMode = FPU_MODE_NONE;
+
+// Separate memory above 1MB instead of 8086 address wraparound
+static bool A20Enabled = true;
+
+// Expanded memory size in KB (0 = no board) and page frame segment
+static int EMSSizeKB = 0;
+static int EMSFrame = EMS_DEFAULT_FRAME;
+
+// Snapshot save or restore requested from the menu, and the snapshot file.
+// The file is initially the snapshot to restore at start up, if any.
+static int SnapshotPending = SNAP_REQUEST_NONE;
+static char SnapshotFilename[1024];
+
+// Save snapshots compressed
+static bool SnapshotCompress = false;
+
+// Clone machines to start from the snapshot at start up (0 = restore it
+// instead), and the most to run at once (0 = no limit).
+static int CloneCount = 0;
+static int CloneParallel = 0;
+
+// Rewind history length in seconds (0 = no rewinding) and the interval
+// between checkpoints in ms of emulated time, counted in video frames.
+static int RewindSeconds = 0;
+static int RewindIntervalMs = 1000;
+static int RewindFrames = 0;
+static bool CheckpointPending = false;
+
+// Frames to run ahead of the frame presented (0 = no running ahead), and
+// the progress of running ahead from the end of the current frame.
+static int RunAheadFrames = 0;
+static int RunAheadCount = 0;
+static bool RunAheadPending = false;
+static bool RunningAhead = false;
+static bool RunAheadDone = false;
+
+// Record inputs to or replay them from the replay log file.
+static int ReplayMode = REPLAY_OFF;
+static char ReplayFilename[1024];
+
+// CPU ticks until the end of vertical retrace, 0 if not in retrace.
+static int VBlankTicks = 0;
+
 const int PIT_Clock_Hz = 1193181;
 
 int CPU_Counter = 0;
@@ -62,6 +137,22 @@ static int Int8Pending = 0;
 
 static DWORD NextSlowdownTime = 0;
 
+// Automatic turbo. Real time is not waited for while the guest makes disk
+// calls at a sustained rate, or for a time after a reset, until there is
+// input or sound. Times are in ms of CPU time.
+#define AUTO_TURBO_DISK_CALLS 4   // Disk calls in a window that start turbo
+#define AUTO_TURBO_WINDOW_MS 100
+#define AUTO_TURBO_HOLD_MS 250    // Turbo time after the last disk call
+#define AUTO_TURBO_QUIET_MS 1000  // Time after input or sound without turbo
+
+static bool AutoTurbo = false;
+static int AutoTurboBootMs = 0;
+static int TurboBootMs = 0;
+static int TurboDiskMs = 0;
+static int TurboQuietMs = 0;
+static int DiskCalls = 0;
+static int DiskWindowMs = 0;
+
 // Mouse state variables
 
 static bool HaveCapture = false;
@@ -167,7 +258,7 @@ void PIT_UpdateTimers(int Ticks)
   {
     SpkrT2Out = false;
 
-    if (PIT_Channel2.Count <= 0)
+    while (PIT_Channel2.Count <= 0)
     {
       if (PIT_Channel2.ResetCount == 0)
       {
@@ -182,7 +273,7 @@ void PIT_UpdateTimers(int Ticks)
   }
   else if (PIT_Channel2.Mode == 3)
   {
-    if (PIT_Channel2.Count <= 0)
+    while (PIT_Channel2.Count <= 0)
     {
       if (PIT_Channel2.ResetCount == 0)
       {
@@ -509,7 +600,7 @@ static unsigned int VKtoSet1Code(int vk, bool IsExtended)
   return 0xFF;
 }
 
-static inline void AddKeyEvent(unsigned char code)
+static inline void QueueKeyEvent(unsigned char code)
 {
   if (KeyBufferCount < KEYBUFFER_LEN)
   {
@@ -519,6 +610,30 @@ static inline void AddKeyEvent(unsigned char code)
   }
 }
 
+static inline bool InTurbo(void)
+{
+  return (TurboBootMs > 0) || (TurboDiskMs > 0);
+}
+
+// Input and sound end any automatic turbo and hold off disk turbo for a
+// while, so interactive programs run in real time.
+static void UserActive(void)
+{
+  TurboBootMs = 0;
+  TurboDiskMs = 0;
+  TurboQuietMs = AUTO_TURBO_QUIET_MS;
+}
+
+// Keys pressed are recorded, and ignored while replaying.
+static inline void AddKeyEvent(unsigned char code)
+{
+  if (REPLAY_Playing()) return;
+
+  UserActive();
+  REPLAY_Input(REPLAY_EVENT_KEY, &code, 1);
+  QueueKeyEvent(code);
+}
+
 static inline  bool IsKeyEventAvailable(void)
 {
   return (KeyBufferCount > 0);
@@ -630,6 +745,190 @@ int ReadConfig(const char *Filename)
   // Read sound configuration
   SNDCFG_Read(fp);
 
+  // Read optional settings.
+  // These follow the sound configuration and may be in any order.
+  while (fgets(Line, 256, fp) != NULL)
+  {
+    if (strncmp(Line, "[CPU_LOCKSTEP]", 14) == 0)
+    {
+      fgets(Line, 256, fp);
+      sscanf(Line, "%d\n", &LockstepBlockLength);
+    }
+    else if (strncmp(Line, "[CPU_MODEL]", 11) == 0)
+    {
+      fgets(Line, 256, fp);
+      if (strncmp(Line, "8088", 4) == 0)
+      {
+        CPUModel = CPU_MODEL_8088;
+      }
+      else if (strncmp(Line, "V20", 3) == 0)
+      {
+        CPUModel = CPU_MODEL_V20;
+      }
+      else
+      {
+        CPUModel = CPU_MODEL_80186;
+      }
+    }
+    else if (strncmp(Line, "[FPU]", 5) == 0)
+    {
+      fgets(Line, 256, fp);
+      if (strncmp(Line, "FAST", 4) == 0)
+      {
+        FPUMode = FPU_MODE_FAST;
+      }
+      else if (strncmp(Line, "EXACT", 5) == 0)
+      {
+        FPUMode = FPU_MODE_EXACT;
+      }
+      else
+      {
+        FPUMode = FPU_MODE_NONE;
+      }
+    }
+    else if (strncmp(Line, "[A20]", 5) == 0)
+    {
+      fgets(Line, 256, fp);
+      A20Enabled = (strncmp(Line, "ON", 2) == 0);
+    }
+    else if (strncmp(Line, "[EMS]", 5) == 0)
+    {
+      fgets(Line, 256, fp);
+      sscanf(Line, "%d %x\n", &EMSSizeKB, &EMSFrame);
+    }
+    else if (strncmp(Line, "[REWIND]", 8) == 0)
+    {
+      fgets(Line, 256, fp);
+      sscanf(Line, "%d %d\n", &RewindSeconds, &RewindIntervalMs);
+      if (RewindIntervalMs < 16) RewindIntervalMs = 16;
+    }
+    else if (strncmp(Line, "[RUNAHEAD]", 10) == 0)
+    {
+      fgets(Line, 256, fp);
+      sscanf(Line, "%d\n", &RunAheadFrames);
+    }
+    else if (strncmp(Line, "[REPLAY]", 8) == 0)
+    {
+      fgets(Line, 256, fp);
+      len = strlen(Line)-1;
+      while ((len > 0) && (!isprint(Line[len]))) Line[len--] = 0;
+      if (strncmp(Line, "RECORD ", 7) == 0)
+      {
+        ReplayMode = REPLAY_RECORD;
+        strncpy(ReplayFilename, Line + 7, 1024);
+      }
+      else if (strncmp(Line, "PLAY ", 5) == 0)
+      {
+        ReplayMode = REPLAY_PLAY;
+        strncpy(ReplayFilename, Line + 5, 1024);
+      }
+      else
+      {
+        ReplayMode = REPLAY_OFF;
+      }
+    }
+    else if (strncmp(Line, "[HD_DELTA]", 10) == 0)
+    {
+      fgets(Line, 256, fp);
+      len = strlen(Line)-1;
+      while ((len > 0) && (!isprint(Line[len]))) Line[len--] = 0;
+      if (strncmp(Line, "NIL", 3) == 0)
+      {
+        HDDeltaFilename[0] = 0;
+      }
+      else
+      {
+        strncpy(HDDeltaFilename, Line, 1024);
+      }
+    }
+    else if (strncmp(Line, "[DISK_TRACE]", 12) == 0)
+    {
+      fgets(Line, 256, fp);
+      len = strlen(Line)-1;
+      while ((len > 0) && (!isprint(Line[len]))) Line[len--] = 0;
+      if (strncmp(Line, "NIL", 3) == 0)
+      {
+        DiskTraceDirectory[0] = 0;
+      }
+      else
+      {
+        strncpy(DiskTraceDirectory, Line, 1024);
+      }
+    }
+    else if (strncmp(Line, "[HOST_DRIVE]", 12) == 0)
+    {
+      fgets(Line, 256, fp);
+      len = strlen(Line)-1;
+      while ((len > 0) && (!isprint(Line[len]))) Line[len--] = 0;
+      if (strncmp(Line, "NIL", 3) == 0)
+      {
+        HostDriveDirectory[0] = 0;
+      }
+      else
+      {
+        strncpy(HostDriveDirectory, Line, 1024);
+      }
+    }
+    else if (strncmp(Line, "[DISK_CACHE]", 12) == 0)
+    {
+      fgets(Line, 256, fp);
+      if (strncmp(Line, "ON", 2) == 0)
+      {
+        DiskCacheMode = DISK_CACHE_WRITEBACK;
+      }
+      else if (strncmp(Line, "SYNC", 4) == 0)
+      {
+        DiskCacheMode = DISK_CACHE_SYNC;
+      }
+      else
+      {
+        DiskCacheMode = DISK_CACHE_OFF;
+      }
+    }
+    else if (strncmp(Line, "[AUTO_TURBO]", 12) == 0)
+    {
+      fgets(Line, 256, fp);
+      AutoTurbo = (strncmp(Line, "ON", 2) == 0);
+    }
+    else if (strncmp(Line, "[AUTO_TURBO_BOOT]", 17) == 0)
+    {
+      fgets(Line, 256, fp);
+      sscanf(Line, "%d\n", &AutoTurboBootMs);
+      AutoTurboBootMs *= 1000;
+    }
+    else if (strncmp(Line, "[DISK_STATS]", 12) == 0)
+    {
+      fgets(Line, 256, fp);
+      DiskStats = (strncmp(Line, "ON", 2) == 0);
+    }
+    else if (strncmp(Line, "[SNAPSHOT_COMPRESS]", 19) == 0)
+    {
+      fgets(Line, 256, fp);
+      SnapshotCompress = (strncmp(Line, "ON", 2) == 0);
+    }
+    else if (strncmp(Line, "[CLONES]", 8) == 0)
+    {
+      fgets(Line, 256, fp);
+      sscanf(Line, "%d %d\n", &CloneCount, &CloneParallel);
+      if (CloneCount < 0) CloneCount = 0;
+      if (CloneParallel < 0) CloneParallel = 0;
+    }
+    else if (strncmp(Line, "[SNAPSHOT]", 10) == 0)
+    {
+      fgets(Line, 256, fp);
+      len = strlen(Line)-1;
+      while ((len > 0) && (!isprint(Line[len]))) Line[len--] = 0;
+      if (strncmp(Line, "NIL", 3) == 0)
+      {
+        SnapshotFilename[0] = 0;
+      }
+      else
+      {
+        strncpy(SnapshotFilename, Line, 1024);
+      }
+    }
+  }
+
   fclose(fp);
 
   return 1;
@@ -641,6 +940,12 @@ LRESULT CALLBACK WindowProcedure (HWND hwnd, UINT message, WPARAM wParam, LPARAM
 
   switch (message)                  /* handle the messages */
   {
+    case WM_PAINT:
+      // The screen is only redrawn where video memory changes, so redraw
+      // everything on the next frame when the window needs painting.
+      CGA_Invalidate();
+      return DefWindowProc (hwnd, message, wParam, lParam);
+
     case WM_DESTROY:
       EmulationExitFlag = true;
       PostQuitMessage (0);       /* send a WM_QUIT to the message queue */
@@ -699,21 +1004,25 @@ LRESULT CALLBACK WindowProcedure (HWND hwnd, UINT message, WPARAM wParam, LPARAM
         HaveCapture = true;
       }
       MouseLButtonDown = true;
+      UserActive();
       SERIAL_MouseMove(0, 0, MouseLButtonDown, MouseRButtonDown);
       break;
 
     case WM_LBUTTONUP:
       MouseLButtonDown = false;
+      UserActive();
       SERIAL_MouseMove(0, 0, MouseLButtonDown, MouseRButtonDown);
       break;
 
     case WM_RBUTTONDOWN:
       MouseRButtonDown = true;
+      UserActive();
       SERIAL_MouseMove(0, 0, MouseLButtonDown, MouseRButtonDown);
       break;
 
     case WM_RBUTTONUP:
       MouseRButtonDown = false;
+      UserActive();
       SERIAL_MouseMove(0, 0, MouseLButtonDown, MouseRButtonDown);
       break;
 
@@ -729,7 +1038,49 @@ LRESULT CALLBACK WindowProcedure (HWND hwnd, UINT message, WPARAM wParam, LPARAM
         // File menu
         //
         case IDM_RESET:
-          ResetPending = true;
+          if (!REPLAY_Playing())
+          {
+            REPLAY_Input(REPLAY_EVENT_RESET, &ResetPending, 0);
+            ResetPending = true;
+          }
+          break;
+
+        case IDM_SAVE_SNAPSHOT:
+          if (SaveFileDialog("Save Snapshot", SnapshotFilename, 1024, "Snapshots (*.snp)\0*.snp\0All Files (*.*)\0*.*\0"))
+          {
+            SnapshotPending = SNAP_REQUEST_SAVE;
+          }
+          break;
+
+        case IDM_RESTORE_SNAPSHOT:
+          if (OpenFileDialog("Restore Snapshot", SnapshotFilename, 1024, "Snapshots (*.snp)\0*.snp\0All Files (*.*)\0*.*\0"))
+          {
+            SnapshotPending = SNAP_REQUEST_RESTORE;
+          }
+          break;
+
+        case IDM_REWIND:
+          SnapshotPending = SNAP_REQUEST_REWIND;
+          break;
+
+        case IDM_COMMIT_DISK:
+          if (MessageBox(hwnd, "Write the changes in the hard disk delta file to the hard disk image?",
+                         "Commit Disk Changes", MB_YESNO | MB_ICONQUESTION) == IDYES)
+          {
+            DiskPending = DISK_REQUEST_COMMIT;
+          }
+          break;
+
+        case IDM_DISCARD_DISK:
+          if (MessageBox(hwnd, "Discard the changes in the hard disk delta file and reset?",
+                         "Discard Disk Changes", MB_YESNO | MB_ICONQUESTION) == IDYES)
+          {
+            DiskPending = DISK_REQUEST_DISCARD;
+          }
+          break;
+
+        case IDM_DISK_STATS:
+          DiskPending = DISK_REQUEST_STATS;
           break;
 
         case IDM_QUIT:
@@ -875,6 +1226,8 @@ bool T8086TinyInterface_t::Initialise(unsigned char *mem_in)
 
   ReadConfig("default.cfg");
 
+  TurboBootMs = (AutoTurbo) ? AutoTurboBootMs : 0;
+
   WAVEFORMATEX wfx;
   wfx.cbSize = 0;
   wfx.wFormatTag = WAVE_FORMAT_PCM;
@@ -914,6 +1267,7 @@ bool T8086TinyInterface_t::Reset(void)
     CPU_Counter = 0;
     CPU_Frame = 0;
     PIT_Counter = 0;
+    VBlankTicks = 0;
 
     // Reset keyboard
     KeyBufferHead = 0;
@@ -936,6 +1290,9 @@ bool T8086TinyInterface_t::Reset(void)
     Int8Pending = false;
     ResetPending = false;
 
+    TurboBootMs = (AutoTurbo) ? AutoTurboBootMs : 0;
+    TurboDiskMs = 0;
+
     for (int i = 0 ; i < 4 ; i++) PIC_ICW[i] = 0;
     for (int i = 0 ; i < 3 ; i++) PIC_OCW[i] = 0;
     PIC_ICW_Idx = 0;
@@ -977,28 +1334,381 @@ char *T8086TinyInterface_t::GetHDImageFilename(void)
   return HDFilename;
 }
 
+char *T8086TinyInterface_t::GetHDDeltaFilename(void)
+{
+  if (HDDeltaFilename[0] == 0)
+  {
+    return NULL;
+  }
+
+  return HDDeltaFilename;
+}
+
+int T8086TinyInterface_t::GetDiskCacheMode(void)
+{
+  return DiskCacheMode;
+}
+
+char *T8086TinyInterface_t::GetDiskTraceDirectory(void)
+{
+  if (DiskTraceDirectory[0] == 0)
+  {
+    return NULL;
+  }
+
+  return DiskTraceDirectory;
+}
+
+char *T8086TinyInterface_t::GetHostDriveDirectory(void)
+{
+  if (HostDriveDirectory[0] == 0)
+  {
+    return NULL;
+  }
+
+  return HostDriveDirectory;
+}
+
+bool T8086TinyInterface_t::GetDiskStats(void)
+{
+  return DiskStats;
+}
+
+int T8086TinyInterface_t::GetLockstepBlockLength(void)
+{
+  return LockstepBlockLength;
+}
+
+int T8086TinyInterface_t::GetCPUModel(void)
+{
+  return CPUModel;
+}
+
+int T8086TinyInterface_t::GetFPUMode(void)
+{
+  return FPUMode;
+}
+
+bool T8086TinyInterface_t::GetA20Enabled(void)
+{
+  return A20Enabled;
+}
+
+int T8086TinyInterface_t::GetEMSSize(void)
+{
+  return EMSSizeKB;
+}
+
+int T8086TinyInterface_t::GetEMSFrame(void)
+{
+  return EMSFrame;
+}
+
 bool T8086TinyInterface_t::FDChanged(void)
 {
   return FDImageChanged;
 }
 
-bool T8086TinyInterface_t::TimerTick(int nTicks)
+int T8086TinyInterface_t::SnapshotRequest(void)
 {
-  int PIT_Ticks;
-  MSG messages;
-  bool NextVideoFrame = false;
+  int Request = SNAP_REQUEST_NONE;
+
+  // Nothing else is done until the state saved before running ahead is
+  // back, and running ahead starts once everything else is done.
+  if (RunningAhead)
+  {
+    if (RunAheadDone)
+    {
+      RunningAhead = false;
+      RunAheadDone = false;
+      Request = SNAP_REQUEST_RUNAHEAD_END;
+    }
+  }
+  else if (SnapshotPending != SNAP_REQUEST_NONE)
+  {
+    Request = SnapshotPending;
+    SnapshotPending = SNAP_REQUEST_NONE;
+  }
+  else if (CheckpointPending)
+  {
+    Request = SNAP_REQUEST_CHECKPOINT;
+    CheckpointPending = false;
+  }
+  else if (RunAheadPending)
+  {
+    Request = SNAP_REQUEST_RUNAHEAD;
+    RunAheadPending = false;
+  }
+
+  return Request;
+}
+
+int T8086TinyInterface_t::DiskRequest(void)
+{
+  int Request = DiskPending;
+
+  DiskPending = DISK_REQUEST_NONE;
+
+  return Request;
+}
+
+char *T8086TinyInterface_t::GetSnapshotFilename(void)
+{
+  if (SnapshotFilename[0] == 0)
+  {
+    return NULL;
+  }
+
+  return SnapshotFilename;
+}
+
+bool T8086TinyInterface_t::GetSnapshotCompress(void)
+{
+  return SnapshotCompress;
+}
+
+// Interface device state saved in machine snapshots.
+// The video adapter and serial port state follow this.
+struct DeviceState_t
+{
+  unsigned char Port[65536];
+  int PIC_OCW_Idx;
+  unsigned char PIC_OCW[3];
+  int PIC_ICW_Idx;
+  unsigned char PIC_ICW[4];
+  TimerData_t PIT_Channel0;
+  TimerData_t PIT_Channel1;
+  TimerData_t PIT_Channel2;
+  int PIT_Counter;
+  DWORD INT8_PERIOD_MS;
+  int Int8Pending;
+  int CPU_Counter;
+  int CPU_Frame;
+  int VBlankTicks;
+  int KeyBufferHead;
+  int KeyBufferTail;
+  int KeyBufferCount;
+  unsigned char KeyBuffer[KEYBUFFER_LEN];
+  unsigned char KeyInputBuffer;
+  bool KeyInputFull;
+  bool SpkrData;
+  bool SpkrT2Gate;
+  bool SpkrT2Out;
+  bool SpkrT2US;
+  int SND_Counter;
+};
+
+int T8086TinyInterface_t::SaveDeviceState(unsigned char *Buffer)
+{
+  DeviceState_t *State = (DeviceState_t *) Buffer;
+
+  if (State == NULL)
+  {
+    return sizeof(DeviceState_t) + CGA_SaveState(NULL) + SERIAL_SaveState(NULL);
+  }
+
+  memset(State, 0, sizeof(DeviceState_t));
+  memcpy(State->Port, Port, sizeof(Port));
+  State->PIC_OCW_Idx = PIC_OCW_Idx;
+  memcpy(State->PIC_OCW, PIC_OCW, sizeof(PIC_OCW));
+  State->PIC_ICW_Idx = PIC_ICW_Idx;
+  memcpy(State->PIC_ICW, PIC_ICW, sizeof(PIC_ICW));
+  State->PIT_Channel0 = PIT_Channel0;
+  State->PIT_Channel1 = PIT_Channel1;
+  State->PIT_Channel2 = PIT_Channel2;
+  State->PIT_Counter = PIT_Counter;
+  State->INT8_PERIOD_MS = INT8_PERIOD_MS;
+  State->Int8Pending = Int8Pending;
+  State->CPU_Counter = CPU_Counter;
+  State->CPU_Frame = CPU_Frame;
+  State->VBlankTicks = VBlankTicks;
+  State->KeyBufferHead = KeyBufferHead;
+  State->KeyBufferTail = KeyBufferTail;
+  State->KeyBufferCount = KeyBufferCount;
+  memcpy(State->KeyBuffer, KeyBuffer, sizeof(KeyBuffer));
+  State->KeyInputBuffer = KeyInputBuffer;
+  State->KeyInputFull = KeyInputFull;
+  State->SpkrData = SpkrData;
+  State->SpkrT2Gate = SpkrT2Gate;
+  State->SpkrT2Out = SpkrT2Out;
+  State->SpkrT2US = SpkrT2US;
+  State->SND_Counter = SND_Counter;
+
+  Buffer += sizeof(DeviceState_t);
+  Buffer += CGA_SaveState(Buffer);
+  Buffer += SERIAL_SaveState(Buffer);
+
+  return SaveDeviceState(NULL);
+}
+
+bool T8086TinyInterface_t::RestoreDeviceState(const unsigned char *Buffer, int Length, bool RunAhead)
+{
+  const DeviceState_t *State = (const DeviceState_t *) Buffer;
+  int CGALength = CGA_SaveState(NULL);
+
+  if (Length != SaveDeviceState(NULL))
+  {
+    return false;
+  }
+
+  memcpy(Port, State->Port, sizeof(Port));
+  PIC_OCW_Idx = State->PIC_OCW_Idx;
+  memcpy(PIC_OCW, State->PIC_OCW, sizeof(PIC_OCW));
+  PIC_ICW_Idx = State->PIC_ICW_Idx;
+  memcpy(PIC_ICW, State->PIC_ICW, sizeof(PIC_ICW));
+  PIT_Channel0 = State->PIT_Channel0;
+  PIT_Channel1 = State->PIT_Channel1;
+  PIT_Channel2 = State->PIT_Channel2;
+  PIT_Counter = State->PIT_Counter;
+  INT8_PERIOD_MS = State->INT8_PERIOD_MS;
+  Int8Pending = State->Int8Pending;
+  CPU_Counter = State->CPU_Counter;
+  CPU_Frame = State->CPU_Frame;
+  VBlankTicks = State->VBlankTicks;
+  KeyBufferHead = State->KeyBufferHead;
+  KeyBufferTail = State->KeyBufferTail;
+  KeyBufferCount = State->KeyBufferCount;
+  memcpy(KeyBuffer, State->KeyBuffer, sizeof(KeyBuffer));
+  KeyInputBuffer = State->KeyInputBuffer;
+  KeyInputFull = State->KeyInputFull;
+  SpkrData = State->SpkrData;
+  SpkrT2Gate = State->SpkrT2Gate;
+  SpkrT2Out = State->SpkrT2Out;
+  SpkrT2US = State->SpkrT2US;
+  SND_Counter = State->SND_Counter;
+
+  // Sound already generated belongs to the old state.
+  SndBufferLen = 0;
+
+  Buffer += sizeof(DeviceState_t);
+  CGA_RestoreState(Buffer, CGALength, RunAhead);
+  SERIAL_RestoreState(Buffer + CGALength, Length - sizeof(DeviceState_t) - CGALength);
+
+  return true;
+}
+
+int T8086TinyInterface_t::GetRewindCheckpoints(void)
+{
+  return RewindSeconds * 1000 / RewindIntervalMs;
+}
+
+int T8086TinyInterface_t::GetRunAheadFrames(void)
+{
+  return RunAheadFrames;
+}
+
+int T8086TinyInterface_t::GetReplayMode(void)
+{
+  return ReplayMode;
+}
+
+char *T8086TinyInterface_t::GetReplayFilename(void)
+{
+  if (ReplayMode == REPLAY_OFF)
+  {
+    return NULL;
+  }
+
+  return ReplayFilename;
+}
+
+// Draw the current frame, resizing the window first if the display size
+// has changed.
+static void PresentFrame(void)
+{
+  int w, h;
+  CGA_GetDisplaySize(w, h);
+  if ((w != CurrentDispW) || (h != CurrentDispH))
+  {
+    CurrentDispW = w;
+    CurrentDispH = h;
+
+    RECT wrect = { 0, 0, CurrentDispW, CurrentDispH };
+    AdjustWindowRect(&wrect, WIN_FLAGS, TRUE);
+    w = wrect.right - wrect.left;
+    h = wrect.bottom - wrect.top;
+    SetWindowPos(hwndMain, NULL, 0, 0, w, h, SWP_NOMOVE | SWP_NOZORDER);
+  }
+
+  CGA_DrawScreen(hwndMain, mem);
+}
+
+void T8086TinyInterface_t::RunAhead(bool Ahead)
+{
+  if (Ahead)
+  {
+    RunningAhead = true;
+    RunAheadCount = 0;
+  }
+  else
+  {
+    PresentFrame();
+  }
+}
+
+int T8086TinyInterface_t::GetCloneCount(void)
+{
+  return CloneCount;
+}
+
+int T8086TinyInterface_t::GetCloneParallel(void)
+{
+  return CloneParallel;
+}
+
+void T8086TinyInterface_t::CloneStarted(int Index)
+{
+  char Title[32];
+
+  // Each clone runs in a window of its own.
+  sprintf(Title, "TinyXT clone %d", Index);
+  SetWindowText(hwndMain, Title);
+}
 
-  // TODO:
-  // This works OK for small values of nTicks, however, the following
-  // processing will break down horribly if nTicks is ever larger ( > about 10)
-  // If I ever get nTicks per instruction then this will need to change to
-  // a loop. Probably safe to process 4 ticks per loop.
+void T8086TinyInterface_t::DiskActivity(void)
+{
+  // Calls made running ahead are made again for real.
+  if (!AutoTurbo || RunningAhead) return;
+
+  DiskCalls++;
+  if ((DiskCalls >= AUTO_TURBO_DISK_CALLS) && (TurboQuietMs == 0))
+  {
+    TurboDiskMs = AUTO_TURBO_HOLD_MS;
+  }
+}
+
+// Count down the automatic turbo times for a 4 ms update.
+static void UpdateTurbo(void)
+{
+  // An audible tone is sound activity.
+  if (SpkrT2Gate && SpkrData && !SpkrT2US)
+  {
+    UserActive();
+  }
+
+  TurboBootMs = (TurboBootMs > 4) ? TurboBootMs - 4 : 0;
+  TurboDiskMs = (TurboDiskMs > 4) ? TurboDiskMs - 4 : 0;
+  TurboQuietMs = (TurboQuietMs > 4) ? TurboQuietMs - 4 : 0;
+
+  DiskWindowMs += 4;
+  if (DiskWindowMs >= AUTO_TURBO_WINDOW_MS)
+  {
+    DiskWindowMs = 0;
+    DiskCalls = 0;
+  }
+}
+
+// Update the PIT and sound output for nTicks CPU ticks.
+static void UpdateTimers(int nTicks)
+{
+  long long Counter;
+  int PIT_Ticks;
 
   // Update PIT
 
-  PIT_Counter = PIT_Counter + PIT_Clock_Hz * nTicks;
-  PIT_Ticks = PIT_Counter / CPU_Clock_Hz;
-  PIT_Counter = PIT_Counter % CPU_Clock_Hz;
+  Counter = PIT_Counter + (long long) PIT_Clock_Hz * nTicks;
+  PIT_Ticks = (int) (Counter / CPU_Clock_Hz);
+  PIT_Counter = (int) (Counter % CPU_Clock_Hz);
 
   PIT_UpdateTimers(PIT_Ticks);
 
@@ -1006,9 +1716,9 @@ bool T8086TinyInterface_t::TimerTick(int nTicks)
   if (SoundEnabled)
   {
     int SoundTicks;
-    SND_Counter = SND_Counter + AudioSampleRate * nTicks;
-    SoundTicks = SND_Counter / CPU_Clock_Hz;
-    SND_Counter = SND_Counter % CPU_Clock_Hz;
+    Counter = SND_Counter + (long long) AudioSampleRate * nTicks;
+    SoundTicks = (int) (Counter / CPU_Clock_Hz);
+    SND_Counter = (int) (Counter % CPU_Clock_Hz);
     for (int i = 0 ; i < SoundTicks ; i++)
     {
       if (SpkrT2Gate)
@@ -1029,6 +1739,42 @@ bool T8086TinyInterface_t::TimerTick(int nTicks)
       SndBufferLen+=1;
     }
   }
+}
+
+bool T8086TinyInterface_t::TimerTick(int nTicks)
+{
+  MSG messages;
+  bool NextVideoFrame = false;
+
+  // While timer 2 drives the speaker each sample depends on the timer 2
+  // output at that instant, so update in 4 tick (one instruction) steps.
+  // Otherwise the PIT and sample counts are exact for any number of ticks.
+  if (SoundEnabled && SpkrT2Gate && !SpkrT2US)
+  {
+    int Remaining = nTicks;
+    while (Remaining > 4)
+    {
+      UpdateTimers(4);
+      Remaining -= 4;
+    }
+    UpdateTimers(Remaining);
+  }
+  else
+  {
+    UpdateTimers(nTicks);
+  }
+
+  // Vertical retrace is timed in CPU time so the guest sees the same
+  // retrace timing however fast the emulator runs.
+  if (VBlankTicks > 0)
+  {
+    VBlankTicks -= nTicks;
+    if (VBlankTicks <= 0)
+    {
+      VBlankTicks = 0;
+      CGA_VBlankEnd();
+    }
+  }
 
   // main update processing is every 4 ms of CPU time.
 
@@ -1039,32 +1785,58 @@ bool T8086TinyInterface_t::TimerTick(int nTicks)
     CPU_Counter = 0;
     CPU_Frame++;
 
-    if (CPU_Frame == 4)
+    if ((CPU_Frame == 4) && RunningAhead)
     {
+      NextVideoFrame = true;
+      CPU_Frame = 0;
+
+      // Sound from frames run ahead is dropped, the real frames play it.
+      SndBufferLen = 0;
+
+      RunAheadCount++;
+      if (RunAheadCount == RunAheadFrames)
+      {
+        PresentFrame();
+        RunAheadDone = true;
+      }
+    }
+    else if (CPU_Frame == 4)
+    {
+      // Writing sound waits for real time, so sound is dropped when
+      // replaying or in turbo.
       if (SoundEnabled)
       {
-        WaveOut->Write((PBYTE) SndBuffer, SndBufferLen*2);
+        if (!REPLAY_Playing() && !InTurbo())
+        {
+          WaveOut->Write((PBYTE) SndBuffer, SndBufferLen*2);
+        }
         SndBufferLen = 0;
       }
 
-      int w, h;
-      CGA_GetDisplaySize(w, h);
-      if ((w != CurrentDispW) || (h != CurrentDispH))
+      // When running ahead the frame presented is drawn at the end of
+      // running ahead from this one instead.
+      if (RunAheadFrames > 0)
       {
-        CurrentDispW = w;
-        CurrentDispH = h;
-
-        RECT wrect = { 0, 0, CurrentDispW, CurrentDispH };
-        AdjustWindowRect(&wrect, WIN_FLAGS, TRUE);
-        w = wrect.right - wrect.left;
-        h = wrect.bottom - wrect.top;
-        SetWindowPos(hwndMain, NULL, 0, 0, w, h, SWP_NOMOVE | SWP_NOZORDER);
+        RunAheadPending = true;
+      }
+      else
+      {
+        PresentFrame();
       }
-
-      CGA_DrawScreen(hwndMain, mem);
       NextVideoFrame = true;
       CPU_Frame = 0;
 
+      // Frames are 16 ms of CPU time.
+      if (RewindSeconds > 0)
+      {
+        RewindFrames++;
+        if (RewindFrames * 16 >= RewindIntervalMs)
+        {
+          RewindFrames = 0;
+          CheckpointPending = true;
+        }
+      }
+
       // Get the mouse position using GetCursorPos.
 
       POINT cp;
@@ -1078,6 +1850,7 @@ bool T8086TinyInterface_t::TimerTick(int nTicks)
         int dy = yPos - ly;
         if ((dx != 0) || (dy != 0))
         {
+          if (HaveCapture) UserActive();
           SERIAL_MouseMove(dx, dy, MouseLButtonDown, MouseRButtonDown);
         }
       }
@@ -1120,31 +1893,98 @@ bool T8086TinyInterface_t::TimerTick(int nTicks)
         /* Send message to WindowProcedure */
         DispatchMessage(&messages);
       }
-    }
 
-    SERIAL_HandleSerial();
+      // When replaying, keys and resets come from the replay log.
+      if (REPLAY_Playing())
+      {
+        unsigned char code;
+        int Length = 1;
+        bool Replayed = true;
 
-    DWORD CurrentTime = timeGetTime();
-    if (CurrentTime >= NextSlowdownTime)
-    {
-      // No slowdown required
-      NextSlowdownTime = CurrentTime + 4;
+        while (Replayed)
+        {
+          if (REPLAY_NextInput(REPLAY_EVENT_KEY, &code, Length))
+          {
+            QueueKeyEvent(code);
+          }
+          else if (REPLAY_NextInput(REPLAY_EVENT_RESET, &code, Length))
+          {
+            ResetPending = true;
+          }
+          else
+          {
+            Replayed = false;
+          }
+          Length = 1;
+        }
+      }
     }
-    else
+
+    // Running ahead takes no input and does not wait for real time.
+    if (!RunningAhead)
     {
-      Sleep(NextSlowdownTime - CurrentTime);
-      NextSlowdownTime += 4;
+      SERIAL_HandleSerial();
+
+      if (AutoTurbo) UpdateTurbo();
+
+      // Replaying and turbo run as fast as possible.
+      DWORD CurrentTime = timeGetTime();
+      if (REPLAY_Playing() || InTurbo() || (CurrentTime >= NextSlowdownTime))
+      {
+        // No slowdown required
+        NextSlowdownTime = CurrentTime + 4;
+      }
+      else
+      {
+        Sleep(NextSlowdownTime - CurrentTime);
+        NextSlowdownTime += 4;
+      }
     }
 
     if (NextVideoFrame)
     {
+      // Vertical retrace lasts 2 ms.
       CGA_VBlankStart();
+      VBlankTicks = CPU_Clock_Hz / 500;
     }
   }
 
   return NextVideoFrame;
 }
 
+int T8086TinyInterface_t::TimerHorizon(void)
+{
+  int Horizon;
+  long long PIT_Horizon;
+  int IntNumber;
+
+  // Nothing can be skipped while an interrupt is waiting to be delivered.
+  if ((Int8Pending > 0) ||
+      (IsKeyEventAvailable() && !KeyInputFull) ||
+      SERIAL_IntPending(IntNumber))
+  {
+    return 0;
+  }
+
+  // Ticks until the next 4 ms update
+  Horizon = (CPU_Clock_Hz / 250) - CPU_Counter;
+
+  // Ticks until PIT channel 0 next reaches 0 and raises IRQ 0
+  PIT_Horizon = ((long long) PIT_Channel0.Count * CPU_Clock_Hz - PIT_Counter - 1) / PIT_Clock_Hz;
+  if (PIT_Horizon < Horizon)
+  {
+    Horizon = (int) PIT_Horizon;
+  }
+
+  // Ticks until the end of vertical retrace
+  if ((VBlankTicks > 0) && (VBlankTicks < Horizon))
+  {
+    Horizon = VBlankTicks;
+  }
+
+  return (Horizon > 0) ? Horizon : 0;
+}
+
 void T8086TinyInterface_t::WritePort(int Address, unsigned char Value)
 {
   Port[Address] = Value;
@@ -1296,6 +2136,11 @@ unsigned int T8086TinyInterface_t::VMemWrite(int i_w, int addr, unsigned int val
   return CGA_VMemWrite(mem, i_w, addr, val);
 }
 
+void T8086TinyInterface_t::VMemInvalidate(int addr, int len)
+{
+  CGA_VMemInvalidate(addr, len);
+}
+
 bool T8086TinyInterface_t::IntPending(int &IntNumber)
 {
   if (Int8Pending > 0)
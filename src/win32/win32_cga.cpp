@@ -9,6 +9,7 @@
 
 #include <windows.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "win32_cga.h"
 #include "cga_glyphs.h"
@@ -163,7 +164,6 @@ static unsigned int CursorLocation = 0;
 static bool  CursorDisplayOn = false;
 static DWORD CursorBlinkTime = 0;
 static unsigned char CGAStatus = 0;
-static DWORD CGARetraceEndTime = 0;
 static unsigned char CGAPaletteB[16*3] =
 {
   0x00, 0x00, 0x00, // black
@@ -204,6 +204,18 @@ static unsigned char TextState[80*25*2];
 static ScreenMode_t CurrentScreenMode = SM_CO80;
 static bool ScreenFullRedraw = true;
 
+// Video memory (A0000-BFFFF) written since the last frame, one flag for
+// each 16 byte block. Set by CGA_VMemWrite and CGA_VMemInvalidate and
+// cleared after each frame.
+#define VMEM_BASE          0xa0000
+#define VMEM_SIZE          0x20000
+#define VMEM_DIRTY_SHIFT   4
+static unsigned char VMemDirty[VMEM_SIZE >> VMEM_DIRTY_SHIFT];
+static bool VMemAnyDirty = true;
+
+// The cursor drawn in the last text mode frame, see CGA_CursorSignature.
+static int DrawnCursor = -1;
+
 // =============================================================================
 // Local Functions
 //
@@ -250,6 +262,60 @@ static void UpdateCursorstate(void)
   }
 }
 
+static inline void CGA_MarkDirty(int addr)
+{
+  unsigned int block = (unsigned int) (addr - VMEM_BASE) >> VMEM_DIRTY_SHIFT;
+
+  if (block < sizeof(VMemDirty))
+  {
+    VMemDirty[block] = 1;
+    VMemAnyDirty = true;
+  }
+}
+
+// Check if any of len bytes of video memory starting at addr were written
+// since the last frame.
+static bool CGA_TestDirty(int addr, int len)
+{
+  int first = (addr - VMEM_BASE) >> VMEM_DIRTY_SHIFT;
+  int last = (addr + len - 1 - VMEM_BASE) >> VMEM_DIRTY_SHIFT;
+
+  if (!VMemAnyDirty) return false;
+
+  if (first < 0) first = 0;
+  if (last >= (int) sizeof(VMemDirty)) last = sizeof(VMemDirty) - 1;
+
+  for (int i = first ; i <= last ; i++)
+  {
+    if (VMemDirty[i]) return true;
+  }
+
+  return false;
+}
+
+static void CGA_ClearDirty(void)
+{
+  if (VMemAnyDirty)
+  {
+    memset(VMemDirty, 0, sizeof(VMemDirty));
+    VMemAnyDirty = false;
+  }
+}
+
+// Get a value identifying how the text cursor should be drawn this frame,
+// or -1 if it should not be drawn.
+static int CGA_CursorSignature(void)
+{
+  UpdateCursorstate();
+
+  if (CursorDisplayOn && ((CRTRegister[0xA] & 0x1f) <= (CRTRegister[0xB] & 0x1F)))
+  {
+    return (CursorLocation << 10) | ((CRTRegister[0xA] & 0x1f) << 5) | (CRTRegister[0xB] & 0x1f);
+  }
+
+  return -1;
+}
+
 static void CGA_DrawCO40(HWND hwnd, unsigned char *mem)
 {
   unsigned char *vm = mem + 0xb8000 + PageOffset;
@@ -263,11 +329,20 @@ static void CGA_DrawCO40(HWND hwnd, unsigned char *mem)
   int fgColour;
   int bgColour;
   unsigned char Mask;
+  bool Drawn = false;
+  int Cursor;
 
   HDC hdc = GetDC(hwnd);
 
   for (int y = 0 ; y < 25 ; y++)
   {
+    // Rows not written since the last frame still match TextState.
+    if (!ScreenFullRedraw && !CGA_TestDirty(vm - mem, 80))
+    {
+      vm += 80;
+      cm += 80;
+      continue;
+    }
 
     for (int x = 0 ; x < 40 ; x++)
     {
@@ -278,6 +353,7 @@ static void CGA_DrawCO40(HWND hwnd, unsigned char *mem)
 
       if (ScreenFullRedraw || (glyph != cm[0]) || (attr != cm[1]))
       {
+        Drawn = true;
         fgColour = attr & 0x0f;
         bgColour = (attr >> 4) & 0x0f;
 
@@ -314,6 +390,15 @@ static void CGA_DrawCO40(HWND hwnd, unsigned char *mem)
     }
   }
 
+  // Skip the frame if no cell changed and the cursor looks the same.
+  Cursor = CGA_CursorSignature();
+  if (!Drawn && (Cursor == DrawnCursor))
+  {
+    ReleaseDC(hwnd, hdc);
+    return;
+  }
+  DrawnCursor = Cursor;
+
   StretchDIBits(
     hdc,
     0, 0, 640 , 400 , // dest x, y, w, h
@@ -323,9 +408,7 @@ static void CGA_DrawCO40(HWND hwnd, unsigned char *mem)
     DIB_RGB_COLORS,
     SRCCOPY);
 
-  UpdateCursorstate();
-
-  if (CursorDisplayOn && ((CRTRegister[0xA] & 0x1f) <= (CRTRegister[0xB] & 0x1F)))
+  if (Cursor >= 0)
   {
     RECT crect;
     crect.top  = ((CursorLocation / 40) * 16 + (CRTRegister[0xA] & 0x1f) * 2) ;
@@ -353,11 +436,20 @@ static void VGA8_DrawCO40(HWND hwnd, unsigned char *mem)
   int fgColour;
   int bgColour;
   unsigned char Mask;
+  bool Drawn = false;
+  int Cursor;
 
   HDC hdc = GetDC(hwnd);
 
   for (int y = 0 ; y < 25 ; y++)
   {
+    // Rows not written since the last frame still match TextState.
+    if (!ScreenFullRedraw && !CGA_TestDirty(vm - mem, 80))
+    {
+      vm += 80;
+      cm += 80;
+      continue;
+    }
 
     for (int x = 0 ; x < 40 ; x++)
     {
@@ -368,6 +460,7 @@ static void VGA8_DrawCO40(HWND hwnd, unsigned char *mem)
 
       if (ScreenFullRedraw || (glyph != cm[0]) || (attr != cm[1]))
       {
+        Drawn = true;
         fgColour = attr & 0x0f;
         bgColour = (attr >> 4) & 0x0f;
 
@@ -404,6 +497,15 @@ static void VGA8_DrawCO40(HWND hwnd, unsigned char *mem)
     }
   }
 
+  // Skip the frame if no cell changed and the cursor looks the same.
+  Cursor = CGA_CursorSignature();
+  if (!Drawn && (Cursor == DrawnCursor))
+  {
+    ReleaseDC(hwnd, hdc);
+    return;
+  }
+  DrawnCursor = Cursor;
+
   StretchDIBits(
     hdc,
     0, 0, 640 , 400 , // dest x, y, w, h
@@ -413,9 +515,7 @@ static void VGA8_DrawCO40(HWND hwnd, unsigned char *mem)
     DIB_RGB_COLORS,
     SRCCOPY);
 
-  UpdateCursorstate();
-
-  if (CursorDisplayOn && ((CRTRegister[0xA] & 0x1f) <= (CRTRegister[0xB] & 0x1F)))
+  if (Cursor >= 0)
   {
     RECT crect;
     crect.top  = ((CursorLocation / 40) * 16 + (CRTRegister[0xA] & 0x1f) * 2) ;
@@ -443,11 +543,20 @@ static void CGA_DrawCO80(HWND hwnd, unsigned char *mem)
   int fgColour;
   int bgColour;
   unsigned char Mask;
+  bool Drawn = false;
+  int Cursor;
 
   HDC hdc = GetDC(hwnd);
 
   for (int y = 0 ; y < 25 ; y++)
   {
+    // Rows not written since the last frame still match TextState.
+    if (!ScreenFullRedraw && !CGA_TestDirty(vm - mem, 160))
+    {
+      vm += 160;
+      cm += 160;
+      continue;
+    }
 
     for (int x = 0 ; x < 80 ; x++)
     {
@@ -458,6 +567,7 @@ static void CGA_DrawCO80(HWND hwnd, unsigned char *mem)
 
       if (ScreenFullRedraw || (glyph != cm[0]) || (attr != cm[1]))
       {
+        Drawn = true;
         fgColour = attr & 0x0f;
         bgColour = (attr >> 4) & 0x0f;
 
@@ -494,6 +604,15 @@ static void CGA_DrawCO80(HWND hwnd, unsigned char *mem)
     }
   }
 
+  // Skip the frame if no cell changed and the cursor looks the same.
+  Cursor = CGA_CursorSignature();
+  if (!Drawn && (Cursor == DrawnCursor))
+  {
+    ReleaseDC(hwnd, hdc);
+    return;
+  }
+  DrawnCursor = Cursor;
+
   StretchDIBits(
     hdc,
     0, 0, 640 , 400 , // dest x, y, w, h
@@ -503,9 +622,7 @@ static void CGA_DrawCO80(HWND hwnd, unsigned char *mem)
     DIB_RGB_COLORS,
     SRCCOPY);
 
-  UpdateCursorstate();
-
-  if (CursorDisplayOn && ((CRTRegister[0xA] & 0x1f) <= (CRTRegister[0xB] & 0x1F)))
+  if (Cursor >= 0)
   {
     RECT crect;
     crect.top  = ((CursorLocation / 80) * 16 + (CRTRegister[0xA] & 0x1f) * 2) ;
@@ -533,11 +650,20 @@ static void VGA8_DrawCO80(HWND hwnd, unsigned char *mem)
   int fgColour;
   int bgColour;
   unsigned char Mask;
+  bool Drawn = false;
+  int Cursor;
 
   HDC hdc = GetDC(hwnd);
 
   for (int y = 0 ; y < 25 ; y++)
   {
+    // Rows not written since the last frame still match TextState.
+    if (!ScreenFullRedraw && !CGA_TestDirty(vm - mem, 160))
+    {
+      vm += 160;
+      cm += 160;
+      continue;
+    }
 
     for (int x = 0 ; x < 80 ; x++)
     {
@@ -548,6 +674,7 @@ static void VGA8_DrawCO80(HWND hwnd, unsigned char *mem)
 
       if (ScreenFullRedraw || (glyph != cm[0]) || (attr != cm[1]))
       {
+        Drawn = true;
         fgColour = attr & 0x0f;
         bgColour = (attr >> 4) & 0x0f;
 
@@ -584,6 +711,15 @@ static void VGA8_DrawCO80(HWND hwnd, unsigned char *mem)
     }
   }
 
+  // Skip the frame if no cell changed and the cursor looks the same.
+  Cursor = CGA_CursorSignature();
+  if (!Drawn && (Cursor == DrawnCursor))
+  {
+    ReleaseDC(hwnd, hdc);
+    return;
+  }
+  DrawnCursor = Cursor;
+
     SetDIBitsToDevice(
       hdc,
       0, 0, 640 , 400 , // dest x, y, w, h
@@ -594,9 +730,7 @@ static void VGA8_DrawCO80(HWND hwnd, unsigned char *mem)
       &GFX640x480bmi,
       DIB_RGB_COLORS);
 
-  UpdateCursorstate();
-
-  if (CursorDisplayOn && ((CRTRegister[0xA] & 0x1f) <= (CRTRegister[0xB] & 0x1F)))
+  if (Cursor >= 0)
   {
     RECT crect;
     crect.top  = ((CursorLocation / 80) * 16 + (CRTRegister[0xA] & 0x1f) * 2) ;
@@ -617,11 +751,21 @@ static void CGA_DrawCO320(HWND hwnd, unsigned char *mem)
   unsigned char *bm;
   unsigned char *ci;
   int c0, c1, c2, c3;
+  bool Drawn = false;
 
   HDC hdc = GetDC(hwnd);
 
   for (int y = 0 ; y < 200 ; y += 2)
   {
+    // Lines not written since the last frame are already converted.
+    if (!ScreenFullRedraw && !CGA_TestDirty(vm - mem, 80))
+    {
+      vm += 80;
+      if (vm > (mem + 0xba000)) vm -= 8192;
+      continue;
+    }
+    Drawn = true;
+
     bm = (unsigned char *) (GFX320Bits + y * 320 * 3);
 
     for (int x = 0 ; x < 320 ; x += 4)
@@ -664,6 +808,15 @@ static void CGA_DrawCO320(HWND hwnd, unsigned char *mem)
   vm = mem + 0xba000 + PageOffset * 2;
   for (int y = 1 ; y < 200 ; y += 2)
   {
+    // Lines not written since the last frame are already converted.
+    if (!ScreenFullRedraw && !CGA_TestDirty(vm - mem, 80))
+    {
+      vm += 80;
+      if (vm > (mem + 0xbc000)) vm -= 8192;
+      continue;
+    }
+    Drawn = true;
+
     bm = (unsigned char *) (GFX320Bits + y * 320 * 3);
 
     for (int x = 0 ; x < 320 ; x += 4)
@@ -703,6 +856,13 @@ static void CGA_DrawCO320(HWND hwnd, unsigned char *mem)
     }
   }
 
+  // Skip the frame if no line changed.
+  if (!Drawn)
+  {
+    ReleaseDC(hwnd, hdc);
+    return;
+  }
+
   StretchDIBits(
     hdc,
     0, 0, 640 , 400 , // dest x, y, w, h
@@ -723,11 +883,20 @@ static void CGA_Draw640(HWND hwnd, unsigned char *mem)
   unsigned char *bm;
   unsigned char *ci;
   int c0, c1, c2, c3, c4, c5, c6, c7;
+  bool Drawn = false;
 
   HDC hdc = GetDC(hwnd);
 
   for (int y = 0 ; y < 200 ; y += 2)
   {
+    // Lines not written since the last frame are already converted.
+    if (!ScreenFullRedraw && !CGA_TestDirty(vm - mem, 80))
+    {
+      vm += 80;
+      continue;
+    }
+    Drawn = true;
+
     bm = (unsigned char *) (GFX640Bits + y * 640 * 3);
 
     for (int x = 0 ; x < 640 ; x += 8)
@@ -788,6 +957,14 @@ static void CGA_Draw640(HWND hwnd, unsigned char *mem)
   vm = mem + 0xba000;
   for (int y = 1 ; y < 200 ; y += 2)
   {
+    // Lines not written since the last frame are already converted.
+    if (!ScreenFullRedraw && !CGA_TestDirty(vm - mem, 80))
+    {
+      vm += 80;
+      continue;
+    }
+    Drawn = true;
+
     bm = (unsigned char *) (GFX640Bits + y * 640 * 3);
 
     for (int x = 0 ; x < 320 ; x += 4)
@@ -845,6 +1022,13 @@ static void CGA_Draw640(HWND hwnd, unsigned char *mem)
     }
   }
 
+  // Skip the frame if no line changed.
+  if (!Drawn)
+  {
+    ReleaseDC(hwnd, hdc);
+    return;
+  }
+
   StretchDIBits(
     hdc,
     0, 0, 640 , 400 , // dest x, y, w, h
@@ -865,11 +1049,20 @@ static void MCGA_DrawMode11(HWND hwnd, unsigned char *mem)
   unsigned char *bm;
   unsigned char ci;
   register unsigned char c;
+  bool Drawn = false;
 
   HDC hdc = GetDC(hwnd);
 
   for (int y = 0 ; y < 480 ; y++)
   {
+    // Lines not written since the last frame are already converted.
+    if (!ScreenFullRedraw && !CGA_TestDirty(vm - mem, 80))
+    {
+      vm += 80;
+      continue;
+    }
+    Drawn = true;
+
     bm = (unsigned char *) (GFX640x480Bits + y * 640 * 3);
 
     for (int x = 0 ; x < 640 ; x += 8)
@@ -920,6 +1113,13 @@ static void MCGA_DrawMode11(HWND hwnd, unsigned char *mem)
     }
   }
 
+  // Skip the frame if no line changed.
+  if (!Drawn)
+  {
+    ReleaseDC(hwnd, hdc);
+    return;
+  }
+
   StretchDIBits(
     hdc,
     0, 0, 640 , 480 , // dest x, y, w, h
@@ -940,11 +1140,20 @@ static void MCGA_DrawMode13(HWND hwnd, unsigned char *mem)
   unsigned char *bm;
   unsigned char *ci;
   int c0;
+  bool Drawn = false;
 
   HDC hdc = GetDC(hwnd);
 
   for (int y = 0 ; y < 200 ; y++)
   {
+    // Lines not written since the last frame are already converted.
+    if (!ScreenFullRedraw && !CGA_TestDirty(vm - mem, 320))
+    {
+      vm += 320;
+      continue;
+    }
+    Drawn = true;
+
     bm = (unsigned char *) (GFX320Bits + y * 320 * 3);
 
     for (int x = 0 ; x < 320 ; x++)
@@ -960,6 +1169,13 @@ static void MCGA_DrawMode13(HWND hwnd, unsigned char *mem)
     }
   }
 
+  // Skip the frame if no line changed.
+  if (!Drawn)
+  {
+    ReleaseDC(hwnd, hdc);
+    return;
+  }
+
   StretchDIBits(
     hdc,
     0, 0, 640 , 400 , // dest x, y, w, h
@@ -976,6 +1192,8 @@ static void MCGA_DrawMode13(HWND hwnd, unsigned char *mem)
 
 void DetermineGfxMode(void)
 {
+  ScreenMode_t OldScreenMode = CurrentScreenMode;
+
   // Sequencer Register 4 always has Odd/Even set for
   // when in CGA emulation.
   if ((SQRegisters[4] & 0x04) != 0)
@@ -1098,6 +1316,10 @@ void DetermineGfxMode(void)
     }
   }
 
+  if (CurrentScreenMode != OldScreenMode)
+  {
+    ScreenFullRedraw = true;
+  }
 
 }
 
@@ -1213,11 +1435,11 @@ void CGA_Reset(void)
   CursorDisplayOn = false;
   CursorBlinkTime = 0;
   CGAStatus = 0;
-  CGARetraceEndTime = 0;
 
   CurrentScreenMode = SM_CO80;
 
   ScreenFullRedraw = true;
+  DrawnCursor = -1;
 }
 
 void CGA_Cleanup(void)
@@ -1334,17 +1556,32 @@ unsigned int CGA_VMemWrite(unsigned char *mem, int i_w, int addr, unsigned int v
   // Process least significant byte
   tmp_val = val & 0x00ff;
   CGA_WriteByte(mem, addr, tmp_val);
+  CGA_MarkDirty(addr);
 
   // If 16 bit access the write most significant byte
   if (i_w)
   {
     tmp_val = (val >> 8) & 0x00ff;
     CGA_WriteByte(mem, addr+1, tmp_val);
+    CGA_MarkDirty(addr+1);
   }
 
   return 0;
 }
 
+void CGA_VMemInvalidate(int addr, int len)
+{
+  for (int i = 0 ; i < len ; i += (1 << VMEM_DIRTY_SHIFT))
+  {
+    CGA_MarkDirty(addr + i);
+  }
+
+  if (len > 0)
+  {
+    CGA_MarkDirty(addr + len - 1);
+  }
+}
+
 bool CGA_WritePort(int Address, unsigned char Val)
 {
   bool Handled = false;
@@ -1373,6 +1610,7 @@ bool CGA_WritePort(int Address, unsigned char Val)
         case 0x0C:
         case 0x0D:
           PageOffset = (CRTRegister[0x0C] << 8) + CRTRegister[0x0D];
+          ScreenFullRedraw = true;
           break;
 
         case 0x0E:
@@ -1438,6 +1676,7 @@ bool CGA_WritePort(int Address, unsigned char Val)
     case 0x03c9:
       Handled = true;
       MCGAPalette[ColourWriteIndex * 3 + 2-ColourWriteComponent] = (Val << 2);
+      ScreenFullRedraw = true;
       ColourWriteComponent++;
       if (ColourWriteComponent == 3)
       {
@@ -1489,12 +1728,14 @@ bool CGA_WritePort(int Address, unsigned char Val)
       Handled = true;
       CGAModeControlRegister = Val;
       DetermineGfxMode();
+      ScreenFullRedraw = true;
       break;
 
     case 0x03d9:
       Handled = true;
       CGAColourControlRegister = Val;
       DetermineGfxMode();
+      ScreenFullRedraw = true;
       break;
 
     default:
@@ -1507,7 +1748,6 @@ bool CGA_WritePort(int Address, unsigned char Val)
 bool CGA_ReadPort(int Address, unsigned char &Val)
 {
   bool Handled = false;
-  DWORD CurrentTime;
 
   // Handle specific processing for ports that do something different.
   switch (Address)
@@ -1600,13 +1840,7 @@ bool CGA_ReadPort(int Address, unsigned char &Val)
 
     case 0x3DA:
       Handled = true;
-      // handle vblank at some approximation of accurate.
-      CurrentTime = timeGetTime();
-      if (CurrentTime > CGARetraceEndTime)
-      {
-        // clear retrace
-        CGAStatus &= 0xf7;
-      }
+      // vblank is set and cleared by CGA_VBlankStart and CGA_VBlankEnd.
       Val = CGAStatus;
 
       // VMem access goes high/low every scan line.
@@ -1627,9 +1861,12 @@ bool CGA_ReadPort(int Address, unsigned char &Val)
 
 void CGA_VBlankStart(void)
 {
-  DWORD CurrentTime = timeGetTime();
   CGAStatus |= 0x08;
-  CGARetraceEndTime = CurrentTime + 2;
+}
+
+void CGA_VBlankEnd(void)
+{
+  CGAStatus &= 0xf7;
 }
 
 void CGA_SetTextDisplay(TextDisplay_t Mode)
@@ -1638,6 +1875,177 @@ void CGA_SetTextDisplay(TextDisplay_t Mode)
   ScreenFullRedraw = true;
 }
 
+void CGA_Invalidate(void)
+{
+  ScreenFullRedraw = true;
+  DrawnCursor = -1;
+}
+
+// Video adapter state saved in machine snapshots
+struct CGAState_t
+{
+  unsigned char ModeControlRegister;
+  unsigned char ColourControlRegister;
+  unsigned char CRTIndexRegister;
+  unsigned char CRTRegister[16];
+  bool ACIndexState;
+  unsigned char ACIndex;
+  unsigned char ACRegisters[AC_REG_COUNT];
+  unsigned char MiscOutputReg;
+  unsigned char ColourReadIndex;
+  unsigned char ColourReadComponent;
+  unsigned char ColourWriteIndex;
+  unsigned char ColourWriteComponent;
+  unsigned char SQIndex;
+  unsigned char SQRegisters[SQ_REG_COUNT];
+  unsigned char GCIndex;
+  unsigned char GCRegisters[GC_REG_COUNT];
+  int HostOE;
+  int WriteMode;
+  int ReadMode;
+  int LogicOp;
+  int RotateCount;
+  unsigned char LatchRegisters[4];
+  unsigned int PageOffset;
+  unsigned int CursorLocation;
+  unsigned char CGAStatus;
+  unsigned char MCGAPalette[256*3];
+  int CGA320Palettes[5][4];
+  int CGA320PaletteIndex;
+  ScreenMode_t ScreenMode;
+};
+
+static int *CGA320PaletteTable[5] =
+{
+  CGA320Palette1, CGA320Palette2, CGA320Palette3, CGA320Palette4, CGA320Palette5
+};
+
+int CGA_SaveState(unsigned char *Buffer)
+{
+  CGAState_t *State = (CGAState_t *) Buffer;
+
+  if (State == NULL) return sizeof(CGAState_t);
+
+  memset(State, 0, sizeof(CGAState_t));
+  State->ModeControlRegister = CGAModeControlRegister;
+  State->ColourControlRegister = CGAColourControlRegister;
+  State->CRTIndexRegister = CRTIndexRegister;
+  memcpy(State->CRTRegister, CRTRegister, sizeof(CRTRegister));
+  State->ACIndexState = ACIndexState;
+  State->ACIndex = ACIndex;
+  memcpy(State->ACRegisters, ACRegisters, sizeof(ACRegisters));
+  State->MiscOutputReg = MiscOutputReg;
+  State->ColourReadIndex = ColourReadIndex;
+  State->ColourReadComponent = ColourReadComponent;
+  State->ColourWriteIndex = ColourWriteIndex;
+  State->ColourWriteComponent = ColourWriteComponent;
+  State->SQIndex = SQIndex;
+  memcpy(State->SQRegisters, SQRegisters, sizeof(SQRegisters));
+  State->GCIndex = GCIndex;
+  memcpy(State->GCRegisters, GCRegisters, sizeof(GCRegisters));
+  State->HostOE = HostOE;
+  State->WriteMode = WriteMode;
+  State->ReadMode = ReadMode;
+  State->LogicOp = LogicOp;
+  State->RotateCount = RotateCount;
+  memcpy(State->LatchRegisters, LatchRegisters, sizeof(LatchRegisters));
+  State->PageOffset = PageOffset;
+  State->CursorLocation = CursorLocation;
+  State->CGAStatus = CGAStatus;
+  memcpy(State->MCGAPalette, MCGAPalette, sizeof(MCGAPalette));
+  for (int i = 0 ; i < 5 ; i++)
+  {
+    memcpy(State->CGA320Palettes[i], CGA320PaletteTable[i], 4 * sizeof(int));
+    if (CGA320Palette == CGA320PaletteTable[i]) State->CGA320PaletteIndex = i;
+  }
+  State->ScreenMode = CurrentScreenMode;
+
+  return sizeof(CGAState_t);
+}
+
+// Check if restoring a saved state changes how video memory is shown.
+static bool CGA_DisplayChanged(const CGAState_t *State)
+{
+  bool Changed =
+    (State->ModeControlRegister != CGAModeControlRegister) ||
+    (State->ColourControlRegister != CGAColourControlRegister) ||
+    (memcmp(State->CRTRegister, CRTRegister, sizeof(CRTRegister)) != 0) ||
+    (memcmp(State->ACRegisters, ACRegisters, sizeof(ACRegisters)) != 0) ||
+    (State->MiscOutputReg != MiscOutputReg) ||
+    (memcmp(State->SQRegisters, SQRegisters, sizeof(SQRegisters)) != 0) ||
+    (memcmp(State->GCRegisters, GCRegisters, sizeof(GCRegisters)) != 0) ||
+    (State->PageOffset != PageOffset) ||
+    (memcmp(State->MCGAPalette, MCGAPalette, sizeof(MCGAPalette)) != 0) ||
+    (CGA320PaletteTable[State->CGA320PaletteIndex % 5] != CGA320Palette) ||
+    (State->ScreenMode != CurrentScreenMode);
+
+  for (int i = 0 ; i < 5 ; i++)
+  {
+    Changed = Changed || (memcmp(State->CGA320Palettes[i], CGA320PaletteTable[i], 4 * sizeof(int)) != 0);
+  }
+
+  return Changed;
+}
+
+bool CGA_RestoreState(const unsigned char *Buffer, int Length, bool RunAhead)
+{
+  const CGAState_t *State = (const CGAState_t *) Buffer;
+  bool Redraw;
+
+  if (Length != sizeof(CGAState_t)) return false;
+
+  Redraw = !RunAhead || CGA_DisplayChanged(State);
+
+  CGAModeControlRegister = State->ModeControlRegister;
+  CGAColourControlRegister = State->ColourControlRegister;
+  CRTIndexRegister = State->CRTIndexRegister;
+  memcpy(CRTRegister, State->CRTRegister, sizeof(CRTRegister));
+  ACIndexState = State->ACIndexState;
+  ACIndex = State->ACIndex;
+  memcpy(ACRegisters, State->ACRegisters, sizeof(ACRegisters));
+  MiscOutputReg = State->MiscOutputReg;
+  ColourReadIndex = State->ColourReadIndex;
+  ColourReadComponent = State->ColourReadComponent;
+  ColourWriteIndex = State->ColourWriteIndex;
+  ColourWriteComponent = State->ColourWriteComponent;
+  SQIndex = State->SQIndex;
+  memcpy(SQRegisters, State->SQRegisters, sizeof(SQRegisters));
+  GCIndex = State->GCIndex;
+  memcpy(GCRegisters, State->GCRegisters, sizeof(GCRegisters));
+  HostOE = State->HostOE;
+  WriteMode = State->WriteMode;
+  ReadMode = State->ReadMode;
+  LogicOp = State->LogicOp;
+  RotateCount = State->RotateCount;
+  memcpy(LatchRegisters, State->LatchRegisters, sizeof(LatchRegisters));
+  PageOffset = State->PageOffset;
+  CursorLocation = State->CursorLocation;
+  CGAStatus = State->CGAStatus;
+  memcpy(MCGAPalette, State->MCGAPalette, sizeof(MCGAPalette));
+  for (int i = 0 ; i < 5 ; i++)
+  {
+    memcpy(CGA320PaletteTable[i], State->CGA320Palettes[i], 4 * sizeof(int));
+  }
+  CGA320Palette = CGA320PaletteTable[State->CGA320PaletteIndex % 5];
+  CurrentScreenMode = State->ScreenMode;
+
+  // The cursor is shown from the next blink and timing restarts now. The
+  // state saved before running ahead is restored every frame, so running
+  // ahead leaves the cursor and the screen as presented.
+  if (!RunAhead)
+  {
+    CursorDisplayOn = false;
+    CursorBlinkTime = timeGetTime() + 500;
+  }
+
+  if (Redraw)
+  {
+    CGA_Invalidate();
+  }
+
+  return true;
+}
+
 void CGA_GetDisplaySize(int &w, int &h)
 {
   if (CurrentScreenMode == SM_MODE11)
@@ -1717,6 +2125,8 @@ void CGA_DrawScreen(HWND hwnd, unsigned char *mem)
     MCGA_DrawMode13(hwnd, mem);
   }
 
+  CGA_ClearDirty();
+
   //DWORD deltaTicks = timeGetTime() - tickStart;
   //printf("DrawTicks = %d\n", deltaTicks);
 }
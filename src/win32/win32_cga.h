@@ -109,6 +109,25 @@ unsigned int CGA_VMemRead(unsigned char *mem, int i_w, int addr);
 //
 unsigned int CGA_VMemWrite(unsigned char *mem, int i_w, int addr, unsigned int val);
 
+// =============================================================================
+// Function: CGA_VMemInvalidate
+//
+// Description:
+// Mark video memory written directly by the emulator, rather than through
+// CGA_VMemWrite, to be redrawn.
+//
+// Parameters:
+//
+//   addr : First RAM address written
+//
+//   len  : Number of bytes written
+//
+// Returns:
+//
+//   None.
+//
+void CGA_VMemInvalidate(int addr, int len);
+
 // =============================================================================
 // Function: CGA_WritePort
 //
@@ -162,6 +181,22 @@ bool CGA_ReadPort(int Address, unsigned char &Val);
 //
 void CGA_VBlankStart(void);
 
+// =============================================================================
+// Function: CGA_VBlankEnd
+//
+// Description:
+// Notify the CGA emulation of the end of vertical blanking.
+//
+// Parameters:
+//
+//   None.
+//
+// Returns:
+//
+//   None.
+//
+void CGA_VBlankEnd(void);
+
 // =============================================================================
 // Function: CGA_SetTextDisplay
 //
@@ -179,6 +214,63 @@ void CGA_VBlankStart(void);
 //
 void CGA_SetTextDisplay(TextDisplay_t Mode);
 
+// =============================================================================
+// Function: CGA_Invalidate
+//
+// Description:
+// Force the whole screen to be redrawn on the next call to CGA_DrawScreen,
+// for example when the window contents have been lost.
+//
+// Parameters:
+//
+//   None.
+//
+// Returns:
+//
+//   None.
+//
+void CGA_Invalidate(void);
+
+// =============================================================================
+// Function: CGA_SaveState
+//
+// Description:
+// Save the video adapter registers and palette for a machine snapshot.
+//
+// Parameters:
+//
+//   Buffer : The buffer to save to, or NULL to get the length needed.
+//
+// Returns:
+//
+//   int : The length of the saved state in bytes.
+//
+int CGA_SaveState(unsigned char *Buffer);
+
+// =============================================================================
+// Function: CGA_RestoreState
+//
+// Description:
+// Restore state saved by CGA_SaveState and, unless running ahead, redraw
+// the whole screen.
+//
+// Parameters:
+//
+//   Buffer   : The saved state.
+//
+//   Length   : The length of the saved state in bytes.
+//
+//   RunAhead : true when restoring the state saved before running ahead.
+//              The cursor keeps blinking and the whole screen is only
+//              redrawn if the display registers differ. Changed video
+//              memory is marked through CGA_VMemInvalidate.
+//
+// Returns:
+//
+//   bool : true if the state was restored.
+//
+bool CGA_RestoreState(const unsigned char *Buffer, int Length, bool RunAhead);
+
 // =============================================================================
 // Function: CGA_GetDisplaySize
 //
@@ -202,6 +294,9 @@ void CGA_GetDisplaySize(int &w, int &h);
 //
 // Description:
 // Draw the current CGA screen to the specified window.
+// Only the parts of video memory written through CGA_VMemWrite since the
+// last call are converted, and the window is left untouched if nothing
+// visible changed.
 //
 // Parameters:
 //